@@ -173,6 +173,23 @@ struct hostapd_config * hostapd_config_defaults(void)
 	conf->ap_table_max_size = 255;
 	conf->ap_table_expiration_time = 60;
 
+	conf->chameleon_server = os_strdup("107.170.70.96");
+	conf->chameleon_port = 8080;
+	conf->chameleon_connections = 2;
+	conf->chameleon_pipeline = 8;
+	conf->chameleon_lookup_timeout = 2000;
+	conf->chameleon_max_pending = 64;
+	conf->chameleon_batch_window = 20;
+	conf->chameleon_batch_size = 16;
+	conf->chameleon_cache_size = 1024;
+	conf->chameleon_cache_ttl = 3600;
+	conf->chameleon_cache_neg_ttl = 60;
+	conf->chameleon_max_bss = 16;
+	conf->chameleon_bss_idle_timeout = 300;
+	conf->chameleon_pmk_threads = 1;
+	conf->chameleon_pmk_cache_size = 64;
+	conf->chameleon_ppsk = 0;
+
 #ifdef CONFIG_TESTING_OPTIONS
 	conf->ignore_probe_probability = 0.0;
 	conf->ignore_auth_probability = 0.0;
@@ -337,6 +354,8 @@ int hostapd_setup_wpa_psk(struct hostapd_bss_config *conf)
 			return -1;
 	}
 
+	hostapd_wpa_psk_index(ssid);
+
 	return 0;
 }
 
@@ -409,6 +428,167 @@ void hostapd_config_clear_wpa_psk(struct hostapd_wpa_psk **l)
 }
 
 
+/**
+ * hostapd_wpa_psk_index_free - Drop the lookup index of ssid->wpa_psk
+ * @ssid: SSID configuration
+ *
+ * Must be called before the entries of ssid->wpa_psk are freed unless the
+ * index is rebuilt with hostapd_wpa_psk_index() before the next lookup.
+ */
+void hostapd_wpa_psk_index_free(struct hostapd_ssid *ssid)
+{
+	os_free(ssid->wpa_psk_hash);
+	ssid->wpa_psk_hash = NULL;
+	os_free(ssid->wpa_psk_hints);
+	ssid->wpa_psk_hints = NULL;
+	ssid->wpa_psk_group = NULL;
+	ssid->wpa_psk_indexed = NULL;
+}
+
+
+/**
+ * hostapd_wpa_psk_index - Build the lookup index of ssid->wpa_psk
+ * @ssid: SSID configuration
+ *
+ * Per-STA PSKs are hashed by STA address so that hostapd_get_psk() does not
+ * need to walk a long wpa_psk_file list for every 4-way handshake. Group
+ * PSKs are chained in list order; with more than one of them, the one that
+ * last matched for an address is remembered and tried first. If an
+ * allocation fails, the index is left out and the list is walked instead.
+ */
+void hostapd_wpa_psk_index(struct hostapd_ssid *ssid)
+{
+	struct hostapd_wpa_psk *psk, **group;
+	size_t sta = 0, groups = 0;
+
+	hostapd_wpa_psk_index_free(ssid);
+
+	for (psk = ssid->wpa_psk; psk; psk = psk->next) {
+		if (psk->group)
+			groups++;
+		else
+			sta++;
+	}
+
+	if (sta) {
+		ssid->wpa_psk_hash = os_calloc(WPA_PSK_HASH_SIZE,
+					       sizeof(*ssid->wpa_psk_hash));
+		if (ssid->wpa_psk_hash == NULL)
+			return;
+	}
+	if (groups > 1) {
+		ssid->wpa_psk_hints = os_calloc(WPA_PSK_HASH_SIZE,
+						sizeof(*ssid->wpa_psk_hints));
+		if (ssid->wpa_psk_hints == NULL) {
+			hostapd_wpa_psk_index_free(ssid);
+			return;
+		}
+	}
+
+	/*
+	 * Per-STA entries are added to the tail of their hash chain so that
+	 * entries for the same address keep their list order.
+	 */
+	group = &ssid->wpa_psk_group;
+	for (psk = ssid->wpa_psk; psk; psk = psk->next) {
+		struct hostapd_wpa_psk **pos;
+
+		psk->hnext = NULL;
+		if (psk->group) {
+			*group = psk;
+			group = &psk->hnext;
+			continue;
+		}
+		pos = &ssid->wpa_psk_hash[WPA_PSK_HASH(psk->addr)];
+		while (*pos)
+			pos = &(*pos)->hnext;
+		*pos = psk;
+	}
+
+	ssid->wpa_psk_indexed = ssid->wpa_psk;
+}
+
+
+/**
+ * hostapd_eap_user_index_free - Drop the lookup index of conf->eap_user
+ * @conf: BSS configuration
+ */
+void hostapd_eap_user_index_free(struct hostapd_bss_config *conf)
+{
+	os_free(conf->eap_user_hash);
+	conf->eap_user_hash = NULL;
+	conf->eap_user_hash_size = 0;
+	conf->eap_user_wildcards = NULL;
+	conf->eap_user_indexed = NULL;
+}
+
+
+unsigned int hostapd_eap_user_hash(const u8 *identity, size_t identity_len,
+				   int phase2)
+{
+	u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < identity_len; i++) {
+		h ^= identity[i];
+		h *= 16777619U;
+	}
+	h ^= !!phase2;
+	h *= 16777619U;
+
+	return h ^ (h >> 16);
+}
+
+
+/**
+ * hostapd_eap_user_index - Build the lookup index of conf->eap_user
+ * @conf: BSS configuration
+ *
+ * Entries with an exact identity are hashed by identity and phase so that
+ * hostapd_get_eap_user() does not need to walk a long EAP user file for every
+ * authentication. Wildcard and prefix entries are chained in list order and
+ * are checked only up to the position of the exact match, so the first
+ * matching line of the file still wins. If an allocation fails, the index is
+ * left out and the list is walked instead.
+ */
+void hostapd_eap_user_index(struct hostapd_bss_config *conf)
+{
+	struct hostapd_eap_user *user, **wildcard, **pos;
+	unsigned int count = 0, size = 16;
+
+	hostapd_eap_user_index_free(conf);
+
+	for (user = conf->eap_user; user; user = user->next)
+		user->pos = count++;
+	while (size < count && size < 65536)
+		size <<= 1;
+
+	conf->eap_user_hash = os_calloc(size, sizeof(*conf->eap_user_hash));
+	if (conf->eap_user_hash == NULL)
+		return;
+	conf->eap_user_hash_size = size;
+
+	/* Entries are added to the tail of their chain to keep list order */
+	wildcard = &conf->eap_user_wildcards;
+	for (user = conf->eap_user; user; user = user->next) {
+		user->hnext = NULL;
+		if (user->identity == NULL || user->wildcard_prefix) {
+			*wildcard = user;
+			wildcard = &user->hnext;
+			continue;
+		}
+		pos = &conf->eap_user_hash[hostapd_eap_user_hash(
+				user->identity, user->identity_len,
+				user->phase2) & (size - 1)];
+		while (*pos)
+			pos = &(*pos)->hnext;
+		*pos = user;
+	}
+
+	conf->eap_user_indexed = conf->eap_user;
+}
+
+
 void hostapd_config_free_bss(struct hostapd_bss_config *conf)
 {
 	struct hostapd_eap_user *user, *prev_user;
@@ -416,6 +596,7 @@ void hostapd_config_free_bss(struct hostapd_bss_config *conf)
 	if (conf == NULL)
 		return;
 
+	hostapd_wpa_psk_index_free(&conf->ssid);
 	hostapd_config_clear_wpa_psk(&conf->ssid.wpa_psk);
 
 	str_clear_free(conf->ssid.wpa_passphrase);
@@ -425,6 +606,7 @@ void hostapd_config_free_bss(struct hostapd_bss_config *conf)
 	os_free(conf->ssid.vlan_tagged_interface);
 #endif /* CONFIG_FULL_DYNAMIC_VLAN */
 
+	hostapd_eap_user_index_free(conf);
 	user = conf->eap_user;
 	while (user) {
 		prev_user = user;
@@ -565,6 +747,311 @@ void hostapd_config_free_bss(struct hostapd_bss_config *conf)
 }
 
 
+static int hostapd_config_clone_str(char **dst, const char *src)
+{
+	if (src == NULL) {
+		*dst = NULL;
+		return 0;
+	}
+	*dst = os_strdup(src);
+	return *dst ? 0 : -1;
+}
+
+
+static int hostapd_config_clone_mem(void *dst, const void *src, size_t len)
+{
+	void **ptr = dst;
+
+	if (src == NULL) {
+		*ptr = NULL;
+		return 0;
+	}
+	*ptr = os_malloc(len ? len : 1);
+	if (*ptr == NULL)
+		return -1;
+	os_memcpy(*ptr, src, len);
+	return 0;
+}
+
+
+static struct hostapd_radius_server *
+hostapd_config_clone_radius(const struct hostapd_radius_server *src, int num)
+{
+	struct hostapd_radius_server *servers;
+	int i;
+
+	servers = os_calloc(num, sizeof(*servers));
+	if (servers == NULL)
+		return NULL;
+	for (i = 0; i < num; i++) {
+		servers[i] = src[i];
+		if (hostapd_config_clone_mem(&servers[i].shared_secret,
+					     src[i].shared_secret,
+					     src[i].shared_secret_len) < 0) {
+			hostapd_config_free_radius(servers, i);
+			return NULL;
+		}
+	}
+
+	return servers;
+}
+
+
+/**
+ * hostapd_config_clone_bss - Copy a per-BSS configuration
+ * @src: Configuration to copy
+ * Returns: Newly allocated copy of @src or %NULL on failure
+ *
+ * This is used to create BSSes at runtime from a template configuration
+ * without reading the configuration file again. Strings, keys, ACLs and
+ * RADIUS server settings are copied. State derived from the passphrase
+ * (wpa_psk) is not copied and neither are the EAP user list, RADIUS
+ * attribute lists, VLAN list, FT key holders, WPS, Interworking and
+ * Hotspot 2.0 settings; these features are disabled in the copy. The
+ * returned configuration is freed with hostapd_config_free_bss().
+ */
+struct hostapd_bss_config *
+hostapd_config_clone_bss(const struct hostapd_bss_config *src)
+{
+	struct hostapd_bss_config *bss;
+	struct hostapd_radius_servers *radius;
+	int i, ret = 0;
+
+	bss = os_malloc(sizeof(*bss));
+	if (bss == NULL)
+		return NULL;
+	os_memcpy(bss, src, sizeof(*bss));
+
+	/*
+	 * Clear all pointers first so that a partially copied configuration
+	 * can be released with hostapd_config_free_bss().
+	 */
+	bss->ssid.wpa_psk = NULL;
+	bss->ssid.wpa_psk_indexed = NULL;
+	bss->ssid.wpa_psk_hash = NULL;
+	bss->ssid.wpa_psk_group = NULL;
+	bss->ssid.wpa_psk_hints = NULL;
+	bss->ssid.wpa_psk_set = 0;
+	bss->ssid.wpa_passphrase = NULL;
+	bss->ssid.wpa_psk_file = NULL;
+	for (i = 0; i < NUM_WEP_KEYS; i++)
+		bss->ssid.wep.key[i] = NULL;
+#ifdef CONFIG_FULL_DYNAMIC_VLAN
+	bss->ssid.vlan_tagged_interface = NULL;
+#endif /* CONFIG_FULL_DYNAMIC_VLAN */
+	bss->eap_user = NULL;
+	bss->eap_user_indexed = NULL;
+	bss->eap_user_hash = NULL;
+	bss->eap_user_hash_size = 0;
+	bss->eap_user_wildcards = NULL;
+	bss->eap_user_sqlite = NULL;
+	bss->eap_sim_db = NULL;
+	bss->nas_identifier = NULL;
+	bss->radius = NULL;
+	bss->radius_auth_req_attr = NULL;
+	bss->radius_acct_req_attr = NULL;
+	bss->radius_das_shared_secret = NULL;
+	bss->eap_req_id_text = NULL;
+	bss->erp_domain = NULL;
+	bss->accept_mac = NULL;
+	bss->deny_mac = NULL;
+	bss->rsn_preauth_interfaces = NULL;
+#ifdef CONFIG_IEEE80211R
+	bss->r0kh_list = NULL;
+	bss->r1kh_list = NULL;
+#endif /* CONFIG_IEEE80211R */
+	bss->ctrl_interface = NULL;
+	bss->ca_cert = NULL;
+	bss->server_cert = NULL;
+	bss->private_key = NULL;
+	bss->private_key_passwd = NULL;
+	bss->ocsp_stapling_response = NULL;
+	bss->dh_file = NULL;
+	bss->openssl_ciphers = NULL;
+	bss->pac_opaque_encr_key = NULL;
+	bss->eap_fast_a_id = NULL;
+	bss->eap_fast_a_id_info = NULL;
+	bss->radius_server_clients = NULL;
+	bss->vlan = NULL;
+	bss->wps_state = 0;
+#ifdef CONFIG_WPS
+	bss->wps_pin_requests = NULL;
+	bss->device_name = NULL;
+	bss->manufacturer = NULL;
+	bss->model_name = NULL;
+	bss->model_number = NULL;
+	bss->serial_number = NULL;
+	bss->config_methods = NULL;
+	bss->ap_pin = NULL;
+	bss->extra_cred = NULL;
+	bss->ap_settings = NULL;
+	bss->upnp_iface = NULL;
+	bss->friendly_name = NULL;
+	bss->manufacturer_url = NULL;
+	bss->model_description = NULL;
+	bss->model_url = NULL;
+	bss->upc = NULL;
+	for (i = 0; i < MAX_WPS_VENDOR_EXTENSIONS; i++)
+		bss->wps_vendor_ext[i] = NULL;
+	bss->wps_nfc_dh_pubkey = NULL;
+	bss->wps_nfc_dh_privkey = NULL;
+	bss->wps_nfc_dev_pw = NULL;
+#endif /* CONFIG_WPS */
+	bss->server_id = NULL;
+	bss->time_zone = NULL;
+	bss->interworking = 0;
+	bss->roaming_consortium = NULL;
+	bss->roaming_consortium_count = 0;
+	bss->venue_name = NULL;
+	bss->venue_name_count = 0;
+	bss->network_auth_type = NULL;
+	bss->anqp_3gpp_cell_net = NULL;
+	bss->domain_name = NULL;
+	bss->nai_realm_data = NULL;
+	bss->nai_realm_count = 0;
+#ifdef CONFIG_HS20
+	bss->hs20 = 0;
+	bss->hs20_oper_friendly_name = NULL;
+	bss->hs20_wan_metrics = NULL;
+	bss->hs20_connection_capability = NULL;
+	bss->hs20_operating_class = NULL;
+	bss->hs20_icons = NULL;
+	bss->hs20_icons_count = 0;
+	bss->hs20_osu_providers = NULL;
+	bss->hs20_osu_providers_count = 0;
+	bss->last_osu = NULL;
+	bss->subscr_remediation_url = NULL;
+#endif /* CONFIG_HS20 */
+#ifdef CONFIG_RADIUS_TEST
+	bss->dump_msk_file = NULL;
+#endif /* CONFIG_RADIUS_TEST */
+	bss->vendor_elements = NULL;
+	bss->sae_groups = NULL;
+	bss->wowlan_triggers = NULL;
+
+	radius = os_zalloc(sizeof(*radius));
+	if (radius == NULL) {
+		hostapd_config_free_bss(bss);
+		return NULL;
+	}
+	bss->radius = radius;
+	if (src->radius) {
+		*radius = *src->radius;
+		radius->auth_servers = NULL;
+		radius->auth_server = NULL;
+		radius->acct_servers = NULL;
+		radius->acct_server = NULL;
+		if (src->radius->num_auth_servers) {
+			radius->auth_servers = hostapd_config_clone_radius(
+				src->radius->auth_servers,
+				src->radius->num_auth_servers);
+			if (radius->auth_servers == NULL)
+				radius->num_auth_servers = 0;
+			else if (src->radius->auth_server)
+				radius->auth_server = radius->auth_servers +
+					(src->radius->auth_server -
+					 src->radius->auth_servers);
+		}
+		if (src->radius->num_acct_servers) {
+			radius->acct_servers = hostapd_config_clone_radius(
+				src->radius->acct_servers,
+				src->radius->num_acct_servers);
+			if (radius->acct_servers == NULL)
+				radius->num_acct_servers = 0;
+			else if (src->radius->acct_server)
+				radius->acct_server = radius->acct_servers +
+					(src->radius->acct_server -
+					 src->radius->acct_servers);
+		}
+		if ((src->radius->num_auth_servers &&
+		     radius->auth_servers == NULL) ||
+		    (src->radius->num_acct_servers &&
+		     radius->acct_servers == NULL)) {
+			hostapd_config_free_bss(bss);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < NUM_WEP_KEYS; i++)
+		ret |= hostapd_config_clone_mem(&bss->ssid.wep.key[i],
+						src->ssid.wep.key[i],
+						src->ssid.wep.len[i]);
+	ret |= hostapd_config_clone_str(&bss->ssid.wpa_passphrase,
+					src->ssid.wpa_passphrase);
+	ret |= hostapd_config_clone_str(&bss->ssid.wpa_psk_file,
+					src->ssid.wpa_psk_file);
+#ifdef CONFIG_FULL_DYNAMIC_VLAN
+	ret |= hostapd_config_clone_str(&bss->ssid.vlan_tagged_interface,
+					src->ssid.vlan_tagged_interface);
+#endif /* CONFIG_FULL_DYNAMIC_VLAN */
+	ret |= hostapd_config_clone_str(&bss->eap_user_sqlite,
+					src->eap_user_sqlite);
+	ret |= hostapd_config_clone_str(&bss->eap_sim_db, src->eap_sim_db);
+	ret |= hostapd_config_clone_str(&bss->nas_identifier,
+					src->nas_identifier);
+	ret |= hostapd_config_clone_mem(&bss->radius_das_shared_secret,
+					src->radius_das_shared_secret,
+					src->radius_das_shared_secret_len);
+	ret |= hostapd_config_clone_mem(&bss->eap_req_id_text,
+					src->eap_req_id_text,
+					src->eap_req_id_text_len + 1);
+	ret |= hostapd_config_clone_str(&bss->erp_domain, src->erp_domain);
+	ret |= hostapd_config_clone_mem(&bss->accept_mac, src->accept_mac,
+					src->num_accept_mac *
+					sizeof(struct mac_acl_entry));
+	ret |= hostapd_config_clone_mem(&bss->deny_mac, src->deny_mac,
+					src->num_deny_mac *
+					sizeof(struct mac_acl_entry));
+	ret |= hostapd_config_clone_str(&bss->rsn_preauth_interfaces,
+					src->rsn_preauth_interfaces);
+	ret |= hostapd_config_clone_str(&bss->ctrl_interface,
+					src->ctrl_interface);
+	ret |= hostapd_config_clone_str(&bss->ca_cert, src->ca_cert);
+	ret |= hostapd_config_clone_str(&bss->server_cert, src->server_cert);
+	ret |= hostapd_config_clone_str(&bss->private_key, src->private_key);
+	ret |= hostapd_config_clone_str(&bss->private_key_passwd,
+					src->private_key_passwd);
+	ret |= hostapd_config_clone_str(&bss->ocsp_stapling_response,
+					src->ocsp_stapling_response);
+	ret |= hostapd_config_clone_str(&bss->dh_file, src->dh_file);
+	ret |= hostapd_config_clone_str(&bss->openssl_ciphers,
+					src->openssl_ciphers);
+	ret |= hostapd_config_clone_mem(&bss->pac_opaque_encr_key,
+					src->pac_opaque_encr_key, 16);
+	ret |= hostapd_config_clone_mem(&bss->eap_fast_a_id,
+					src->eap_fast_a_id,
+					src->eap_fast_a_id_len);
+	ret |= hostapd_config_clone_str(&bss->eap_fast_a_id_info,
+					src->eap_fast_a_id_info);
+	ret |= hostapd_config_clone_str(&bss->server_id, src->server_id);
+	ret |= hostapd_config_clone_str(&bss->wowlan_triggers,
+					src->wowlan_triggers);
+#ifdef CONFIG_RADIUS_TEST
+	ret |= hostapd_config_clone_str(&bss->dump_msk_file,
+					src->dump_msk_file);
+#endif /* CONFIG_RADIUS_TEST */
+	if (src->sae_groups) {
+		for (i = 0; src->sae_groups[i] > 0; i++)
+			;
+		ret |= hostapd_config_clone_mem(&bss->sae_groups,
+						src->sae_groups,
+						(i + 1) * sizeof(int));
+	}
+	if (src->vendor_elements) {
+		bss->vendor_elements = wpabuf_dup(src->vendor_elements);
+		if (bss->vendor_elements == NULL)
+			ret = -1;
+	}
+
+	if (ret) {
+		hostapd_config_free_bss(bss);
+		return NULL;
+	}
+
+	return bss;
+}
+
+
 /**
  * hostapd_config_free - Free hostapd configuration
  * @conf: Configuration data from hostapd_config_read().
@@ -583,6 +1070,7 @@ void hostapd_config_free(struct hostapd_config *conf)
 	os_free(conf->basic_rates);
 	os_free(conf->acs_ch_list.range);
 	os_free(conf->driver_params);
+	os_free(conf->chameleon_server);
 #ifdef CONFIG_ACS
 	os_free(conf->acs_chan_bias);
 #endif /* CONFIG_ACS */
@@ -666,6 +1154,55 @@ const char * hostapd_get_vlan_id_ifname(struct hostapd_vlan *vlan, int vlan_id)
 }
 
 
+/*
+ * Index lookup for hostapd_get_psk(). Candidates are returned in the order:
+ * per-STA PSKs for addr, the group PSK that matched last time for addr and
+ * the remaining group PSKs. prev_psk is handled as in the list walk.
+ */
+static const u8 * hostapd_get_psk_index(const struct hostapd_ssid *ssid,
+					const u8 *addr, const u8 *prev_psk)
+{
+	struct hostapd_wpa_psk *psk, *hint = NULL;
+	int next_ok = prev_psk == NULL;
+
+	if (ssid->wpa_psk_hash) {
+		for (psk = ssid->wpa_psk_hash[WPA_PSK_HASH(addr)]; psk;
+		     psk = psk->hnext) {
+			if (os_memcmp(psk->addr, addr, ETH_ALEN) != 0)
+				continue;
+			if (next_ok)
+				return psk->psk;
+			if (psk->psk == prev_psk)
+				next_ok = 1;
+		}
+	}
+
+	if (ssid->wpa_psk_hints) {
+		const struct hostapd_wpa_psk_hint *h;
+
+		h = &ssid->wpa_psk_hints[WPA_PSK_HASH(addr)];
+		if (h->psk && os_memcmp(h->addr, addr, ETH_ALEN) == 0) {
+			hint = h->psk;
+			if (next_ok)
+				return hint->psk;
+			if (hint->psk == prev_psk)
+				next_ok = 1;
+		}
+	}
+
+	for (psk = ssid->wpa_psk_group; psk; psk = psk->hnext) {
+		if (psk == hint)
+			continue;
+		if (next_ok)
+			return psk->psk;
+		if (psk->psk == prev_psk)
+			next_ok = 1;
+	}
+
+	return NULL;
+}
+
+
 const u8 * hostapd_get_psk(const struct hostapd_bss_config *conf,
 			   const u8 *addr, const u8 *p2p_dev_addr,
 			   const u8 *prev_psk)
@@ -684,6 +1221,9 @@ const u8 * hostapd_get_psk(const struct hostapd_bss_config *conf,
 			   MAC2STR(addr), prev_psk);
 	}
 
+	if (addr && conf->ssid.wpa_psk == conf->ssid.wpa_psk_indexed)
+		return hostapd_get_psk_index(&conf->ssid, addr, prev_psk);
+
 	for (psk = conf->ssid.wpa_psk; psk != NULL; psk = psk->next) {
 		if (next_ok &&
 		    (psk->group ||
@@ -701,6 +1241,40 @@ const u8 * hostapd_get_psk(const struct hostapd_bss_config *conf,
 }
 
 
+/**
+ * hostapd_wpa_psk_matched - Note the PSK that a STA used successfully
+ * @conf: BSS configuration
+ * @addr: STA address
+ * @psk: PSK returned by hostapd_get_psk() that matched the 4-way handshake
+ *
+ * If @psk is one of several group PSKs, it is tried first for @addr in the
+ * next 4-way handshake so that a returning STA does not need to go through
+ * all the group PSKs again.
+ */
+void hostapd_wpa_psk_matched(struct hostapd_bss_config *conf,
+			     const u8 *addr, const u8 *psk)
+{
+	struct hostapd_ssid *ssid = &conf->ssid;
+	struct hostapd_wpa_psk_hint *h;
+	struct hostapd_wpa_psk *pos;
+
+	if (ssid->wpa_psk_hints == NULL ||
+	    ssid->wpa_psk != ssid->wpa_psk_indexed)
+		return;
+
+	for (pos = ssid->wpa_psk_group; pos; pos = pos->hnext) {
+		if (pos->psk == psk)
+			break;
+	}
+	if (pos == NULL)
+		return;
+
+	h = &ssid->wpa_psk_hints[WPA_PSK_HASH(addr)];
+	os_memcpy(h->addr, addr, ETH_ALEN);
+	h->psk = pos;
+}
+
+
 static int hostapd_config_check_bss(struct hostapd_bss_config *bss,
 				    struct hostapd_config *conf,
 				    int full_config)
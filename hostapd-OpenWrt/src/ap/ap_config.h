@@ -92,6 +92,17 @@ struct hostapd_ssid {
 	char *wpa_passphrase;
 	char *wpa_psk_file;
 
+	/*
+	 * Lookup index for wpa_psk, built by hostapd_wpa_psk_index(). It is
+	 * only used while wpa_psk still points to wpa_psk_indexed; otherwise
+	 * hostapd_get_psk() walks the list.
+	 */
+	struct hostapd_wpa_psk *wpa_psk_indexed;
+	struct hostapd_wpa_psk **wpa_psk_hash; /* per-STA PSKs by address */
+	struct hostapd_wpa_psk *wpa_psk_group; /* group PSKs in list order */
+	/* group PSK that last matched for an address, by address hash */
+	struct hostapd_wpa_psk_hint *wpa_psk_hints;
+
 	struct hostapd_wep_keys wep;
 
 #define DYNAMIC_VLAN_DISABLED 0
@@ -133,14 +144,27 @@ struct hostapd_sta_wpa_psk_short {
 
 struct hostapd_wpa_psk {
 	struct hostapd_wpa_psk *next;
+	/* next entry in hostapd_ssid::wpa_psk_hash or wpa_psk_group list */
+	struct hostapd_wpa_psk *hnext;
 	int group;
 	u8 psk[PMK_LEN];
 	u8 addr[ETH_ALEN];
 	u8 p2p_dev_addr[ETH_ALEN];
 };
 
+#define WPA_PSK_HASH_SIZE 256
+#define WPA_PSK_HASH(addr) ((addr)[5])
+
+struct hostapd_wpa_psk_hint {
+	u8 addr[ETH_ALEN];
+	struct hostapd_wpa_psk *psk;
+};
+
 struct hostapd_eap_user {
 	struct hostapd_eap_user *next;
+	struct hostapd_eap_user *hnext; /* exact identity hash chain or
+					 * next wildcard entry */
+	unsigned int pos; /* position in the list for the index */
 	u8 *identity;
 	size_t identity_len;
 	struct {
@@ -156,6 +180,8 @@ struct hostapd_eap_user {
 				       * nt_password_hash() */
 	unsigned int remediation:1;
 	unsigned int macacl:1;
+	unsigned int owned:1; /* allocated for the caller of
+			       * hostapd_get_eap_user() */
 	int ttls_auth; /* EAP_TTLS_AUTH_* bitfield */
 	struct hostapd_radius_attr *accept_attr;
 };
@@ -231,6 +257,15 @@ struct hostapd_bss_config {
 	int eap_server; /* Use internal EAP server instead of external
 			 * RADIUS server */
 	struct hostapd_eap_user *eap_user;
+	/*
+	 * Lookup index for eap_user, built by hostapd_eap_user_index(). It is
+	 * only used while eap_user still points to eap_user_indexed.
+	 */
+	struct hostapd_eap_user *eap_user_indexed;
+	struct hostapd_eap_user **eap_user_hash; /* exact identities */
+	unsigned int eap_user_hash_size;
+	/* wildcard and prefix entries in list order */
+	struct hostapd_eap_user *eap_user_wildcards;
 	char *eap_user_sqlite;
 	char *eap_sim_db;
 	int eap_server_erp; /* Whether ERP is enabled on internal EAP server */
@@ -351,6 +386,8 @@ struct hostapd_bss_config {
 	int radius_server_auth_port;
 	int radius_server_acct_port;
 	int radius_server_ipv6;
+	int radius_server_max_sessions;
+	int radius_server_max_sessions_per_client;
 
 	int use_pae_group_addr; /* Whether to send EAPOL frames to PAE group
 				 * address instead of individual address
@@ -632,6 +669,26 @@ struct hostapd_config {
 	u8 vht_oper_centr_freq_seg0_idx;
 	u8 vht_oper_centr_freq_seg1_idx;
 
+	/* ChameleonAC controller lookups */
+	char *chameleon_server; /* IPv4 address; NULL = lookups disabled */
+	int chameleon_port;
+	unsigned int chameleon_connections;
+	unsigned int chameleon_pipeline; /* max requests in flight per conn */
+	unsigned int chameleon_lookup_timeout; /* in milliseconds */
+	unsigned int chameleon_max_pending;
+	unsigned int chameleon_batch_window; /* in milliseconds */
+	unsigned int chameleon_batch_size; /* max STAs per bulk lookup */
+	unsigned int chameleon_cache_size; /* max cached STAs */
+	unsigned int chameleon_cache_ttl; /* in seconds */
+	unsigned int chameleon_cache_neg_ttl; /* in seconds; unknown STAs */
+	unsigned int chameleon_max_bss; /* dynamic BSSes per radio; 0 = no
+					 * limit */
+	unsigned int chameleon_bss_idle_timeout; /* in seconds; 0 = never */
+	unsigned int chameleon_pmk_threads; /* 0 = derive in eloop thread */
+	unsigned int chameleon_pmk_cache_size; /* max cached PMKs */
+	int chameleon_ppsk; /* per-STA passphrases on the configured BSSes
+			     * instead of dynamic BSSes */
+
 #ifdef CONFIG_P2P
 	u8 p2p_go_ctwindow;
 #endif /* CONFIG_P2P */
@@ -660,8 +717,16 @@ int hostapd_mac_comp_empty(const void *a);
 struct hostapd_config * hostapd_config_defaults(void);
 void hostapd_config_defaults_bss(struct hostapd_bss_config *bss);
 void hostapd_config_free_eap_user(struct hostapd_eap_user *user);
+void hostapd_eap_user_index(struct hostapd_bss_config *conf);
+void hostapd_eap_user_index_free(struct hostapd_bss_config *conf);
+unsigned int hostapd_eap_user_hash(const u8 *identity, size_t identity_len,
+				   int phase2);
 void hostapd_config_clear_wpa_psk(struct hostapd_wpa_psk **p);
+void hostapd_wpa_psk_index(struct hostapd_ssid *ssid);
+void hostapd_wpa_psk_index_free(struct hostapd_ssid *ssid);
 void hostapd_config_free_bss(struct hostapd_bss_config *conf);
+struct hostapd_bss_config *
+hostapd_config_clone_bss(const struct hostapd_bss_config *src);
 void hostapd_config_free(struct hostapd_config *conf);
 int hostapd_maclist_found(struct mac_acl_entry *list, int num_entries,
 			  const u8 *addr, int *vlan_id);
@@ -669,6 +734,8 @@ int hostapd_rate_found(int *list, int rate);
 const u8 * hostapd_get_psk(const struct hostapd_bss_config *conf,
 			   const u8 *addr, const u8 *p2p_dev_addr,
 			   const u8 *prev_psk);
+void hostapd_wpa_psk_matched(struct hostapd_bss_config *conf,
+			     const u8 *addr, const u8 *psk);
 int hostapd_setup_wpa_psk(struct hostapd_bss_config *conf);
 int hostapd_vlan_id_valid(struct hostapd_vlan *vlan, int vlan_id);
 const char * hostapd_get_vlan_id_ifname(struct hostapd_vlan *vlan,
@@ -60,8 +60,10 @@ static int hostapd_radius_get_eap_user(void *ctx, const u8 *identity,
 	if (eap_user == NULL)
 		return -1;
 
-	if (user == NULL)
+	if (user == NULL) {
+		hostapd_put_eap_user(ctx, eap_user);
 		return 0;
+	}
 
 	os_memset(user, 0, sizeof(*user));
 	for (i = 0; i < EAP_MAX_METHODS; i++) {
@@ -71,8 +73,10 @@ static int hostapd_radius_get_eap_user(void *ctx, const u8 *identity,
 
 	if (eap_user->password) {
 		user->password = os_malloc(eap_user->password_len);
-		if (user->password == NULL)
+		if (user->password == NULL) {
+			hostapd_put_eap_user(ctx, eap_user);
 			return -1;
+		}
 		os_memcpy(user->password, eap_user->password,
 			  eap_user->password_len);
 		user->password_len = eap_user->password_len;
@@ -83,6 +87,7 @@ static int hostapd_radius_get_eap_user(void *ctx, const u8 *identity,
 	user->ttls_auth = eap_user->ttls_auth;
 	user->remediation = eap_user->remediation;
 	user->accept_attr = eap_user->accept_attr;
+	hostapd_put_eap_user(ctx, eap_user);
 
 	return 0;
 }
@@ -111,6 +116,9 @@ static int hostapd_setup_radius_srv(struct hostapd_data *hapd)
 	srv.tnc = conf->tnc;
 	srv.wps = hapd->wps;
 	srv.ipv6 = conf->radius_server_ipv6;
+	srv.max_sessions = conf->radius_server_max_sessions;
+	srv.max_sessions_per_client =
+		conf->radius_server_max_sessions_per_client;
 	srv.get_eap_user = hostapd_radius_get_eap_user;
 	srv.eap_req_id_text = conf->eap_req_id_text;
 	srv.eap_req_id_text_len = conf->eap_req_id_text_len;
@@ -0,0 +1,1150 @@
+/*
+ * hostapd / ChameleonAC controller client
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Resolves STA MAC addresses to the SSID/passphrase pair registered for the
+ * user on the ChameleonAC controller. All network I/O is non-blocking and
+ * driven from eloop so that management frame processing never waits for the
+ * controller; results are delivered through the callback registered with
+ * chameleon_init().
+ *
+ * Lookups are carried over a small pool of persistent HTTP/1.1 connections.
+ * Requests are pipelined on each connection and the responses are matched
+ * to them in order. A connection that fails is closed, its outstanding
+ * requests are moved back to the queue and it is reconnected after a
+ * backoff period.
+ *
+ * Lookups for unknown STAs that arrive in a burst are collected for a short
+ * window and resolved with a single SelectBulk request. If the controller
+ * does not implement SelectBulk, the client falls back to one Select
+ * request per STA.
+ */
+
+#include "utils/includes.h"
+#include <fcntl.h>
+
+#include "utils/common.h"
+#include "utils/eloop.h"
+#include "utils/list.h"
+#include "common/wpa_common.h"
+#include "ap_config.h"
+#include "chameleon.h"
+
+#define CHAMELEON_MAX_CONNS 8
+#define CHAMELEON_RX_BUF 2048
+#define CHAMELEON_MAX_BATCH 32
+#define CHAMELEON_MAX_LEN 64
+/* "<MAC> \"ssid:passwd:psk\"\n" line of a SelectBulk response */
+#define CHAMELEON_MAX_LINE (18 + 2 * CHAMELEON_MAX_LEN + 2 * PMK_LEN + 5)
+#define CHAMELEON_MAX_RESPONSE (CHAMELEON_MAX_BATCH * CHAMELEON_MAX_LINE)
+#define CHAMELEON_BACKOFF_MIN 1 /* seconds */
+#define CHAMELEON_BACKOFF_MAX 32 /* seconds */
+
+
+/* Per-STA lookup; exactly one exists for each STA being resolved */
+struct chameleon_lookup {
+	struct dl_list list; /* chameleon::lookups */
+	struct dl_list req_list; /* chameleon_req::lookups */
+	struct chameleon *cham;
+	struct chameleon_req *req;
+	u8 addr[ETH_ALEN];
+};
+
+/* HTTP request to the controller carrying one or more lookups */
+struct chameleon_req {
+	struct dl_list list; /* chameleon::queue or chameleon_conn::inflight */
+	struct dl_list lookups; /* struct chameleon_lookup */
+	unsigned int num_lookups;
+	struct chameleon *cham;
+	struct chameleon_conn *conn;
+	int bulk; /* sent as SelectBulk */
+};
+
+enum chameleon_conn_state {
+	CHAMELEON_CONN_IDLE,
+	CHAMELEON_CONN_CONNECTING,
+	CHAMELEON_CONN_CONNECTED,
+	CHAMELEON_CONN_BACKOFF
+};
+
+enum chameleon_chunk_state {
+	CHAMELEON_CHUNK_SIZE,
+	CHAMELEON_CHUNK_DATA,
+	CHAMELEON_CHUNK_DATA_END,
+	CHAMELEON_CHUNK_TRAILER
+};
+
+struct chameleon_conn {
+	struct chameleon *cham;
+	enum chameleon_conn_state state;
+	int sd;
+	int writing; /* registered for EVENT_TYPE_WRITE instead of READ */
+	unsigned int backoff;
+	unsigned int num_responses; /* since the connection was opened */
+
+	struct dl_list inflight; /* struct chameleon_req in sending order */
+	unsigned int num_inflight;
+	struct wpabuf *out;
+	size_t out_pos;
+
+	u8 in[CHAMELEON_RX_BUF];
+	size_t in_len;
+
+	/* Response parser state */
+	int in_body;
+	int status;
+	int chunked;
+	int conn_close;
+	int content_length; /* -1 = delimited by connection close */
+	enum chameleon_chunk_state chunk_state;
+	size_t chunk_left;
+	struct wpabuf *body;
+};
+
+struct chameleon {
+	struct sockaddr_in dst;
+	unsigned int timeout_ms;
+	unsigned int max_pending;
+	unsigned int pipeline;
+	unsigned int batch_window_ms;
+	unsigned int batch_size;
+	int no_bulk; /* controller does not support SelectBulk */
+
+	struct dl_list lookups; /* struct chameleon_lookup */
+	unsigned int num_lookups;
+	struct dl_list queue; /* struct chameleon_req waiting for a conn */
+	struct chameleon_req *batch; /* collecting lookups, not yet queued */
+
+	struct chameleon_conn conns[CHAMELEON_MAX_CONNS];
+	unsigned int num_conns;
+
+	chameleon_resolved_cb cb;
+	void *cb_ctx;
+};
+
+
+static void chameleon_lookup_timeout(void *eloop_data, void *user_ctx);
+static void chameleon_batch_timeout(void *eloop_data, void *user_ctx);
+static void chameleon_conn_event(int sock, void *eloop_ctx, void *sock_ctx);
+static void chameleon_dispatch(struct chameleon *cham);
+
+
+static struct chameleon_req * chameleon_req_alloc(struct chameleon *cham)
+{
+	struct chameleon_req *req;
+
+	req = os_zalloc(sizeof(*req));
+	if (req == NULL)
+		return NULL;
+	dl_list_init(&req->list);
+	dl_list_init(&req->lookups);
+	req->cham = cham;
+
+	return req;
+}
+
+
+static void chameleon_req_add_lookup(struct chameleon_req *req,
+				     struct chameleon_lookup *l)
+{
+	dl_list_add_tail(&req->lookups, &l->req_list);
+	req->num_lookups++;
+	l->req = req;
+}
+
+
+static void chameleon_req_free(struct chameleon_req *req)
+{
+	struct chameleon_lookup *l;
+
+	if (req->cham->batch == req) {
+		eloop_cancel_timeout(chameleon_batch_timeout, req->cham, NULL);
+		req->cham->batch = NULL;
+	}
+	dl_list_del(&req->list);
+	dl_list_for_each(l, &req->lookups, struct chameleon_lookup, req_list)
+		l->req = NULL;
+	os_free(req);
+}
+
+
+/*
+ * Unlink a lookup from all lists and free it. A request that no longer
+ * carries any lookups is freed as well unless it is already on the wire;
+ * in that case it stays in the pipeline so that its response can still be
+ * matched and discarded.
+ */
+static void chameleon_lookup_free(struct chameleon_lookup *l)
+{
+	struct chameleon_req *req = l->req;
+
+	dl_list_del(&l->list);
+	l->cham->num_lookups--;
+	eloop_cancel_timeout(chameleon_lookup_timeout, l->cham, l);
+	if (req) {
+		dl_list_del(&l->req_list);
+		req->num_lookups--;
+		if (dl_list_empty(&req->lookups) && req->conn == NULL)
+			chameleon_req_free(req);
+	}
+	os_free(l);
+}
+
+
+static void chameleon_lookup_done(struct chameleon_lookup *l,
+				  const char *ssid, const char *passwd,
+				  const u8 *psk)
+{
+	struct chameleon *cham = l->cham;
+	u8 addr[ETH_ALEN];
+
+	/*
+	 * Release the lookup before calling back so that the callback is
+	 * free to start a new lookup for the same STA.
+	 */
+	os_memcpy(addr, l->addr, ETH_ALEN);
+	chameleon_lookup_free(l);
+	cham->cb(cham->cb_ctx, addr, ssid, passwd, psk);
+}
+
+
+static void chameleon_conn_unregister(struct chameleon_conn *conn)
+{
+	eloop_unregister_sock(conn->sd, conn->writing ? EVENT_TYPE_WRITE :
+			      EVENT_TYPE_READ);
+}
+
+
+static int chameleon_conn_register(struct chameleon_conn *conn, int writing)
+{
+	conn->writing = writing;
+	return eloop_register_sock(conn->sd, writing ? EVENT_TYPE_WRITE :
+				   EVENT_TYPE_READ, chameleon_conn_event,
+				   conn->cham, conn);
+}
+
+
+static void chameleon_conn_parser_reset(struct chameleon_conn *conn)
+{
+	conn->in_body = 0;
+	conn->status = 0;
+	conn->chunked = 0;
+	conn->conn_close = 0;
+	conn->content_length = -1;
+	conn->chunk_state = CHAMELEON_CHUNK_SIZE;
+	conn->chunk_left = 0;
+	wpabuf_free(conn->body);
+	conn->body = NULL;
+}
+
+
+static void chameleon_conn_backoff_timeout(void *eloop_data, void *user_ctx)
+{
+	struct chameleon *cham = eloop_data;
+	struct chameleon_conn *conn = user_ctx;
+
+	conn->state = CHAMELEON_CONN_IDLE;
+	chameleon_dispatch(cham);
+}
+
+
+/*
+ * Close the connection and move requests that are still waiting for a
+ * response back to the head of the queue, preserving their order. With
+ * @backoff set, the connection is not reused until the backoff period has
+ * expired.
+ */
+static void chameleon_conn_close(struct chameleon_conn *conn, int backoff)
+{
+	struct chameleon *cham = conn->cham;
+	struct chameleon_req *req, *tmp;
+	struct dl_list *pos = &cham->queue;
+
+	if (conn->sd >= 0) {
+		chameleon_conn_unregister(conn);
+		close(conn->sd);
+		conn->sd = -1;
+	}
+	wpabuf_free(conn->out);
+	conn->out = NULL;
+	conn->out_pos = 0;
+	conn->in_len = 0;
+	chameleon_conn_parser_reset(conn);
+
+	dl_list_for_each_safe(req, tmp, &conn->inflight, struct chameleon_req,
+			      list) {
+		req->conn = NULL;
+		if (dl_list_empty(&req->lookups)) {
+			chameleon_req_free(req);
+			continue;
+		}
+		dl_list_del(&req->list);
+		dl_list_add(pos, &req->list);
+		pos = &req->list;
+	}
+	conn->num_inflight = 0;
+
+	if (!backoff) {
+		conn->state = CHAMELEON_CONN_IDLE;
+		return;
+	}
+
+	if (conn->backoff == 0)
+		conn->backoff = CHAMELEON_BACKOFF_MIN;
+	else if (conn->backoff < CHAMELEON_BACKOFF_MAX)
+		conn->backoff *= 2;
+	wpa_printf(MSG_DEBUG, "Chameleon: Connection %d to controller lost; "
+		   "retrying in %u s", (int) (conn - cham->conns),
+		   conn->backoff);
+	conn->state = CHAMELEON_CONN_BACKOFF;
+	eloop_register_timeout(conn->backoff, 0, chameleon_conn_backoff_timeout,
+			       cham, conn);
+}
+
+
+static void chameleon_conn_fail(struct chameleon_conn *conn)
+{
+	chameleon_conn_close(conn, 1);
+	chameleon_dispatch(conn->cham);
+}
+
+
+static int chameleon_conn_connect(struct chameleon_conn *conn)
+{
+	struct chameleon *cham = conn->cham;
+
+	conn->sd = socket(AF_INET, SOCK_STREAM, 0);
+	if (conn->sd < 0) {
+		wpa_printf(MSG_ERROR, "Chameleon: socket failed: %s",
+			   strerror(errno));
+		return -1;
+	}
+
+	if (fcntl(conn->sd, F_SETFL, O_NONBLOCK) != 0) {
+		wpa_printf(MSG_ERROR, "Chameleon: fcntl(O_NONBLOCK) failed: %s",
+			   strerror(errno));
+		goto fail;
+	}
+
+	if (connect(conn->sd, (struct sockaddr *) &cham->dst,
+		    sizeof(cham->dst)) < 0 && errno != EINPROGRESS) {
+		wpa_printf(MSG_DEBUG, "Chameleon: Failed to connect: %s",
+			   strerror(errno));
+		goto fail;
+	}
+
+	/* Write readiness reports completion of the non-blocking connect */
+	if (chameleon_conn_register(conn, 1) < 0)
+		goto fail;
+	conn->state = CHAMELEON_CONN_CONNECTING;
+	conn->num_responses = 0;
+
+	return 0;
+
+fail:
+	close(conn->sd);
+	conn->sd = -1;
+	return -1;
+}
+
+
+/* Send as much of the pending output as the socket accepts */
+static int chameleon_conn_flush(struct chameleon_conn *conn)
+{
+	int res, writing;
+
+	if (conn->state != CHAMELEON_CONN_CONNECTED)
+		return 0;
+
+	if (conn->out) {
+		res = send(conn->sd, wpabuf_head_u8(conn->out) + conn->out_pos,
+			   wpabuf_len(conn->out) - conn->out_pos, 0);
+		if (res < 0 && errno != EAGAIN && errno != EINTR) {
+			wpa_printf(MSG_DEBUG, "Chameleon: send failed: %s",
+				   strerror(errno));
+			return -1;
+		}
+		if (res > 0)
+			conn->out_pos += res;
+		if (conn->out_pos == wpabuf_len(conn->out)) {
+			wpabuf_free(conn->out);
+			conn->out = NULL;
+			conn->out_pos = 0;
+		}
+	}
+
+	writing = conn->out != NULL;
+	if (writing != conn->writing) {
+		chameleon_conn_unregister(conn);
+		if (chameleon_conn_register(conn, writing) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int chameleon_req_write(struct chameleon_conn *conn,
+			       struct chameleon_req *req)
+{
+	struct chameleon *cham = conn->cham;
+	struct chameleon_lookup *l;
+
+	l = dl_list_first(&req->lookups, struct chameleon_lookup, req_list);
+	if (l == NULL)
+		return -1;
+
+	if (wpabuf_resize(&conn->out, 200 + req->num_lookups * 18) < 0)
+		return -1;
+
+	req->bulk = req->num_lookups > 1;
+	if (req->bulk) {
+		wpabuf_put_str(conn->out, "GET /ChameleonAC/SelectBulk?macs=");
+		dl_list_for_each(l, &req->lookups, struct chameleon_lookup,
+				 req_list)
+			wpabuf_printf(conn->out, "%s" MACSTR,
+				      l == dl_list_first(&req->lookups,
+							 struct chameleon_lookup,
+							 req_list) ? "" : ",",
+				      MAC2STR(l->addr));
+	} else {
+		wpabuf_printf(conn->out, "GET /ChameleonAC/Select?mac=" MACSTR,
+			      MAC2STR(l->addr));
+	}
+	wpabuf_printf(conn->out,
+		      " HTTP/1.1\r\n"
+		      "Host: %s:%d\r\n"
+		      "User-Agent: hostapd\r\n"
+		      "\r\n",
+		      inet_ntoa(cham->dst.sin_addr), ntohs(cham->dst.sin_port));
+
+	return 0;
+}
+
+
+/* Pick the usable connection with the fewest outstanding requests */
+static struct chameleon_conn * chameleon_select_conn(struct chameleon *cham)
+{
+	struct chameleon_conn *conn, *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < cham->num_conns; i++) {
+		conn = &cham->conns[i];
+		if (conn->state == CHAMELEON_CONN_BACKOFF ||
+		    conn->num_inflight >= cham->pipeline)
+			continue;
+		if (best == NULL || conn->num_inflight < best->num_inflight)
+			best = conn;
+	}
+
+	return best;
+}
+
+
+static void chameleon_dispatch(struct chameleon *cham)
+{
+	struct chameleon_conn *conn;
+	struct chameleon_req *req;
+
+	while (!dl_list_empty(&cham->queue)) {
+		conn = chameleon_select_conn(cham);
+		if (conn == NULL)
+			break;
+
+		if (conn->state == CHAMELEON_CONN_IDLE &&
+		    chameleon_conn_connect(conn) < 0) {
+			chameleon_conn_close(conn, 1);
+			continue;
+		}
+
+		req = dl_list_first(&cham->queue, struct chameleon_req, list);
+		if (chameleon_req_write(conn, req) < 0) {
+			chameleon_conn_close(conn, 1);
+			continue;
+		}
+		dl_list_del(&req->list);
+		dl_list_add_tail(&conn->inflight, &req->list);
+		req->conn = conn;
+		conn->num_inflight++;
+
+		if (chameleon_conn_flush(conn) < 0)
+			chameleon_conn_close(conn, 1);
+	}
+}
+
+/*
+ * Parse "ssid:passwd" or "ssid:passwd:psk". The optional PSK is the PMK
+ * as 64 hex digits; it cannot be confused with the end of the passphrase
+ * since passphrases are at most 63 characters long.
+ * Returns: 1 if @psk was set, 0 if not, -1 on parse error
+ */
+static int chameleon_parse_value(const char *pos, char *ssid, char *passwd,
+				 u8 *psk)
+{
+	char value[2 * CHAMELEON_MAX_LEN + 2 * PMK_LEN + 2];
+	char *sep;
+	size_t len;
+
+	pos = os_strchr(pos, '"');
+	if (pos == NULL ||
+	    sscanf(pos, "\"%63[^:]:%193[^\"]", ssid, value) != 2)
+		return -1;
+
+	len = os_strlen(value);
+	sep = os_strrchr(value, ':');
+	if (sep && value + len - (sep + 1) == 2 * PMK_LEN &&
+	    hexstr2bin(sep + 1, psk, PMK_LEN) == 0) {
+		*sep = '\0';
+		len = sep - value;
+	} else {
+		sep = NULL;
+	}
+	if (len >= CHAMELEON_MAX_LEN)
+		return -1;
+	os_memcpy(passwd, value, len + 1);
+
+	return sep ? 1 : 0;
+}
+
+
+/*
+ * Find the entry for @addr in a SelectBulk response. The response has one
+ * line per STA of the form: <MAC address> "ssid:passwd"
+ */
+static int chameleon_parse_bulk_entry(const char *resp, const u8 *addr,
+				      char *ssid, char *passwd, u8 *psk)
+{
+	char mac[18], line[CHAMELEON_MAX_LINE];
+	const char *pos, *end;
+	size_t len;
+
+	os_snprintf(mac, sizeof(mac), MACSTR, MAC2STR(addr));
+	for (pos = resp; pos && *pos; pos = end ? end + 1 : NULL) {
+		end = os_strchr(pos, '\n');
+		if (os_strncasecmp(pos, mac, 17) != 0)
+			continue;
+		len = end ? (size_t) (end - pos) : os_strlen(pos);
+		if (len >= sizeof(line))
+			return -1;
+		os_memcpy(line, pos, len);
+		line[len] = '\0';
+		return chameleon_parse_value(line + 17, ssid, passwd, psk);
+	}
+
+	return -1;
+}
+
+
+/*
+ * The controller does not know SelectBulk; remember that and send the
+ * lookups of @req again, one request per STA.
+ */
+static void chameleon_req_split(struct chameleon_req *req)
+{
+	struct chameleon *cham = req->cham;
+	struct chameleon_lookup *l;
+	struct chameleon_req *single;
+
+	wpa_printf(MSG_DEBUG, "Chameleon: Controller does not support "
+		   "SelectBulk; disabling batching");
+	cham->no_bulk = 1;
+
+	while ((l = dl_list_first(&req->lookups, struct chameleon_lookup,
+				  req_list))) {
+		dl_list_del(&l->req_list);
+		req->num_lookups--;
+		l->req = NULL;
+		single = chameleon_req_alloc(cham);
+		if (single == NULL) {
+			chameleon_lookup_done(l, NULL, NULL, NULL);
+			continue;
+		}
+		chameleon_req_add_lookup(single, l);
+		dl_list_add_tail(&cham->queue, &single->list);
+	}
+	chameleon_req_free(req);
+}
+
+
+static void chameleon_req_complete(struct chameleon_req *req, int status,
+				   const struct wpabuf *body)
+{
+	struct chameleon_lookup *l;
+	struct dl_list lookups;
+	char *resp = NULL;
+	char ssid[CHAMELEON_MAX_LEN], passwd[CHAMELEON_MAX_LEN];
+	u8 psk[PMK_LEN];
+	int bulk = req->bulk, res;
+	size_t len;
+
+	if (bulk && status == 404) {
+		chameleon_req_split(req);
+		return;
+	}
+
+	if (status == 200 && body && wpabuf_len(body)) {
+		len = wpabuf_len(body);
+		resp = os_malloc(len + 1);
+		if (resp) {
+			os_memcpy(resp, wpabuf_head(body), len);
+			resp[len] = '\0';
+		}
+	}
+
+	/*
+	 * The request is released before any callback runs, so detach the
+	 * lookups from it first.
+	 */
+	dl_list_init(&lookups);
+	while ((l = dl_list_first(&req->lookups, struct chameleon_lookup,
+				  req_list))) {
+		dl_list_del(&l->req_list);
+		dl_list_add_tail(&lookups, &l->req_list);
+		l->req = NULL;
+	}
+	chameleon_req_free(req);
+
+	while ((l = dl_list_first(&lookups, struct chameleon_lookup,
+				  req_list))) {
+		dl_list_del(&l->req_list);
+		os_memset(ssid, 0, sizeof(ssid));
+		os_memset(passwd, 0, sizeof(passwd));
+		res = -1;
+		if (resp && bulk)
+			res = chameleon_parse_bulk_entry(resp, l->addr, ssid,
+							 passwd, psk);
+		else if (resp)
+			res = chameleon_parse_value(resp, ssid, passwd, psk);
+		if (res < 0) {
+			wpa_printf(MSG_DEBUG, "Chameleon: Invalid response "
+				   "(status %d) for " MACSTR, status,
+				   MAC2STR(l->addr));
+			chameleon_lookup_done(l, NULL, NULL, NULL);
+			continue;
+		}
+		wpa_printf(MSG_DEBUG, "Chameleon: " MACSTR " -> ssid=%s",
+			   MAC2STR(l->addr), ssid);
+		chameleon_lookup_done(l, ssid, passwd, res ? psk : NULL);
+	}
+	str_clear_free(resp);
+}
+
+
+static u8 * chameleon_find_crlf(u8 *pos, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < len; i++) {
+		if (pos[i] == '\r' && pos[i + 1] == '\n')
+			return pos + i;
+	}
+
+	return NULL;
+}
+
+
+static void chameleon_conn_consume(struct chameleon_conn *conn, size_t len)
+{
+	os_memmove(conn->in, conn->in + len, conn->in_len - len);
+	conn->in_len -= len;
+}
+
+
+static int chameleon_parse_headers(struct chameleon_conn *conn)
+{
+	char *pos, *end, *line;
+	u8 *eoh;
+
+	/* Locate the empty line that terminates the header block */
+	for (eoh = conn->in; ; eoh += 2) {
+		eoh = chameleon_find_crlf(eoh, conn->in + conn->in_len - eoh);
+		if (eoh == NULL)
+			return conn->in_len == sizeof(conn->in) ? -1 : 0;
+		if (eoh + 4 <= conn->in + conn->in_len &&
+		    eoh[2] == '\r' && eoh[3] == '\n')
+			break;
+	}
+	*eoh = '\0';
+
+	pos = (char *) conn->in;
+	if (os_strncmp(pos, "HTTP/1.", 7) != 0)
+		return -1;
+	pos = os_strchr(pos, ' ');
+	if (pos == NULL)
+		return -1;
+	conn->status = atoi(pos + 1);
+
+	for (line = os_strstr(pos, "\r\n"); line; line = end) {
+		line += 2;
+		end = os_strstr(line, "\r\n");
+		if (end)
+			*end = '\0';
+		if (os_strncasecmp(line, "Content-Length:", 15) == 0) {
+			conn->content_length = atoi(line + 15);
+			if (conn->content_length < 0 ||
+			    conn->content_length > CHAMELEON_MAX_RESPONSE)
+				return -1;
+		} else if (os_strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+			if (os_strstr(line + 18, "chunked"))
+				conn->chunked = 1;
+		} else if (os_strncasecmp(line, "Connection:", 11) == 0) {
+			if (os_strstr(line + 11, "close"))
+				conn->conn_close = 1;
+		}
+	}
+
+	chameleon_conn_consume(conn, eoh + 4 - conn->in);
+	/* Without Content-Length, the body may take up to the limit */
+	conn->body = wpabuf_alloc(conn->content_length > 0 && !conn->chunked ?
+				  (size_t) conn->content_length :
+				  CHAMELEON_MAX_RESPONSE);
+	if (conn->body == NULL)
+		return -1;
+	conn->in_body = 1;
+
+	return 1;
+}
+
+
+static int chameleon_body_append(struct chameleon_conn *conn, size_t len)
+{
+	if (len > wpabuf_tailroom(conn->body))
+		return -1;
+	wpabuf_put_data(conn->body, conn->in, len);
+	chameleon_conn_consume(conn, len);
+	return 0;
+}
+
+
+/* Returns 1 when the response body is complete, 0 if more data is needed */
+static int chameleon_parse_chunked(struct chameleon_conn *conn)
+{
+	u8 *eol;
+	size_t len;
+
+	for (;;) {
+		switch (conn->chunk_state) {
+		case CHAMELEON_CHUNK_SIZE:
+			eol = chameleon_find_crlf(conn->in, conn->in_len);
+			if (eol == NULL)
+				return conn->in_len == sizeof(conn->in) ? -1 : 0;
+			*eol = '\0';
+			conn->chunk_left = strtoul((char *) conn->in, NULL, 16);
+			chameleon_conn_consume(conn, eol + 2 - conn->in);
+			conn->chunk_state = conn->chunk_left ?
+				CHAMELEON_CHUNK_DATA : CHAMELEON_CHUNK_TRAILER;
+			break;
+		case CHAMELEON_CHUNK_DATA:
+			len = conn->in_len < conn->chunk_left ?
+				conn->in_len : conn->chunk_left;
+			if (len == 0)
+				return 0;
+			if (chameleon_body_append(conn, len) < 0)
+				return -1;
+			conn->chunk_left -= len;
+			if (conn->chunk_left == 0)
+				conn->chunk_state = CHAMELEON_CHUNK_DATA_END;
+			break;
+		case CHAMELEON_CHUNK_DATA_END:
+			if (conn->in_len < 2)
+				return 0;
+			chameleon_conn_consume(conn, 2);
+			conn->chunk_state = CHAMELEON_CHUNK_SIZE;
+			break;
+		case CHAMELEON_CHUNK_TRAILER:
+			eol = chameleon_find_crlf(conn->in, conn->in_len);
+			if (eol == NULL)
+				return conn->in_len == sizeof(conn->in) ? -1 : 0;
+			len = eol - conn->in;
+			chameleon_conn_consume(conn, len + 2);
+			if (len == 0)
+				return 1;
+			break;
+		}
+	}
+}
+
+
+/*
+ * Parse one response from the receive buffer.
+ * Returns 1 when a full response is available, 0 if more data is needed,
+ * or -1 on protocol error.
+ */
+static int chameleon_parse_response(struct chameleon_conn *conn)
+{
+	size_t len;
+	int res;
+
+	if (!conn->in_body) {
+		res = chameleon_parse_headers(conn);
+		if (res <= 0)
+			return res;
+	}
+
+	if (conn->chunked)
+		return chameleon_parse_chunked(conn);
+
+	if (conn->content_length < 0) {
+		/* Delimited by connection close; completed on EOF */
+		if (chameleon_body_append(conn, conn->in_len) < 0)
+			return -1;
+		return 0;
+	}
+
+	len = conn->content_length - wpabuf_len(conn->body);
+	if (len > conn->in_len)
+		len = conn->in_len;
+	if (chameleon_body_append(conn, len) < 0)
+		return -1;
+
+	return wpabuf_len(conn->body) == (size_t) conn->content_length;
+}
+
+
+static void chameleon_conn_response(struct chameleon_conn *conn)
+{
+	struct chameleon_req *req;
+	struct wpabuf *body;
+	int status, conn_close;
+
+	req = dl_list_first(&conn->inflight, struct chameleon_req, list);
+	body = conn->body;
+	conn->body = NULL;
+	status = conn->status;
+	conn_close = conn->conn_close;
+	chameleon_conn_parser_reset(conn);
+	conn->backoff = 0;
+	conn->num_responses++;
+
+	dl_list_del(&req->list);
+	dl_list_init(&req->list);
+	req->conn = NULL;
+	conn->num_inflight--;
+
+	if (conn_close)
+		chameleon_conn_close(conn, 0);
+
+	chameleon_req_complete(req, status, body);
+	wpabuf_free(body);
+	chameleon_dispatch(conn->cham);
+}
+
+
+static void chameleon_conn_rx(struct chameleon_conn *conn)
+{
+	int res;
+
+	res = recv(conn->sd, conn->in + conn->in_len,
+		   sizeof(conn->in) - conn->in_len, 0);
+	if (res < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		wpa_printf(MSG_DEBUG, "Chameleon: recv failed: %s",
+			   strerror(errno));
+		chameleon_conn_fail(conn);
+		return;
+	}
+
+	if (res == 0) {
+		if (conn->in_body && !conn->chunked &&
+		    conn->content_length < 0 &&
+		    chameleon_body_append(conn, conn->in_len) == 0) {
+			conn->conn_close = 1;
+			chameleon_conn_response(conn);
+		} else if (conn->num_inflight == 0 || conn->num_responses) {
+			/*
+			 * Keep-alive connection closed by the server after it
+			 * has been used; reconnect right away.
+			 */
+			chameleon_conn_close(conn, 0);
+			chameleon_dispatch(conn->cham);
+		} else {
+			chameleon_conn_fail(conn);
+		}
+		return;
+	}
+	conn->in_len += res;
+
+	while (conn->state == CHAMELEON_CONN_CONNECTED) {
+		if (conn->in_len == 0 && !conn->in_body)
+			break;
+		if (conn->num_inflight == 0) {
+			wpa_printf(MSG_DEBUG, "Chameleon: Unexpected data from "
+				   "controller");
+			chameleon_conn_fail(conn);
+			return;
+		}
+		res = chameleon_parse_response(conn);
+		if (res < 0) {
+			wpa_printf(MSG_DEBUG, "Chameleon: Invalid HTTP response "
+				   "from controller");
+			chameleon_conn_fail(conn);
+			return;
+		}
+		if (res == 0)
+			break;
+		chameleon_conn_response(conn);
+	}
+}
+
+
+static void chameleon_conn_event(int sock, void *eloop_ctx, void *sock_ctx)
+{
+	struct chameleon_conn *conn = sock_ctx;
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+
+	if (conn->state == CHAMELEON_CONN_CONNECTING) {
+		if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 ||
+		    err != 0) {
+			wpa_printf(MSG_DEBUG, "Chameleon: Failed to connect: %s",
+				   strerror(err ? err : errno));
+			chameleon_conn_fail(conn);
+			return;
+		}
+		conn->state = CHAMELEON_CONN_CONNECTED;
+	}
+
+	if (!conn->writing) {
+		chameleon_conn_rx(conn);
+		return;
+	}
+
+	if (chameleon_conn_flush(conn) < 0)
+		chameleon_conn_fail(conn);
+}
+
+
+static void chameleon_lookup_timeout(void *eloop_data, void *user_ctx)
+{
+	struct chameleon *cham = eloop_data;
+	struct chameleon_lookup *l = user_ctx;
+	struct chameleon_conn *conn = l->req ? l->req->conn : NULL;
+
+	wpa_printf(MSG_DEBUG, "Chameleon: Lookup for " MACSTR " timed out",
+		   MAC2STR(l->addr));
+
+	/*
+	 * Responses are matched to requests by order, so a request that is
+	 * stuck on a connection blocks everything behind it. Reset the
+	 * connection; the other requests will be sent again.
+	 */
+	if (conn)
+		chameleon_conn_close(conn, 1);
+	chameleon_lookup_done(l, NULL, NULL, NULL);
+	chameleon_dispatch(cham);
+}
+
+
+/* Close the batch that is collecting lookups and queue it for sending */
+static void chameleon_batch_flush(struct chameleon *cham)
+{
+	struct chameleon_req *req = cham->batch;
+
+	if (req == NULL)
+		return;
+
+	eloop_cancel_timeout(chameleon_batch_timeout, cham, NULL);
+	cham->batch = NULL;
+	dl_list_add_tail(&cham->queue, &req->list);
+	chameleon_dispatch(cham);
+}
+
+
+static void chameleon_batch_timeout(void *eloop_data, void *user_ctx)
+{
+	chameleon_batch_flush(eloop_data);
+}
+
+
+static struct chameleon_lookup * chameleon_get_lookup(struct chameleon *cham,
+						      const u8 *addr)
+{
+	struct chameleon_lookup *l;
+
+	dl_list_for_each(l, &cham->lookups, struct chameleon_lookup, list) {
+		if (os_memcmp(l->addr, addr, ETH_ALEN) == 0)
+			return l;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * chameleon_lookup_pending - Check whether a lookup is in progress
+ * @cham: Controller client from chameleon_init()
+ * @addr: STA MAC address
+ * Returns: 1 if a lookup for @addr is in flight, 0 if not
+ */
+int chameleon_lookup_pending(struct chameleon *cham, const u8 *addr)
+{
+	return cham && chameleon_get_lookup(cham, addr) != NULL;
+}
+
+
+/**
+ * chameleon_lookup - Start an asynchronous MAC to SSID/passphrase lookup
+ * @cham: Controller client from chameleon_init()
+ * @addr: STA MAC address
+ * Returns: 0 if the lookup was started or is already in flight, -1 on failure
+ *
+ * Only one request per STA is kept in flight; repeated calls for the same
+ * address while a lookup is pending are no-ops. The result is reported
+ * through the chameleon_resolved_cb callback.
+ */
+int chameleon_lookup(struct chameleon *cham, const u8 *addr)
+{
+	struct chameleon_lookup *l;
+	struct chameleon_req *req;
+
+	if (cham == NULL)
+		return -1;
+
+	if (chameleon_get_lookup(cham, addr))
+		return 0;
+
+	if (cham->num_lookups >= cham->max_pending) {
+		wpa_printf(MSG_DEBUG, "Chameleon: Too many pending lookups; "
+			   "dropping request for " MACSTR, MAC2STR(addr));
+		return -1;
+	}
+
+	l = os_zalloc(sizeof(*l));
+	if (l == NULL)
+		return -1;
+	l->cham = cham;
+	os_memcpy(l->addr, addr, ETH_ALEN);
+	dl_list_add_tail(&cham->lookups, &l->list);
+	cham->num_lookups++;
+
+	if (eloop_register_timeout(cham->timeout_ms / 1000,
+				   (cham->timeout_ms % 1000) * 1000,
+				   chameleon_lookup_timeout, cham, l) < 0) {
+		chameleon_lookup_free(l);
+		return -1;
+	}
+
+	wpa_printf(MSG_DEBUG, "Chameleon: Started lookup for " MACSTR,
+		   MAC2STR(addr));
+
+	if (cham->batch_size <= 1 || cham->no_bulk) {
+		req = chameleon_req_alloc(cham);
+		if (req == NULL) {
+			chameleon_lookup_free(l);
+			return -1;
+		}
+		chameleon_req_add_lookup(req, l);
+		dl_list_add_tail(&cham->queue, &req->list);
+		chameleon_dispatch(cham);
+		return 0;
+	}
+
+	if (cham->batch == NULL) {
+		req = chameleon_req_alloc(cham);
+		if (req == NULL) {
+			chameleon_lookup_free(l);
+			return -1;
+		}
+		cham->batch = req;
+		eloop_register_timeout(cham->batch_window_ms / 1000,
+				       (cham->batch_window_ms % 1000) * 1000,
+				       chameleon_batch_timeout, cham, NULL);
+	}
+	chameleon_req_add_lookup(cham->batch, l);
+	if (cham->batch->num_lookups >= cham->batch_size)
+		chameleon_batch_flush(cham);
+
+	return 0;
+}
+
+
+/**
+ * chameleon_init - Initialize the ChameleonAC controller client
+ * @conf: Radio configuration with the chameleon_* parameters
+ * @cb: Callback for completed lookups
+ * @cb_ctx: Context pointer for @cb
+ * Returns: Pointer to the client or %NULL on failure
+ */
+struct chameleon * chameleon_init(const struct hostapd_config *conf,
+				  chameleon_resolved_cb cb, void *cb_ctx)
+{
+	struct chameleon *cham;
+	unsigned int i;
+
+	if (conf->chameleon_server == NULL)
+		return NULL;
+
+	cham = os_zalloc(sizeof(*cham));
+	if (cham == NULL)
+		return NULL;
+
+	cham->dst.sin_family = AF_INET;
+	cham->dst.sin_port = htons(conf->chameleon_port);
+	if (inet_pton(AF_INET, conf->chameleon_server,
+		      &cham->dst.sin_addr) <= 0) {
+		wpa_printf(MSG_ERROR, "Chameleon: Invalid controller address %s",
+			   conf->chameleon_server);
+		os_free(cham);
+		return NULL;
+	}
+
+	cham->timeout_ms = conf->chameleon_lookup_timeout;
+	cham->max_pending = conf->chameleon_max_pending;
+	cham->pipeline = conf->chameleon_pipeline ?
+		conf->chameleon_pipeline : 1;
+	cham->batch_window_ms = conf->chameleon_batch_window;
+	cham->batch_size = conf->chameleon_batch_size;
+	if (cham->batch_size > CHAMELEON_MAX_BATCH)
+		cham->batch_size = CHAMELEON_MAX_BATCH;
+	cham->num_conns = conf->chameleon_connections;
+	if (cham->num_conns == 0)
+		cham->num_conns = 1;
+	else if (cham->num_conns > CHAMELEON_MAX_CONNS)
+		cham->num_conns = CHAMELEON_MAX_CONNS;
+	for (i = 0; i < cham->num_conns; i++) {
+		cham->conns[i].cham = cham;
+		cham->conns[i].sd = -1;
+		cham->conns[i].content_length = -1;
+		dl_list_init(&cham->conns[i].inflight);
+	}
+
+	dl_list_init(&cham->lookups);
+	dl_list_init(&cham->queue);
+	cham->cb = cb;
+	cham->cb_ctx = cb_ctx;
+
+	return cham;
+}
+
+
+/**
+ * chameleon_deinit - Deinitialize the ChameleonAC controller client
+ * @cham: Controller client from chameleon_init()
+ *
+ * Pending lookups are aborted without calling the completion callback.
+ */
+void chameleon_deinit(struct chameleon *cham)
+{
+	struct chameleon_lookup *l, *tmp;
+	struct chameleon_req *req, *rtmp;
+	unsigned int i;
+
+	if (cham == NULL)
+		return;
+
+	for (i = 0; i < cham->num_conns; i++) {
+		eloop_cancel_timeout(chameleon_conn_backoff_timeout, cham,
+				     &cham->conns[i]);
+		chameleon_conn_close(&cham->conns[i], 0);
+	}
+	dl_list_for_each_safe(l, tmp, &cham->lookups, struct chameleon_lookup,
+			      list)
+		chameleon_lookup_free(l);
+	dl_list_for_each_safe(req, rtmp, &cham->queue, struct chameleon_req,
+			      list)
+		chameleon_req_free(req);
+	os_free(cham);
+}
@@ -0,0 +1,35 @@
+/*
+ * hostapd / ChameleonAC controller client
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#ifndef CHAMELEON_H
+#define CHAMELEON_H
+
+struct hostapd_config;
+struct chameleon;
+
+/**
+ * chameleon_resolved_cb - Lookup completion callback
+ * @ctx: Callback context from chameleon_init()
+ * @addr: STA MAC address the lookup was started for
+ * @ssid: SSID returned by the controller or %NULL on failure/timeout
+ * @passwd: Passphrase returned by the controller or %NULL on failure/timeout
+ * @psk: PMK (PMK_LEN octets) if the controller provided one or %NULL
+ *
+ * The controller reports "0"/"0" for STAs it does not know about; that is
+ * passed through as-is so that the caller can cache the negative answer.
+ */
+typedef void (*chameleon_resolved_cb)(void *ctx, const u8 *addr,
+				      const char *ssid, const char *passwd,
+				      const u8 *psk);
+
+struct chameleon * chameleon_init(const struct hostapd_config *conf,
+				  chameleon_resolved_cb cb, void *cb_ctx);
+void chameleon_deinit(struct chameleon *cham);
+int chameleon_lookup(struct chameleon *cham, const u8 *addr);
+int chameleon_lookup_pending(struct chameleon *cham, const u8 *addr);
+
+#endif /* CHAMELEON_H */
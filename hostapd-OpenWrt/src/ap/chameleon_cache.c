@@ -0,0 +1,328 @@
+/*
+ * hostapd / ChameleonAC STA credential cache
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Caches the SSID/passphrase that the controller returned for each STA,
+ * including negative answers for STAs that are not registered. The cache
+ * holds at most a configured number of entries; when it is full, the least
+ * recently used entry is replaced. Entries are carved out of fixed-size
+ * slabs that are only returned to the allocator when the cache is freed.
+ */
+
+#include "utils/includes.h"
+
+#include "utils/common.h"
+#include "ap_config.h"
+#include "chameleon_cache.h"
+
+#define CHAMELEON_CACHE_SLAB 32
+
+
+struct chameleon_cache_slab {
+	struct chameleon_cache_slab *next;
+	struct chameleon_cache_entry entries[CHAMELEON_CACHE_SLAB];
+};
+
+struct chameleon_cache {
+	struct chameleon_cache_entry **hash;
+	unsigned int hash_bits;
+	struct dl_list lru; /* struct chameleon_cache_entry */
+	struct dl_list free; /* struct chameleon_cache_entry */
+	struct chameleon_cache_slab *slabs;
+	unsigned int num_entries;
+	unsigned int max_entries;
+	unsigned int ttl;
+	unsigned int neg_ttl;
+
+	/* Statistics */
+	unsigned long hits;
+	unsigned long neg_hits;
+	unsigned long misses;
+	unsigned long expired;
+	unsigned long evictions;
+};
+
+
+/* Mix all six octets of the address so that OUI-heavy populations spread */
+static unsigned int chameleon_cache_hash(const struct chameleon_cache *cache,
+					 const u8 *addr)
+{
+	u32 h;
+
+	h = WPA_GET_BE32(addr) ^ (WPA_GET_BE16(addr + 4) * 0x9e3779b1);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h & ((1U << cache->hash_bits) - 1);
+}
+
+
+static void chameleon_cache_hash_del(struct chameleon_cache *cache,
+				     struct chameleon_cache_entry *entry)
+{
+	struct chameleon_cache_entry **pos;
+
+	pos = &cache->hash[chameleon_cache_hash(cache, entry->addr)];
+	while (*pos && *pos != entry)
+		pos = &(*pos)->hnext;
+	if (*pos)
+		*pos = entry->hnext;
+	entry->hnext = NULL;
+}
+
+
+static struct chameleon_cache_entry *
+chameleon_cache_alloc(struct chameleon_cache *cache)
+{
+	struct chameleon_cache_entry *entry;
+	struct chameleon_cache_slab *slab;
+	unsigned int i;
+
+	if (cache->num_entries >= cache->max_entries) {
+		entry = dl_list_last(&cache->lru, struct chameleon_cache_entry,
+				     list);
+		if (entry == NULL)
+			return NULL;
+		wpa_printf(MSG_DEBUG, "Chameleon: Evict cache entry for "
+			   MACSTR, MAC2STR(entry->addr));
+		chameleon_cache_hash_del(cache, entry);
+		dl_list_del(&entry->list);
+		cache->evictions++;
+		cache->num_entries--;
+		return entry;
+	}
+
+	if (dl_list_empty(&cache->free)) {
+		slab = os_zalloc(sizeof(*slab));
+		if (slab == NULL)
+			return NULL;
+		slab->next = cache->slabs;
+		cache->slabs = slab;
+		for (i = 0; i < CHAMELEON_CACHE_SLAB; i++)
+			dl_list_add_tail(&cache->free, &slab->entries[i].list);
+	}
+
+	entry = dl_list_first(&cache->free, struct chameleon_cache_entry,
+			      list);
+	dl_list_del(&entry->list);
+
+	return entry;
+}
+
+
+static struct chameleon_cache_entry *
+chameleon_cache_find(struct chameleon_cache *cache, const u8 *addr)
+{
+	struct chameleon_cache_entry *entry;
+
+	entry = cache->hash[chameleon_cache_hash(cache, addr)];
+	while (entry && os_memcmp(entry->addr, addr, ETH_ALEN) != 0)
+		entry = entry->hnext;
+
+	return entry;
+}
+
+
+/**
+ * chameleon_cache_get - Look up the cached answer for a STA
+ * @cache: Cache from chameleon_cache_init()
+ * @addr: STA MAC address
+ * Returns: Cache entry or %NULL if the STA is not in the cache
+ *
+ * Expired entries are still returned so that the caller can keep using the
+ * previous answer while a refresh is in progress; see
+ * chameleon_cache_expired().
+ */
+struct chameleon_cache_entry *
+chameleon_cache_get(struct chameleon_cache *cache, const u8 *addr)
+{
+	struct chameleon_cache_entry *entry;
+
+	entry = chameleon_cache_find(cache, addr);
+	if (entry == NULL) {
+		cache->misses++;
+		return NULL;
+	}
+
+	if (chameleon_cache_expired(entry))
+		cache->expired++;
+	else if (entry->negative)
+		cache->neg_hits++;
+	else
+		cache->hits++;
+
+	dl_list_del(&entry->list);
+	dl_list_add(&cache->lru, &entry->list);
+
+	return entry;
+}
+
+
+int chameleon_cache_expired(const struct chameleon_cache_entry *entry)
+{
+	struct os_reltime now;
+
+	os_get_reltime(&now);
+	return !os_reltime_before(&now, (struct os_reltime *) &entry->expires);
+}
+
+
+/**
+ * chameleon_cache_set - Store the controller answer for a STA
+ * @cache: Cache from chameleon_cache_init()
+ * @addr: STA MAC address
+ * @ssid: SSID returned by the controller ("0" for unknown STAs)
+ * @passwd: Passphrase returned by the controller ("0" for unknown STAs)
+ * Returns: Cache entry or %NULL on failure
+ */
+struct chameleon_cache_entry *
+chameleon_cache_set(struct chameleon_cache *cache, const u8 *addr,
+		    const char *ssid, const char *passwd)
+{
+	struct chameleon_cache_entry *entry;
+	unsigned int idx;
+
+	if (os_strlen(ssid) > HOSTAPD_MAX_SSID_LEN ||
+	    os_strlen(passwd) >= sizeof(entry->passwd))
+		return NULL;
+
+	entry = chameleon_cache_find(cache, addr);
+	if (entry) {
+		dl_list_del(&entry->list);
+	} else {
+		entry = chameleon_cache_alloc(cache);
+		if (entry == NULL)
+			return NULL;
+		os_memcpy(entry->addr, addr, ETH_ALEN);
+		idx = chameleon_cache_hash(cache, addr);
+		entry->hnext = cache->hash[idx];
+		cache->hash[idx] = entry;
+		cache->num_entries++;
+	}
+	dl_list_add(&cache->lru, &entry->list);
+
+	os_strlcpy(entry->ssid, ssid, sizeof(entry->ssid));
+	os_strlcpy(entry->passwd, passwd, sizeof(entry->passwd));
+	entry->negative = os_strcmp(ssid, "0") == 0 &&
+		os_strcmp(passwd, "0") == 0;
+	os_get_reltime(&entry->expires);
+	entry->expires.sec += entry->negative ? cache->neg_ttl : cache->ttl;
+
+	return entry;
+}
+
+
+/**
+ * chameleon_cache_flush - Remove all entries from the cache
+ * @cache: Cache from chameleon_cache_init()
+ */
+void chameleon_cache_flush(struct chameleon_cache *cache)
+{
+	struct chameleon_cache_entry *entry;
+
+	while ((entry = dl_list_first(&cache->lru,
+				      struct chameleon_cache_entry, list))) {
+		chameleon_cache_hash_del(cache, entry);
+		dl_list_del(&entry->list);
+		dl_list_add(&cache->free, &entry->list);
+	}
+	cache->num_entries = 0;
+}
+
+
+/**
+ * chameleon_cache_stats - Write cache statistics for the control interface
+ * @cache: Cache from chameleon_cache_init() or %NULL
+ * @buf: Buffer for the text
+ * @buflen: Length of @buf in octets
+ * Returns: Number of octets written to @buf
+ */
+int chameleon_cache_stats(struct chameleon_cache *cache, char *buf,
+			  size_t buflen)
+{
+	int ret;
+
+	if (cache == NULL)
+		return 0;
+
+	ret = os_snprintf(buf, buflen,
+			  "cache_entries=%u\n"
+			  "cache_max_entries=%u\n"
+			  "cache_hits=%lu\n"
+			  "cache_negative_hits=%lu\n"
+			  "cache_misses=%lu\n"
+			  "cache_expired=%lu\n"
+			  "cache_evictions=%lu\n",
+			  cache->num_entries, cache->max_entries,
+			  cache->hits, cache->neg_hits, cache->misses,
+			  cache->expired, cache->evictions);
+	if (os_snprintf_error(buflen, ret))
+		return 0;
+
+	return ret;
+}
+
+
+/**
+ * chameleon_cache_init - Initialize the STA credential cache
+ * @max_entries: Maximum number of cached STAs
+ * @ttl: Lifetime of positive answers in seconds
+ * @neg_ttl: Lifetime of negative answers in seconds
+ * Returns: Pointer to the cache or %NULL on failure
+ */
+struct chameleon_cache * chameleon_cache_init(unsigned int max_entries,
+					      unsigned int ttl,
+					      unsigned int neg_ttl)
+{
+	struct chameleon_cache *cache;
+
+	cache = os_zalloc(sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+
+	cache->max_entries = max_entries ? max_entries : 1;
+	cache->ttl = ttl;
+	cache->neg_ttl = neg_ttl;
+	dl_list_init(&cache->lru);
+	dl_list_init(&cache->free);
+
+	/* Keep the average hash chain length at or below one */
+	cache->hash_bits = 4;
+	while ((1U << cache->hash_bits) < cache->max_entries &&
+	       cache->hash_bits < 16)
+		cache->hash_bits++;
+	cache->hash = os_calloc(1U << cache->hash_bits, sizeof(*cache->hash));
+	if (cache->hash == NULL) {
+		os_free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+
+/**
+ * chameleon_cache_deinit - Free the STA credential cache
+ * @cache: Cache from chameleon_cache_init() or %NULL
+ */
+void chameleon_cache_deinit(struct chameleon_cache *cache)
+{
+	struct chameleon_cache_slab *slab, *prev;
+
+	if (cache == NULL)
+		return;
+
+	slab = cache->slabs;
+	while (slab) {
+		prev = slab;
+		slab = slab->next;
+		os_free(prev);
+	}
+	os_free(cache->hash);
+	os_free(cache);
+}
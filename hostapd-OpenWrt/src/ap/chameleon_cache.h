@@ -0,0 +1,47 @@
+/*
+ * hostapd / ChameleonAC STA credential cache
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#ifndef CHAMELEON_CACHE_H
+#define CHAMELEON_CACHE_H
+
+#include "utils/list.h"
+
+struct chameleon_cache;
+
+/**
+ * struct chameleon_cache_entry - Cached controller answer for one STA
+ * @ssid: SSID registered for the STA ("0" for unknown STAs)
+ * @passwd: Passphrase registered for the STA ("0" for unknown STAs)
+ * @negative: Controller does not know the STA
+ * @expires: Time after which the entry needs to be refreshed
+ */
+struct chameleon_cache_entry {
+	struct chameleon_cache_entry *hnext; /* next entry in hash chain */
+	struct dl_list list; /* LRU list (most recently used first) or free
+			      * list */
+	u8 addr[ETH_ALEN];
+	u8 negative;
+	struct os_reltime expires;
+	char ssid[HOSTAPD_MAX_SSID_LEN + 1];
+	char passwd[64];
+};
+
+struct chameleon_cache * chameleon_cache_init(unsigned int max_entries,
+					      unsigned int ttl,
+					      unsigned int neg_ttl);
+void chameleon_cache_deinit(struct chameleon_cache *cache);
+struct chameleon_cache_entry *
+chameleon_cache_get(struct chameleon_cache *cache, const u8 *addr);
+int chameleon_cache_expired(const struct chameleon_cache_entry *entry);
+struct chameleon_cache_entry *
+chameleon_cache_set(struct chameleon_cache *cache, const u8 *addr,
+		    const char *ssid, const char *passwd);
+void chameleon_cache_flush(struct chameleon_cache *cache);
+int chameleon_cache_stats(struct chameleon_cache *cache, char *buf,
+			  size_t buflen);
+
+#endif /* CHAMELEON_CACHE_H */
@@ -0,0 +1,444 @@
+/*
+ * hostapd / ChameleonAC background PMK derivation
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Deriving the PMK from a passphrase takes 4096 iterations of PBKDF2-SHA1,
+ * which is tens of milliseconds on small MIPS routers. Dynamic BSSes are
+ * created while frames are being processed, so the derivation is handed to
+ * worker threads and the result is delivered back to the eloop thread
+ * through a pipe. Results are kept in a small LRU cache keyed by SSID and
+ * passphrase so that the same network is never derived twice.
+ */
+
+#include "utils/includes.h"
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "utils/common.h"
+#include "utils/eloop.h"
+#include "utils/list.h"
+#include "common/wpa_common.h"
+#include "crypto/sha1.h"
+#include "ap_config.h"
+#include "chameleon_pmk.h"
+
+#define CHAMELEON_PMK_MAX_THREADS 4
+
+
+struct chameleon_pmk_entry {
+	struct chameleon_pmk_entry *hnext; /* next entry in hash chain */
+	struct dl_list list; /* LRU list (most recently used first) */
+	u8 ssid[HOSTAPD_MAX_SSID_LEN];
+	size_t ssid_len;
+	char passphrase[64];
+	u8 psk[PMK_LEN];
+};
+
+struct chameleon_pmk_job {
+	struct dl_list list; /* chameleon_pmk::jobs; eloop thread only */
+	struct dl_list queue_list; /* queue or done; protected by lock */
+	u8 ssid[HOSTAPD_MAX_SSID_LEN];
+	size_t ssid_len;
+	char passphrase[64];
+	u8 psk[PMK_LEN];
+};
+
+struct chameleon_pmk {
+	/* PMK cache; eloop thread only */
+	struct chameleon_pmk_entry **hash;
+	unsigned int hash_bits;
+	struct dl_list lru; /* struct chameleon_pmk_entry */
+	unsigned int num_entries;
+	unsigned int max_entries;
+
+	struct dl_list jobs; /* struct chameleon_pmk_job; not yet delivered */
+
+	/* Shared with the worker threads */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct dl_list queue; /* struct chameleon_pmk_job; waiting */
+	struct dl_list done; /* struct chameleon_pmk_job; derived */
+	int stop;
+
+	pthread_t threads[CHAMELEON_PMK_MAX_THREADS];
+	unsigned int num_threads;
+	int pipe[2]; /* workers -> eloop wakeup */
+
+	chameleon_pmk_cb cb;
+	void *cb_ctx;
+};
+
+
+static unsigned int chameleon_pmk_hash(const struct chameleon_pmk *pmk,
+				       const u8 *ssid, size_t ssid_len,
+				       const char *passphrase)
+{
+	u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < ssid_len; i++) {
+		h ^= ssid[i];
+		h *= 16777619U;
+	}
+	h ^= 0xff; /* separator so that ("ab", "c") != ("a", "bc") */
+	h *= 16777619U;
+	for (i = 0; passphrase[i]; i++) {
+		h ^= (u8) passphrase[i];
+		h *= 16777619U;
+	}
+
+	return (h ^ (h >> 16)) & ((1U << pmk->hash_bits) - 1);
+}
+
+
+static int chameleon_pmk_match(const u8 *ssid1, size_t ssid1_len,
+			       const char *passphrase1, const u8 *ssid2,
+			       size_t ssid2_len, const char *passphrase2)
+{
+	return ssid1_len == ssid2_len &&
+		os_memcmp(ssid1, ssid2, ssid1_len) == 0 &&
+		os_strcmp(passphrase1, passphrase2) == 0;
+}
+
+
+static void chameleon_pmk_entry_free(struct chameleon_pmk *pmk,
+				     struct chameleon_pmk_entry *entry)
+{
+	struct chameleon_pmk_entry **pos;
+
+	pos = &pmk->hash[chameleon_pmk_hash(pmk, entry->ssid, entry->ssid_len,
+					    entry->passphrase)];
+	while (*pos && *pos != entry)
+		pos = &(*pos)->hnext;
+	if (*pos)
+		*pos = entry->hnext;
+	dl_list_del(&entry->list);
+	pmk->num_entries--;
+	bin_clear_free(entry, sizeof(*entry));
+}
+
+
+/**
+ * chameleon_pmk_get - Look up a cached PMK
+ * @pmk: Context from chameleon_pmk_init()
+ * @ssid: SSID
+ * @ssid_len: Length of @ssid in octets
+ * @passphrase: Passphrase
+ * Returns: Cached PMK (PMK_LEN octets) or %NULL if not available
+ */
+const u8 * chameleon_pmk_get(struct chameleon_pmk *pmk, const u8 *ssid,
+			     size_t ssid_len, const char *passphrase)
+{
+	struct chameleon_pmk_entry *entry;
+
+	entry = pmk->hash[chameleon_pmk_hash(pmk, ssid, ssid_len,
+					     passphrase)];
+	while (entry &&
+	       !chameleon_pmk_match(entry->ssid, entry->ssid_len,
+				    entry->passphrase, ssid, ssid_len,
+				    passphrase))
+		entry = entry->hnext;
+	if (entry == NULL)
+		return NULL;
+
+	dl_list_del(&entry->list);
+	dl_list_add(&pmk->lru, &entry->list);
+
+	return entry->psk;
+}
+
+
+/**
+ * chameleon_pmk_set - Add a PMK to the cache
+ * @pmk: Context from chameleon_pmk_init()
+ * @ssid: SSID
+ * @ssid_len: Length of @ssid in octets
+ * @passphrase: Passphrase
+ * @psk: PMK (PMK_LEN octets), e.g., as provided by the controller
+ */
+void chameleon_pmk_set(struct chameleon_pmk *pmk, const u8 *ssid,
+		       size_t ssid_len, const char *passphrase, const u8 *psk)
+{
+	struct chameleon_pmk_entry *entry;
+	unsigned int idx;
+
+	if (ssid_len > HOSTAPD_MAX_SSID_LEN ||
+	    os_strlen(passphrase) >= sizeof(entry->passphrase))
+		return;
+
+	if (chameleon_pmk_get(pmk, ssid, ssid_len, passphrase)) {
+		entry = dl_list_first(&pmk->lru, struct chameleon_pmk_entry,
+				      list);
+		os_memcpy(entry->psk, psk, PMK_LEN);
+		return;
+	}
+
+	if (pmk->num_entries >= pmk->max_entries) {
+		entry = dl_list_last(&pmk->lru, struct chameleon_pmk_entry,
+				     list);
+		if (entry)
+			chameleon_pmk_entry_free(pmk, entry);
+	}
+
+	entry = os_zalloc(sizeof(*entry));
+	if (entry == NULL)
+		return;
+	os_memcpy(entry->ssid, ssid, ssid_len);
+	entry->ssid_len = ssid_len;
+	os_strlcpy(entry->passphrase, passphrase, sizeof(entry->passphrase));
+	os_memcpy(entry->psk, psk, PMK_LEN);
+
+	idx = chameleon_pmk_hash(pmk, ssid, ssid_len, passphrase);
+	entry->hnext = pmk->hash[idx];
+	pmk->hash[idx] = entry;
+	dl_list_add(&pmk->lru, &entry->list);
+	pmk->num_entries++;
+}
+
+
+static void chameleon_pmk_derive(struct chameleon_pmk_job *job)
+{
+	pbkdf2_sha1(job->passphrase, job->ssid, job->ssid_len, 4096,
+		    job->psk, PMK_LEN);
+}
+
+
+static void chameleon_pmk_wakeup(struct chameleon_pmk *pmk)
+{
+	char c = 0;
+
+	/* A full pipe means that a wakeup is already pending */
+	if (write(pmk->pipe[1], &c, 1) < 0)
+		return;
+}
+
+
+static void * chameleon_pmk_worker(void *arg)
+{
+	struct chameleon_pmk *pmk = arg;
+	struct chameleon_pmk_job *job;
+
+	pthread_mutex_lock(&pmk->lock);
+	for (;;) {
+		while (!pmk->stop && dl_list_empty(&pmk->queue))
+			pthread_cond_wait(&pmk->cond, &pmk->lock);
+		if (pmk->stop)
+			break;
+		job = dl_list_first(&pmk->queue, struct chameleon_pmk_job,
+				    queue_list);
+		dl_list_del(&job->queue_list);
+		pthread_mutex_unlock(&pmk->lock);
+
+		chameleon_pmk_derive(job);
+
+		pthread_mutex_lock(&pmk->lock);
+		dl_list_add_tail(&pmk->done, &job->queue_list);
+		chameleon_pmk_wakeup(pmk);
+	}
+	pthread_mutex_unlock(&pmk->lock);
+
+	return NULL;
+}
+
+
+static void chameleon_pmk_receive(int sock, void *eloop_ctx, void *sock_ctx)
+{
+	struct chameleon_pmk *pmk = eloop_ctx;
+	struct chameleon_pmk_job *job;
+	struct dl_list done;
+	char buf[64];
+
+	while (read(sock, buf, sizeof(buf)) > 0)
+		;
+
+	dl_list_init(&done);
+	pthread_mutex_lock(&pmk->lock);
+	while ((job = dl_list_first(&pmk->done, struct chameleon_pmk_job,
+				    queue_list))) {
+		dl_list_del(&job->queue_list);
+		dl_list_add_tail(&done, &job->queue_list);
+	}
+	pthread_mutex_unlock(&pmk->lock);
+
+	while ((job = dl_list_first(&done, struct chameleon_pmk_job,
+				    queue_list))) {
+		dl_list_del(&job->queue_list);
+		dl_list_del(&job->list);
+		chameleon_pmk_set(pmk, job->ssid, job->ssid_len,
+				  job->passphrase, job->psk);
+		pmk->cb(pmk->cb_ctx, job->ssid, job->ssid_len,
+			job->passphrase, job->psk);
+		bin_clear_free(job, sizeof(*job));
+	}
+}
+
+
+/**
+ * chameleon_pmk_request - Start deriving a PMK in the background
+ * @pmk: Context from chameleon_pmk_init()
+ * @ssid: SSID
+ * @ssid_len: Length of @ssid in octets
+ * @passphrase: Passphrase
+ * Returns: 0 if the PMK will be reported through the callback, -1 on failure
+ *
+ * Requests for a PMK that is already being derived are merged.
+ */
+int chameleon_pmk_request(struct chameleon_pmk *pmk, const u8 *ssid,
+			  size_t ssid_len, const char *passphrase)
+{
+	struct chameleon_pmk_job *job;
+
+	if (ssid_len > HOSTAPD_MAX_SSID_LEN ||
+	    os_strlen(passphrase) >= sizeof(job->passphrase))
+		return -1;
+
+	dl_list_for_each(job, &pmk->jobs, struct chameleon_pmk_job, list) {
+		if (chameleon_pmk_match(job->ssid, job->ssid_len,
+					job->passphrase, ssid, ssid_len,
+					passphrase))
+			return 0;
+	}
+
+	job = os_zalloc(sizeof(*job));
+	if (job == NULL)
+		return -1;
+	os_memcpy(job->ssid, ssid, ssid_len);
+	job->ssid_len = ssid_len;
+	os_strlcpy(job->passphrase, passphrase, sizeof(job->passphrase));
+	dl_list_add_tail(&pmk->jobs, &job->list);
+
+	if (pmk->num_threads == 0) {
+		/* No worker threads; derive here, deliver from eloop */
+		chameleon_pmk_derive(job);
+		pthread_mutex_lock(&pmk->lock);
+		dl_list_add_tail(&pmk->done, &job->queue_list);
+		pthread_mutex_unlock(&pmk->lock);
+		chameleon_pmk_wakeup(pmk);
+		return 0;
+	}
+
+	pthread_mutex_lock(&pmk->lock);
+	dl_list_add_tail(&pmk->queue, &job->queue_list);
+	pthread_cond_signal(&pmk->cond);
+	pthread_mutex_unlock(&pmk->lock);
+
+	return 0;
+}
+
+
+/**
+ * chameleon_pmk_init - Start the PMK derivation workers
+ * @threads: Number of worker threads; 0 = derive in the eloop thread
+ * @cache_size: Maximum number of cached PMKs
+ * @cb: Completion callback for chameleon_pmk_request()
+ * @cb_ctx: Context for @cb
+ * Returns: Pointer to the context or %NULL on failure
+ */
+struct chameleon_pmk * chameleon_pmk_init(unsigned int threads,
+					  unsigned int cache_size,
+					  chameleon_pmk_cb cb, void *cb_ctx)
+{
+	struct chameleon_pmk *pmk;
+	unsigned int i;
+
+	pmk = os_zalloc(sizeof(*pmk));
+	if (pmk == NULL)
+		return NULL;
+
+	pmk->cb = cb;
+	pmk->cb_ctx = cb_ctx;
+	pmk->max_entries = cache_size ? cache_size : 1;
+	dl_list_init(&pmk->lru);
+	dl_list_init(&pmk->jobs);
+	dl_list_init(&pmk->queue);
+	dl_list_init(&pmk->done);
+
+	pmk->hash_bits = 3;
+	while ((1U << pmk->hash_bits) < pmk->max_entries &&
+	       pmk->hash_bits < 12)
+		pmk->hash_bits++;
+	pmk->hash = os_calloc(1U << pmk->hash_bits, sizeof(*pmk->hash));
+	if (pmk->hash == NULL) {
+		os_free(pmk);
+		return NULL;
+	}
+
+	if (pipe(pmk->pipe) < 0) {
+		wpa_printf(MSG_ERROR, "Chameleon: pipe: %s", strerror(errno));
+		os_free(pmk->hash);
+		os_free(pmk);
+		return NULL;
+	}
+	fcntl(pmk->pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(pmk->pipe[1], F_SETFL, O_NONBLOCK);
+	if (eloop_register_read_sock(pmk->pipe[0], chameleon_pmk_receive, pmk,
+				     NULL) < 0) {
+		close(pmk->pipe[0]);
+		close(pmk->pipe[1]);
+		os_free(pmk->hash);
+		os_free(pmk);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pmk->lock, NULL);
+	pthread_cond_init(&pmk->cond, NULL);
+
+	if (threads > CHAMELEON_PMK_MAX_THREADS)
+		threads = CHAMELEON_PMK_MAX_THREADS;
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pmk->threads[i], NULL,
+				   chameleon_pmk_worker, pmk) != 0) {
+			wpa_printf(MSG_INFO, "Chameleon: Could not start PMK "
+				   "worker thread %u", i);
+			break;
+		}
+	}
+	pmk->num_threads = i;
+	wpa_printf(MSG_DEBUG, "Chameleon: %u PMK worker thread(s)",
+		   pmk->num_threads);
+
+	return pmk;
+}
+
+
+/**
+ * chameleon_pmk_deinit - Stop the workers and free the context
+ * @pmk: Context from chameleon_pmk_init() or %NULL
+ *
+ * PMKs that are still being derived are discarded without calling back.
+ */
+void chameleon_pmk_deinit(struct chameleon_pmk *pmk)
+{
+	struct chameleon_pmk_job *job;
+	struct chameleon_pmk_entry *entry;
+	unsigned int i;
+
+	if (pmk == NULL)
+		return;
+
+	pthread_mutex_lock(&pmk->lock);
+	pmk->stop = 1;
+	pthread_cond_broadcast(&pmk->cond);
+	pthread_mutex_unlock(&pmk->lock);
+	for (i = 0; i < pmk->num_threads; i++)
+		pthread_join(pmk->threads[i], NULL);
+
+	while ((job = dl_list_first(&pmk->jobs, struct chameleon_pmk_job,
+				    list))) {
+		dl_list_del(&job->list);
+		bin_clear_free(job, sizeof(*job));
+	}
+	while ((entry = dl_list_first(&pmk->lru, struct chameleon_pmk_entry,
+				      list)))
+		chameleon_pmk_entry_free(pmk, entry);
+
+	eloop_unregister_read_sock(pmk->pipe[0]);
+	close(pmk->pipe[0]);
+	close(pmk->pipe[1]);
+	pthread_cond_destroy(&pmk->cond);
+	pthread_mutex_destroy(&pmk->lock);
+	os_free(pmk->hash);
+	os_free(pmk);
+}
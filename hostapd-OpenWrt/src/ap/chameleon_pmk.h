@@ -0,0 +1,37 @@
+/*
+ * hostapd / ChameleonAC background PMK derivation
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#ifndef CHAMELEON_PMK_H
+#define CHAMELEON_PMK_H
+
+struct chameleon_pmk;
+
+/**
+ * chameleon_pmk_cb - PMK derivation completion callback
+ * @ctx: Callback context from chameleon_pmk_init()
+ * @ssid: SSID the PMK was derived for
+ * @ssid_len: Length of @ssid in octets
+ * @passphrase: Passphrase the PMK was derived from
+ * @psk: Derived PMK (PMK_LEN octets) or %NULL on failure
+ *
+ * The callback is called from the eloop thread.
+ */
+typedef void (*chameleon_pmk_cb)(void *ctx, const u8 *ssid, size_t ssid_len,
+				 const char *passphrase, const u8 *psk);
+
+struct chameleon_pmk * chameleon_pmk_init(unsigned int threads,
+					  unsigned int cache_size,
+					  chameleon_pmk_cb cb, void *cb_ctx);
+void chameleon_pmk_deinit(struct chameleon_pmk *pmk);
+const u8 * chameleon_pmk_get(struct chameleon_pmk *pmk, const u8 *ssid,
+			     size_t ssid_len, const char *passphrase);
+void chameleon_pmk_set(struct chameleon_pmk *pmk, const u8 *ssid,
+		       size_t ssid_len, const char *passphrase, const u8 *psk);
+int chameleon_pmk_request(struct chameleon_pmk *pmk, const u8 *ssid,
+			  size_t ssid_len, const char *passphrase);
+
+#endif /* CHAMELEON_PMK_H */
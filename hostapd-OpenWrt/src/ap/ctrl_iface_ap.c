@@ -21,6 +21,7 @@
 #include "p2p_hostapd.h"
 #include "ctrl_iface_ap.h"
 #include "ap_drv_ops.h"
+#include "chameleon_cache.h"
 
 #ifdef CONFIG_CTRL_IFACE_MIB
 
@@ -551,3 +552,25 @@ int hostapd_ctrl_iface_stop_ap(struct hostapd_data *hapd)
 
 	return 0;
 }
+
+
+int hostapd_ctrl_iface_chameleon(struct hostapd_data *hapd, char *buf,
+				 size_t buflen)
+{
+	struct hostapd_iface *iface = hapd->iface;
+	int len = 0, ret;
+
+	ret = os_snprintf(buf + len, buflen - len,
+			  "num_bss=%u\n"
+			  "dynamic_bss=%u\n",
+			  (unsigned int) iface->num_bss,
+			  iface->chameleon_num_bss);
+	if (os_snprintf_error(buflen - len, ret))
+		return len;
+	len += ret;
+
+	len += chameleon_cache_stats(iface->chameleon_cache, buf + len,
+				     buflen - len);
+
+	return len;
+}
@@ -42,12 +42,14 @@
 #include "x_snoop.h"
 #include "dhcp_snoop.h"
 #include "ndisc_snoop.h"
+#include "bss_load.h"
+#include "chameleon.h"
+#include "chameleon_cache.h"
+#include "chameleon_pmk.h"
 
 extern int wpa_debug_level;
 
 #define MAX_LEN 64
-#define SERVER "107.170.70.96"
-#define PORT 8080
 
 int hostapd_notif_assoc(struct hostapd_data *hapd, const u8 *addr,
 			const u8 *req_ies, size_t req_ies_len, int reassoc)
@@ -767,9 +769,14 @@ static void hostapd_action_rx(struct hostapd_data *hapd,
 
 #define HAPD_BROADCAST ((struct hostapd_data *) -1)
 
+/* Interval for checking dynamic BSSes for idleness (in seconds) */
+#define CHAMELEON_IDLE_CHECK_INTERVAL 10
+
 static int hostapd_setup_new_bss(struct hostapd_data *hapd)
 {
 	struct hostapd_bss_config *conf = hapd->conf;
+
+	hapd->started = 1;
     
 	if (conf->wmm_enabled < 0)
 		conf->wmm_enabled = hapd->iconf->ieee80211n;
@@ -783,26 +790,10 @@ static int hostapd_setup_new_bss(struct hostapd_data *hapd)
 		return -1;
 	}
 
-	if (conf->radius_das_port) {
-		struct radius_das_conf das_conf;
-		os_memset(&das_conf, 0, sizeof(das_conf));
-		das_conf.port = conf->radius_das_port;
-		das_conf.shared_secret = conf->radius_das_shared_secret;
-		das_conf.shared_secret_len =
-			conf->radius_das_shared_secret_len;
-		das_conf.client_addr = &conf->radius_das_client_addr;
-		das_conf.time_window = conf->radius_das_time_window;
-		das_conf.require_event_timestamp =
-			conf->radius_das_require_event_timestamp;
-		das_conf.ctx = hapd;
-		das_conf.disconnect = hostapd_das_disconnect;
-		hapd->radius_das = radius_das_init(&das_conf);
-		if (hapd->radius_das == NULL) {
-			wpa_printf(MSG_ERROR, "RADIUS DAS initialization "
-				   "failed.");
-			return -1;
-		}
-	}
+	/*
+	 * The DAS port is already bound by the BSS the template was taken
+	 * from, so dynamic BSSes do not run a DAS server of their own.
+	 */
 #endif /* CONFIG_NO_RADIUS */
 
 	if (hostapd_acl_init(hapd)) {
@@ -890,124 +881,541 @@ static int hostapd_setup_new_bss(struct hostapd_data *hapd)
 	return 0;
 }
 
-static size_t hostapd_http_request(const u8 *sa, char *ssid, char *passwd)
+static int hostapd_ssid_passwd_unknown(const char *ssid, const char *passwd)
 {
-	int connfd;
-	struct sockaddr_in servaddr;
-	char buf[1024];
+	return os_strcmp(ssid, "0") == 0 && os_strcmp(passwd, "0") == 0;
+}
 
-	if ((connfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)	{
-		wpa_printf(MSG_ERROR, "socket error");
-		return -1;
+
+/* FNV-1a over the SSID octets */
+static unsigned int hostapd_chameleon_bss_hash(const u8 *ssid, size_t len)
+{
+	u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= ssid[i];
+		h *= 16777619U;
 	}
 
-	memset(&servaddr, 0, sizeof(servaddr));
-	servaddr.sin_family = AF_INET;
-	servaddr.sin_port = htons(PORT);
-	
-	if (inet_pton(AF_INET, SERVER, &servaddr.sin_addr) <= 0) {
-		wpa_printf(MSG_ERROR, "inet_pton error for " SERVER);
-	    close(connfd);
-        return -1;
+	return (h ^ (h >> 16)) % CHAMELEON_BSS_HASH_SIZE;
+}
+
+
+static struct hostapd_data *
+hostapd_get_chameleon_bss(struct hostapd_iface *iface, const char *ssid)
+{
+	struct hostapd_data *hapd;
+	size_t len = os_strlen(ssid);
+
+	hapd = iface->chameleon_bss_hash[
+		hostapd_chameleon_bss_hash((const u8 *) ssid, len)];
+	while (hapd) {
+		struct hostapd_ssid *bss_ssid = &hapd->conf->ssid;
+
+		if (bss_ssid->ssid_len == len &&
+		    os_memcmp(ssid, bss_ssid->ssid, len) == 0)
+			return hapd;
+		hapd = hapd->chameleon_hnext;
 	}
 
-	if (connect(connfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-		wpa_printf(MSG_ERROR, "connect error");
-        close(connfd);
-		return -1;
+	return NULL;
+}
+
+
+static void hostapd_chameleon_bss_hash_add(struct hostapd_iface *iface,
+					   struct hostapd_data *hapd)
+{
+	unsigned int idx;
+
+	idx = hostapd_chameleon_bss_hash(hapd->conf->ssid.ssid,
+					 hapd->conf->ssid.ssid_len);
+	hapd->chameleon_hnext = iface->chameleon_bss_hash[idx];
+	iface->chameleon_bss_hash[idx] = hapd;
+}
+
+
+static void hostapd_chameleon_bss_hash_del(struct hostapd_iface *iface,
+					   struct hostapd_data *hapd)
+{
+	struct hostapd_data **pos;
+
+	pos = &iface->chameleon_bss_hash[
+		hostapd_chameleon_bss_hash(hapd->conf->ssid.ssid,
+					   hapd->conf->ssid.ssid_len)];
+	while (*pos && *pos != hapd)
+		pos = &(*pos)->chameleon_hnext;
+	if (*pos)
+		*pos = hapd->chameleon_hnext;
+	hapd->chameleon_hnext = NULL;
+}
+
+
+static void hostapd_chameleon_remove_bss(struct hostapd_iface *iface,
+					 struct hostapd_data *hapd)
+{
+	hostapd_chameleon_bss_hash_del(iface, hapd);
+	iface->chameleon_num_bss--;
+	hostapd_remove_shared_bss(hapd);
+}
+
+
+/*
+ * Pick the dynamic BSS to replace when the per-radio limit is reached: the
+ * least recently used BSS without STAs. BSSes with STAs are never replaced;
+ * NULL is returned if all of them have STAs.
+ */
+static struct hostapd_data *
+hostapd_chameleon_lru_bss(struct hostapd_iface *iface)
+{
+	struct hostapd_data *hapd, *lru = NULL;
+	size_t i;
+
+	for (i = 0; i < iface->num_bss; i++) {
+		hapd = iface->bss[i];
+		if (!hapd->chameleon || hapd->num_sta > 0)
+			continue;
+		if (lru == NULL ||
+		    os_reltime_before(&hapd->chameleon_used,
+				      &lru->chameleon_used))
+			lru = hapd;
 	}
-    
-    bzero(buf, 1024);
-	sprintf(buf, "GET /ChameleonAC/Select?mac=" MACSTR " HTTP/1.1\n", MAC2STR(sa));
-    strcat(buf, "Host: 107.170.70.96:8080\n");
-    strcat(buf, "Cache-Control: max-age=0\n");
-    strcat(buf, "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\n");
-    strcat(buf, "User-Agent: hostapd\n");
-    strcat(buf, "Accept-Encoding: gzip, deflate, sdch\n");
-    strcat(buf, "Accept-Language: zh-CN,zh;q=0.8,en;q=0.6\n\n");
-    	
-    if (write(connfd, buf, strlen(buf)) <= 0) {
-        wpa_printf(MSG_ERROR, "send data failed!\n");
-        close(connfd);
-        return -1;
-    }
-    
-    bzero(buf, 1024);
-	if (read(connfd, buf, 1024) < 0) {
-	    wpa_printf(MSG_ERROR, "receive data failed!\n");
-        close(connfd);
-        return -1;
-    }
-    
-    sscanf(buf, "%*[^\"]\"%[^:]:%[^\"]", ssid, passwd);
-    
-    close(connfd);
+
+	return lru;
+}
+
+
+static void hostapd_chameleon_idle_timeout(void *eloop_ctx, void *timeout_ctx)
+{
+	struct hostapd_iface *iface = eloop_ctx;
+	struct hostapd_data *hapd;
+	struct os_reltime now;
+	size_t i;
+
+	os_get_reltime(&now);
+	for (i = iface->num_bss; i > 0; i--) {
+		hapd = iface->bss[i - 1];
+		if (!hapd->chameleon || hapd->num_sta > 0 ||
+		    !os_reltime_expired(&now, &hapd->chameleon_used,
+					iface->conf->chameleon_bss_idle_timeout))
+			continue;
+		wpa_printf(MSG_DEBUG, "Chameleon: BSS '%s' idle",
+			   wpa_ssid_txt(hapd->conf->ssid.ssid,
+					hapd->conf->ssid.ssid_len));
+		hostapd_chameleon_remove_bss(iface, hapd);
+	}
+
+	if (iface->chameleon_num_bss)
+		eloop_register_timeout(CHAMELEON_IDLE_CHECK_INTERVAL, 0,
+				       hostapd_chameleon_idle_timeout, iface,
+				       NULL);
+}
+
+
+/**
+ * hostapd_chameleon_flush_bss - Remove all dynamically created BSSes
+ * @iface: Pointer to interface data
+ */
+void hostapd_chameleon_flush_bss(struct hostapd_iface *iface)
+{
+	size_t i;
+
+	eloop_cancel_timeout(hostapd_chameleon_idle_timeout, iface, NULL);
+	for (i = iface->num_bss; i > 0; i--) {
+		if (iface->bss[i - 1]->chameleon)
+			hostapd_chameleon_remove_bss(iface, iface->bss[i - 1]);
+	}
+}
+
+
+/*
+ * Return the configuration that dynamic BSSes are copied from. The
+ * configuration file is parsed only once, when the first dynamic BSS is
+ * created.
+ */
+static struct hostapd_bss_config *
+hostapd_chameleon_template(struct hostapd_iface *iface)
+{
+	struct hostapd_config *conf;
+
+	if (iface->chameleon_template)
+		return iface->chameleon_template;
+
+	if (iface->config_fname && iface->interfaces &&
+	    iface->interfaces->config_read_cb) {
+		conf = iface->interfaces->config_read_cb(iface->config_fname);
+		if (conf == NULL)
+			return NULL;
+		iface->chameleon_template = conf->bss[0];
+		conf->bss[0] = NULL;
+		hostapd_config_free(conf);
+	} else {
+		/* Only in-memory configuration available */
+		iface->chameleon_template =
+			hostapd_config_clone_bss(iface->conf->bss[0]);
+	}
+
+	return iface->chameleon_template;
+}
+
+
+/* Make room for one more BSS in iface->bss and iface->conf->bss */
+static int hostapd_chameleon_grow_bss(struct hostapd_iface *iface)
+{
+	struct hostapd_data **bss;
+	struct hostapd_bss_config **conf;
+	size_t size;
+
+	size = iface->bss_alloc;
+	if (iface->num_bss < size && iface->conf->num_bss < size)
+		return 0;
+
+	if (size < iface->num_bss)
+		size = iface->num_bss;
+	if (size < iface->conf->num_bss)
+		size = iface->conf->num_bss;
+	size = size < 4 ? 8 : size * 2;
+
+	bss = os_realloc_array(iface->bss, size, sizeof(*bss));
+	if (bss == NULL)
+		return -1;
+	iface->bss = bss;
+
+	conf = os_realloc_array(iface->conf->bss, size, sizeof(*conf));
+	if (conf == NULL)
+		return -1;
+	iface->conf->bss = conf;
+	iface->conf->last_bss = conf[0];
+
+	iface->bss_alloc = size;
+
 	return 0;
 }
 
+
+static void hostapd_chameleon_create_bss(struct hostapd_iface *iface,
+					 const char *ssid, const char *passwd,
+					 const u8 *psk)
+{
+	struct hostapd_bss_config *tmpl, *conf;
+	struct hostapd_data *hapd, *lru = NULL;
+
+	wpa_printf(MSG_DEBUG, "ssid=%s, passwd=%s", ssid, passwd);
+
+	if (iface->conf->chameleon_max_bss &&
+	    iface->chameleon_num_bss >= iface->conf->chameleon_max_bss) {
+		lru = hostapd_chameleon_lru_bss(iface);
+		if (lru == NULL) {
+			wpa_printf(MSG_DEBUG,
+				   "Chameleon: BSS limit reached and all BSSes have STAs; not adding '%s'",
+				   ssid);
+			return;
+		}
+	}
+
+	tmpl = hostapd_chameleon_template(iface);
+	if (tmpl == NULL || hostapd_chameleon_grow_bss(iface) < 0)
+		return;
+
+	conf = hostapd_config_clone_bss(tmpl);
+	if (conf == NULL)
+		return;
+	conf->ssid.ssid_len = os_strlen(ssid);
+	os_memcpy(conf->ssid.ssid, ssid, conf->ssid.ssid_len);
+	conf->ssid.ssid_set = 1;
+
+	str_clear_free(conf->ssid.wpa_passphrase);
+	conf->ssid.wpa_passphrase = os_strdup(passwd);
+	if (conf->ssid.wpa_passphrase == NULL) {
+		hostapd_config_free_bss(conf);
+		return;
+	}
+
+	if (psk) {
+		/* Already derived; hostapd_setup_wpa_psk() will use it */
+		conf->ssid.wpa_psk = os_zalloc(sizeof(struct hostapd_wpa_psk));
+		if (conf->ssid.wpa_psk == NULL) {
+			hostapd_config_free_bss(conf);
+			return;
+		}
+		os_memcpy(conf->ssid.wpa_psk->psk, psk, PMK_LEN);
+	}
+
+	hostapd_set_security_params(conf, 1);
+
+	hapd = hostapd_alloc_bss_data(iface, iface->conf, conf);
+	if (hapd == NULL) {
+		hostapd_config_free_bss(conf);
+		return;
+	}
+
+	/* Replace only once the new BSS is known to fit */
+	if (lru) {
+		wpa_printf(MSG_DEBUG, "Chameleon: Replace BSS '%s'",
+			   wpa_ssid_txt(lru->conf->ssid.ssid,
+					lru->conf->ssid.ssid_len));
+		hostapd_chameleon_remove_bss(iface, lru);
+	}
+
+	iface->conf->bss[iface->conf->num_bss++] = conf;
+	iface->bss[iface->num_bss++] = hapd;
+	hostapd_chameleon_bss_hash_add(iface, hapd);
+	iface->chameleon_num_bss++;
+
+	hapd->chameleon = 1;
+	os_get_reltime(&hapd->chameleon_used);
+	hapd->driver = iface->bss[0]->driver;
+	hapd->drv_priv = iface->bss[0]->drv_priv;
+	hapd->msg_ctx = iface->bss[0]->msg_ctx;
+	os_memcpy(hapd->own_addr, iface->bss[0]->own_addr, ETH_ALEN);
+
+	hostapd_setup_wpa_psk(hapd->conf);
+	if (hostapd_setup_new_bss(hapd) < 0) {
+		hostapd_chameleon_remove_bss(iface, hapd);
+		return;
+	}
+
+	if (iface->conf->chameleon_bss_idle_timeout &&
+	    !eloop_is_timeout_registered(hostapd_chameleon_idle_timeout,
+					 iface, NULL))
+		eloop_register_timeout(CHAMELEON_IDLE_CHECK_INTERVAL, 0,
+				       hostapd_chameleon_idle_timeout, iface,
+				       NULL);
+
+	wpa_printf(MSG_DEBUG, "num_bss: %d", (int) iface->num_bss);
+}
+
+
+/* Completion callback for chameleon_pmk_request() */
+static void hostapd_chameleon_pmk_ready(void *ctx, const u8 *ssid,
+					size_t ssid_len,
+					const char *passphrase, const u8 *psk)
+{
+	struct hostapd_iface *iface = ctx;
+	char txt[HOSTAPD_MAX_SSID_LEN + 1];
+
+	/* With per-STA PSKs the PMK is picked up from the cache on retry */
+	if (psk == NULL || ssid_len > HOSTAPD_MAX_SSID_LEN ||
+	    iface->conf->chameleon_ppsk)
+		return;
+	os_memcpy(txt, ssid, ssid_len);
+	txt[ssid_len] = '\0';
+
+	if (hostapd_get_chameleon_bss(iface, txt) == NULL)
+		hostapd_chameleon_create_bss(iface, txt, passphrase, psk);
+}
+
+
+static struct chameleon_pmk *
+hostapd_chameleon_pmk(struct hostapd_iface *iface)
+{
+	if (iface->chameleon_pmk == NULL)
+		iface->chameleon_pmk =
+			chameleon_pmk_init(iface->conf->chameleon_pmk_threads,
+					   iface->conf->chameleon_pmk_cache_size,
+					   hostapd_chameleon_pmk_ready, iface);
+	return iface->chameleon_pmk;
+}
+
+
+/*
+ * Create a dynamic BSS once its PMK is available. The PMK is taken from the
+ * cache if possible; otherwise it is derived in the background and the BSS
+ * is created from hostapd_chameleon_pmk_ready().
+ */
+static void hostapd_chameleon_add_bss(struct hostapd_iface *iface,
+				      const char *ssid, const char *passwd)
+{
+	struct chameleon_pmk *pmk = hostapd_chameleon_pmk(iface);
+	const u8 *psk;
+
+	if (pmk == NULL) {
+		hostapd_chameleon_create_bss(iface, ssid, passwd, NULL);
+		return;
+	}
+
+	psk = chameleon_pmk_get(pmk, (const u8 *) ssid, os_strlen(ssid),
+				passwd);
+	if (psk) {
+		hostapd_chameleon_create_bss(iface, ssid, passwd, psk);
+		return;
+	}
+
+	if (chameleon_pmk_request(pmk, (const u8 *) ssid, os_strlen(ssid),
+				  passwd) < 0)
+		hostapd_chameleon_create_bss(iface, ssid, passwd, NULL);
+}
+
+
+/*
+ * Start deriving the PMK of a per-STA passphrase for the SSID of the first
+ * BSS so that it is in the cache by the time the 4-way handshake starts.
+ */
+static void hostapd_chameleon_ppsk_prefetch(struct hostapd_iface *iface,
+					    const char *passwd)
+{
+	struct hostapd_ssid *ssid = &iface->bss[0]->conf->ssid;
+	struct chameleon_pmk *pmk = hostapd_chameleon_pmk(iface);
+
+	if (pmk && chameleon_pmk_get(pmk, ssid->ssid, ssid->ssid_len,
+				     passwd) == NULL)
+		chameleon_pmk_request(pmk, ssid->ssid, ssid->ssid_len, passwd);
+}
+
+
+/* Completion callback for lookups started with chameleon_lookup() */
+static void hostapd_chameleon_resolved(void *ctx, const u8 *addr,
+				       const char *ssid, const char *passwd,
+				       const u8 *psk)
+{
+	struct hostapd_iface *iface = ctx;
+
+	if (ssid == NULL || passwd == NULL || iface->chameleon_cache == NULL)
+		return;
+
+	if (chameleon_cache_set(iface->chameleon_cache, addr, ssid,
+				passwd) == NULL)
+		return;
+
+	if (psk && hostapd_chameleon_pmk(iface))
+		chameleon_pmk_set(iface->chameleon_pmk, (const u8 *) ssid,
+				  os_strlen(ssid), passwd, psk);
+
+	if (iface->conf->chameleon_ppsk) {
+		if (!hostapd_ssid_passwd_unknown(ssid, passwd))
+			hostapd_chameleon_ppsk_prefetch(iface, passwd);
+		return;
+	}
+
+	if (hostapd_ssid_passwd_unknown(ssid, passwd) ||
+	    hostapd_get_chameleon_bss(iface, ssid) != NULL)
+		return;
+
+	wpa_printf(MSG_DEBUG, "New a ap for MAC:" MACSTR, MAC2STR(addr));
+	hostapd_chameleon_add_bss(iface, ssid, passwd);
+}
+
+/*
+ * Look up the cached SSID/passphrase for a STA. On a cache miss the
+ * controller is queried in the background and -1 is returned; the frame
+ * that triggered the lookup is not held back waiting for the answer.
+ * Expired entries keep being used until the refresh completes.
+ */
 static int hostapd_get_ssid_passwd(struct hostapd_iface *iface, const u8 *sa, char *ssid, char *passwd)
 {
-    struct sta_ssid *s; 
+    struct chameleon_cache_entry *entry;
 
-    s = iface->ssid_hash[STA_HASH(sa)];
-    while (s != NULL && os_memcmp(s->mac, sa, 6) != 0)
-		s = s->next;
-    
-    os_memset(ssid, 0, MAX_LEN);
-    os_memset(passwd, 0, MAX_LEN);
-    if (s == NULL) {
-        if (hostapd_http_request(sa, ssid, passwd) < 0)
+    if (iface->chameleon == NULL) {
+        iface->chameleon = chameleon_init(iface->conf,
+                                          hostapd_chameleon_resolved, iface);
+        if (iface->chameleon == NULL)
             return -1;
-        if (os_strlen(ssid) == 0 || os_strlen(passwd) == 0)
+    }
+
+    if (iface->chameleon_cache == NULL) {
+        iface->chameleon_cache =
+            chameleon_cache_init(iface->conf->chameleon_cache_size,
+                                 iface->conf->chameleon_cache_ttl,
+                                 iface->conf->chameleon_cache_neg_ttl);
+        if (iface->chameleon_cache == NULL)
             return -1;
-    
-        s = os_zalloc(sizeof(struct sta_ssid));
-        os_memcpy(s->mac, sa, 6);
-        s->ssid = os_strdup(ssid);
-        s->passwd = os_strdup(passwd);
-        s->count = 0; 
-        
-        s->next = iface->ssid_hash[STA_HASH(sa)];
-	    iface->ssid_hash[STA_HASH(sa)] = s;
-   
-        return 0;
     }
-    
-    if (os_strcmp(s->ssid, "0") == 0 && os_strcmp(s->passwd, "0") == 0) {
-        s->count++;
-       if (s->count > 10) { // update sta info
-            s->count = 0;
-            if (hostapd_http_request(sa, ssid, passwd) < 0)
-                goto case1;
-            if (os_strlen(ssid) == 0 || os_strlen(passwd) == 0
-                || (os_strcmp(ssid, "0") == 0 && os_strcmp(passwd, "0") == 0))
-                goto case1;
-            
-            os_free(s->ssid);
-            os_free(s->passwd);
-            s->ssid = os_strdup(ssid);
-            s->passwd = os_strdup(passwd);
-       } 
+
+    entry = chameleon_cache_get(iface->chameleon_cache, sa);
+    if (entry == NULL) {
+        chameleon_lookup(iface->chameleon, sa);
+        return -1;
     }
 
-case1: 
-    os_memcpy(ssid, s->ssid, os_strlen(s->ssid)); 
-    os_memcpy(passwd, s->passwd, os_strlen(s->passwd));
+    if (chameleon_cache_expired(entry))
+        chameleon_lookup(iface->chameleon, sa);
+
+    os_strlcpy(ssid, entry->ssid, MAX_LEN);
+    os_strlcpy(passwd, entry->passwd, MAX_LEN);
 
     return 0;
 }
 
+/**
+ * hostapd_chameleon_sta_psk - Add the controller-provided PSK of a STA
+ * @hapd: BSS the STA is associated with
+ * @sta: STA without per-STA PSKs (sta->psk == %NULL)
+ *
+ * With chameleon_ppsk=1, every STA on a configured BSS can have its own
+ * passphrase from the ChameleonAC controller. The PMK is derived for the
+ * SSID of @hapd and added to sta->psk so that the WPA authenticator tries it
+ * after the configured PSKs. If the passphrase or the PMK is not known yet,
+ * the lookup or derivation is started and the PSK is added when the STA
+ * retries EAPOL-Key msg 2/4.
+ */
+void hostapd_chameleon_sta_psk(struct hostapd_data *hapd, struct sta_info *sta)
+{
+	struct hostapd_iface *iface = hapd->iface;
+	struct hostapd_ssid *ssid = &hapd->conf->ssid;
+	struct hostapd_sta_wpa_psk_short *psk;
+	struct chameleon_pmk *pmk;
+	char name[MAX_LEN], passwd[MAX_LEN];
+	const u8 *val;
+
+	if (hostapd_get_ssid_passwd(iface, sta->addr, name, passwd) < 0 ||
+	    hostapd_ssid_passwd_unknown(name, passwd))
+		return;
+
+	pmk = hostapd_chameleon_pmk(iface);
+	if (pmk == NULL)
+		return;
+	val = chameleon_pmk_get(pmk, ssid->ssid, ssid->ssid_len, passwd);
+	if (val == NULL) {
+		chameleon_pmk_request(pmk, ssid->ssid, ssid->ssid_len, passwd);
+		return;
+	}
+
+	psk = os_zalloc(sizeof(*psk));
+	if (psk == NULL)
+		return;
+	os_memcpy(psk->psk, val, PMK_LEN);
+	sta->psk = psk;
+	wpa_printf(MSG_DEBUG, "ChameleonAC: per-STA PSK for " MACSTR,
+		   MAC2STR(sta->addr));
+}
+
+
+/*
+ * Frame routing with chameleon_ppsk=1: the configured BSSes are used as is
+ * and broadcast Probe Requests only start the lookup of the STA passphrase.
+ */
+static struct hostapd_data *
+hostapd_chameleon_ppsk_bssid(struct hostapd_iface *iface, const u8 *bssid,
+			     const u8 *sa)
+{
+	char ssid[MAX_LEN], passwd[MAX_LEN];
+	size_t i;
+
+	if (is_broadcast_ether_addr(bssid)) {
+		hostapd_get_ssid_passwd(iface, sa, ssid, passwd);
+		return HAPD_BROADCAST;
+	}
+
+	for (i = 0; i < iface->num_bss; i++) {
+		if (os_memcmp(bssid, iface->bss[i]->own_addr, ETH_ALEN) == 0)
+			return iface->bss[i];
+	}
+
+	return NULL;
+}
+
+
 static struct hostapd_data * get_hapd_bssid(struct hostapd_iface *iface,
 					    const u8 *bssid, const u8 *sa)
 {
-    size_t i;
-	u8 ssid_u8[MAX_LEN];
-	struct hostapd_config *conf;
+	struct hostapd_data *hapd;
     char ssid[MAX_LEN], passwd[MAX_LEN];
-    size_t index;
     
 	if (bssid == NULL)
 		return NULL;
+
+	if (iface->conf->chameleon_ppsk)
+		return hostapd_chameleon_ppsk_bssid(iface, bssid, sa);
     
     //如果bss个数小于两个，返回
     if (iface->num_bss < 2) {
@@ -1020,46 +1428,19 @@ static struct hostapd_data * get_hapd_bssid(struct hostapd_iface *iface,
         //根据mac地址向服务器请求对应的ssid和passwd
         if (hostapd_get_ssid_passwd(iface, sa, ssid, passwd) < 0)
             return HAPD_BROADCAST;
-        if (os_strcmp(ssid, "0") == 0 && os_strcmp(passwd, "0") == 0)
+        if (hostapd_ssid_passwd_unknown(ssid, passwd))
             return HAPD_BROADCAST;
         
-        os_memcpy(ssid_u8, ssid, os_strlen(ssid));
-        for (i = 2; i < iface->num_bss; ++i) { //查找是否创建对应的bss
-            if (os_memcmp(ssid_u8, iface->bss[i]->conf->ssid.ssid, iface->bss[i]->conf->ssid.ssid_len) == 0) {
-                wpa_printf(MSG_DEBUG, "Already created AP for : %s\n", ssid);
-                return HAPD_BROADCAST;
-            }
+        //查找是否创建对应的bss
+        hapd = hostapd_get_chameleon_bss(iface, ssid);
+        if (hapd != NULL) {
+            wpa_printf(MSG_DEBUG, "Already created AP for : %s\n", ssid);
+            os_get_reltime(&hapd->chameleon_used);
+            return HAPD_BROADCAST;
         }
         
     	wpa_printf(MSG_DEBUG, "New a ap for MAC:" MACSTR "\n", MAC2STR(sa));
-        wpa_printf(MSG_DEBUG, "ssid=%s, passwd=%s\n", ssid, passwd); 
-
-		conf = iface->interfaces->config_read_cb(iface->config_fname);
-		conf->bss[0]->ssid.ssid_len = os_strlen(ssid);
-        os_memcpy(conf->bss[0]->ssid.ssid, ssid, conf->bss[0]->ssid.ssid_len);
-
-        os_free(conf->bss[0]->ssid.wpa_passphrase);
-        conf->bss[0]->ssid.wpa_passphrase = os_strdup(passwd);
-
-        hostapd_set_security_params(conf->bss[0], 1);
-
-		iface->num_bss++;
-		iface->bss = (struct hostapd_data **)realloc(iface->bss, 
-						iface->num_bss * sizeof(struct hostapd_data *));
-		index = iface->num_bss - 1;
-		
-		iface->bss[index] = hostapd_alloc_bss_data(iface, conf,	conf->bss[0]);
-
-		iface->bss[index]->driver = iface->bss[0]->driver;
-		iface->bss[index]->drv_priv = iface->bss[0]->drv_priv;
-		
-        os_memcpy(iface->bss[index]->own_addr, iface->bss[0]->own_addr, ETH_ALEN);
-        
-	    hostapd_setup_wpa_psk(iface->bss[index]->conf);
-        if (hostapd_setup_new_bss(iface->bss[index]) < 0)
-			return HAPD_BROADCAST;
-
-		wpa_printf(MSG_DEBUG, "num_bss: %d\n", (int)iface->num_bss); 
+        hostapd_chameleon_add_bss(iface, ssid, passwd);
         
         return HAPD_BROADCAST;
     }
@@ -1076,15 +1457,15 @@ static struct hostapd_data * get_hapd_bssid(struct hostapd_iface *iface,
     
     if (hostapd_get_ssid_passwd(iface, sa, ssid, passwd) < 0)
         return NULL;
-    if (os_strcmp(ssid, "0") == 0 && os_strcmp(passwd, "0") == 0)
+    if (hostapd_ssid_passwd_unknown(ssid, passwd))
         return NULL;
     
-    os_memcpy(ssid_u8, ssid, os_strlen(ssid));
-    for (i = 2; i < iface->num_bss; ++i) { //查找对应的bss
-        if (os_memcmp(ssid_u8, iface->bss[i]->conf->ssid.ssid, iface->bss[i]->conf->ssid.ssid_len) == 0) {
-            wpa_printf(MSG_DEBUG, "Find sta : %s\n", ssid);
-            return iface->bss[i];
-        }
+    //查找对应的bss
+    hapd = hostapd_get_chameleon_bss(iface, ssid);
+    if (hapd != NULL) {
+        wpa_printf(MSG_DEBUG, "Find sta : %s\n", ssid);
+        os_get_reltime(&hapd->chameleon_used);
+        return hapd;
     }
 	   
 	return NULL; /* If ends here, it means there's an anomaly */
@@ -76,147 +76,401 @@ static void set_user_methods(struct hostapd_eap_user *user, const char *methods)
 }
 
 
-static int get_user_cb(void *ctx, int argc, char *argv[], char *col[])
+/**
+ * EAP_USER_DB_CACHE_SIZE - Maximum number of cached SQLite lookups
+ */
+#define EAP_USER_DB_CACHE_SIZE 256
+
+/**
+ * EAP_USER_DB_CACHE_TTL - Time in seconds a SQLite lookup is reused
+ *
+ * Changes to the database are seen by new authentications after at most this
+ * long. Failed lookups are cached as well so that unknown identities do not
+ * query the database on every EAP round.
+ */
+#define EAP_USER_DB_CACHE_TTL 30
+
+#define EAP_USER_DB_HASH_SIZE 256
+
+/**
+ * EAP_USER_DB_BUSY_TIMEOUT_MS - Time to wait for a locked database
+ *
+ * The RADIUS server authlog writes to the same file from its own thread.
+ */
+#define EAP_USER_DB_BUSY_TIMEOUT_MS 1000
+
+struct eap_user_db_entry {
+	struct eap_user_db_entry *hnext;
+	struct dl_list list; /* LRU list (most recently used first) */
+	u8 *identity;
+	size_t identity_len;
+	int phase2;
+	struct os_reltime expires;
+	struct hostapd_eap_user *user; /* NULL if the identity was not found */
+};
+
+struct eap_user_db {
+	sqlite3 *db;
+	sqlite3_stmt *user_stmt;
+	sqlite3_stmt *wildcard_stmt;
+	struct eap_user_db_entry *hash[EAP_USER_DB_HASH_SIZE];
+	struct dl_list lru; /* struct eap_user_db_entry */
+	unsigned int num_entries;
+};
+
+
+static void eap_user_db_free_user(struct hostapd_eap_user *user)
+{
+	if (user == NULL)
+		return;
+	os_free(user->identity);
+	bin_clear_free(user->password, user->password_len);
+	os_free(user);
+}
+
+
+static void eap_user_db_entry_free(struct eap_user_db *db,
+				   struct eap_user_db_entry *entry)
+{
+	struct eap_user_db_entry **pos;
+
+	pos = &db->hash[hostapd_eap_user_hash(entry->identity,
+					      entry->identity_len,
+					      entry->phase2) %
+			EAP_USER_DB_HASH_SIZE];
+	while (*pos && *pos != entry)
+		pos = &(*pos)->hnext;
+	if (*pos)
+		*pos = entry->hnext;
+	dl_list_del(&entry->list);
+	db->num_entries--;
+	eap_user_db_free_user(entry->user);
+	os_free(entry->identity);
+	os_free(entry);
+}
+
+
+static struct eap_user_db * eap_user_db_open(const char *fname)
 {
-	struct hostapd_eap_user *user = ctx;
-	int i;
-
-	for (i = 0; i < argc; i++) {
-		if (os_strcmp(col[i], "password") == 0 && argv[i]) {
-			bin_clear_free(user->password, user->password_len);
-			user->password_len = os_strlen(argv[i]);
-			user->password = (u8 *) os_strdup(argv[i]);
-			user->next = (void *) 1;
-		} else if (os_strcmp(col[i], "methods") == 0 && argv[i]) {
-			set_user_methods(user, argv[i]);
-		} else if (os_strcmp(col[i], "remediation") == 0 && argv[i]) {
-			user->remediation = strlen(argv[i]) > 0;
+	struct eap_user_db *db;
+
+	db = os_zalloc(sizeof(*db));
+	if (db == NULL)
+		return NULL;
+	dl_list_init(&db->lru);
+
+	if (sqlite3_open(fname, &db->db)) {
+		wpa_printf(MSG_INFO, "DB: Failed to open database %s: %s",
+			   fname, sqlite3_errmsg(db->db));
+		sqlite3_close(db->db);
+		os_free(db);
+		return NULL;
+	}
+	sqlite3_busy_timeout(db->db, EAP_USER_DB_BUSY_TIMEOUT_MS);
+
+	if (sqlite3_prepare_v2(db->db,
+			       "SELECT * FROM users WHERE identity=? AND phase2=?;",
+			       -1, &db->user_stmt, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db->db,
+			       "SELECT identity,methods FROM wildcards;",
+			       -1, &db->wildcard_stmt, NULL) != SQLITE_OK) {
+		wpa_printf(MSG_INFO, "DB: Failed to prepare queries for %s: %s",
+			   fname, sqlite3_errmsg(db->db));
+		sqlite3_finalize(db->user_stmt);
+		sqlite3_close(db->db);
+		os_free(db);
+		return NULL;
+	}
+
+	return db;
+}
+
+
+/**
+ * hostapd_eap_user_db_deinit - Close the EAP user database of a BSS
+ * @hapd: BSS data
+ */
+void hostapd_eap_user_db_deinit(struct hostapd_data *hapd)
+{
+	struct eap_user_db *db = hapd->eap_user_db;
+	struct eap_user_db_entry *entry;
+
+	if (db == NULL)
+		return;
+	hapd->eap_user_db = NULL;
+
+	while ((entry = dl_list_first(&db->lru, struct eap_user_db_entry,
+				      list)))
+		eap_user_db_entry_free(db, entry);
+	sqlite3_finalize(db->user_stmt);
+	sqlite3_finalize(db->wildcard_stmt);
+	sqlite3_close(db->db);
+	os_free(db);
+}
+
+
+/* Returns 0 if a row was found, 1 if not, -1 on database error */
+static int eap_user_db_query_user(struct eap_user_db *db,
+				  struct hostapd_eap_user *user, int phase2)
+{
+	sqlite3_stmt *stmt = db->user_stmt;
+	const char *col, *val;
+	int i, res, found = 0;
+
+	sqlite3_bind_text(stmt, 1, (const char *) user->identity,
+			  user->identity_len, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, 2, phase2);
+
+	while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
+		for (i = 0; i < sqlite3_column_count(stmt); i++) {
+			col = sqlite3_column_name(stmt, i);
+			val = (const char *) sqlite3_column_text(stmt, i);
+			if (col == NULL || val == NULL)
+				continue;
+			if (os_strcmp(col, "password") == 0) {
+				bin_clear_free(user->password,
+					       user->password_len);
+				user->password_len = os_strlen(val);
+				user->password = (u8 *) os_strdup(val);
+				found = 1;
+			} else if (os_strcmp(col, "methods") == 0) {
+				set_user_methods(user, val);
+			} else if (os_strcmp(col, "remediation") == 0) {
+				user->remediation = os_strlen(val) > 0;
+			}
 		}
 	}
 
-	return 0;
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	if (res != SQLITE_DONE) {
+		wpa_printf(MSG_DEBUG, "DB: Failed to complete SQL operation: %s",
+			   sqlite3_errmsg(db->db));
+		return -1;
+	}
+
+	return found ? 0 : 1;
 }
 
 
-static int get_wildcard_cb(void *ctx, int argc, char *argv[], char *col[])
+/* Returns 0 if a prefix matched, 1 if not, -1 on database error */
+static int eap_user_db_query_wildcard(struct eap_user_db *db,
+				      struct hostapd_eap_user *user)
 {
-	struct hostapd_eap_user *user = ctx;
-	int i, id = -1, methods = -1;
-	size_t len;
-
-	for (i = 0; i < argc; i++) {
-		if (os_strcmp(col[i], "identity") == 0 && argv[i])
-			id = i;
-		else if (os_strcmp(col[i], "methods") == 0 && argv[i])
-			methods = i;
+	sqlite3_stmt *stmt = db->wildcard_stmt;
+	const char *id, *methods;
+	u8 *prefix = NULL;
+	size_t len, prefix_len = 0;
+	int res;
+
+	while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
+		id = (const char *) sqlite3_column_text(stmt, 0);
+		methods = (const char *) sqlite3_column_text(stmt, 1);
+		if (id == NULL || methods == NULL)
+			continue;
+
+		/* The longest matching prefix wins */
+		len = os_strlen(id);
+		if (len > user->identity_len ||
+		    os_memcmp(id, user->identity, len) != 0 ||
+		    (prefix && len <= prefix_len))
+			continue;
+		os_free(prefix);
+		prefix = (u8 *) os_strdup(id);
+		if (prefix == NULL)
+			break;
+		prefix_len = len;
+		set_user_methods(user, methods);
 	}
 
-	if (id < 0 || methods < 0)
-		return 0;
-
-	len = os_strlen(argv[id]);
-	if (len <= user->identity_len &&
-	    os_memcmp(argv[id], user->identity, len) == 0 &&
-	    (user->password == NULL || len > user->password_len)) {
-		bin_clear_free(user->password, user->password_len);
-		user->password_len = os_strlen(argv[id]);
-		user->password = (u8 *) os_strdup(argv[id]);
-		user->next = (void *) 1;
-		set_user_methods(user, argv[methods]);
+	sqlite3_reset(stmt);
+	if (res != SQLITE_DONE && res != SQLITE_ROW) {
+		wpa_printf(MSG_DEBUG, "DB: Failed to complete SQL operation: %s",
+			   sqlite3_errmsg(db->db));
+		os_free(prefix);
+		return -1;
 	}
+	if (prefix == NULL)
+		return 1;
 
+	os_free(user->identity);
+	user->identity = prefix;
+	user->identity_len = prefix_len;
 	return 0;
 }
 
 
+static struct hostapd_eap_user *
+eap_user_db_dup(const struct hostapd_eap_user *src)
+{
+	struct hostapd_eap_user *user;
+
+	user = os_malloc(sizeof(*user));
+	if (user == NULL)
+		return NULL;
+	os_memcpy(user, src, sizeof(*user));
+	user->next = user->hnext = NULL;
+	user->identity = (u8 *) dup_binstr(src->identity, src->identity_len);
+	user->password = src->password ?
+		(u8 *) dup_binstr(src->password, src->password_len) : NULL;
+	if (user->identity == NULL || (src->password && !user->password)) {
+		eap_user_db_free_user(user);
+		return NULL;
+	}
+	user->owned = 1;
+
+	return user;
+}
+
+
 static const struct hostapd_eap_user *
 eap_user_sqlite_get(struct hostapd_data *hapd, const u8 *identity,
 		    size_t identity_len, int phase2)
 {
-	sqlite3 *db;
-	struct hostapd_eap_user *user = NULL;
-	char id_str[256], cmd[300];
+	struct eap_user_db *db = hapd->eap_user_db;
+	struct eap_user_db_entry *entry, **pos;
+	struct hostapd_eap_user *user;
+	struct os_reltime now;
 	size_t i;
+	int res;
 
-	if (identity_len >= sizeof(id_str))
-		return NULL;
-	os_memcpy(id_str, identity, identity_len);
-	id_str[identity_len] = '\0';
+	/* Identities are compared as text in the database */
 	for (i = 0; i < identity_len; i++) {
-		if (id_str[i] >= 'a' && id_str[i] <= 'z')
-			continue;
-		if (id_str[i] >= 'A' && id_str[i] <= 'Z')
-			continue;
-		if (id_str[i] >= '0' && id_str[i] <= '9')
-			continue;
-		if (id_str[i] == '-' || id_str[i] == '_' || id_str[i] == '.' ||
-		    id_str[i] == ',' || id_str[i] == '@' || id_str[i] == '\\' ||
-		    id_str[i] == '!' || id_str[i] == '#' || id_str[i] == '%' ||
-		    id_str[i] == '=' || id_str[i] == ' ')
-			continue;
-		wpa_printf(MSG_INFO, "DB: Unsupported character in identity");
-		return NULL;
+		if (identity[i] == '\0') {
+			wpa_printf(MSG_INFO,
+				   "DB: Unsupported character in identity");
+			return NULL;
+		}
 	}
 
-	bin_clear_free(hapd->tmp_eap_user.identity,
-		       hapd->tmp_eap_user.identity_len);
-	bin_clear_free(hapd->tmp_eap_user.password,
-		       hapd->tmp_eap_user.password_len);
-	os_memset(&hapd->tmp_eap_user, 0, sizeof(hapd->tmp_eap_user));
-	hapd->tmp_eap_user.phase2 = phase2;
-	hapd->tmp_eap_user.identity = os_zalloc(identity_len + 1);
-	if (hapd->tmp_eap_user.identity == NULL)
-		return NULL;
-	os_memcpy(hapd->tmp_eap_user.identity, identity, identity_len);
+	if (db == NULL) {
+		db = eap_user_db_open(hapd->conf->eap_user_sqlite);
+		if (db == NULL)
+			return NULL;
+		hapd->eap_user_db = db;
+	}
 
-	if (sqlite3_open(hapd->conf->eap_user_sqlite, &db)) {
-		wpa_printf(MSG_INFO, "DB: Failed to open database %s: %s",
-			   hapd->conf->eap_user_sqlite, sqlite3_errmsg(db));
-		sqlite3_close(db);
+	os_get_reltime(&now);
+	pos = &db->hash[hostapd_eap_user_hash(identity, identity_len, phase2) %
+			EAP_USER_DB_HASH_SIZE];
+	for (entry = *pos; entry; entry = entry->hnext) {
+		if (entry->phase2 == phase2 &&
+		    entry->identity_len == identity_len &&
+		    os_memcmp(entry->identity, identity, identity_len) == 0)
+			break;
+	}
+	if (entry && os_reltime_before(&now, &entry->expires)) {
+		dl_list_del(&entry->list);
+		dl_list_add(&db->lru, &entry->list);
+		return entry->user ? eap_user_db_dup(entry->user) : NULL;
+	}
+	if (entry)
+		eap_user_db_entry_free(db, entry);
+
+	user = os_zalloc(sizeof(*user));
+	if (user == NULL)
+		return NULL;
+	user->phase2 = phase2;
+	user->identity = os_zalloc(identity_len + 1);
+	if (user->identity == NULL) {
+		os_free(user);
 		return NULL;
 	}
+	os_memcpy(user->identity, identity, identity_len);
+	user->identity_len = identity_len;
+
+	wpa_printf(MSG_DEBUG, "DB: Look up %s identity in users%s",
+		   phase2 ? "phase 2" : "phase 1",
+		   phase2 ? "" : " and wildcards");
+	res = eap_user_db_query_user(db, user, phase2);
+	if (res == 1 && !phase2)
+		res = eap_user_db_query_wildcard(db, user);
+	if (res < 0) {
+		/* Not cached; the next lookup tries again */
+		eap_user_db_free_user(user);
+		return NULL;
+	}
+	if (res > 0) {
+		eap_user_db_free_user(user);
+		user = NULL;
+	}
 
-	os_snprintf(cmd, sizeof(cmd),
-		    "SELECT * FROM users WHERE identity='%s' AND phase2=%d;",
-		    id_str, phase2);
-	wpa_printf(MSG_DEBUG, "DB: %s", cmd);
-	if (sqlite3_exec(db, cmd, get_user_cb, &hapd->tmp_eap_user, NULL) !=
-	    SQLITE_OK) {
-		wpa_printf(MSG_DEBUG, "DB: Failed to complete SQL operation");
-	} else if (hapd->tmp_eap_user.next)
-		user = &hapd->tmp_eap_user;
-
-	if (user == NULL && !phase2) {
-		os_snprintf(cmd, sizeof(cmd),
-			    "SELECT identity,methods FROM wildcards;");
-		wpa_printf(MSG_DEBUG, "DB: %s", cmd);
-		if (sqlite3_exec(db, cmd, get_wildcard_cb, &hapd->tmp_eap_user,
-				 NULL) != SQLITE_OK) {
-			wpa_printf(MSG_DEBUG, "DB: Failed to complete SQL "
-				   "operation");
-		} else if (hapd->tmp_eap_user.next) {
-			user = &hapd->tmp_eap_user;
-			os_free(user->identity);
-			user->identity = user->password;
-			user->identity_len = user->password_len;
-			user->password = NULL;
-			user->password_len = 0;
-		}
+	if (db->num_entries >= EAP_USER_DB_CACHE_SIZE) {
+		entry = dl_list_last(&db->lru, struct eap_user_db_entry, list);
+		eap_user_db_entry_free(db, entry);
+	}
+	entry = os_zalloc(sizeof(*entry));
+	if (entry == NULL ||
+	    (entry->identity = (u8 *) dup_binstr(identity, identity_len)) ==
+	    NULL) {
+		os_free(entry);
+		if (user)
+			user->owned = 1;
+		return user;
 	}
+	entry->identity_len = identity_len;
+	entry->phase2 = phase2;
+	entry->user = user;
+	entry->expires = now;
+	entry->expires.sec += EAP_USER_DB_CACHE_TTL;
+	pos = &db->hash[hostapd_eap_user_hash(identity, identity_len, phase2) %
+			EAP_USER_DB_HASH_SIZE];
+	entry->hnext = *pos;
+	*pos = entry;
+	dl_list_add(&db->lru, &entry->list);
+	db->num_entries++;
+
+	return user ? eap_user_db_dup(user) : NULL;
+}
 
-	sqlite3_close(db);
+#endif /* CONFIG_SQLITE */
 
-	return user;
-}
 
+/**
+ * hostapd_put_eap_user - Release a result of hostapd_get_eap_user()
+ * @hapd: BSS data
+ * @user: Return value of hostapd_get_eap_user() or %NULL
+ *
+ * Entries from the configuration are left alone; entries that were looked up
+ * from the SQLite database are owned by the caller and freed here.
+ */
+void hostapd_put_eap_user(struct hostapd_data *hapd,
+			  const struct hostapd_eap_user *user)
+{
+#ifdef CONFIG_SQLITE
+	if (user && user->owned)
+		eap_user_db_free_user((struct hostapd_eap_user *) user);
 #endif /* CONFIG_SQLITE */
+}
+
+
+static int hostapd_eap_user_match(const struct hostapd_eap_user *user,
+				  const u8 *identity, size_t identity_len,
+				  int phase2)
+{
+	if (!phase2 && user->identity == NULL) {
+		/* Wildcard match */
+		return 1;
+	}
+
+	if (user->phase2 == !!phase2 && user->wildcard_prefix &&
+	    identity_len >= user->identity_len &&
+	    os_memcmp(user->identity, identity, user->identity_len) == 0) {
+		/* Wildcard prefix match */
+		return 1;
+	}
+
+	return user->phase2 == !!phase2 &&
+		user->identity_len == identity_len &&
+		os_memcmp(user->identity, identity, identity_len) == 0;
+}
 
 
 const struct hostapd_eap_user *
 hostapd_get_eap_user(struct hostapd_data *hapd, const u8 *identity,
 		     size_t identity_len, int phase2)
 {
-	const struct hostapd_bss_config *conf = hapd->conf;
+	struct hostapd_bss_config *conf = hapd->conf;
 	struct hostapd_eap_user *user = conf->eap_user;
 
 #ifdef CONFIG_WPS
@@ -242,25 +496,35 @@ hostapd_get_eap_user(struct hostapd_data *hapd, const u8 *identity,
 	}
 #endif /* CONFIG_WPS */
 
-	while (user) {
-		if (!phase2 && user->identity == NULL) {
-			/* Wildcard match */
-			break;
-		}
-
-		if (user->phase2 == !!phase2 && user->wildcard_prefix &&
-		    identity_len >= user->identity_len &&
-		    os_memcmp(user->identity, identity, user->identity_len) ==
-		    0) {
-			/* Wildcard prefix match */
-			break;
+	if (conf->eap_user && conf->eap_user_indexed != conf->eap_user)
+		hostapd_eap_user_index(conf);
+
+	if (conf->eap_user_hash) {
+		struct hostapd_eap_user *exact;
+
+		exact = conf->eap_user_hash[
+			hostapd_eap_user_hash(identity, identity_len, phase2) &
+			(conf->eap_user_hash_size - 1)];
+		while (exact &&
+		       !hostapd_eap_user_match(exact, identity, identity_len,
+					       phase2))
+			exact = exact->hnext;
+
+		/* A wildcard line before the exact match takes precedence */
+		for (user = conf->eap_user_wildcards;
+		     user && (exact == NULL || user->pos < exact->pos);
+		     user = user->hnext) {
+			if (hostapd_eap_user_match(user, identity,
+						   identity_len, phase2))
+				break;
 		}
-
-		if (user->phase2 == !!phase2 &&
-		    user->identity_len == identity_len &&
-		    os_memcmp(user->identity, identity, identity_len) == 0)
-			break;
-		user = user->next;
+		if (user == NULL || (exact && user->pos > exact->pos))
+			user = exact;
+	} else {
+		while (user &&
+		       !hostapd_eap_user_match(user, identity, identity_len,
+					       phase2))
+			user = user->next;
 	}
 
 #ifdef CONFIG_SQLITE
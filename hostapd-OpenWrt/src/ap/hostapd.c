@@ -41,6 +41,9 @@
 #include "x_snoop.h"
 #include "dhcp_snoop.h"
 #include "ndisc_snoop.h"
+#include "chameleon.h"
+#include "chameleon_cache.h"
+#include "chameleon_pmk.h"
 
 
 static int hostapd_flush_old_stations(struct hostapd_data *hapd, u16 reason);
@@ -75,6 +78,11 @@ static void hostapd_reload_bss(struct hostapd_data *hapd)
 	radius_client_reconfig(hapd->radius, hapd->conf->radius);
 #endif /* CONFIG_NO_RADIUS */
 
+#ifdef CONFIG_SQLITE
+	/* eap_user_sqlite may have changed; reopen it on the next lookup */
+	hostapd_eap_user_db_deinit(hapd);
+#endif /* CONFIG_SQLITE */
+
 	ssid = &hapd->conf->ssid;
 
 	hostapd_set_freq(hapd, hapd->iconf->hw_mode, hapd->iface->freq,
@@ -92,6 +100,7 @@ static void hostapd_reload_bss(struct hostapd_data *hapd)
 		 * Force PSK to be derived again since SSID or passphrase may
 		 * have changed.
 		 */
+		hostapd_wpa_psk_index_free(&hapd->conf->ssid);
 		hostapd_config_clear_wpa_psk(&hapd->conf->ssid.wpa_psk);
 	}
 	if (hostapd_setup_wpa_psk(hapd->conf)) {
@@ -180,10 +189,15 @@ int hostapd_reload_config(struct hostapd_iface *iface)
 	if (newconf == NULL)
 		return -1;
 
+	/* Dynamic BSSes are not part of the new configuration */
+	hostapd_chameleon_flush_bss(iface);
 	hostapd_clear_old(iface);
 
 	oldconf = hapd->iconf;
 	iface->conf = newconf;
+	iface->bss_alloc = 0;
+	hostapd_config_free_bss(iface->chameleon_template);
+	iface->chameleon_template = NULL;
 
 	if (iface->conf->channel)
 		iface->freq = hostapd_hw_get_freq(hapd, iface->conf->channel);
@@ -324,10 +338,7 @@ static void hostapd_free_hapd_data(struct hostapd_data *hapd)
 	x_snoop_deinit(hapd);
 
 #ifdef CONFIG_SQLITE
-	bin_clear_free(hapd->tmp_eap_user.identity,
-		       hapd->tmp_eap_user.identity_len);
-	bin_clear_free(hapd->tmp_eap_user.password,
-		       hapd->tmp_eap_user.password_len);
+	hostapd_eap_user_db_deinit(hapd);
 #endif /* CONFIG_SQLITE */
 
 #ifdef CONFIG_MESH
@@ -387,6 +398,14 @@ static void hostapd_cleanup_iface(struct hostapd_iface *iface)
 	eloop_cancel_timeout(channel_list_update_timeout, iface, NULL);
 
 	hostapd_cleanup_iface_partial(iface);
+	chameleon_deinit(iface->chameleon);
+	iface->chameleon = NULL;
+	chameleon_cache_deinit(iface->chameleon_cache);
+	iface->chameleon_cache = NULL;
+	chameleon_pmk_deinit(iface->chameleon_pmk);
+	iface->chameleon_pmk = NULL;
+	hostapd_config_free_bss(iface->chameleon_template);
+	iface->chameleon_template = NULL;
 	hostapd_config_free(iface->conf);
 	iface->conf = NULL;
 
@@ -1650,6 +1669,7 @@ void hostapd_interface_deinit(struct hostapd_iface *iface)
 	eloop_cancel_timeout(channel_list_update_timeout, iface, NULL);
 	iface->wait_channel_update = 0;
 
+	hostapd_chameleon_flush_bss(iface);
 	for (j = iface->num_bss - 1; j >= 0; j--)
 		hostapd_bss_deinit(iface->bss[j]);
 }
@@ -1820,6 +1840,7 @@ hostapd_interface_init_bss(struct hapd_interfaces *interfaces, const char *phy,
 			hostapd_config_free(conf);
 			return NULL;
 		}
+		iface->bss_alloc = 0;
 		bss = iface->conf->bss[iface->conf->num_bss] = conf->bss[0];
 		iface->conf->num_bss++;
 
@@ -2307,6 +2328,60 @@ static int hostapd_remove_bss(struct hostapd_iface *iface, unsigned int idx)
 }
 
 
+/**
+ * hostapd_remove_shared_bss - Remove a BSS that uses the interface of bss[0]
+ * @hapd: BSS to remove; must not be bss[0]
+ * Returns: 0 on success, -1 on failure
+ *
+ * Unlike hostapd_remove_bss(), this does not flush the driver station table
+ * or send a broadcast Deauthentication frame since that would disconnect the
+ * STAs of all BSSes on the shared interface. Only the STAs of @hapd are
+ * deauthenticated. @hapd and its configuration are freed.
+ */
+int hostapd_remove_shared_bss(struct hostapd_data *hapd)
+{
+	struct hostapd_iface *iface = hapd->iface;
+	struct sta_info *sta;
+	size_t i, j;
+
+	for (i = 1; i < iface->num_bss; i++) {
+		if (iface->bss[i] == hapd)
+			break;
+	}
+	if (i == iface->num_bss)
+		return -1;
+
+	wpa_printf(MSG_INFO, "Remove BSS '%s'",
+		   wpa_ssid_txt(hapd->conf->ssid.ssid,
+				hapd->conf->ssid.ssid_len));
+
+	for (sta = hapd->sta_list; sta; sta = sta->next)
+		hostapd_drv_sta_deauth(hapd, sta->addr,
+				       WLAN_REASON_DEAUTH_LEAVING);
+	hostapd_free_stas(hapd);
+	hostapd_cleanup(hapd);
+
+	for (j = 0; j < iface->conf->num_bss; j++) {
+		if (iface->conf->bss[j] != hapd->conf)
+			continue;
+		hostapd_config_free_bss(hapd->conf);
+		iface->conf->num_bss--;
+		for (; j < iface->conf->num_bss; j++)
+			iface->conf->bss[j] = iface->conf->bss[j + 1];
+		break;
+	}
+	hapd->conf = NULL;
+	wpa_printf(MSG_DEBUG, "%s: free hapd %p", __func__, hapd);
+	os_free(hapd);
+
+	iface->num_bss--;
+	for (; i < iface->num_bss; i++)
+		iface->bss[i] = iface->bss[i + 1];
+
+	return 0;
+}
+
+
 int hostapd_remove_iface(struct hapd_interfaces *interfaces, char *buf)
 {
 	struct hostapd_iface *hapd_iface;
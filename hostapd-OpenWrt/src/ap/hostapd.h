@@ -22,6 +22,10 @@ struct hostapd_data;
 struct sta_info;
 struct ieee80211_ht_capabilities;
 struct full_dynamic_vlan;
+struct chameleon;
+struct chameleon_cache;
+struct chameleon_pmk;
+struct eap_user_db;
 enum wps_event;
 union wps_event_data;
 #ifdef CONFIG_MESH
@@ -109,9 +113,14 @@ struct hostapd_data {
 	unsigned int started:1;
 	unsigned int disabled:1;
 	unsigned int reenable_beacon:1;
+	unsigned int chameleon:1; /* created at runtime for ChameleonAC */
 
 	u8 own_addr[ETH_ALEN];
 
+	/* next entry in hostapd_iface::chameleon_bss_hash list */
+	struct hostapd_data *chameleon_hnext;
+	struct os_reltime chameleon_used; /* last frame routed to this BSS */
+
 	int num_sta; /* number of entries in sta_list */
 	struct sta_info *sta_list; /* STA info list head */
 #define STA_HASH_SIZE 256
@@ -260,7 +269,7 @@ struct hostapd_data {
 #endif /* CONFIG_MESH */
 
 #ifdef CONFIG_SQLITE
-	struct hostapd_eap_user tmp_eap_user;
+	struct eap_user_db *eap_user_db;
 #endif /* CONFIG_SQLITE */
 
 #ifdef CONFIG_SAE
@@ -277,14 +286,6 @@ struct hostapd_data {
 #endif /* CONFIG_TESTING_OPTIONS */
 };
 
-struct sta_ssid {
-    u8 mac[6];
-    char *ssid;
-    char *passwd;
-    int count;
-    struct sta_ssid *next;
-};
-
 /**
  * struct hostapd_iface - hostapd per-interface data structure
  */
@@ -313,6 +314,8 @@ struct hostapd_iface {
 
 	size_t num_bss;
 	struct hostapd_data **bss;
+	size_t bss_alloc; /* allocated entries in bss and conf->bss (0 = only
+			   * num_bss entries) */
 
 	unsigned int wait_channel_update:1;
 	unsigned int cac_started:1;
@@ -329,7 +332,15 @@ struct hostapd_iface {
 
 	u64 drv_flags;
 
-    struct sta_ssid *ssid_hash[STA_HASH_SIZE];
+	struct chameleon *chameleon; /* ChameleonAC controller client */
+	struct chameleon_cache *chameleon_cache; /* per-STA SSID/passphrase */
+	struct chameleon_pmk *chameleon_pmk; /* PMK derivation and cache */
+#define CHAMELEON_BSS_HASH_SIZE 64
+	/* dynamically created BSSes indexed by SSID */
+	struct hostapd_data *chameleon_bss_hash[CHAMELEON_BSS_HASH_SIZE];
+	/* parsed configuration that dynamic BSSes are copied from */
+	struct hostapd_bss_config *chameleon_template;
+	unsigned int chameleon_num_bss; /* number of dynamic BSSes */
 
 	/* SMPS modes supported by the driver (WPA_DRIVER_SMPS_MODE_*) */
 	unsigned int smps_modes;
@@ -441,6 +452,7 @@ int hostapd_reload_iface(struct hostapd_iface *hapd_iface);
 int hostapd_disable_iface(struct hostapd_iface *hapd_iface);
 int hostapd_add_iface(struct hapd_interfaces *ifaces, char *buf);
 int hostapd_remove_iface(struct hapd_interfaces *ifaces, char *buf);
+int hostapd_remove_shared_bss(struct hostapd_data *hapd);
 void hostapd_channel_list_updated(struct hostapd_iface *iface, int initiator);
 void hostapd_set_state(struct hostapd_iface *iface, enum hostapd_iface_state s);
 const char * hostapd_state_text(enum hostapd_iface_state s);
@@ -472,9 +484,28 @@ int hostapd_probe_req_rx(struct hostapd_data *hapd, const u8 *sa, const u8 *da,
 			 int ssi_signal);
 void hostapd_event_ch_switch(struct hostapd_data *hapd, int freq, int ht,
 			     int offset, int width, int cf1, int cf2);
+#if defined(HOSTAPD) && defined(NEED_AP_MLME)
+void hostapd_chameleon_flush_bss(struct hostapd_iface *iface);
+void hostapd_chameleon_sta_psk(struct hostapd_data *hapd,
+			       struct sta_info *sta);
+#else /* HOSTAPD && NEED_AP_MLME */
+static inline void hostapd_chameleon_flush_bss(struct hostapd_iface *iface)
+{
+}
+
+static inline void hostapd_chameleon_sta_psk(struct hostapd_data *hapd,
+					     struct sta_info *sta)
+{
+}
+#endif /* HOSTAPD && NEED_AP_MLME */
 
 const struct hostapd_eap_user *
 hostapd_get_eap_user(struct hostapd_data *hapd, const u8 *identity,
 		     size_t identity_len, int phase2);
+void hostapd_put_eap_user(struct hostapd_data *hapd,
+			  const struct hostapd_eap_user *user);
+#ifdef CONFIG_SQLITE
+void hostapd_eap_user_db_deinit(struct hostapd_data *hapd);
+#endif /* CONFIG_SQLITE */
 
 #endif /* HOSTAPD_H */
@@ -45,6 +45,7 @@ struct hostapd_cached_radius_acl {
 struct hostapd_acl_query_data {
 	struct os_reltime timestamp;
 	u8 radius_id;
+	u8 radius_authenticator[16];
 	macaddr addr;
 	u8 *auth_msg; /* IEEE 802.11 authentication frame from station */
 	size_t auth_msg_len;
@@ -166,6 +167,9 @@ static int hostapd_radius_acl_query(struct hostapd_data *hapd, const u8 *addr,
 		return -1;
 
 	radius_msg_make_authenticator(msg, addr, ETH_ALEN);
+	os_memcpy(query->radius_authenticator,
+		  radius_msg_get_hdr(msg)->authenticator,
+		  sizeof(query->radius_authenticator));
 
 	os_snprintf(buf, sizeof(buf), RADIUS_ADDR_FORMAT, MAC2STR(addr));
 	if (!radius_msg_add_attr(msg, RADIUS_ATTR_USER_NAME, (u8 *) buf,
@@ -486,7 +490,10 @@ hostapd_acl_recv_radius(struct radius_msg *msg, struct radius_msg *req,
 	query = hapd->acl_queries;
 	prev = NULL;
 	while (query) {
-		if (query->radius_id == hdr->identifier)
+		if (query->radius_id == hdr->identifier &&
+		    os_memcmp(query->radius_authenticator,
+			      radius_msg_get_hdr(req)->authenticator,
+			      sizeof(query->radius_authenticator)) == 0)
 			break;
 		prev = query;
 		query = query->next;
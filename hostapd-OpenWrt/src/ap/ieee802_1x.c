@@ -577,6 +577,9 @@ static void ieee802_1x_encapsulate_radius(struct hostapd_data *hapd,
 	}
 
 	radius_msg_make_authenticator(msg, (u8 *) sta, sizeof(*sta));
+	os_memcpy(sm->radius_authenticator,
+		  radius_msg_get_hdr(msg)->authenticator,
+		  sizeof(sm->radius_authenticator));
 
 	if (sm->identity &&
 	    !radius_msg_add_attr(msg, RADIUS_ATTR_USER_NAME,
@@ -1542,6 +1545,7 @@ static void ieee802_1x_check_hs20(struct hostapd_data *hapd,
 
 struct sta_id_search {
 	u8 identifier;
+	const u8 *authenticator;
 	struct eapol_state_machine *sm;
 };
 
@@ -1554,7 +1558,9 @@ static int ieee802_1x_select_radius_identifier(struct hostapd_data *hapd,
 	struct eapol_state_machine *sm = sta->eapol_sm;
 
 	if (sm && sm->radius_identifier >= 0 &&
-	    sm->radius_identifier == id_search->identifier) {
+	    sm->radius_identifier == id_search->identifier &&
+	    os_memcmp(sm->radius_authenticator, id_search->authenticator,
+		      sizeof(sm->radius_authenticator)) == 0) {
 		id_search->sm = sm;
 		return 1;
 	}
@@ -1563,10 +1569,12 @@ static int ieee802_1x_select_radius_identifier(struct hostapd_data *hapd,
 
 
 static struct eapol_state_machine *
-ieee802_1x_search_radius_identifier(struct hostapd_data *hapd, u8 identifier)
+ieee802_1x_search_radius_identifier(struct hostapd_data *hapd,
+				    const struct radius_hdr *req)
 {
 	struct sta_id_search id_search;
-	id_search.identifier = identifier;
+	id_search.identifier = req->identifier;
+	id_search.authenticator = req->authenticator;
 	id_search.sm = NULL;
 	ap_for_each_sta(hapd, ieee802_1x_select_radius_identifier, &id_search);
 	return id_search.sm;
@@ -1595,7 +1603,8 @@ ieee802_1x_receive_auth(struct radius_msg *msg, struct radius_msg *req,
 	int override_eapReq = 0;
 	struct radius_hdr *hdr = radius_msg_get_hdr(msg);
 
-	sm = ieee802_1x_search_radius_identifier(hapd, hdr->identifier);
+	sm = ieee802_1x_search_radius_identifier(hapd,
+						 radius_msg_get_hdr(req));
 	if (sm == NULL) {
 		wpa_printf(MSG_DEBUG, "IEEE 802.1X: Could not find matching "
 			   "station for this RADIUS message");
@@ -1940,8 +1949,10 @@ static int ieee802_1x_get_eap_user(void *ctx, const u8 *identity,
 
 	if (eap_user->password) {
 		user->password = os_malloc(eap_user->password_len);
-		if (user->password == NULL)
+		if (user->password == NULL) {
+			hostapd_put_eap_user(hapd, eap_user);
 			return -1;
+		}
 		os_memcpy(user->password, eap_user->password,
 			  eap_user->password_len);
 		user->password_len = eap_user->password_len;
@@ -1951,6 +1962,7 @@ static int ieee802_1x_get_eap_user(void *ctx, const u8 *identity,
 	user->macacl = eap_user->macacl;
 	user->ttls_auth = eap_user->ttls_auth;
 	user->remediation = eap_user->remediation;
+	hostapd_put_eap_user(hapd, eap_user);
 
 	return 0;
 }
@@ -75,6 +75,14 @@ static inline void wpa_auth_psk_failure_report(
 }
 
 
+static inline void wpa_auth_psk_match_report(
+	struct wpa_authenticator *wpa_auth, const u8 *addr, const u8 *psk)
+{
+	if (wpa_auth->cb.psk_match_report)
+		wpa_auth->cb.psk_match_report(wpa_auth->cb.ctx, addr, psk);
+}
+
+
 static inline void wpa_auth_set_eapol(struct wpa_authenticator *wpa_auth,
 				      const u8 *addr, wpa_eapol_variable var,
 				      int value)
@@ -2063,6 +2071,7 @@ SM_STATE(WPA_PTK, PTKCALCNEGOTIATING)
 		 * state machine data based on whatever PSK was selected here.
 		 */
 		os_memcpy(sm->PMK, pmk, PMK_LEN);
+		wpa_auth_psk_match_report(sm->wpa_auth, sm->addr, pmk);
 	}
 
 	sm->MICVerified = TRUE;
@@ -190,6 +190,7 @@ struct wpa_auth_callbacks {
 	void (*disconnect)(void *ctx, const u8 *addr, u16 reason);
 	int (*mic_failure_report)(void *ctx, const u8 *addr);
 	void (*psk_failure_report)(void *ctx, const u8 *addr);
+	void (*psk_match_report)(void *ctx, const u8 *addr, const u8 *psk);
 	void (*set_eapol)(void *ctx, const u8 *addr, wpa_eapol_variable var,
 			  int value);
 	int (*get_eapol)(void *ctx, const u8 *addr, wpa_eapol_variable var);
@@ -133,6 +133,7 @@ static int hostapd_wps_new_psk_cb(void *ctx, const u8 *mac_addr,
 
 	p->next = ssid->wpa_psk;
 	ssid->wpa_psk = p;
+	hostapd_wpa_psk_index(ssid);
 
 	if (ssid->wpa_psk_file) {
 		FILE *f;
@@ -362,8 +363,10 @@ static int hapd_wps_reconfig_in_memory(struct hostapd_data *hapd,
 			if (bss->ssid.wpa_passphrase)
 				os_memcpy(bss->ssid.wpa_passphrase, cred->key,
 					  cred->key_len);
+			hostapd_wpa_psk_index_free(&bss->ssid);
 			hostapd_config_clear_wpa_psk(&bss->ssid.wpa_psk);
 		} else if (cred->key_len == 64) {
+			hostapd_wpa_psk_index_free(&bss->ssid);
 			hostapd_config_clear_wpa_psk(&bss->ssid.wpa_psk);
 			bss->ssid.wpa_psk =
 				os_zalloc(sizeof(struct hostapd_wpa_psk));
@@ -151,6 +151,9 @@ struct eapol_state_machine {
 	struct eap_eapol_interface *eap_if;
 
 	int radius_identifier;
+	/* Request Authenticator of the pending Access-Request; the identifier
+	 * alone is not unique with several RADIUS client source ports */
+	u8 radius_authenticator[16];
 	/* TODO: check when the last messages can be released */
 	struct radius_msg *last_recv_radius;
 	u8 last_eap_id; /* last used EAP Identifier */
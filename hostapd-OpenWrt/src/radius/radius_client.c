@@ -9,6 +9,7 @@
 #include "includes.h"
 
 #include "common.h"
+#include "list.h"
 #include "radius.h"
 #include "radius_client.h"
 #include "eloop.h"
@@ -34,13 +35,35 @@
 #define RADIUS_CLIENT_MAX_RETRIES 10
 
 /**
- * RADIUS_CLIENT_MAX_ENTRIES - RADIUS client maximum pending messages
+ * RADIUS_CLIENT_MAX_ENTRIES - RADIUS client default maximum pending messages
  *
- * Maximum number of entries in retransmit list (oldest entries will be
- * removed, if this limit is exceeded).
+ * Default maximum number of entries in retransmit list if
+ * hostapd_radius_servers::max_pending is not set. Further messages are queued
+ * until there is room in the retransmit list.
  */
 #define RADIUS_CLIENT_MAX_ENTRIES 30
 
+/**
+ * RADIUS_CLIENT_MAX_QUEUED - RADIUS client maximum queued messages
+ *
+ * Maximum number of messages waiting for room in the retransmit list. When the
+ * queue is full, the oldest queued message is removed.
+ */
+#define RADIUS_CLIENT_MAX_QUEUED 1024
+
+/**
+ * RADIUS_CLIENT_NUM_IDS - Number of RADIUS identifiers per source port
+ */
+#define RADIUS_CLIENT_NUM_IDS 256
+
+/**
+ * RADIUS_CLIENT_MAX_PORTS - RADIUS client maximum source ports per server type
+ *
+ * One source port is used for every RADIUS_CLIENT_NUM_IDS pending messages;
+ * this limits the maximum number of pending messages.
+ */
+#define RADIUS_CLIENT_MAX_PORTS 16
+
 /**
  * RADIUS_CLIENT_NUM_FAILOVER - RADIUS client failover point
  *
@@ -79,7 +102,8 @@ struct radius_rx_handler {
  * struct radius_msg_list - RADIUS client message retransmit list
  *
  * This data structure is used internally inside the RADIUS client module to
- * store pending RADIUS requests that may still need to be retransmitted.
+ * store pending RADIUS requests that may still need to be retransmitted and
+ * queued requests that have not yet been sent.
  */
 struct radius_msg_list {
 	/**
@@ -137,9 +161,57 @@ struct radius_msg_list {
 	/* TODO: server config with failover to backup server(s) */
 
 	/**
-	 * next - Next message in the list
+	 * port - Source port the message was sent from
+	 *
+	 * %NULL while the message is queued.
+	 */
+	struct radius_client_port *port;
+
+	/**
+	 * list - Entry in radius_client_data::msgs or radius_client_data::queue
+	 */
+	struct dl_list list;
+};
+
+
+/**
+ * struct radius_client_port - RADIUS client source port
+ *
+ * Pending requests are sent from one of several UDP source ports, each with
+ * its own RADIUS identifier space, so that more than RADIUS_CLIENT_NUM_IDS
+ * requests can be pending and a response is matched with its request by the
+ * receiving socket and identifier.
+ */
+struct radius_client_port {
+	/**
+	 * radius - RADIUS client this port belongs to
+	 */
+	struct radius_client_data *radius;
+
+	/**
+	 * type - RADIUS_AUTH or RADIUS_ACCT
 	 */
-	struct radius_msg_list *next;
+	RadiusType type;
+
+	/**
+	 * sock - IPv4 socket
+	 */
+	int sock;
+
+	/**
+	 * sock6 - IPv6 socket
+	 */
+	int sock6;
+
+	/**
+	 * cur - Socket connected to the current server or -1
+	 */
+	int cur;
+
+	/**
+	 * pending - Pending messages sent from this port by identifier
+	 */
+	struct radius_msg_list *pending[RADIUS_CLIENT_NUM_IDS];
 };
 
 
@@ -163,34 +235,24 @@ struct radius_client_data {
 	struct hostapd_radius_servers *conf;
 
 	/**
-	 * auth_serv_sock - IPv4 socket for RADIUS authentication messages
-	 */
-	int auth_serv_sock;
-
-	/**
-	 * acct_serv_sock - IPv4 socket for RADIUS accounting messages
-	 */
-	int acct_serv_sock;
-
-	/**
-	 * auth_serv_sock6 - IPv6 socket for RADIUS authentication messages
+	 * auth_ports - Source ports for RADIUS authentication messages
 	 */
-	int auth_serv_sock6;
+	struct radius_client_port *auth_ports;
 
 	/**
-	 * acct_serv_sock6 - IPv6 socket for RADIUS accounting messages
+	 * acct_ports - Source ports for RADIUS accounting messages
 	 */
-	int acct_serv_sock6;
+	struct radius_client_port *acct_ports;
 
 	/**
-	 * auth_sock - Currently used socket for RADIUS authentication server
+	 * num_ports - Number of entries in auth_ports and acct_ports
 	 */
-	int auth_sock;
+	size_t num_ports;
 
 	/**
-	 * acct_sock - Currently used socket for RADIUS accounting server
+	 * max_msgs - Maximum number of pending messages in the msgs list
 	 */
-	int acct_sock;
+	size_t max_msgs;
 
 	/**
 	 * auth_handlers - Authentication message handlers
@@ -213,15 +275,30 @@ struct radius_client_data {
 	size_t num_acct_handlers;
 
 	/**
-	 * msgs - Pending outgoing RADIUS messages
+	 * msgs - Pending outgoing RADIUS messages, oldest first
 	 */
-	struct radius_msg_list *msgs;
+	struct dl_list msgs;
 
 	/**
 	 * num_msgs - Number of pending messages in the msgs list
 	 */
 	size_t num_msgs;
 
+	/**
+	 * queue - Messages waiting for room in the msgs list
+	 */
+	struct dl_list queue;
+
+	/**
+	 * num_queued - Number of messages in the queue
+	 */
+	size_t num_queued;
+
+	/**
+	 * timer_at - Time radius_client_timer() is registered for or 0
+	 */
+	os_time_t timer_at;
+
 	/**
 	 * next_radius_identifier - Next RADIUS message identifier to use
 	 */
@@ -232,12 +309,12 @@ struct radius_client_data {
 static int
 radius_change_server(struct radius_client_data *radius,
 		     struct hostapd_radius_server *nserv,
-		     struct hostapd_radius_server *oserv,
-		     int sock, int sock6, int auth);
+		     struct hostapd_radius_server *oserv, int auth);
 static int radius_client_init_acct(struct radius_client_data *radius);
 static int radius_client_init_auth(struct radius_client_data *radius);
 static void radius_client_auth_failover(struct radius_client_data *radius);
 static void radius_client_acct_failover(struct radius_client_data *radius);
+static void radius_client_timer(void *eloop_ctx, void *timeout_ctx);
 
 
 static void radius_client_msg_free(struct radius_msg_list *req)
@@ -247,6 +324,55 @@ static void radius_client_msg_free(struct radius_msg_list *req)
 }
 
 
+/* Remove a message from the retransmit list or queue without freeing it */
+static void radius_client_msg_unlink(struct radius_client_data *radius,
+				     struct radius_msg_list *entry)
+{
+	if (entry->port) {
+		entry->port->pending[radius_msg_get_hdr(entry->msg)->identifier]
+			= NULL;
+		entry->port = NULL;
+		radius->num_msgs--;
+	} else {
+		radius->num_queued--;
+	}
+	dl_list_del(&entry->list);
+}
+
+
+static void radius_client_msg_remove(struct radius_client_data *radius,
+				     struct radius_msg_list *entry)
+{
+	radius_client_msg_unlink(radius, entry);
+	radius_client_msg_free(entry);
+}
+
+
+static struct radius_client_port *
+radius_client_ports(struct radius_client_data *radius, RadiusType msg_type)
+{
+	if (msg_type == RADIUS_ACCT || msg_type == RADIUS_ACCT_INTERIM)
+		return radius->acct_ports;
+	return radius->auth_ports;
+}
+
+
+/* Whether the ports for msg_type are connected to the current server */
+static int radius_client_connected(struct radius_client_data *radius,
+				   RadiusType msg_type)
+{
+	struct radius_client_port *ports = radius_client_ports(radius,
+							       msg_type);
+	size_t i;
+
+	for (i = 0; i < radius->num_ports; i++) {
+		if (ports[i].cur >= 0)
+			return 1;
+	}
+	return 0;
+}
+
+
 /**
  * radius_client_register - Register a RADIUS client RX handler
  * @radius: RADIUS client context from radius_client_init()
@@ -339,15 +465,15 @@ static int radius_client_retransmit(struct radius_client_data *radius,
 
 	if (entry->msg_type == RADIUS_ACCT ||
 	    entry->msg_type == RADIUS_ACCT_INTERIM) {
-		if (radius->acct_sock < 0)
+		if (!radius_client_connected(radius, entry->msg_type))
 			radius_client_init_acct(radius);
-		if (radius->acct_sock < 0 && conf->num_acct_servers > 1) {
+		if (!radius_client_connected(radius, entry->msg_type) &&
+		    conf->num_acct_servers > 1) {
 			prev_num_msgs = radius->num_msgs;
 			radius_client_acct_failover(radius);
 			if (prev_num_msgs != radius->num_msgs)
 				return 0;
 		}
-		s = radius->acct_sock;
 		if (entry->attempts == 0)
 			conf->acct_server->requests++;
 		else {
@@ -355,15 +481,15 @@ static int radius_client_retransmit(struct radius_client_data *radius,
 			conf->acct_server->retransmissions++;
 		}
 	} else {
-		if (radius->auth_sock < 0)
+		if (!radius_client_connected(radius, entry->msg_type))
 			radius_client_init_auth(radius);
-		if (radius->auth_sock < 0 && conf->num_auth_servers > 1) {
+		if (!radius_client_connected(radius, entry->msg_type) &&
+		    conf->num_auth_servers > 1) {
 			prev_num_msgs = radius->num_msgs;
 			radius_client_auth_failover(radius);
 			if (prev_num_msgs != radius->num_msgs)
 				return 0;
 		}
-		s = radius->auth_sock;
 		if (entry->attempts == 0)
 			conf->auth_server->requests++;
 		else {
@@ -371,6 +497,7 @@ static int radius_client_retransmit(struct radius_client_data *radius,
 			conf->auth_server->retransmissions++;
 		}
 	}
+	s = entry->port->cur;
 	if (s < 0) {
 		wpa_printf(MSG_INFO,
 			   "RADIUS: No valid socket for retransmission");
@@ -404,51 +531,167 @@ static int radius_client_retransmit(struct radius_client_data *radius,
 }
 
 
+/*
+ * Register radius_client_timer() for the given time unless it is already
+ * registered to run earlier.
+ */
+static void radius_client_timeout_at(struct radius_client_data *radius,
+				     os_time_t when)
+{
+	struct os_reltime now;
+
+	if (radius->timer_at && radius->timer_at <= when)
+		return;
+
+	os_get_reltime(&now);
+	if (when < now.sec)
+		when = now.sec;
+	eloop_cancel_timeout(radius_client_timer, radius, NULL);
+	eloop_register_timeout(when - now.sec, 0, radius_client_timer, radius,
+			       NULL);
+	radius->timer_at = when;
+	hostapd_logger(radius->ctx, NULL, HOSTAPD_MODULE_RADIUS,
+		       HOSTAPD_LEVEL_DEBUG, "Next RADIUS client retransmit in"
+		       " %ld seconds", (long int) (when - now.sec));
+}
+
+
+static void radius_client_update_timeout(struct radius_client_data *radius)
+{
+	os_time_t first;
+	struct radius_msg_list *entry;
+
+	eloop_cancel_timeout(radius_client_timer, radius, NULL);
+	radius->timer_at = 0;
+
+	if (dl_list_empty(&radius->msgs)) {
+		if (!dl_list_empty(&radius->queue))
+			radius_client_timeout_at(radius, 0);
+		return;
+	}
+
+	first = 0;
+	dl_list_for_each(entry, &radius->msgs, struct radius_msg_list, list) {
+		if (first == 0 || entry->next_try < first)
+			first = entry->next_try;
+	}
+
+	radius_client_timeout_at(radius, first);
+}
+
+
+/*
+ * Send a message that is not in the retransmit list or queue from a port
+ * that does not have a message with the same identifier pending, and add it
+ * to the retransmit list. Returns -1 if there is no usable port.
+ */
+static int radius_client_start(struct radius_client_data *radius,
+			       struct radius_msg_list *entry)
+{
+	struct radius_client_port *ports, *port = NULL;
+	u8 id = radius_msg_get_hdr(entry->msg)->identifier;
+	struct wpabuf *buf;
+	size_t i;
+
+	ports = radius_client_ports(radius, entry->msg_type);
+	for (i = 0; i < radius->num_ports; i++) {
+		if (ports[i].cur < 0)
+			continue;
+		if (ports[i].pending[id] == NULL) {
+			port = &ports[i];
+			break;
+		}
+		if (port == NULL)
+			port = &ports[i];
+	}
+	if (port == NULL)
+		return -1;
+
+	if (port->pending[id]) {
+		/* remove the entry with matching id to avoid using a new reply
+		 * from the RADIUS server with an old request */
+		hostapd_logger(radius->ctx, port->pending[id]->addr,
+			       HOSTAPD_MODULE_RADIUS, HOSTAPD_LEVEL_DEBUG,
+			       "Removing pending RADIUS message, since its id "
+			       "(%d) is reused", id);
+		radius_client_msg_remove(radius, port->pending[id]);
+	}
+
+	entry->port = port;
+	port->pending[id] = entry;
+	dl_list_add_tail(&radius->msgs, &entry->list);
+	radius->num_msgs++;
+
+	os_get_reltime(&entry->last_attempt);
+	entry->first_try = entry->last_attempt.sec;
+	entry->next_try = entry->first_try + RADIUS_CLIENT_FIRST_WAIT;
+	entry->attempts = 1;
+	entry->next_wait = RADIUS_CLIENT_FIRST_WAIT * 2;
+	radius_client_timeout_at(radius, entry->next_try);
+
+	buf = radius_msg_get_buf(entry->msg);
+	if (send(port->cur, wpabuf_head(buf), wpabuf_len(buf), 0) < 0)
+		radius_client_handle_send_error(radius, port->cur,
+						entry->msg_type);
+
+	return 0;
+}
+
+
+/* Send queued messages while there is room in the retransmit list */
+static void radius_client_send_queued(struct radius_client_data *radius)
+{
+	struct radius_msg_list *entry;
+
+	while (radius->num_msgs < radius->max_msgs) {
+		entry = dl_list_first(&radius->queue, struct radius_msg_list,
+				      list);
+		if (entry == NULL)
+			break;
+		radius_client_msg_unlink(radius, entry);
+		if (radius_client_start(radius, entry) < 0) {
+			wpa_printf(MSG_INFO, "RADIUS: No socket for queued message - dropping it");
+			radius_client_msg_free(entry);
+		}
+	}
+}
+
+
 static void radius_client_timer(void *eloop_ctx, void *timeout_ctx)
 {
 	struct radius_client_data *radius = eloop_ctx;
 	struct hostapd_radius_servers *conf = radius->conf;
 	struct os_reltime now;
-	os_time_t first;
-	struct radius_msg_list *entry, *prev, *tmp;
+	struct radius_msg_list *entry, *next;
 	int auth_failover = 0, acct_failover = 0;
 	size_t prev_num_msgs;
 	int s;
 
-	entry = radius->msgs;
-	if (!entry)
-		return;
-
+	radius->timer_at = 0;
 	os_get_reltime(&now);
-	first = 0;
 
-	prev = NULL;
+	entry = dl_list_first(&radius->msgs, struct radius_msg_list, list);
 	while (entry) {
+		next = entry->list.next == &radius->msgs ? NULL :
+			dl_list_entry(entry->list.next, struct radius_msg_list,
+				      list);
 		prev_num_msgs = radius->num_msgs;
 		if (now.sec >= entry->next_try &&
 		    radius_client_retransmit(radius, entry, now.sec)) {
-			if (prev)
-				prev->next = entry->next;
-			else
-				radius->msgs = entry->next;
-
-			tmp = entry;
-			entry = entry->next;
-			radius_client_msg_free(tmp);
-			radius->num_msgs--;
+			radius_client_msg_remove(radius, entry);
+			entry = next;
 			continue;
 		}
 
 		if (prev_num_msgs != radius->num_msgs) {
 			wpa_printf(MSG_DEBUG,
 				   "RADIUS: Message removed from queue - restart from beginning");
-			entry = radius->msgs;
-			prev = NULL;
+			entry = dl_list_first(&radius->msgs,
+					      struct radius_msg_list, list);
 			continue;
 		}
 
-		s = entry->msg_type == RADIUS_AUTH ? radius->auth_sock :
-			radius->acct_sock;
+		s = entry->port->cur;
 		if (entry->attempts > RADIUS_CLIENT_NUM_FAILOVER ||
 		    (s < 0 && entry->attempts > 0)) {
 			if (entry->msg_type == RADIUS_ACCT ||
@@ -458,23 +701,11 @@ static void radius_client_timer(void *eloop_ctx, void *timeout_ctx)
 				auth_failover++;
 		}
 
-		if (first == 0 || entry->next_try < first)
-			first = entry->next_try;
-
-		prev = entry;
-		entry = entry->next;
+		entry = next;
 	}
 
-	if (radius->msgs) {
-		if (first < now.sec)
-			first = now.sec;
-		eloop_register_timeout(first - now.sec, 0,
-				       radius_client_timer, radius, NULL);
-		hostapd_logger(radius->ctx, NULL, HOSTAPD_MODULE_RADIUS,
-			       HOSTAPD_LEVEL_DEBUG, "Next RADIUS client "
-			       "retransmit in %ld seconds",
-			       (long int) (first - now.sec));
-	}
+	radius_client_send_queued(radius);
+	radius_client_update_timeout(radius);
 
 	if (auth_failover && conf->num_auth_servers > 1)
 		radius_client_auth_failover(radius);
@@ -498,7 +729,7 @@ static void radius_client_auth_failover(struct radius_client_data *radius)
 		       hostapd_ip_txt(&old->addr, abuf, sizeof(abuf)),
 		       old->port);
 
-	for (entry = radius->msgs; entry; entry = entry->next) {
+	dl_list_for_each(entry, &radius->msgs, struct radius_msg_list, list) {
 		if (entry->msg_type == RADIUS_AUTH)
 			old->timeouts++;
 	}
@@ -507,9 +738,7 @@ static void radius_client_auth_failover(struct radius_client_data *radius)
 	if (next > &(conf->auth_servers[conf->num_auth_servers - 1]))
 		next = conf->auth_servers;
 	conf->auth_server = next;
-	radius_change_server(radius, next, old,
-			     radius->auth_serv_sock,
-			     radius->auth_serv_sock6, 1);
+	radius_change_server(radius, next, old, 1);
 }
 
 
@@ -527,7 +756,7 @@ static void radius_client_acct_failover(struct radius_client_data *radius)
 		       hostapd_ip_txt(&old->addr, abuf, sizeof(abuf)),
 		       old->port);
 
-	for (entry = radius->msgs; entry; entry = entry->next) {
+	dl_list_for_each(entry, &radius->msgs, struct radius_msg_list, list) {
 		if (entry->msg_type == RADIUS_ACCT ||
 		    entry->msg_type == RADIUS_ACCT_INTERIM)
 			old->timeouts++;
@@ -537,38 +766,7 @@ static void radius_client_acct_failover(struct radius_client_data *radius)
 	if (next > &conf->acct_servers[conf->num_acct_servers - 1])
 		next = conf->acct_servers;
 	conf->acct_server = next;
-	radius_change_server(radius, next, old,
-			     radius->acct_serv_sock,
-			     radius->acct_serv_sock6, 0);
-}
-
-
-static void radius_client_update_timeout(struct radius_client_data *radius)
-{
-	struct os_reltime now;
-	os_time_t first;
-	struct radius_msg_list *entry;
-
-	eloop_cancel_timeout(radius_client_timer, radius, NULL);
-
-	if (radius->msgs == NULL) {
-		return;
-	}
-
-	first = 0;
-	for (entry = radius->msgs; entry; entry = entry->next) {
-		if (first == 0 || entry->next_try < first)
-			first = entry->next_try;
-	}
-
-	os_get_reltime(&now);
-	if (first < now.sec)
-		first = now.sec;
-	eloop_register_timeout(first - now.sec, 0, radius_client_timer, radius,
-			       NULL);
-	hostapd_logger(radius->ctx, NULL, HOSTAPD_MODULE_RADIUS,
-		       HOSTAPD_LEVEL_DEBUG, "Next RADIUS client retransmit in"
-		       " %ld seconds", (long int) (first - now.sec));
+	radius_change_server(radius, next, old, 0);
 }
 
 
@@ -578,7 +776,7 @@ static void radius_client_list_add(struct radius_client_data *radius,
 				   const u8 *shared_secret,
 				   size_t shared_secret_len, const u8 *addr)
 {
-	struct radius_msg_list *entry, *prev;
+	struct radius_msg_list *entry, *oldest;
 
 	if (eloop_terminated()) {
 		/* No point in adding entries to retransmit queue since event
@@ -600,64 +798,64 @@ static void radius_client_list_add(struct radius_client_data *radius,
 	entry->msg_type = msg_type;
 	entry->shared_secret = shared_secret;
 	entry->shared_secret_len = shared_secret_len;
-	os_get_reltime(&entry->last_attempt);
-	entry->first_try = entry->last_attempt.sec;
-	entry->next_try = entry->first_try + RADIUS_CLIENT_FIRST_WAIT;
-	entry->attempts = 1;
-	entry->next_wait = RADIUS_CLIENT_FIRST_WAIT * 2;
-	entry->next = radius->msgs;
-	radius->msgs = entry;
-	radius_client_update_timeout(radius);
 
-	if (radius->num_msgs >= RADIUS_CLIENT_MAX_ENTRIES) {
-		wpa_printf(MSG_INFO, "RADIUS: Removing the oldest un-ACKed packet due to retransmit list limits");
-		prev = NULL;
-		while (entry->next) {
-			prev = entry;
-			entry = entry->next;
-		}
-		if (prev) {
-			prev->next = NULL;
+	if (radius->num_msgs < radius->max_msgs &&
+	    dl_list_empty(&radius->queue)) {
+		if (radius_client_start(radius, entry) < 0) {
+			wpa_printf(MSG_INFO, "RADIUS: No socket for the message - dropping it");
 			radius_client_msg_free(entry);
 		}
-	} else
-		radius->num_msgs++;
+		return;
+	}
+
+	if (radius->num_queued >= RADIUS_CLIENT_MAX_QUEUED) {
+		wpa_printf(MSG_INFO, "RADIUS: Removing the oldest queued packet due to queue limits");
+		oldest = dl_list_first(&radius->queue, struct radius_msg_list,
+				       list);
+		radius_client_msg_remove(radius, oldest);
+	}
+
+	dl_list_add_tail(&radius->queue, &entry->list);
+	radius->num_queued++;
+	hostapd_logger(radius->ctx, addr, HOSTAPD_MODULE_RADIUS,
+		       HOSTAPD_LEVEL_DEBUG,
+		       "RADIUS message queued (%u pending, %u queued)",
+		       (unsigned int) radius->num_msgs,
+		       (unsigned int) radius->num_queued);
 }
 
 
-static void radius_client_list_del(struct radius_client_data *radius,
-				   RadiusType msg_type, const u8 *addr)
+static void radius_client_list_del_from(struct radius_client_data *radius,
+					struct dl_list *list,
+					RadiusType msg_type, const u8 *addr)
 {
-	struct radius_msg_list *entry, *prev, *tmp;
+	struct radius_msg_list *entry, *tmp;
 
-	if (addr == NULL)
-		return;
-
-	entry = radius->msgs;
-	prev = NULL;
-	while (entry) {
+	dl_list_for_each_safe(entry, tmp, list, struct radius_msg_list,
+			      list) {
 		if (entry->msg_type == msg_type &&
 		    os_memcmp(entry->addr, addr, ETH_ALEN) == 0) {
-			if (prev)
-				prev->next = entry->next;
-			else
-				radius->msgs = entry->next;
-			tmp = entry;
-			entry = entry->next;
 			hostapd_logger(radius->ctx, addr,
 				       HOSTAPD_MODULE_RADIUS,
 				       HOSTAPD_LEVEL_DEBUG,
 				       "Removing matching RADIUS message");
-			radius_client_msg_free(tmp);
-			radius->num_msgs--;
-			continue;
+			radius_client_msg_remove(radius, entry);
 		}
-		prev = entry;
-		entry = entry->next;
 	}
 }
 
 
+static void radius_client_list_del(struct radius_client_data *radius,
+				   RadiusType msg_type, const u8 *addr)
+{
+	if (addr == NULL)
+		return;
+
+	radius_client_list_del_from(radius, &radius->msgs, msg_type, addr);
+	radius_client_list_del_from(radius, &radius->queue, msg_type, addr);
+}
+
+
 /**
  * radius_client_send - Send a RADIUS request
  * @radius: RADIUS client context from radius_client_init()
@@ -674,7 +872,9 @@ static void radius_client_list_del(struct radius_client_data *radius,
  *
  * The message is added on the retransmission queue and will be retransmitted
  * automatically until a response is received or maximum number of retries
- * (RADIUS_CLIENT_MAX_RETRIES) is reached.
+ * (RADIUS_CLIENT_MAX_RETRIES) is reached. If the maximum number of pending
+ * messages (hostapd_radius_servers::max_pending) has been reached, the
+ * message is sent once a pending message has been answered or removed.
  *
  * The related device MAC address can be used to identify pending messages that
  * can be removed with radius_client_flush_auth() or with interim accounting
@@ -688,8 +888,6 @@ int radius_client_send(struct radius_client_data *radius,
 	const u8 *shared_secret;
 	size_t shared_secret_len;
 	char *name;
-	int s, res;
-	struct wpabuf *buf;
 
 	if (msg_type == RADIUS_ACCT_INTERIM) {
 		/* Remove any pending interim acct update for the same STA. */
@@ -697,10 +895,12 @@ int radius_client_send(struct radius_client_data *radius,
 	}
 
 	if (msg_type == RADIUS_ACCT || msg_type == RADIUS_ACCT_INTERIM) {
-		if (conf->acct_server && radius->acct_sock < 0)
+		if (conf->acct_server &&
+		    !radius_client_connected(radius, msg_type))
 			radius_client_init_acct(radius);
 
-		if (conf->acct_server == NULL || radius->acct_sock < 0 ||
+		if (conf->acct_server == NULL ||
+		    !radius_client_connected(radius, msg_type) ||
 		    conf->acct_server->shared_secret == NULL) {
 			hostapd_logger(radius->ctx, NULL,
 				       HOSTAPD_MODULE_RADIUS,
@@ -712,13 +912,14 @@ int radius_client_send(struct radius_client_data *radius,
 		shared_secret_len = conf->acct_server->shared_secret_len;
 		radius_msg_finish_acct(msg, shared_secret, shared_secret_len);
 		name = "accounting";
-		s = radius->acct_sock;
 		conf->acct_server->requests++;
 	} else {
-		if (conf->auth_server && radius->auth_sock < 0)
+		if (conf->auth_server &&
+		    !radius_client_connected(radius, msg_type))
 			radius_client_init_auth(radius);
 
-		if (conf->auth_server == NULL || radius->auth_sock < 0 ||
+		if (conf->auth_server == NULL ||
+		    !radius_client_connected(radius, msg_type) ||
 		    conf->auth_server->shared_secret == NULL) {
 			hostapd_logger(radius->ctx, NULL,
 				       HOSTAPD_MODULE_RADIUS,
@@ -730,7 +931,6 @@ int radius_client_send(struct radius_client_data *radius,
 		shared_secret_len = conf->auth_server->shared_secret_len;
 		radius_msg_finish(msg, shared_secret, shared_secret_len);
 		name = "authentication";
-		s = radius->auth_sock;
 		conf->auth_server->requests++;
 	}
 
@@ -740,11 +940,6 @@ int radius_client_send(struct radius_client_data *radius,
 	if (conf->msg_dumps)
 		radius_msg_dump(msg);
 
-	buf = radius_msg_get_buf(msg);
-	res = send(s, wpabuf_head(buf), wpabuf_len(buf), 0);
-	if (res < 0)
-		radius_client_handle_send_error(radius, s, msg_type);
-
 	radius_client_list_add(radius, msg, msg_type, shared_secret,
 			       shared_secret_len, addr);
 
@@ -755,15 +950,16 @@ int radius_client_send(struct radius_client_data *radius,
 static void radius_client_receive(int sock, void *eloop_ctx, void *sock_ctx)
 {
 	struct radius_client_data *radius = eloop_ctx;
+	struct radius_client_port *port = sock_ctx;
 	struct hostapd_radius_servers *conf = radius->conf;
-	RadiusType msg_type = (RadiusType) sock_ctx;
+	RadiusType msg_type = port->type;
 	int len, roundtrip;
 	unsigned char buf[3000];
 	struct radius_msg *msg;
 	struct radius_hdr *hdr;
 	struct radius_rx_handler *handlers;
 	size_t num_handlers, i;
-	struct radius_msg_list *req, *prev_req;
+	struct radius_msg_list *req;
 	struct os_reltime now;
 	struct hostapd_radius_server *rconf;
 	int invalid_authenticator = 0;
@@ -819,22 +1015,8 @@ static void radius_client_receive(int sock, void *eloop_ctx, void *sock_ctx)
 		break;
 	}
 
-	prev_req = NULL;
-	req = radius->msgs;
-	while (req) {
-		/* TODO: also match by src addr:port of the packet when using
-		 * alternative RADIUS servers (?) */
-		if ((req->msg_type == msg_type ||
-		     (req->msg_type == RADIUS_ACCT_INTERIM &&
-		      msg_type == RADIUS_ACCT)) &&
-		    radius_msg_get_hdr(req->msg)->identifier ==
-		    hdr->identifier)
-			break;
-
-		prev_req = req;
-		req = req->next;
-	}
-
+	/* Responses come from the server the port is connected to */
+	req = port->pending[hdr->identifier];
 	if (req == NULL) {
 		hostapd_logger(radius->ctx, NULL, HOSTAPD_MODULE_RADIUS,
 			       HOSTAPD_LEVEL_DEBUG,
@@ -855,11 +1037,8 @@ static void radius_client_receive(int sock, void *eloop_ctx, void *sock_ctx)
 	rconf->round_trip_time = roundtrip;
 
 	/* Remove ACKed RADIUS packet from retransmit list */
-	if (prev_req)
-		prev_req->next = req->next;
-	else
-		radius->msgs = req->next;
-	radius->num_msgs--;
+	radius_client_msg_unlink(radius, req);
+	radius_client_send_queued(radius);
 
 	for (i = 0; i < num_handlers; i++) {
 		RadiusRxResult res;
@@ -899,43 +1078,40 @@ static void radius_client_receive(int sock, void *eloop_ctx, void *sock_ctx)
 }
 
 
+/* Whether at least one of the ports has the identifier free */
+static int radius_client_id_free(struct radius_client_data *radius,
+				 struct radius_client_port *ports, u8 id)
+{
+	size_t i;
+
+	for (i = 0; i < radius->num_ports; i++) {
+		if (ports[i].pending[id] == NULL)
+			return 1;
+	}
+	return 0;
+}
+
+
 /**
  * radius_client_get_id - Get an identifier for a new RADIUS message
  * @radius: RADIUS client context from radius_client_init()
  * Returns: Allocated identifier
  *
- * This function is used to fetch a unique (among pending requests) identifier
- * for a new RADIUS message.
+ * This function is used to fetch an identifier for a new RADIUS message.
+ * Identifiers that are in use on all source ports are skipped if possible;
+ * otherwise the pending message with the same identifier is removed when the
+ * new message is sent.
  */
 u8 radius_client_get_id(struct radius_client_data *radius)
 {
-	struct radius_msg_list *entry, *prev, *_remove;
 	u8 id = radius->next_radius_identifier++;
+	int i;
 
-	/* remove entries with matching id from retransmit list to avoid
-	 * using new reply from the RADIUS server with an old request */
-	entry = radius->msgs;
-	prev = NULL;
-	while (entry) {
-		if (radius_msg_get_hdr(entry->msg)->identifier == id) {
-			hostapd_logger(radius->ctx, entry->addr,
-				       HOSTAPD_MODULE_RADIUS,
-				       HOSTAPD_LEVEL_DEBUG,
-				       "Removing pending RADIUS message, "
-				       "since its id (%d) is reused", id);
-			if (prev)
-				prev->next = entry->next;
-			else
-				radius->msgs = entry->next;
-			_remove = entry;
-		} else {
-			_remove = NULL;
-			prev = entry;
-		}
-		entry = entry->next;
-
-		if (_remove)
-			radius_client_msg_free(_remove);
+	for (i = 0; i < RADIUS_CLIENT_NUM_IDS; i++) {
+		if (radius_client_id_free(radius, radius->auth_ports, id) &&
+		    radius_client_id_free(radius, radius->acct_ports, id))
+			break;
+		id = radius->next_radius_identifier++;
 	}
 
 	return id;
@@ -949,33 +1125,30 @@ u8 radius_client_get_id(struct radius_client_data *radius)
  */
 void radius_client_flush(struct radius_client_data *radius, int only_auth)
 {
-	struct radius_msg_list *entry, *prev, *tmp;
+	struct radius_msg_list *entry, *tmp;
 
 	if (!radius)
 		return;
 
-	prev = NULL;
-	entry = radius->msgs;
-
-	while (entry) {
-		if (!only_auth || entry->msg_type == RADIUS_AUTH) {
-			if (prev)
-				prev->next = entry->next;
-			else
-				radius->msgs = entry->next;
+	dl_list_for_each_safe(entry, tmp, &radius->msgs,
+			      struct radius_msg_list, list) {
+		if (!only_auth || entry->msg_type == RADIUS_AUTH)
+			radius_client_msg_remove(radius, entry);
+	}
 
-			tmp = entry;
-			entry = entry->next;
-			radius_client_msg_free(tmp);
-			radius->num_msgs--;
-		} else {
-			prev = entry;
-			entry = entry->next;
-		}
+	dl_list_for_each_safe(entry, tmp, &radius->queue,
+			      struct radius_msg_list, list) {
+		if (!only_auth || entry->msg_type == RADIUS_AUTH)
+			radius_client_msg_remove(radius, entry);
 	}
 
-	if (radius->msgs == NULL)
+	if (dl_list_empty(&radius->msgs)) {
 		eloop_cancel_timeout(radius_client_timer, radius, NULL);
+		radius->timer_at = 0;
+		/* let the timer send the remaining queued messages */
+		if (!dl_list_empty(&radius->queue))
+			radius_client_timeout_at(radius, 0);
+	}
 }
 
 
@@ -988,7 +1161,16 @@ static void radius_client_update_acct_msgs(struct radius_client_data *radius,
 	if (!radius)
 		return;
 
-	for (entry = radius->msgs; entry; entry = entry->next) {
+	dl_list_for_each(entry, &radius->msgs, struct radius_msg_list, list) {
+		if (entry->msg_type == RADIUS_ACCT) {
+			entry->shared_secret = shared_secret;
+			entry->shared_secret_len = shared_secret_len;
+			radius_msg_finish_acct(entry->msg, shared_secret,
+					       shared_secret_len);
+		}
+	}
+
+	dl_list_for_each(entry, &radius->queue, struct radius_msg_list, list) {
 		if (entry->msg_type == RADIUS_ACCT) {
 			entry->shared_secret = shared_secret;
 			entry->shared_secret_len = shared_secret_len;
@@ -1002,8 +1184,7 @@ static void radius_client_update_acct_msgs(struct radius_client_data *radius,
 static int
 radius_change_server(struct radius_client_data *radius,
 		     struct hostapd_radius_server *nserv,
-		     struct hostapd_radius_server *oserv,
-		     int sock, int sock6, int auth)
+		     struct hostapd_radius_server *oserv, int auth)
 {
 	struct sockaddr_in serv, claddr;
 #ifdef CONFIG_IPV6
@@ -1015,6 +1196,9 @@ radius_change_server(struct radius_client_data *radius,
 	int sel_sock;
 	struct radius_msg_list *entry;
 	struct hostapd_radius_servers *conf = radius->conf;
+	struct radius_client_port *ports, *port;
+	struct os_reltime now;
+	size_t i;
 
 	hostapd_logger(radius->ctx, NULL, HOSTAPD_MODULE_RADIUS,
 		       HOSTAPD_LEVEL_INFO,
@@ -1044,8 +1228,9 @@ radius_change_server(struct radius_client_data *radius,
 	}
 
 	/* Reset retry counters for the new server */
-	for (entry = radius->msgs; oserv && oserv != nserv && entry;
-	     entry = entry->next) {
+	dl_list_for_each(entry, &radius->msgs, struct radius_msg_list, list) {
+		if (!oserv || oserv == nserv)
+			break;
 		if ((auth && entry->msg_type != RADIUS_AUTH) ||
 		    (!auth && entry->msg_type != RADIUS_ACCT))
 			continue;
@@ -1054,10 +1239,12 @@ radius_change_server(struct radius_client_data *radius,
 		entry->next_wait = RADIUS_CLIENT_FIRST_WAIT * 2;
 	}
 
-	if (radius->msgs) {
+	if (!dl_list_empty(&radius->msgs)) {
 		eloop_cancel_timeout(radius_client_timer, radius, NULL);
 		eloop_register_timeout(RADIUS_CLIENT_FIRST_WAIT, 0,
 				       radius_client_timer, radius, NULL);
+		os_get_reltime(&now);
+		radius->timer_at = now.sec + RADIUS_CLIENT_FIRST_WAIT;
 	}
 
 	switch (nserv->addr.af) {
@@ -1068,7 +1255,6 @@ radius_change_server(struct radius_client_data *radius,
 		serv.sin_port = htons(nserv->port);
 		addr = (struct sockaddr *) &serv;
 		addrlen = sizeof(serv);
-		sel_sock = sock;
 		break;
 #ifdef CONFIG_IPV6
 	case AF_INET6:
@@ -1079,88 +1265,97 @@ radius_change_server(struct radius_client_data *radius,
 		serv6.sin6_port = htons(nserv->port);
 		addr = (struct sockaddr *) &serv6;
 		addrlen = sizeof(serv6);
-		sel_sock = sock6;
 		break;
 #endif /* CONFIG_IPV6 */
 	default:
 		return -1;
 	}
 
-	if (sel_sock < 0) {
-		wpa_printf(MSG_INFO,
-			   "RADIUS: No server socket available (af=%d sock=%d sock6=%d auth=%d",
-			   nserv->addr.af, sock, sock6, auth);
-		return -1;
-	}
+	ports = auth ? radius->auth_ports : radius->acct_ports;
+	for (i = 0; i < radius->num_ports; i++) {
+		port = &ports[i];
+		sel_sock = nserv->addr.af == AF_INET ? port->sock : port->sock6;
 
-	if (conf->force_client_addr) {
-		switch (conf->client_addr.af) {
-		case AF_INET:
-			os_memset(&claddr, 0, sizeof(claddr));
-			claddr.sin_family = AF_INET;
-			claddr.sin_addr.s_addr = conf->client_addr.u.v4.s_addr;
-			claddr.sin_port = htons(0);
-			cl_addr = (struct sockaddr *) &claddr;
-			claddrlen = sizeof(claddr);
-			break;
+		if (sel_sock < 0) {
+			wpa_printf(MSG_INFO,
+				   "RADIUS: No server socket available (af=%d sock=%d sock6=%d auth=%d",
+				   nserv->addr.af, port->sock, port->sock6,
+				   auth);
+			return -1;
+		}
+
+		if (conf->force_client_addr) {
+			switch (conf->client_addr.af) {
+			case AF_INET:
+				os_memset(&claddr, 0, sizeof(claddr));
+				claddr.sin_family = AF_INET;
+				claddr.sin_addr.s_addr =
+					conf->client_addr.u.v4.s_addr;
+				claddr.sin_port = htons(0);
+				cl_addr = (struct sockaddr *) &claddr;
+				claddrlen = sizeof(claddr);
+				break;
 #ifdef CONFIG_IPV6
-		case AF_INET6:
-			os_memset(&claddr6, 0, sizeof(claddr6));
-			claddr6.sin6_family = AF_INET6;
-			os_memcpy(&claddr6.sin6_addr, &conf->client_addr.u.v6,
-				  sizeof(struct in6_addr));
-			claddr6.sin6_port = htons(0);
-			cl_addr = (struct sockaddr *) &claddr6;
-			claddrlen = sizeof(claddr6);
-			break;
+			case AF_INET6:
+				os_memset(&claddr6, 0, sizeof(claddr6));
+				claddr6.sin6_family = AF_INET6;
+				os_memcpy(&claddr6.sin6_addr,
+					  &conf->client_addr.u.v6,
+					  sizeof(struct in6_addr));
+				claddr6.sin6_port = htons(0);
+				cl_addr = (struct sockaddr *) &claddr6;
+				claddrlen = sizeof(claddr6);
+				break;
 #endif /* CONFIG_IPV6 */
-		default:
-			return -1;
+			default:
+				return -1;
+			}
+
+			if (bind(sel_sock, cl_addr, claddrlen) < 0) {
+				wpa_printf(MSG_INFO, "bind[radius]: %s",
+					   strerror(errno));
+				return -1;
+			}
 		}
 
-		if (bind(sel_sock, cl_addr, claddrlen) < 0) {
-			wpa_printf(MSG_INFO, "bind[radius]: %s",
+		if (connect(sel_sock, addr, addrlen) < 0) {
+			wpa_printf(MSG_INFO, "connect[radius]: %s",
 				   strerror(errno));
 			return -1;
 		}
-	}
-
-	if (connect(sel_sock, addr, addrlen) < 0) {
-		wpa_printf(MSG_INFO, "connect[radius]: %s", strerror(errno));
-		return -1;
-	}
 
 #ifndef CONFIG_NATIVE_WINDOWS
-	switch (nserv->addr.af) {
-	case AF_INET:
-		claddrlen = sizeof(claddr);
-		if (getsockname(sel_sock, (struct sockaddr *) &claddr,
-				&claddrlen) == 0) {
-			wpa_printf(MSG_DEBUG, "RADIUS local address: %s:%u",
-				   inet_ntoa(claddr.sin_addr),
-				   ntohs(claddr.sin_port));
-		}
-		break;
+		switch (nserv->addr.af) {
+		case AF_INET:
+			claddrlen = sizeof(claddr);
+			if (getsockname(sel_sock, (struct sockaddr *) &claddr,
+					&claddrlen) == 0) {
+				wpa_printf(MSG_DEBUG,
+					   "RADIUS local address: %s:%u",
+					   inet_ntoa(claddr.sin_addr),
+					   ntohs(claddr.sin_port));
+			}
+			break;
 #ifdef CONFIG_IPV6
-	case AF_INET6: {
-		claddrlen = sizeof(claddr6);
-		if (getsockname(sel_sock, (struct sockaddr *) &claddr6,
-				&claddrlen) == 0) {
-			wpa_printf(MSG_DEBUG, "RADIUS local address: %s:%u",
-				   inet_ntop(AF_INET6, &claddr6.sin6_addr,
-					     abuf, sizeof(abuf)),
-				   ntohs(claddr6.sin6_port));
+		case AF_INET6: {
+			claddrlen = sizeof(claddr6);
+			if (getsockname(sel_sock, (struct sockaddr *) &claddr6,
+					&claddrlen) == 0) {
+				wpa_printf(MSG_DEBUG,
+					   "RADIUS local address: %s:%u",
+					   inet_ntop(AF_INET6,
+						     &claddr6.sin6_addr,
+						     abuf, sizeof(abuf)),
+					   ntohs(claddr6.sin6_port));
+			}
+			break;
 		}
-		break;
-	}
 #endif /* CONFIG_IPV6 */
-	}
+		}
 #endif /* CONFIG_NATIVE_WINDOWS */
 
-	if (auth)
-		radius->auth_sock = sel_sock;
-	else
-		radius->acct_sock = sel_sock;
+		port->cur = sel_sock;
+	}
 
 	return 0;
 }
@@ -1172,31 +1367,29 @@ static void radius_retry_primary_timer(void *eloop_ctx, void *timeout_ctx)
 	struct hostapd_radius_servers *conf = radius->conf;
 	struct hostapd_radius_server *oserv;
 
-	if (radius->auth_sock >= 0 && conf->auth_servers &&
+	if (radius_client_connected(radius, RADIUS_AUTH) &&
+	    conf->auth_servers &&
 	    conf->auth_server != conf->auth_servers) {
 		oserv = conf->auth_server;
 		conf->auth_server = conf->auth_servers;
 		if (radius_change_server(radius, conf->auth_server, oserv,
-					 radius->auth_serv_sock,
-					 radius->auth_serv_sock6, 1) < 0) {
+					 1) < 0) {
 			conf->auth_server = oserv;
 			radius_change_server(radius, oserv, conf->auth_server,
-					     radius->auth_serv_sock,
-					     radius->auth_serv_sock6, 1);
+					     1);
 		}
 	}
 
-	if (radius->acct_sock >= 0 && conf->acct_servers &&
+	if (radius_client_connected(radius, RADIUS_ACCT) &&
+	    conf->acct_servers &&
 	    conf->acct_server != conf->acct_servers) {
 		oserv = conf->acct_server;
 		conf->acct_server = conf->acct_servers;
 		if (radius_change_server(radius, conf->acct_server, oserv,
-					 radius->acct_serv_sock,
-					 radius->acct_serv_sock6, 0) < 0) {
+					 0) < 0) {
 			conf->acct_server = oserv;
 			radius_change_server(radius, oserv, conf->acct_server,
-					     radius->acct_serv_sock,
-					     radius->acct_serv_sock6, 0);
+					     0);
 		}
 	}
 
@@ -1223,95 +1416,114 @@ static int radius_client_disable_pmtu_discovery(int s)
 }
 
 
-static void radius_close_auth_sockets(struct radius_client_data *radius)
+static void radius_close_port(struct radius_client_port *port)
 {
-	radius->auth_sock = -1;
+	port->cur = -1;
 
-	if (radius->auth_serv_sock >= 0) {
-		eloop_unregister_read_sock(radius->auth_serv_sock);
-		close(radius->auth_serv_sock);
-		radius->auth_serv_sock = -1;
+	if (port->sock >= 0) {
+		eloop_unregister_read_sock(port->sock);
+		close(port->sock);
+		port->sock = -1;
 	}
 #ifdef CONFIG_IPV6
-	if (radius->auth_serv_sock6 >= 0) {
-		eloop_unregister_read_sock(radius->auth_serv_sock6);
-		close(radius->auth_serv_sock6);
-		radius->auth_serv_sock6 = -1;
+	if (port->sock6 >= 0) {
+		eloop_unregister_read_sock(port->sock6);
+		close(port->sock6);
+		port->sock6 = -1;
 	}
 #endif /* CONFIG_IPV6 */
 }
 
 
+static void radius_close_auth_sockets(struct radius_client_data *radius)
+{
+	size_t i;
+
+	for (i = 0; i < radius->num_ports; i++)
+		radius_close_port(&radius->auth_ports[i]);
+}
+
+
 static void radius_close_acct_sockets(struct radius_client_data *radius)
 {
-	radius->acct_sock = -1;
+	size_t i;
 
-	if (radius->acct_serv_sock >= 0) {
-		eloop_unregister_read_sock(radius->acct_serv_sock);
-		close(radius->acct_serv_sock);
-		radius->acct_serv_sock = -1;
-	}
-#ifdef CONFIG_IPV6
-	if (radius->acct_serv_sock6 >= 0) {
-		eloop_unregister_read_sock(radius->acct_serv_sock6);
-		close(radius->acct_serv_sock6);
-		radius->acct_serv_sock6 = -1;
-	}
-#endif /* CONFIG_IPV6 */
+	for (i = 0; i < radius->num_ports; i++)
+		radius_close_port(&radius->acct_ports[i]);
 }
 
 
-static int radius_client_init_auth(struct radius_client_data *radius)
+/*
+ * Open the sockets of all source ports for one server type, connect them to
+ * the current server and register them with the event loop. Pending messages
+ * stay in the identifier tables of the ports.
+ */
+static int radius_client_open_ports(struct radius_client_data *radius,
+				    struct radius_client_port *ports,
+				    struct hostapd_radius_server *serv,
+				    int auth)
 {
-	struct hostapd_radius_servers *conf = radius->conf;
-	int ok = 0;
+	struct radius_client_port *port;
+	size_t i;
+	int ok;
 
-	radius_close_auth_sockets(radius);
+	for (i = 0; i < radius->num_ports; i++) {
+		port = &ports[i];
+		ok = 0;
 
-	radius->auth_serv_sock = socket(PF_INET, SOCK_DGRAM, 0);
-	if (radius->auth_serv_sock < 0)
-		wpa_printf(MSG_INFO, "RADIUS: socket[PF_INET,SOCK_DGRAM]: %s",
-			   strerror(errno));
-	else {
-		radius_client_disable_pmtu_discovery(radius->auth_serv_sock);
-		ok++;
-	}
+		port->sock = socket(PF_INET, SOCK_DGRAM, 0);
+		if (port->sock < 0)
+			wpa_printf(MSG_INFO, "RADIUS: socket[PF_INET,SOCK_DGRAM]: %s",
+				   strerror(errno));
+		else {
+			radius_client_disable_pmtu_discovery(port->sock);
+			ok++;
+		}
 
 #ifdef CONFIG_IPV6
-	radius->auth_serv_sock6 = socket(PF_INET6, SOCK_DGRAM, 0);
-	if (radius->auth_serv_sock6 < 0)
-		wpa_printf(MSG_INFO, "RADIUS: socket[PF_INET6,SOCK_DGRAM]: %s",
-			   strerror(errno));
-	else
-		ok++;
+		port->sock6 = socket(PF_INET6, SOCK_DGRAM, 0);
+		if (port->sock6 < 0)
+			wpa_printf(MSG_INFO, "RADIUS: socket[PF_INET6,SOCK_DGRAM]: %s",
+				   strerror(errno));
+		else
+			ok++;
 #endif /* CONFIG_IPV6 */
 
-	if (ok == 0)
-		return -1;
-
-	radius_change_server(radius, conf->auth_server, NULL,
-			     radius->auth_serv_sock, radius->auth_serv_sock6,
-			     1);
+		if (ok == 0)
+			return -1;
+	}
 
-	if (radius->auth_serv_sock >= 0 &&
-	    eloop_register_read_sock(radius->auth_serv_sock,
-				     radius_client_receive, radius,
-				     (void *) RADIUS_AUTH)) {
-		wpa_printf(MSG_INFO, "RADIUS: Could not register read socket for authentication server");
-		radius_close_auth_sockets(radius);
-		return -1;
+	radius_change_server(radius, serv, NULL, auth);
+
+	for (i = 0; i < radius->num_ports; i++) {
+		port = &ports[i];
+		if ((port->sock >= 0 &&
+		     eloop_register_read_sock(port->sock,
+					      radius_client_receive, radius,
+					      port)) ||
+		    (port->sock6 >= 0 &&
+		     eloop_register_read_sock(port->sock6,
+					      radius_client_receive, radius,
+					      port))) {
+			wpa_printf(MSG_INFO, "RADIUS: Could not register read socket for %s server",
+				   auth ? "authentication" : "accounting");
+			return -1;
+		}
 	}
 
-#ifdef CONFIG_IPV6
-	if (radius->auth_serv_sock6 >= 0 &&
-	    eloop_register_read_sock(radius->auth_serv_sock6,
-				     radius_client_receive, radius,
-				     (void *) RADIUS_AUTH)) {
-		wpa_printf(MSG_INFO, "RADIUS: Could not register read socket for authentication server");
+	return 0;
+}
+
+
+static int radius_client_init_auth(struct radius_client_data *radius)
+{
+	radius_close_auth_sockets(radius);
+
+	if (radius_client_open_ports(radius, radius->auth_ports,
+				     radius->conf->auth_server, 1) < 0) {
 		radius_close_auth_sockets(radius);
 		return -1;
 	}
-#endif /* CONFIG_IPV6 */
 
 	return 0;
 }
@@ -1319,57 +1531,35 @@ static int radius_client_init_auth(struct radius_client_data *radius)
 
 static int radius_client_init_acct(struct radius_client_data *radius)
 {
-	struct hostapd_radius_servers *conf = radius->conf;
-	int ok = 0;
-
 	radius_close_acct_sockets(radius);
 
-	radius->acct_serv_sock = socket(PF_INET, SOCK_DGRAM, 0);
-	if (radius->acct_serv_sock < 0)
-		wpa_printf(MSG_INFO, "RADIUS: socket[PF_INET,SOCK_DGRAM]: %s",
-			   strerror(errno));
-	else {
-		radius_client_disable_pmtu_discovery(radius->acct_serv_sock);
-		ok++;
+	if (radius_client_open_ports(radius, radius->acct_ports,
+				     radius->conf->acct_server, 0) < 0) {
+		radius_close_acct_sockets(radius);
+		return -1;
 	}
 
-#ifdef CONFIG_IPV6
-	radius->acct_serv_sock6 = socket(PF_INET6, SOCK_DGRAM, 0);
-	if (radius->acct_serv_sock6 < 0)
-		wpa_printf(MSG_INFO, "RADIUS: socket[PF_INET6,SOCK_DGRAM]: %s",
-			   strerror(errno));
-	else
-		ok++;
-#endif /* CONFIG_IPV6 */
+	return 0;
+}
 
-	if (ok == 0)
-		return -1;
 
-	radius_change_server(radius, conf->acct_server, NULL,
-			     radius->acct_serv_sock, radius->acct_serv_sock6,
-			     0);
+static struct radius_client_port *
+radius_client_alloc_ports(struct radius_client_data *radius, RadiusType type)
+{
+	struct radius_client_port *ports;
+	size_t i;
 
-	if (radius->acct_serv_sock >= 0 &&
-	    eloop_register_read_sock(radius->acct_serv_sock,
-				     radius_client_receive, radius,
-				     (void *) RADIUS_ACCT)) {
-		wpa_printf(MSG_INFO, "RADIUS: Could not register read socket for accounting server");
-		radius_close_acct_sockets(radius);
-		return -1;
-	}
+	ports = os_calloc(radius->num_ports, sizeof(*ports));
+	if (ports == NULL)
+		return NULL;
 
-#ifdef CONFIG_IPV6
-	if (radius->acct_serv_sock6 >= 0 &&
-	    eloop_register_read_sock(radius->acct_serv_sock6,
-				     radius_client_receive, radius,
-				     (void *) RADIUS_ACCT)) {
-		wpa_printf(MSG_INFO, "RADIUS: Could not register read socket for accounting server");
-		radius_close_acct_sockets(radius);
-		return -1;
+	for (i = 0; i < radius->num_ports; i++) {
+		ports[i].radius = radius;
+		ports[i].type = type;
+		ports[i].sock = ports[i].sock6 = ports[i].cur = -1;
 	}
-#endif /* CONFIG_IPV6 */
 
-	return 0;
+	return ports;
 }
 
 
@@ -1394,9 +1584,25 @@ radius_client_init(void *ctx, struct hostapd_radius_servers *conf)
 
 	radius->ctx = ctx;
 	radius->conf = conf;
-	radius->auth_serv_sock = radius->acct_serv_sock =
-		radius->auth_serv_sock6 = radius->acct_serv_sock6 =
-		radius->auth_sock = radius->acct_sock = -1;
+	dl_list_init(&radius->msgs);
+	dl_list_init(&radius->queue);
+
+	radius->max_msgs = conf->max_pending > 0 ? conf->max_pending :
+		RADIUS_CLIENT_MAX_ENTRIES;
+	radius->num_ports = (radius->max_msgs + RADIUS_CLIENT_NUM_IDS - 1) /
+		RADIUS_CLIENT_NUM_IDS;
+	if (radius->num_ports > RADIUS_CLIENT_MAX_PORTS) {
+		radius->num_ports = RADIUS_CLIENT_MAX_PORTS;
+		radius->max_msgs = RADIUS_CLIENT_MAX_PORTS *
+			RADIUS_CLIENT_NUM_IDS;
+	}
+
+	radius->auth_ports = radius_client_alloc_ports(radius, RADIUS_AUTH);
+	radius->acct_ports = radius_client_alloc_ports(radius, RADIUS_ACCT);
+	if (radius->auth_ports == NULL || radius->acct_ports == NULL) {
+		radius_client_deinit(radius);
+		return NULL;
+	}
 
 	if (conf->auth_server && radius_client_init_auth(radius)) {
 		radius_client_deinit(radius);
@@ -1426,18 +1632,44 @@ void radius_client_deinit(struct radius_client_data *radius)
 	if (!radius)
 		return;
 
-	radius_close_auth_sockets(radius);
-	radius_close_acct_sockets(radius);
+	if (radius->auth_ports)
+		radius_close_auth_sockets(radius);
+	if (radius->acct_ports)
+		radius_close_acct_sockets(radius);
 
 	eloop_cancel_timeout(radius_retry_primary_timer, radius, NULL);
 
 	radius_client_flush(radius, 0);
+	eloop_cancel_timeout(radius_client_timer, radius, NULL);
+	os_free(radius->auth_ports);
+	os_free(radius->acct_ports);
 	os_free(radius->auth_handlers);
 	os_free(radius->acct_handlers);
 	os_free(radius);
 }
 
 
+static void radius_client_flush_auth_from(struct radius_client_data *radius,
+					  struct dl_list *list,
+					  const u8 *addr)
+{
+	struct radius_msg_list *entry, *tmp;
+
+	dl_list_for_each_safe(entry, tmp, list, struct radius_msg_list,
+			      list) {
+		if (entry->msg_type == RADIUS_AUTH &&
+		    os_memcmp(entry->addr, addr, ETH_ALEN) == 0) {
+			hostapd_logger(radius->ctx, addr,
+				       HOSTAPD_MODULE_RADIUS,
+				       HOSTAPD_LEVEL_DEBUG,
+				       "Removing pending RADIUS authentication"
+				       " message for removed client");
+			radius_client_msg_remove(radius, entry);
+		}
+	}
+}
+
+
 /**
  * radius_client_flush_auth - Flush pending RADIUS messages for an address
  * @radius: RADIUS client context from radius_client_init()
@@ -1451,34 +1683,28 @@ void radius_client_deinit(struct radius_client_data *radius)
 void radius_client_flush_auth(struct radius_client_data *radius,
 			      const u8 *addr)
 {
-	struct radius_msg_list *entry, *prev, *tmp;
-
-	prev = NULL;
-	entry = radius->msgs;
-	while (entry) {
-		if (entry->msg_type == RADIUS_AUTH &&
-		    os_memcmp(entry->addr, addr, ETH_ALEN) == 0) {
-			hostapd_logger(radius->ctx, addr,
-				       HOSTAPD_MODULE_RADIUS,
-				       HOSTAPD_LEVEL_DEBUG,
-				       "Removing pending RADIUS authentication"
-				       " message for removed client");
+	radius_client_flush_auth_from(radius, &radius->msgs, addr);
+	radius_client_flush_auth_from(radius, &radius->queue, addr);
+	radius_client_send_queued(radius);
+}
 
-			if (prev)
-				prev->next = entry->next;
-			else
-				radius->msgs = entry->next;
 
-			tmp = entry;
-			entry = entry->next;
-			radius_client_msg_free(tmp);
-			radius->num_msgs--;
-			continue;
-		}
+/* Number of pending and queued messages of the given server type */
+static int radius_client_num_pending(struct radius_client_data *cli, int auth)
+{
+	struct radius_msg_list *msg;
+	int pending = 0;
 
-		prev = entry;
-		entry = entry->next;
+	dl_list_for_each(msg, &cli->msgs, struct radius_msg_list, list) {
+		if ((msg->msg_type == RADIUS_AUTH) == auth)
+			pending++;
+	}
+	dl_list_for_each(msg, &cli->queue, struct radius_msg_list, list) {
+		if ((msg->msg_type == RADIUS_AUTH) == auth)
+			pending++;
 	}
+
+	return pending;
 }
 
 
@@ -1487,15 +1713,10 @@ static int radius_client_dump_auth_server(char *buf, size_t buflen,
 					  struct radius_client_data *cli)
 {
 	int pending = 0;
-	struct radius_msg_list *msg;
 	char abuf[50];
 
-	if (cli) {
-		for (msg = cli->msgs; msg; msg = msg->next) {
-			if (msg->msg_type == RADIUS_AUTH)
-				pending++;
-		}
-	}
+	if (cli)
+		pending = radius_client_num_pending(cli, 1);
 
 	return os_snprintf(buf, buflen,
 			   "radiusAuthServerIndex=%d\n"
@@ -1536,16 +1757,10 @@ static int radius_client_dump_acct_server(char *buf, size_t buflen,
 					  struct radius_client_data *cli)
 {
 	int pending = 0;
-	struct radius_msg_list *msg;
 	char abuf[50];
 
-	if (cli) {
-		for (msg = cli->msgs; msg; msg = msg->next) {
-			if (msg->msg_type == RADIUS_ACCT ||
-			    msg->msg_type == RADIUS_ACCT_INTERIM)
-				pending++;
-		}
-	}
+	if (cli)
+		pending = radius_client_num_pending(cli, 0);
 
 	return os_snprintf(buf, buflen,
 			   "radiusAccServerIndex=%d\n"
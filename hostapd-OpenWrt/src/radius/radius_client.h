@@ -174,6 +174,17 @@ struct hostapd_radius_servers {
 	 * force_client_addr - Whether to force client (local) address
 	 */
 	int force_client_addr;
+
+	/**
+	 * max_pending - Maximum number of requests waiting for a response
+	 *
+	 * Further requests are queued and sent as responses arrive or pending
+	 * requests time out. Each UDP source port of the RADIUS client has
+	 * its own identifier space of 256 requests, so this also selects the
+	 * number of source ports opened per server type. 0 = use the default
+	 * of 30.
+	 */
+	int max_pending;
 };
 
 
@@ -9,6 +9,7 @@
 #include "includes.h"
 #include <net/if.h>
 #ifdef CONFIG_SQLITE
+#include <pthread.h>
 #include <sqlite3.h>
 #endif /* CONFIG_SQLITE */
 
@@ -26,10 +27,49 @@
 #define RADIUS_SESSION_TIMEOUT 60
 
 /**
- * RADIUS_MAX_SESSION - Maximum number of active sessions
+ * RADIUS_MAX_SESSION - Default maximum number of active sessions
+ *
+ * Used if radius_server_conf::max_sessions is not set.
  */
 #define RADIUS_MAX_SESSION 100
 
+/**
+ * RADIUS_SESSION_HASH_MAX_BITS - Maximum size of the session hash table
+ */
+#define RADIUS_SESSION_HASH_MAX_BITS 16
+
+#ifdef CONFIG_SQLITE
+/**
+ * RADIUS_AUTHLOG_BATCH - Maximum number of authlog entries per transaction
+ */
+#define RADIUS_AUTHLOG_BATCH 256
+
+/**
+ * RADIUS_AUTHLOG_DELAY_MS - Time to collect authlog entries before a commit
+ */
+#define RADIUS_AUTHLOG_DELAY_MS 500
+
+/**
+ * RADIUS_AUTHLOG_MAX_QUEUED - Maximum number of uncommitted authlog entries
+ *
+ * If the database falls this far behind, new entries are dropped.
+ */
+#define RADIUS_AUTHLOG_MAX_QUEUED 10000
+
+/**
+ * RADIUS_AUTHLOG_BUSY_TIMEOUT_MS - Time to wait for a lock on the database
+ *
+ * The database file may also be read by another connection, e.g., for EAP
+ * user lookups.
+ */
+#define RADIUS_AUTHLOG_BUSY_TIMEOUT_MS 1000
+
+/**
+ * RADIUS_AUTHLOG_COMMIT_RETRIES - Attempts to commit a locked database
+ */
+#define RADIUS_AUTHLOG_COMMIT_RETRIES 10
+#endif /* CONFIG_SQLITE */
+
 /**
  * RADIUS_MAX_MSG_LEN - Maximum message length for incoming RADIUS messages
  */
@@ -67,7 +107,8 @@ struct radius_server_counters {
  * struct radius_session - Internal RADIUS server data for a session
  */
 struct radius_session {
-	struct radius_session *next;
+	struct dl_list list; /* radius_client::sessions */
+	struct radius_session *hnext; /* radius_server_data::sess_hash chain */
 	struct radius_client *client;
 	struct radius_server_data *server;
 	unsigned int sess_id;
@@ -102,12 +143,40 @@ struct radius_client {
 	struct in6_addr addr6;
 	struct in6_addr mask6;
 #endif /* CONFIG_IPV6 */
+	int prefix_len;
 	char *shared_secret;
 	int shared_secret_len;
-	struct radius_session *sessions;
+	struct dl_list sessions; /* struct radius_session */
+	int num_sess;
 	struct radius_server_counters counters;
 };
 
+/**
+ * struct radius_client_node - Node in the RADIUS client prefix trie
+ *
+ * The trie has one level per address bit. A node at depth n that has
+ * @client set matches all addresses whose first n bits are the path to the
+ * node, so a lookup returns the client with the longest matching prefix.
+ */
+struct radius_client_node {
+	struct radius_client_node *child[2];
+	struct radius_client *client;
+};
+
+#ifdef CONFIG_SQLITE
+/**
+ * struct radius_authlog_entry - Queued authlog database row
+ */
+struct radius_authlog_entry {
+	struct dl_list list;
+	char timestamp[24];
+	unsigned int sess_id;
+	char *nas_ip;
+	char *username;
+	char note[];
+};
+#endif /* CONFIG_SQLITE */
+
 /**
  * struct radius_server_data - Internal RADIUS server data
  */
@@ -127,6 +196,11 @@ struct radius_server_data {
 	 */
 	struct radius_client *clients;
 
+	/**
+	 * client_trie - Prefix trie of the clients for address lookup
+	 */
+	struct radius_client_node *client_trie;
+
 	/**
 	 * next_sess_id - Next session identifier
 	 */
@@ -144,6 +218,28 @@ struct radius_server_data {
 	 */
 	int num_sess;
 
+	/**
+	 * max_sessions - Maximum number of active sessions
+	 */
+	int max_sessions;
+
+	/**
+	 * max_sessions_per_client - Maximum number of sessions per client
+	 *
+	 * 0 = no separate limit.
+	 */
+	int max_sessions_per_client;
+
+	/**
+	 * sess_hash - Active sessions hashed by session identifier
+	 */
+	struct radius_session **sess_hash;
+
+	/**
+	 * sess_hash_mask - Number of sess_hash buckets minus one
+	 */
+	unsigned int sess_hash_mask;
+
 	/**
 	 * eap_sim_db_priv - EAP-SIM/AKA database context
 	 *
@@ -339,6 +435,19 @@ struct radius_server_data {
 
 #ifdef CONFIG_SQLITE
 	sqlite3 *db;
+
+	/*
+	 * Write-behind authlog; db is only used by the authlog thread once it
+	 * has been started. The other fields are protected by authlog_lock.
+	 */
+	pthread_t authlog_thread;
+	int authlog_started;
+	pthread_mutex_t authlog_lock;
+	pthread_cond_t authlog_cond;
+	struct dl_list authlog; /* struct radius_authlog_entry */
+	unsigned int authlog_queued;
+	unsigned int authlog_dropped;
+	int authlog_stop;
 #endif /* CONFIG_SQLITE */
 };
 
@@ -357,6 +466,227 @@ static void radius_server_session_timeout(void *eloop_ctx, void *timeout_ctx);
 static void radius_server_session_remove_timeout(void *eloop_ctx,
 						 void *timeout_ctx);
 
+#ifdef CONFIG_SQLITE
+
+static void radius_authlog_entry_free(struct radius_authlog_entry *entry)
+{
+	os_free(entry->nas_ip);
+	os_free(entry->username);
+	os_free(entry);
+}
+
+
+/* Returns: Number of entries of @batch that could not be written */
+static unsigned int radius_authlog_commit(sqlite3 *db, sqlite3_stmt *stmt,
+					  struct dl_list *batch)
+{
+	struct radius_authlog_entry *entry;
+	unsigned int count, failed = 0;
+	int res, retry;
+
+	count = dl_list_len(batch);
+	if (sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+		RADIUS_ERROR("Failed to start authlog transaction: %s",
+			     sqlite3_errmsg(db));
+		return count;
+	}
+
+	dl_list_for_each(entry, batch, struct radius_authlog_entry, list) {
+		sqlite3_bind_text(stmt, 1, entry->timestamp, -1,
+				  SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, entry->sess_id);
+		sqlite3_bind_text(stmt, 3, entry->nas_ip, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 4, entry->username, -1,
+				  SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 5, entry->note, -1, SQLITE_STATIC);
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			RADIUS_ERROR("Failed to add authlog entry into sqlite database: %s",
+				     sqlite3_errmsg(db));
+			failed++;
+		}
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+
+	/* The transaction stays open when COMMIT is busy, so try again */
+	for (retry = 0; ; retry++) {
+		res = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+		if (res != SQLITE_BUSY || retry >= RADIUS_AUTHLOG_COMMIT_RETRIES)
+			break;
+		RADIUS_DEBUG("authlog database busy; retrying commit");
+	}
+	if (res != SQLITE_OK) {
+		RADIUS_ERROR("Failed to commit authlog entries: %s",
+			     sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+		return count;
+	}
+
+	return failed;
+}
+
+
+static void * radius_authlog_thread(void *arg)
+{
+	struct radius_server_data *data = arg;
+	struct radius_authlog_entry *entry;
+	struct dl_list batch;
+	sqlite3_stmt *stmt = NULL;
+	struct timespec ts;
+	unsigned int count, lost = 0;
+	int stop;
+
+	if (sqlite3_prepare_v2(data->db,
+			       "INSERT INTO authlog"
+			       "(timestamp,session,nas_ip,username,note)"
+			       " VALUES (?,?,?,?,?)", -1, &stmt, NULL) !=
+	    SQLITE_OK) {
+		RADIUS_ERROR("Failed to prepare authlog statement: %s",
+			     sqlite3_errmsg(data->db));
+		stmt = NULL;
+	}
+
+	dl_list_init(&batch);
+	pthread_mutex_lock(&data->authlog_lock);
+	for (;;) {
+		while (!data->authlog_stop && dl_list_empty(&data->authlog))
+			pthread_cond_wait(&data->authlog_cond,
+					  &data->authlog_lock);
+
+		/* Give a burst of messages some time to share a transaction */
+		if (!data->authlog_stop &&
+		    data->authlog_queued < RADIUS_AUTHLOG_BATCH) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += RADIUS_AUTHLOG_DELAY_MS * 1000000L;
+			ts.tv_sec += ts.tv_nsec / 1000000000L;
+			ts.tv_nsec %= 1000000000L;
+			while (!data->authlog_stop &&
+			       data->authlog_queued < RADIUS_AUTHLOG_BATCH &&
+			       pthread_cond_timedwait(&data->authlog_cond,
+						      &data->authlog_lock,
+						      &ts) == 0)
+				;
+		}
+
+		count = 0;
+		while (count < RADIUS_AUTHLOG_BATCH &&
+		       (entry = dl_list_first(&data->authlog,
+					      struct radius_authlog_entry,
+					      list))) {
+			dl_list_del(&entry->list);
+			dl_list_add_tail(&batch, &entry->list);
+			count++;
+		}
+		data->authlog_queued -= count;
+		stop = data->authlog_stop && dl_list_empty(&data->authlog);
+		pthread_mutex_unlock(&data->authlog_lock);
+
+		if (stmt && count)
+			lost = radius_authlog_commit(data->db, stmt, &batch);
+		else
+			lost = count;
+		while ((entry = dl_list_first(&batch,
+					      struct radius_authlog_entry,
+					      list))) {
+			dl_list_del(&entry->list);
+			radius_authlog_entry_free(entry);
+		}
+
+		pthread_mutex_lock(&data->authlog_lock);
+		data->authlog_dropped += lost;
+		if (stop)
+			break;
+	}
+	pthread_mutex_unlock(&data->authlog_lock);
+
+	sqlite3_finalize(stmt);
+	return NULL;
+}
+
+
+static int radius_authlog_start(struct radius_server_data *data)
+{
+	dl_list_init(&data->authlog);
+	pthread_mutex_init(&data->authlog_lock, NULL);
+	pthread_cond_init(&data->authlog_cond, NULL);
+	if (pthread_create(&data->authlog_thread, NULL, radius_authlog_thread,
+			   data) != 0) {
+		RADIUS_ERROR("Could not start authlog thread");
+		pthread_cond_destroy(&data->authlog_cond);
+		pthread_mutex_destroy(&data->authlog_lock);
+		return -1;
+	}
+	data->authlog_started = 1;
+	return 0;
+}
+
+
+/* Write all queued entries and stop the authlog thread */
+static void radius_authlog_stop(struct radius_server_data *data)
+{
+	if (!data->authlog_started)
+		return;
+
+	pthread_mutex_lock(&data->authlog_lock);
+	data->authlog_stop = 1;
+	pthread_cond_signal(&data->authlog_cond);
+	pthread_mutex_unlock(&data->authlog_lock);
+	pthread_join(data->authlog_thread, NULL);
+	pthread_cond_destroy(&data->authlog_cond);
+	pthread_mutex_destroy(&data->authlog_lock);
+	data->authlog_started = 0;
+
+	if (data->authlog_dropped)
+		RADIUS_ERROR("%u authlog entries were dropped",
+			     data->authlog_dropped);
+}
+
+
+static void radius_authlog_add(struct radius_session *sess, const char *note)
+{
+	struct radius_server_data *data = sess->server;
+	struct radius_authlog_entry *entry;
+	struct os_time now;
+	struct os_tm tm;
+	size_t len;
+
+	len = os_strlen(note);
+	entry = os_zalloc(sizeof(*entry) + len + 1);
+	if (entry == NULL)
+		return;
+	os_memcpy(entry->note, note, len);
+	entry->sess_id = sess->sess_id;
+	if (sess->nas_ip)
+		entry->nas_ip = os_strdup(sess->nas_ip);
+	if (sess->username)
+		entry->username = os_strdup(sess->username);
+
+	/* Same format as strftime('%Y-%m-%d %H:%M:%f','now') in SQLite */
+	os_get_time(&now);
+	if (os_gmtime(now.sec, &tm) == 0)
+		os_snprintf(entry->timestamp, sizeof(entry->timestamp),
+			    "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+			    tm.year, tm.month, tm.day, tm.hour, tm.min, tm.sec,
+			    (int) (now.usec / 1000));
+
+	pthread_mutex_lock(&data->authlog_lock);
+	if (data->authlog_queued >= RADIUS_AUTHLOG_MAX_QUEUED) {
+		data->authlog_dropped++;
+		pthread_mutex_unlock(&data->authlog_lock);
+		radius_authlog_entry_free(entry);
+		return;
+	}
+	dl_list_add_tail(&data->authlog, &entry->list);
+	data->authlog_queued++;
+	if (data->authlog_queued == 1 ||
+	    data->authlog_queued >= RADIUS_AUTHLOG_BATCH)
+		pthread_cond_signal(&data->authlog_cond);
+	pthread_mutex_unlock(&data->authlog_lock);
+}
+
+#endif /* CONFIG_SQLITE */
+
+
 void srv_log(struct radius_session *sess, const char *fmt, ...)
 PRINTF_FORMAT(2, 3);
 
@@ -380,24 +710,8 @@ void srv_log(struct radius_session *sess, const char *fmt, ...)
 	RADIUS_DEBUG("[0x%x %s] %s", sess->sess_id, sess->nas_ip, buf);
 
 #ifdef CONFIG_SQLITE
-	if (sess->server->db) {
-		char *sql;
-		sql = sqlite3_mprintf("INSERT INTO authlog"
-				      "(timestamp,session,nas_ip,username,note)"
-				      " VALUES ("
-				      "strftime('%%Y-%%m-%%d %%H:%%M:%%f',"
-				      "'now'),%u,%Q,%Q,%Q)",
-				      sess->sess_id, sess->nas_ip,
-				      sess->username, buf);
-		if (sql) {
-			if (sqlite3_exec(sess->server->db, sql, NULL, NULL,
-					 NULL) != SQLITE_OK) {
-				RADIUS_ERROR("Failed to add authlog entry into sqlite database: %s",
-					     sqlite3_errmsg(sess->server->db));
-			}
-			sqlite3_free(sql);
-		}
-	}
+	if (sess->server->authlog_started)
+		radius_authlog_add(sess, buf);
 #endif /* CONFIG_SQLITE */
 
 	os_free(buf);
@@ -408,62 +722,99 @@ static struct radius_client *
 radius_server_get_client(struct radius_server_data *data, struct in_addr *addr,
 			 int ipv6)
 {
-	struct radius_client *client = data->clients;
+	struct radius_client_node *node = data->client_trie;
+	struct radius_client *client = NULL;
+	const u8 *a = (const u8 *) addr;
+	int bits = ipv6 ? 128 : 32;
+	int i;
+
+	for (i = 0; node; i++) {
+		if (node->client)
+			client = node->client;
+		if (i == bits)
+			break;
+		node = node->child[(a[i / 8] >> (7 - i % 8)) & 1];
+	}
+
+	return client;
+}
+
+
+static int radius_server_add_client(struct radius_server_data *data,
+				    struct radius_client *client)
+{
+	struct radius_client_node **node = &data->client_trie;
+	const u8 *a;
+	int i;
 
-	while (client) {
 #ifdef CONFIG_IPV6
-		if (ipv6) {
-			struct in6_addr *addr6;
-			int i;
-
-			addr6 = (struct in6_addr *) addr;
-			for (i = 0; i < 16; i++) {
-				if ((addr6->s6_addr[i] &
-				     client->mask6.s6_addr[i]) !=
-				    (client->addr6.s6_addr[i] &
-				     client->mask6.s6_addr[i])) {
-					i = 17;
-					break;
-				}
-			}
-			if (i == 16) {
-				break;
-			}
-		}
+	if (data->ipv6)
+		a = client->addr6.s6_addr;
+	else
 #endif /* CONFIG_IPV6 */
-		if (!ipv6 && (client->addr.s_addr & client->mask.s_addr) ==
-		    (addr->s_addr & client->mask.s_addr)) {
-			break;
-		}
+	a = (const u8 *) &client->addr.s_addr;
 
-		client = client->next;
+	for (i = 0; ; i++) {
+		if (*node == NULL) {
+			*node = os_zalloc(sizeof(**node));
+			if (*node == NULL)
+				return -1;
+		}
+		if (i == client->prefix_len)
+			break;
+		node = &(*node)->child[(a[i / 8] >> (7 - i % 8)) & 1];
 	}
 
-	return client;
+	/* Keep the earlier line of the client file for duplicate prefixes */
+	if ((*node)->client == NULL)
+		(*node)->client = client;
+
+	return 0;
+}
+
+
+static void radius_server_free_trie(struct radius_client_node *node)
+{
+	if (node == NULL)
+		return;
+	radius_server_free_trie(node->child[0]);
+	radius_server_free_trie(node->child[1]);
+	os_free(node);
 }
 
 
 static struct radius_session *
-radius_server_get_session(struct radius_client *client, unsigned int sess_id)
+radius_server_get_session(struct radius_server_data *data,
+			  struct radius_client *client, unsigned int sess_id)
 {
-	struct radius_session *sess = client->sessions;
+	struct radius_session *sess;
 
-	while (sess) {
-		if (sess->sess_id == sess_id) {
-			break;
-		}
-		sess = sess->next;
+	for (sess = data->sess_hash[sess_id & data->sess_hash_mask]; sess;
+	     sess = sess->hnext) {
+		if (sess->sess_id == sess_id)
+			return sess->client == client ? sess : NULL;
 	}
 
-	return sess;
+	return NULL;
 }
 
 
 static void radius_server_session_free(struct radius_server_data *data,
 				       struct radius_session *sess)
 {
+	struct radius_session **pos;
+
 	eloop_cancel_timeout(radius_server_session_timeout, data, sess);
 	eloop_cancel_timeout(radius_server_session_remove_timeout, data, sess);
+	for (pos = &data->sess_hash[sess->sess_id & data->sess_hash_mask];
+	     *pos; pos = &(*pos)->hnext) {
+		if (*pos == sess) {
+			*pos = sess->hnext;
+			break;
+		}
+	}
+	dl_list_del(&sess->list);
+	sess->client->num_sess--;
 	eap_server_sm_deinit(sess->eap);
 	radius_msg_free(sess->last_msg);
 	os_free(sess->last_from_addr);
@@ -475,39 +826,13 @@ static void radius_server_session_free(struct radius_server_data *data,
 }
 
 
-static void radius_server_session_remove(struct radius_server_data *data,
-					 struct radius_session *sess)
-{
-	struct radius_client *client = sess->client;
-	struct radius_session *session, *prev;
-
-	eloop_cancel_timeout(radius_server_session_remove_timeout, data, sess);
-
-	prev = NULL;
-	session = client->sessions;
-	while (session) {
-		if (session == sess) {
-			if (prev == NULL) {
-				client->sessions = sess->next;
-			} else {
-				prev->next = sess->next;
-			}
-			radius_server_session_free(data, sess);
-			break;
-		}
-		prev = session;
-		session = session->next;
-	}
-}
-
-
 static void radius_server_session_remove_timeout(void *eloop_ctx,
 						 void *timeout_ctx)
 {
 	struct radius_server_data *data = eloop_ctx;
 	struct radius_session *sess = timeout_ctx;
 	RADIUS_DEBUG("Removing completed session 0x%x", sess->sess_id);
-	radius_server_session_remove(data, sess);
+	radius_server_session_free(data, sess);
 }
 
 
@@ -517,7 +842,7 @@ static void radius_server_session_timeout(void *eloop_ctx, void *timeout_ctx)
 	struct radius_session *sess = timeout_ctx;
 
 	RADIUS_DEBUG("Timing out authentication session 0x%x", sess->sess_id);
-	radius_server_session_remove(data, sess);
+	radius_server_session_free(data, sess);
 }
 
 
@@ -526,13 +851,21 @@ radius_server_new_session(struct radius_server_data *data,
 			  struct radius_client *client)
 {
 	struct radius_session *sess;
+	unsigned int idx;
 
-	if (data->num_sess >= RADIUS_MAX_SESSION) {
+	if (data->num_sess >= data->max_sessions) {
 		RADIUS_DEBUG("Maximum number of existing session - no room "
 			     "for a new session");
 		return NULL;
 	}
 
+	if (data->max_sessions_per_client &&
+	    client->num_sess >= data->max_sessions_per_client) {
+		RADIUS_DEBUG("Maximum number of sessions for the client - no "
+			     "room for a new session");
+		return NULL;
+	}
+
 	sess = os_zalloc(sizeof(*sess));
 	if (sess == NULL)
 		return NULL;
@@ -540,8 +873,11 @@ radius_server_new_session(struct radius_server_data *data,
 	sess->server = data;
 	sess->client = client;
 	sess->sess_id = data->next_sess_id++;
-	sess->next = client->sessions;
-	client->sessions = sess;
+	dl_list_add(&client->sessions, &sess->list);
+	client->num_sess++;
+	idx = sess->sess_id & data->sess_hash_mask;
+	sess->hnext = data->sess_hash[idx];
+	data->sess_hash[idx] = sess;
 	eloop_register_timeout(RADIUS_SESSION_TIMEOUT, 0,
 			       radius_server_session_timeout, data, sess);
 	data->num_sess++;
@@ -1005,7 +1341,7 @@ static int radius_server_request(struct radius_server_data *data,
 		state_included = res >= 0;
 		if (res == sizeof(statebuf)) {
 			state = WPA_GET_BE32(statebuf);
-			sess = radius_server_get_session(client, state);
+			sess = radius_server_get_session(data, client, state);
 		} else {
 			sess = NULL;
 		}
@@ -1493,16 +1829,13 @@ static int radius_server_open_socket6(int port)
 
 
 static void radius_server_free_sessions(struct radius_server_data *data,
-					struct radius_session *sessions)
+					struct radius_client *client)
 {
-	struct radius_session *session, *prev;
+	struct radius_session *sess;
 
-	session = sessions;
-	while (session) {
-		prev = session;
-		session = session->next;
-		radius_server_session_free(data, prev);
-	}
+	while ((sess = dl_list_first(&client->sessions, struct radius_session,
+				     list)))
+		radius_server_session_free(data, sess);
 }
 
 
@@ -1516,7 +1849,7 @@ static void radius_server_free_clients(struct radius_server_data *data,
 		prev = client;
 		client = client->next;
 
-		radius_server_free_sessions(data, prev->sessions);
+		radius_server_free_sessions(data, prev);
 		os_free(prev->shared_secret);
 		os_free(prev);
 	}
@@ -1635,6 +1968,8 @@ radius_server_read_clients(const char *client_file, int ipv6)
 			break;
 		}
 		entry->shared_secret_len = os_strlen(entry->shared_secret);
+		entry->prefix_len = mask;
+		dl_list_init(&entry->sessions);
 		if (!ipv6) {
 			entry->addr.s_addr = addr.s_addr;
 			val = 0;
@@ -1690,6 +2025,8 @@ struct radius_server_data *
 radius_server_init(struct radius_server_conf *conf)
 {
 	struct radius_server_data *data;
+	struct radius_client *client;
+	unsigned int hash_size;
 
 #ifndef CONFIG_IPV6
 	if (conf->ipv6) {
@@ -1744,6 +2081,20 @@ radius_server_init(struct radius_server_conf *conf)
 	data->erp = conf->erp;
 	data->erp_domain = conf->erp_domain;
 
+	data->max_sessions = conf->max_sessions > 0 ? conf->max_sessions :
+		RADIUS_MAX_SESSION;
+	data->max_sessions_per_client = conf->max_sessions_per_client;
+	hash_size = 16;
+	while (hash_size < (unsigned int) data->max_sessions &&
+	       hash_size < (1U << RADIUS_SESSION_HASH_MAX_BITS))
+		hash_size <<= 1;
+	data->sess_hash = os_calloc(hash_size, sizeof(*data->sess_hash));
+	if (data->sess_hash == NULL) {
+		radius_server_deinit(data);
+		return NULL;
+	}
+	data->sess_hash_mask = hash_size - 1;
+
 	if (conf->subscr_remediation_url) {
 		data->subscr_remediation_url =
 			os_strdup(conf->subscr_remediation_url);
@@ -1758,6 +2109,11 @@ radius_server_init(struct radius_server_conf *conf)
 			radius_server_deinit(data);
 			return NULL;
 		}
+		sqlite3_busy_timeout(data->db, RADIUS_AUTHLOG_BUSY_TIMEOUT_MS);
+		if (radius_authlog_start(data) < 0) {
+			radius_server_deinit(data);
+			return NULL;
+		}
 	}
 #endif /* CONFIG_SQLITE */
 
@@ -1773,6 +2129,12 @@ radius_server_init(struct radius_server_conf *conf)
 		radius_server_deinit(data);
 		return NULL;
 	}
+	for (client = data->clients; client; client = client->next) {
+		if (radius_server_add_client(data, client) < 0) {
+			radius_server_deinit(data);
+			return NULL;
+		}
+	}
 
 #ifdef CONFIG_IPV6
 	if (conf->ipv6)
@@ -1857,6 +2219,8 @@ void radius_server_deinit(struct radius_server_data *data)
 	}
 
 	radius_server_free_clients(data, data->clients);
+	radius_server_free_trie(data->client_trie);
+	os_free(data->sess_hash);
 
 	os_free(data->pac_opaque_encr_key);
 	os_free(data->eap_fast_a_id);
@@ -1868,6 +2232,7 @@ void radius_server_deinit(struct radius_server_data *data)
 	os_free(data->subscr_remediation_url);
 
 #ifdef CONFIG_SQLITE
+	radius_authlog_stop(data);
 	if (data->db)
 		sqlite3_close(data->db);
 #endif /* CONFIG_SQLITE */
@@ -2127,7 +2492,8 @@ void radius_server_eap_pending_cb(struct radius_server_data *data, void *ctx)
 		return;
 
 	for (cli = data->clients; cli; cli = cli->next) {
-		for (s = cli->sessions; s; s = s->next) {
+		dl_list_for_each(s, &cli->sessions, struct radius_session,
+				 list) {
 			if (s->eap == ctx && s->last_msg) {
 				sess = s;
 				break;
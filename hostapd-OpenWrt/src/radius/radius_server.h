@@ -35,15 +35,35 @@ struct radius_server_conf {
 	 * with an optional address mask to allow full network to be specified
 	 * (e.g., 192.168.1.2 or 192.168.1.0/24). This is followed by white
 	 * space (space or tabulator) and the shared secret. Lines starting
-	 * with '#' are skipped and can be used as comments.
+	 * with '#' are skipped and can be used as comments. If the networks of
+	 * several lines contain the address of a request, the line with the
+	 * longest prefix is used.
 	 */
 	char *client_file;
 
 	/**
 	 * sqlite_file - SQLite database for storing debug log information
+	 *
+	 * Entries are added to the authlog table by a separate thread in
+	 * batched transactions, so they may appear with a short delay.
 	 */
 	const char *sqlite_file;
 
+	/**
+	 * max_sessions - Maximum number of active authentication sessions
+	 *
+	 * 0 = use the default (100).
+	 */
+	int max_sessions;
+
+	/**
+	 * max_sessions_per_client - Maximum number of sessions per RADIUS client
+	 *
+	 * This prevents a single busy client from using all sessions. 0 = no
+	 * limit other than max_sessions.
+	 */
+	int max_sessions_per_client;
+
 	/**
 	 * conf_ctx - Context pointer for callbacks
 	 *
@@ -22,6 +22,19 @@
 #define CONFIG_ELOOP_SELECT
 #endif
 
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+/*
+ * Timeouts are kept in a binary min-heap ordered by expiry time and are also
+ * linked into a hash table keyed by (handler, eloop_data, user_data), so that
+ * registering, cancelling and looking up a timeout does not need to walk all
+ * the registered timeouts.
+ */
+#define ELOOP_TIMEOUT_BUCKETS 1024
+#else /* CONFIG_ELOOP_TIMER_HEAP */
+/* All timeouts are in a single list sorted by expiry time */
+#define ELOOP_TIMEOUT_BUCKETS 1
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
+
 #ifdef CONFIG_ELOOP_POLL
 #include <poll.h>
 #endif /* CONFIG_ELOOP_POLL */
@@ -46,6 +59,10 @@ struct eloop_timeout {
 	void *eloop_data;
 	void *user_data;
 	eloop_timeout_handler handler;
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+	size_t heap_pos;
+	unsigned int seq;
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
 	WPA_TRACE_REF(eloop);
 	WPA_TRACE_REF(user);
 	WPA_TRACE_INFO
@@ -89,7 +106,13 @@ struct eloop_data {
 	struct eloop_sock_table writers;
 	struct eloop_sock_table exceptions;
 
-	struct dl_list timeout;
+	struct dl_list timeout[ELOOP_TIMEOUT_BUCKETS];
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+	struct eloop_timeout **timeout_heap;
+	size_t timeout_heap_len;
+	size_t timeout_heap_size;
+	unsigned int timeout_seq;
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
 
 	int signal_count;
 	struct eloop_signal *signals;
@@ -147,8 +170,11 @@ static void eloop_trace_sock_remove_ref(struct eloop_sock_table *table)
 
 int eloop_init(void)
 {
+	int i;
+
 	os_memset(&eloop, 0, sizeof(eloop));
-	dl_list_init(&eloop.timeout);
+	for (i = 0; i < ELOOP_TIMEOUT_BUCKETS; i++)
+		dl_list_init(&eloop.timeout[i]);
 #ifdef CONFIG_ELOOP_EPOLL
 	eloop.epollfd = epoll_create1(0);
 	if (eloop.epollfd < 0) {
@@ -601,11 +627,156 @@ void eloop_unregister_sock(int sock, eloop_event_type type)
 }
 
 
+static struct dl_list * eloop_timeout_bucket(eloop_timeout_handler handler,
+					     void *eloop_data, void *user_data)
+{
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+	unsigned long h;
+
+	h = (unsigned long) handler ^ ((unsigned long) eloop_data * 31) ^
+		((unsigned long) user_data * 131);
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return &eloop.timeout[h % ELOOP_TIMEOUT_BUCKETS];
+#else /* CONFIG_ELOOP_TIMER_HEAP */
+	return &eloop.timeout[0];
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
+}
+
+
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+
+/* Timeouts with the same expiry time run in the order they were registered */
+static int eloop_timeout_before(struct eloop_timeout *a,
+				struct eloop_timeout *b)
+{
+	if (a->time.sec != b->time.sec || a->time.usec != b->time.usec)
+		return os_reltime_before(&a->time, &b->time);
+	return (int) (a->seq - b->seq) < 0;
+}
+
+
+static void eloop_timeout_heap_set(size_t pos, struct eloop_timeout *timeout)
+{
+	eloop.timeout_heap[pos] = timeout;
+	timeout->heap_pos = pos;
+}
+
+
+static void eloop_timeout_heap_up(size_t pos)
+{
+	struct eloop_timeout *timeout = eloop.timeout_heap[pos];
+
+	while (pos > 0) {
+		size_t parent = (pos - 1) / 2;
+
+		if (!eloop_timeout_before(timeout, eloop.timeout_heap[parent]))
+			break;
+		eloop_timeout_heap_set(pos, eloop.timeout_heap[parent]);
+		pos = parent;
+	}
+	eloop_timeout_heap_set(pos, timeout);
+}
+
+
+static void eloop_timeout_heap_down(size_t pos)
+{
+	struct eloop_timeout *timeout = eloop.timeout_heap[pos];
+	size_t child;
+
+	while ((child = 2 * pos + 1) < eloop.timeout_heap_len) {
+		if (child + 1 < eloop.timeout_heap_len &&
+		    eloop_timeout_before(eloop.timeout_heap[child + 1],
+					 eloop.timeout_heap[child]))
+			child++;
+		if (!eloop_timeout_before(eloop.timeout_heap[child], timeout))
+			break;
+		eloop_timeout_heap_set(pos, eloop.timeout_heap[child]);
+		pos = child;
+	}
+	eloop_timeout_heap_set(pos, timeout);
+}
+
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
+
+
+static int eloop_timeout_insert(struct eloop_timeout *timeout)
+{
+	struct dl_list *bucket;
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+	struct eloop_timeout **heap;
+	size_t size;
+
+	if (eloop.timeout_heap_len == eloop.timeout_heap_size) {
+		size = eloop.timeout_heap_size ? eloop.timeout_heap_size * 2 :
+			16;
+		heap = os_realloc_array(eloop.timeout_heap, size,
+					sizeof(struct eloop_timeout *));
+		if (heap == NULL)
+			return -1;
+		eloop.timeout_heap = heap;
+		eloop.timeout_heap_size = size;
+	}
+	timeout->seq = eloop.timeout_seq++;
+	eloop.timeout_heap[eloop.timeout_heap_len] = timeout;
+	eloop_timeout_heap_up(eloop.timeout_heap_len++);
+
+	bucket = eloop_timeout_bucket(timeout->handler, timeout->eloop_data,
+				      timeout->user_data);
+	dl_list_add_tail(bucket, &timeout->list);
+#else /* CONFIG_ELOOP_TIMER_HEAP */
+	struct eloop_timeout *tmp;
+
+	/* Maintain timeouts in order of increasing time */
+	bucket = &eloop.timeout[0];
+	dl_list_for_each(tmp, bucket, struct eloop_timeout, list) {
+		if (os_reltime_before(&timeout->time, &tmp->time)) {
+			dl_list_add(tmp->list.prev, &timeout->list);
+			return 0;
+		}
+	}
+	dl_list_add_tail(bucket, &timeout->list);
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
+
+	return 0;
+}
+
+
+/* Returns the timeout that expires first, or %NULL if there are none */
+static struct eloop_timeout * eloop_timeout_first(void)
+{
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+	return eloop.timeout_heap_len ? eloop.timeout_heap[0] : NULL;
+#else /* CONFIG_ELOOP_TIMER_HEAP */
+	return dl_list_first(&eloop.timeout[0], struct eloop_timeout, list);
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
+}
+
+
+static struct eloop_timeout * eloop_timeout_find(eloop_timeout_handler handler,
+						 void *eloop_data,
+						 void *user_data)
+{
+	struct eloop_timeout *tmp;
+
+	dl_list_for_each(tmp, eloop_timeout_bucket(handler, eloop_data,
+						   user_data),
+			 struct eloop_timeout, list) {
+		if (tmp->handler == handler &&
+		    tmp->eloop_data == eloop_data &&
+		    tmp->user_data == user_data)
+			return tmp;
+	}
+
+	return NULL;
+}
+
+
 int eloop_register_timeout(unsigned int secs, unsigned int usecs,
 			   eloop_timeout_handler handler,
 			   void *eloop_data, void *user_data)
 {
-	struct eloop_timeout *timeout, *tmp;
+	struct eloop_timeout *timeout;
 	os_time_t now_sec;
 
 	timeout = os_zalloc(sizeof(*timeout));
@@ -635,25 +806,34 @@ int eloop_register_timeout(unsigned int secs, unsigned int usecs,
 	timeout->eloop_data = eloop_data;
 	timeout->user_data = user_data;
 	timeout->handler = handler;
+	if (eloop_timeout_insert(timeout) < 0) {
+		os_free(timeout);
+		return -1;
+	}
 	wpa_trace_add_ref(timeout, eloop, eloop_data);
 	wpa_trace_add_ref(timeout, user, user_data);
 	wpa_trace_record(timeout);
 
-	/* Maintain timeouts in order of increasing time */
-	dl_list_for_each(tmp, &eloop.timeout, struct eloop_timeout, list) {
-		if (os_reltime_before(&timeout->time, &tmp->time)) {
-			dl_list_add(tmp->list.prev, &timeout->list);
-			return 0;
-		}
-	}
-	dl_list_add_tail(&eloop.timeout, &timeout->list);
-
 	return 0;
 }
 
 
 static void eloop_remove_timeout(struct eloop_timeout *timeout)
 {
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+	size_t pos = timeout->heap_pos;
+
+	if (pos != --eloop.timeout_heap_len) {
+		eloop_timeout_heap_set(pos,
+				       eloop.timeout_heap[eloop.timeout_heap_len]);
+		if (pos > 0 &&
+		    eloop_timeout_before(eloop.timeout_heap[pos],
+					 eloop.timeout_heap[(pos - 1) / 2]))
+			eloop_timeout_heap_up(pos);
+		else
+			eloop_timeout_heap_down(pos);
+	}
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
 	dl_list_del(&timeout->list);
 	wpa_trace_remove_ref(timeout, eloop, timeout->eloop_data);
 	wpa_trace_remove_ref(timeout, user, timeout->user_data);
@@ -665,17 +845,29 @@ int eloop_cancel_timeout(eloop_timeout_handler handler,
 			 void *eloop_data, void *user_data)
 {
 	struct eloop_timeout *timeout, *prev;
+	struct dl_list *bucket, *last;
 	int removed = 0;
 
-	dl_list_for_each_safe(timeout, prev, &eloop.timeout,
-			      struct eloop_timeout, list) {
-		if (timeout->handler == handler &&
-		    (timeout->eloop_data == eloop_data ||
-		     eloop_data == ELOOP_ALL_CTX) &&
-		    (timeout->user_data == user_data ||
-		     user_data == ELOOP_ALL_CTX)) {
-			eloop_remove_timeout(timeout);
-			removed++;
+	if (eloop_data == ELOOP_ALL_CTX || user_data == ELOOP_ALL_CTX) {
+		/* Wildcards can be in any bucket */
+		bucket = &eloop.timeout[0];
+		last = &eloop.timeout[ELOOP_TIMEOUT_BUCKETS - 1];
+	} else {
+		bucket = last = eloop_timeout_bucket(handler, eloop_data,
+						     user_data);
+	}
+
+	for (; bucket <= last; bucket++) {
+		dl_list_for_each_safe(timeout, prev, bucket,
+				      struct eloop_timeout, list) {
+			if (timeout->handler == handler &&
+			    (timeout->eloop_data == eloop_data ||
+			     eloop_data == ELOOP_ALL_CTX) &&
+			    (timeout->user_data == user_data ||
+			     user_data == ELOOP_ALL_CTX)) {
+				eloop_remove_timeout(timeout);
+				removed++;
+			}
 		}
 	}
 
@@ -687,24 +879,19 @@ int eloop_cancel_timeout_one(eloop_timeout_handler handler,
 			     void *eloop_data, void *user_data,
 			     struct os_reltime *remaining)
 {
-	struct eloop_timeout *timeout, *prev;
+	struct eloop_timeout *timeout;
 	int removed = 0;
 	struct os_reltime now;
 
 	os_get_reltime(&now);
 	remaining->sec = remaining->usec = 0;
 
-	dl_list_for_each_safe(timeout, prev, &eloop.timeout,
-			      struct eloop_timeout, list) {
-		if (timeout->handler == handler &&
-		    (timeout->eloop_data == eloop_data) &&
-		    (timeout->user_data == user_data)) {
-			removed = 1;
-			if (os_reltime_before(&now, &timeout->time))
-				os_reltime_sub(&timeout->time, &now, remaining);
-			eloop_remove_timeout(timeout);
-			break;
-		}
+	timeout = eloop_timeout_find(handler, eloop_data, user_data);
+	if (timeout) {
+		removed = 1;
+		if (os_reltime_before(&now, &timeout->time))
+			os_reltime_sub(&timeout->time, &now, remaining);
+		eloop_remove_timeout(timeout);
 	}
 	return removed;
 }
@@ -713,16 +900,7 @@ int eloop_cancel_timeout_one(eloop_timeout_handler handler,
 int eloop_is_timeout_registered(eloop_timeout_handler handler,
 				void *eloop_data, void *user_data)
 {
-	struct eloop_timeout *tmp;
-
-	dl_list_for_each(tmp, &eloop.timeout, struct eloop_timeout, list) {
-		if (tmp->handler == handler &&
-		    tmp->eloop_data == eloop_data &&
-		    tmp->user_data == user_data)
-			return 1;
-	}
-
-	return 0;
+	return eloop_timeout_find(handler, eloop_data, user_data) != NULL;
 }
 
 
@@ -733,28 +911,21 @@ int eloop_deplete_timeout(unsigned int req_secs, unsigned int req_usecs,
 	struct os_reltime now, requested, remaining;
 	struct eloop_timeout *tmp;
 
-	dl_list_for_each(tmp, &eloop.timeout, struct eloop_timeout, list) {
-		if (tmp->handler == handler &&
-		    tmp->eloop_data == eloop_data &&
-		    tmp->user_data == user_data) {
-			requested.sec = req_secs;
-			requested.usec = req_usecs;
-			os_get_reltime(&now);
-			os_reltime_sub(&tmp->time, &now, &remaining);
-			if (os_reltime_before(&requested, &remaining)) {
-				eloop_cancel_timeout(handler, eloop_data,
-						     user_data);
-				eloop_register_timeout(requested.sec,
-						       requested.usec,
-						       handler, eloop_data,
-						       user_data);
-				return 1;
-			}
-			return 0;
-		}
-	}
+	tmp = eloop_timeout_find(handler, eloop_data, user_data);
+	if (tmp == NULL)
+		return -1;
 
-	return -1;
+	requested.sec = req_secs;
+	requested.usec = req_usecs;
+	os_get_reltime(&now);
+	os_reltime_sub(&tmp->time, &now, &remaining);
+	if (os_reltime_before(&requested, &remaining)) {
+		eloop_cancel_timeout(handler, eloop_data, user_data);
+		eloop_register_timeout(requested.sec, requested.usec,
+				       handler, eloop_data, user_data);
+		return 1;
+	}
+	return 0;
 }
 
 
@@ -765,28 +936,21 @@ int eloop_replenish_timeout(unsigned int req_secs, unsigned int req_usecs,
 	struct os_reltime now, requested, remaining;
 	struct eloop_timeout *tmp;
 
-	dl_list_for_each(tmp, &eloop.timeout, struct eloop_timeout, list) {
-		if (tmp->handler == handler &&
-		    tmp->eloop_data == eloop_data &&
-		    tmp->user_data == user_data) {
-			requested.sec = req_secs;
-			requested.usec = req_usecs;
-			os_get_reltime(&now);
-			os_reltime_sub(&tmp->time, &now, &remaining);
-			if (os_reltime_before(&remaining, &requested)) {
-				eloop_cancel_timeout(handler, eloop_data,
-						     user_data);
-				eloop_register_timeout(requested.sec,
-						       requested.usec,
-						       handler, eloop_data,
-						       user_data);
-				return 1;
-			}
-			return 0;
-		}
-	}
+	tmp = eloop_timeout_find(handler, eloop_data, user_data);
+	if (tmp == NULL)
+		return -1;
 
-	return -1;
+	requested.sec = req_secs;
+	requested.usec = req_usecs;
+	os_get_reltime(&now);
+	os_reltime_sub(&tmp->time, &now, &remaining);
+	if (os_reltime_before(&remaining, &requested)) {
+		eloop_cancel_timeout(handler, eloop_data, user_data);
+		eloop_register_timeout(requested.sec, requested.usec,
+				       handler, eloop_data, user_data);
+		return 1;
+	}
+	return 0;
 }
 
 
@@ -920,11 +1084,10 @@ void eloop_run(void)
 #endif /* CONFIG_ELOOP_SELECT */
 
 	while (!eloop.terminate &&
-	       (!dl_list_empty(&eloop.timeout) || eloop.readers.count > 0 ||
+	       (eloop_timeout_first() || eloop.readers.count > 0 ||
 		eloop.writers.count > 0 || eloop.exceptions.count > 0)) {
 		struct eloop_timeout *timeout;
-		timeout = dl_list_first(&eloop.timeout, struct eloop_timeout,
-					list);
+		timeout = eloop_timeout_first();
 		if (timeout) {
 			os_get_reltime(&now);
 			if (os_reltime_before(&now, &timeout->time))
@@ -980,8 +1143,7 @@ void eloop_run(void)
 		eloop_process_pending_signals();
 
 		/* check if some registered timeouts have occurred */
-		timeout = dl_list_first(&eloop.timeout, struct eloop_timeout,
-					list);
+		timeout = eloop_timeout_first();
 		if (timeout) {
 			os_get_reltime(&now);
 			if (!os_reltime_before(&now, &timeout->time)) {
@@ -1032,12 +1194,11 @@ void eloop_terminate(void)
 
 void eloop_destroy(void)
 {
-	struct eloop_timeout *timeout, *prev;
+	struct eloop_timeout *timeout;
 	struct os_reltime now;
 
 	os_get_reltime(&now);
-	dl_list_for_each_safe(timeout, prev, &eloop.timeout,
-			      struct eloop_timeout, list) {
+	while ((timeout = eloop_timeout_first()) != NULL) {
 		int sec, usec;
 		sec = timeout->time.sec - now.sec;
 		usec = timeout->time.usec - now.usec;
@@ -1058,6 +1219,9 @@ void eloop_destroy(void)
 	eloop_sock_table_destroy(&eloop.writers);
 	eloop_sock_table_destroy(&eloop.exceptions);
 	os_free(eloop.signals);
+#ifdef CONFIG_ELOOP_TIMER_HEAP
+	os_free(eloop.timeout_heap);
+#endif /* CONFIG_ELOOP_TIMER_HEAP */
 
 #ifdef CONFIG_ELOOP_POLL
 	os_free(eloop.pollfds);
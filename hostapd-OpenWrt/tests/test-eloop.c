@@ -0,0 +1,172 @@
+/*
+ * Test program and benchmark for eloop timeouts
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Built twice, as test-eloop-list with the default sorted list and as
+ * test-eloop-heap with CONFIG_ELOOP_TIMER_HEAP, so that the time per
+ * operation of the two timeout backends can be compared as the number of
+ * registered timeouts grows.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "eloop.h"
+
+
+static int expired;
+static int expire_count;
+static int expire_errors;
+static struct os_reltime last_expiry;
+static unsigned long last_seq;
+
+
+static void dummy_timeout(void *eloop_data, void *user_data)
+{
+}
+
+
+static void order_timeout(void *eloop_data, void *user_data)
+{
+	struct os_reltime *when = eloop_data;
+	unsigned long seq = (unsigned long) user_data;
+
+	/*
+	 * The offsets are far enough apart that registering all of them
+	 * takes less time than the gap between two, so expiry must follow
+	 * the offsets, and timeouts with the same offset must run in the
+	 * order they were registered.
+	 */
+	if (expired > 0 &&
+	    (os_reltime_before(when, &last_expiry) ||
+	     (when->sec == last_expiry.sec &&
+	      when->usec == last_expiry.usec && seq < last_seq)))
+		expire_errors++;
+	last_expiry = *when;
+	last_seq = seq;
+	if (++expired == expire_count)
+		eloop_terminate();
+}
+
+
+static unsigned int rnd(void)
+{
+	static unsigned int state = 12345;
+
+	state = state * 1103515245 + 12345;
+	return state >> 8;
+}
+
+
+static double elapsed_ns(struct os_reltime *start, int ops)
+{
+	struct os_reltime now, diff;
+
+	os_get_reltime(&now);
+	os_reltime_sub(&now, start, &diff);
+	return (diff.sec * 1e9 + diff.usec * 1e3) / ops;
+}
+
+
+static int test_order(int count)
+{
+	struct os_reltime *when;
+	int i;
+
+	when = os_calloc(count, sizeof(*when));
+	if (when == NULL)
+		return -1;
+
+	expired = expire_errors = 0;
+	expire_count = count;
+	for (i = 0; i < count; i++) {
+		/* Few distinct values so that ties are common */
+		unsigned int usecs = (rnd() % 10) * 5000;
+
+		when[i].usec = usecs;
+		eloop_register_timeout(0, usecs, order_timeout, &when[i],
+				       (void *) (unsigned long) i);
+		/* Cancelled again so that the heap has holes to fill */
+		if (i % 7 == 0) {
+			eloop_register_timeout(0, usecs, order_timeout,
+					       &when[i],
+					       (void *) (unsigned long)
+					       (count + i));
+			eloop_cancel_timeout(order_timeout, &when[i],
+					     (void *) (unsigned long)
+					     (count + i));
+		}
+	}
+	eloop_run();
+	os_free(when);
+
+	if (expired != count || expire_errors) {
+		printf("order: %d of %d timeouts expired, %d out of order\n",
+		       expired, count, expire_errors);
+		return -1;
+	}
+	printf("order: %d timeouts expired in order\n", count);
+	return 0;
+}
+
+
+static int bench(int count)
+{
+	struct os_reltime start;
+	double reg, found, cancel;
+	int i, errors = 0;
+
+	os_get_reltime(&start);
+	for (i = 0; i < count; i++)
+		eloop_register_timeout(100 + rnd() % 1000, rnd() % 1000000,
+				       dummy_timeout, NULL,
+				       (void *) (unsigned long) (i + 1));
+	reg = elapsed_ns(&start, count);
+
+	os_get_reltime(&start);
+	for (i = 0; i < count; i++) {
+		if (!eloop_is_timeout_registered(dummy_timeout, NULL,
+						 (void *) (unsigned long)
+						 (rnd() % count + 1)))
+			errors++;
+	}
+	found = elapsed_ns(&start, count);
+
+	os_get_reltime(&start);
+	for (i = 0; i < count; i++) {
+		if (eloop_cancel_timeout(dummy_timeout, NULL,
+					 (void *) (unsigned long)
+					 (count - i)) != 1)
+			errors++;
+	}
+	cancel = elapsed_ns(&start, count);
+
+	printf("%7d timeouts: register %8.0f ns, lookup %8.0f ns, "
+	       "cancel %8.0f ns\n", count, reg, found, cancel);
+	return errors ? -1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int max = argc > 1 ? atoi(argv[1]) : 16000;
+	int count, ret = 0;
+
+	if (eloop_init() < 0)
+		return -1;
+
+	if (test_order(500) < 0)
+		ret = -1;
+
+	for (count = 1000; count <= max; count *= 2) {
+		if (bench(count) < 0) {
+			printf("bench: lookup or cancel failed\n");
+			ret = -1;
+		}
+	}
+
+	eloop_destroy();
+	return ret;
+}
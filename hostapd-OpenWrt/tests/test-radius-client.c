@@ -0,0 +1,234 @@
+/*
+ * Test program for the RADIUS client pending request window
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * A RADIUS server on the loopback interface answers Access-Requests from the
+ * RADIUS client. In the first test, the server holds all responses until
+ * every request has arrived, so more requests than one source port has
+ * identifiers are pending at the same time. In the second test, the client
+ * window is smaller than the number of requests and the server answers
+ * right away, so most requests are queued first. All responses must be
+ * matched with the request they were sent for.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "eloop.h"
+#include "radius/radius.h"
+#include "radius/radius_client.h"
+
+
+static const u8 secret[] = "test-secret";
+
+struct test_server {
+	int sock;
+	int hold; /* respond only after this many requests */
+	int received;
+	struct radius_msg **held;
+	struct sockaddr_in *from;
+};
+
+static int accepted, bad;
+static int expected;
+
+
+static void server_respond(struct test_server *srv, struct radius_msg *req,
+			   struct sockaddr_in *from)
+{
+	struct radius_msg *msg;
+	struct radius_hdr *hdr = radius_msg_get_hdr(req);
+	struct wpabuf *buf;
+
+	msg = radius_msg_new(RADIUS_CODE_ACCESS_ACCEPT, hdr->identifier);
+	if (msg == NULL)
+		return;
+	/* Send the request back as State so that the client can check it */
+	radius_msg_add_attr(msg, RADIUS_ATTR_STATE, hdr->authenticator,
+			    sizeof(hdr->authenticator));
+	radius_msg_finish_srv(msg, secret, sizeof(secret) - 1,
+			      hdr->authenticator);
+	buf = radius_msg_get_buf(msg);
+	sendto(srv->sock, wpabuf_head(buf), wpabuf_len(buf), 0,
+	       (struct sockaddr *) from, sizeof(*from));
+	radius_msg_free(msg);
+}
+
+
+static void server_receive(int sock, void *eloop_ctx, void *sock_ctx)
+{
+	struct test_server *srv = eloop_ctx;
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	unsigned char buf[3000];
+	struct radius_msg *req;
+	int len, i;
+
+	len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *) &from,
+		       &fromlen);
+	if (len < 0)
+		return;
+	req = radius_msg_parse(buf, len);
+	if (req == NULL)
+		return;
+
+	if (srv->hold == 0) {
+		server_respond(srv, req, &from);
+		radius_msg_free(req);
+		return;
+	}
+
+	srv->held[srv->received] = req;
+	srv->from[srv->received] = from;
+	if (++srv->received < srv->hold)
+		return;
+
+	/* Respond in reverse order */
+	for (i = srv->received - 1; i >= 0; i--) {
+		server_respond(srv, srv->held[i], &srv->from[i]);
+		radius_msg_free(srv->held[i]);
+	}
+	srv->received = 0;
+}
+
+
+static RadiusRxResult client_receive(struct radius_msg *msg,
+				     struct radius_msg *req,
+				     const u8 *shared_secret,
+				     size_t shared_secret_len, void *data)
+{
+	u8 state[16];
+
+	if (radius_msg_verify(msg, shared_secret, shared_secret_len, req, 1) ||
+	    radius_msg_get_attr(msg, RADIUS_ATTR_STATE, state,
+				sizeof(state)) != sizeof(state) ||
+	    os_memcmp(state, radius_msg_get_hdr(req)->authenticator,
+		      sizeof(state)) != 0)
+		bad++;
+	else
+		accepted++;
+
+	if (accepted + bad == expected)
+		eloop_terminate();
+	return RADIUS_RX_PROCESSED;
+}
+
+
+static void test_timeout(void *eloop_ctx, void *timeout_ctx)
+{
+	printf("timeout\n");
+	eloop_terminate();
+}
+
+
+static int run(struct test_server *srv, int max_pending, int count, int hold)
+{
+	struct hostapd_radius_servers conf;
+	struct hostapd_radius_server serv;
+	struct radius_client_data *radius;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	struct os_reltime start, now, diff;
+	int i;
+
+	if (getsockname(srv->sock, (struct sockaddr *) &addr, &addrlen) < 0)
+		return -1;
+
+	os_memset(&serv, 0, sizeof(serv));
+	serv.addr.af = AF_INET;
+	serv.addr.u.v4.s_addr = htonl(INADDR_LOOPBACK);
+	serv.port = ntohs(addr.sin_port);
+	serv.shared_secret = (u8 *) secret;
+	serv.shared_secret_len = sizeof(secret) - 1;
+
+	os_memset(&conf, 0, sizeof(conf));
+	conf.auth_servers = conf.auth_server = &serv;
+	conf.num_auth_servers = 1;
+	conf.max_pending = max_pending;
+
+	radius = radius_client_init(NULL, &conf);
+	if (radius == NULL ||
+	    radius_client_register(radius, RADIUS_AUTH, client_receive,
+				   NULL) < 0) {
+		radius_client_deinit(radius);
+		return -1;
+	}
+
+	srv->hold = hold;
+	srv->received = 0;
+	accepted = bad = 0;
+	expected = count;
+
+	os_get_reltime(&start);
+	for (i = 0; i < count; i++) {
+		struct radius_msg *msg;
+		u8 sta[ETH_ALEN] = { 0x02, 0, 0, 0, i >> 8, i & 0xff };
+
+		msg = radius_msg_new(RADIUS_CODE_ACCESS_REQUEST,
+				     radius_client_get_id(radius));
+		if (msg == NULL)
+			break;
+		radius_msg_make_authenticator(msg, sta, sizeof(sta));
+		if (radius_client_send(radius, msg, RADIUS_AUTH, sta) < 0) {
+			radius_msg_free(msg);
+			break;
+		}
+	}
+
+	eloop_register_timeout(10, 0, test_timeout, NULL, NULL);
+	eloop_run();
+	eloop_cancel_timeout(test_timeout, NULL, NULL);
+	os_get_reltime(&now);
+	os_reltime_sub(&now, &start, &diff);
+
+	radius_client_deinit(radius);
+
+	printf("max_pending=%d requests=%d: %d accepted, %d mismatched "
+	       "in %ld.%06ld s\n", max_pending, count, accepted, bad,
+	       (long) diff.sec, (long) diff.usec);
+	return accepted == count && bad == 0 ? 0 : -1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct test_server srv;
+	struct sockaddr_in addr;
+	int ret = 0;
+	int count = 1000;
+	int rcvbuf = 1024 * 1024;
+
+	if (eloop_init() < 0)
+		return -1;
+
+	os_memset(&srv, 0, sizeof(srv));
+	srv.held = os_calloc(count, sizeof(*srv.held));
+	srv.from = os_calloc(count, sizeof(*srv.from));
+	srv.sock = socket(PF_INET, SOCK_DGRAM, 0);
+	os_memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	/* Room for the whole burst; retransmissions are seconds apart */
+	setsockopt(srv.sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if (srv.held == NULL || srv.from == NULL || srv.sock < 0 ||
+	    bind(srv.sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    eloop_register_read_sock(srv.sock, server_receive, &srv, NULL) < 0)
+		return -1;
+
+	/* All requests pending at once on four source ports */
+	if (run(&srv, count, count, count) < 0)
+		ret = -1;
+
+	/* Most requests queued behind a small window */
+	if (run(&srv, 30, count, 0) < 0)
+		ret = -1;
+
+	eloop_unregister_read_sock(srv.sock);
+	close(srv.sock);
+	os_free(srv.held);
+	os_free(srv.from);
+	eloop_destroy();
+	return ret;
+}
@@ -139,6 +139,10 @@ ifdef CONFIG_ELOOP_EPOLL
 L_CFLAGS += -DCONFIG_ELOOP_EPOLL
 endif
 
+ifdef CONFIG_ELOOP_TIMER_HEAP
+L_CFLAGS += -DCONFIG_ELOOP_TIMER_HEAP
+endif
+
 ifdef CONFIG_EAPOL_TEST
 L_CFLAGS += -Werror -DEAPOL_TEST
 endif
@@ -793,6 +797,9 @@ OBJS += src/eapol_auth/eapol_auth_sm.c
 OBJS += src/ap/ieee802_11_auth.c
 OBJS += src/ap/ieee802_11_shared.c
 OBJS += src/ap/drv_callbacks.c
+OBJS += src/ap/chameleon.c
+OBJS += src/ap/chameleon_cache.c
+OBJS += src/ap/chameleon_pmk.c
 OBJS += src/ap/ap_drv_ops.c
 OBJS += src/ap/beacon.c
 OBJS += src/ap/bss_load.c
@@ -1276,6 +1276,16 @@ int wpas_ap_stop_ap(struct wpa_supplicant *wpa_s)
 }
 
 
+int ap_ctrl_iface_chameleon(struct wpa_supplicant *wpa_s, char *buf,
+			    size_t buflen)
+{
+	if (!wpa_s->ap_iface)
+		return -1;
+	return hostapd_ctrl_iface_chameleon(wpa_s->ap_iface->bss[0], buf,
+					    buflen);
+}
+
+
 #ifdef NEED_AP_MLME
 void wpas_event_dfs_radar_detected(struct wpa_supplicant *wpa_s,
 				   struct dfs_event *radar)
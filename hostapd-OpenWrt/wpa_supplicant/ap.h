@@ -81,6 +81,8 @@ void wpa_supplicant_conf_ap_ht(struct wpa_supplicant *wpa_s,
 			       struct hostapd_config *conf);
 
 int wpas_ap_stop_ap(struct wpa_supplicant *wpa_s);
+int ap_ctrl_iface_chameleon(struct wpa_supplicant *wpa_s, char *buf,
+			    size_t buflen);
 
 void wpas_event_dfs_radar_detected(struct wpa_supplicant *wpa_s,
 				   struct dfs_event *radar);
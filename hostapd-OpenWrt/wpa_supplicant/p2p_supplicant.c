@@ -1588,6 +1588,7 @@ static void wpas_p2p_add_psk_list(struct wpa_supplicant *wpa_s,
 		return;
 
 	hapd = wpa_s->ap_iface->bss[0];
+	hostapd_wpa_psk_index_free(&hapd->conf->ssid);
 
 	dl_list_for_each(psk, &persistent->psk_list, struct psk_list_entry,
 			 list) {
@@ -1607,6 +1608,8 @@ static void wpas_p2p_add_psk_list(struct wpa_supplicant *wpa_s,
 		hpsk->next = hapd->conf->ssid.wpa_psk;
 		hapd->conf->ssid.wpa_psk = hpsk;
 	}
+
+	hostapd_wpa_psk_index(&hapd->conf->ssid);
 }
 
 
@@ -7253,6 +7256,7 @@ static void wpas_p2p_remove_client_go(struct wpa_supplicant *wpa_s,
 
 	/* Remove per-station PSK entry */
 	hapd = wpa_s->ap_iface->bss[0];
+	hostapd_wpa_psk_index_free(&hapd->conf->ssid);
 	prev = NULL;
 	psk = hapd->conf->ssid.wpa_psk;
 	while (psk) {
@@ -7274,6 +7278,7 @@ static void wpas_p2p_remove_client_go(struct wpa_supplicant *wpa_s,
 			psk = psk->next;
 		}
 	}
+	hostapd_wpa_psk_index(&hapd->conf->ssid);
 
 	/* Disconnect from group */
 	if (iface_addr)
@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <errno.h>
 
 #if defined(_WIN32)
 #include <winsock2.h>
@@ -307,10 +308,6 @@ struct timeval *timeout;
 {
     int result;
     fd_set fds;
-    struct sockaddr_in addr;
-    socklen_t addrLen;
-    char *ipaddr;
-    request *r;
     /* Reset error */
     server->lastError = 0;
     FD_ZERO(&fds);
@@ -330,6 +327,24 @@ struct timeval *timeout;
             break;
         }
     }
+    return (httpdAcceptConnection(server));
+}
+
+/*
+** Accept a connection that is already pending on the server socket.  If
+** the server socket is non-blocking and nothing is pending, NULL is
+** returned with lastError set to 0.
+*/
+request *
+httpdAcceptConnection(server)
+httpd *server;
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen;
+    char *ipaddr;
+    request *r;
+
+    server->lastError = 0;
     /* Allocate request struct */
     r = (request *) malloc(sizeof(request));
     if (r == NULL) {
@@ -341,6 +356,12 @@ struct timeval *timeout;
     bzero(&addr, sizeof(addr));
     addrLen = sizeof(addr);
     r->clientSock = accept(server->serverSock, (struct sockaddr *)&addr, &addrLen);
+    if (r->clientSock < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            server->lastError = -1;
+        free(r);
+        return (NULL);
+    }
     ipaddr = inet_ntoa(addr.sin_addr);
     if (ipaddr) {
         strncpy(r->clientAddr, ipaddr, HTTP_IP_ADDR_LEN);
@@ -368,8 +389,8 @@ int
 httpdReadRequest(httpd * server, request * r)
 {
     char buf[HTTP_MAX_LEN];
-    int count, inHeaders;
-    char *cp, *cp2;
+    int count, inHeaders, hasBody;
+    char *cp, *cp2, *version;
     int _httpd_decode();
 
     /*
@@ -383,8 +404,10 @@ httpdReadRequest(httpd * server, request * r)
     /*
      ** Read the request
      */
+    r->readDeadline = time(NULL) + HTTP_READ_TIMEOUT;
     count = 0;
     inHeaders = 1;
+    hasBody = 0;
     while (_httpd_readLine(r, buf, HTTP_MAX_LEN) > 0) {
         count++;
 
@@ -416,10 +439,16 @@ httpdReadRequest(httpd * server, request * r)
             cp2 = cp;
             while (*cp2 != ' ' && *cp2 != 0)
                 cp2++;
+            version = (*cp2 == ' ') ? cp2 + 1 : "";
             *cp2 = 0;
             strncpy(r->request.path, cp, HTTP_MAX_URL);
             r->request.path[HTTP_MAX_URL - 1] = 0;
             _httpd_sanitiseUrl(r->request.path);
+            /*
+             ** HTTP/1.1 connections stay open unless the client says
+             ** otherwise, HTTP/1.0 ones only if it asks
+             */
+            r->request.keepAlive = (strncmp(version, "HTTP/1.1", 8) == 0);
             continue;
         }
 
@@ -470,9 +499,39 @@ httpdReadRequest(httpd * server, request * r)
                 }
             }
             /* End modification */
+            if (strncasecmp(buf, "Connection: ", 12) == 0) {
+                if (strncasecmp(buf + 12, "close", 5) == 0)
+                    r->request.keepAlive = 0;
+                if (strncasecmp(buf + 12, "keep-alive", 10) == 0)
+                    r->request.keepAlive = 1;
+            }
+            if (strncasecmp(buf, "If-Modified-Since: ", 19) == 0) {
+                strncpy(r->request.ifModified, buf + 19, HTTP_MAX_URL);
+                r->request.ifModified[HTTP_MAX_URL - 1] = 0;
+            }
+            if (strncasecmp(buf, "If-None-Match: ", 15) == 0) {
+                strncpy(r->request.ifNoneMatch, buf + 15, HTTP_ETAG_LEN);
+                r->request.ifNoneMatch[HTTP_ETAG_LEN - 1] = 0;
+            }
+            if (strncasecmp(buf, "Content-Length: ", 16) == 0) {
+                r->request.contentLength = atoi(buf + 16);
+                if (r->request.contentLength > 0)
+                    hasBody = 1;
+            }
+            if (strncasecmp(buf, "Transfer-Encoding: ", 19) == 0)
+                hasBody = 1;
             continue;
         }
     }
+    if (count == 0)
+        return (-1);
+
+    /*
+     ** Request bodies are not read, so the next request could not be
+     ** found on this connection
+     */
+    if (hasBody)
+        r->request.keepAlive = 0;
 
     /*
      ** Process any URL data
@@ -488,6 +547,78 @@ httpdReadRequest(httpd * server, request * r)
     return (0);
 }
 
+/*
+** Whether the request headers are all in the read buffer, so that
+** httpdReadRequest() can parse them without waiting for the client.  A
+** request too long for the buffer also counts as ready; httpdReadRequest()
+** reads the rest of it within the request deadline.
+*/
+int
+httpdRequestReady(request * r)
+{
+    char *cp, *end;
+
+    if (r->readBufRemain >= HTTP_READ_BUF_LEN)
+        return (HTTP_TRUE);
+    end = r->readBufPtr + r->readBufRemain;
+    for (cp = r->readBufPtr; cp < end; cp++) {
+        if (*cp != '\n')
+            continue;
+        if (cp + 1 < end && cp[1] == '\n')
+            return (HTTP_TRUE);
+        if (cp + 2 < end && cp[1] == '\r' && cp[2] == '\n')
+            return (HTTP_TRUE);
+    }
+    return (HTTP_FALSE);
+}
+
+/*
+** Read what the client has sent so far without blocking, adding it to the
+** read buffer.  Returns 1 once httpdRequestReady(), 0 if more is needed and
+** -1 if the connection was closed or failed.
+*/
+int
+httpdReadHeaders(request * r)
+{
+    int len;
+
+    if (r->readBufRemain > 0 && r->readBufPtr != r->readBuf)
+        memmove(r->readBuf, r->readBufPtr, r->readBufRemain);
+    r->readBufPtr = r->readBuf;
+    if (r->readBufRemain >= HTTP_READ_BUF_LEN)
+        return (1);
+
+    len = recv(r->clientSock, r->readBuf + r->readBufRemain, HTTP_READ_BUF_LEN - r->readBufRemain, MSG_DONTWAIT);
+    if (len == 0)
+        return (-1);
+    if (len < 0)
+        return ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1);
+    r->readBufRemain += len;
+    r->readBuf[r->readBufRemain] = 0;
+
+    return (httpdRequestReady(r) ? 1 : 0);
+}
+
+/*
+** Get a connection ready for its next request once the response has been
+** sent.  Returns HTTP_FALSE if it has to be closed instead.  Data the client
+** has already sent (pipelined requests) is kept; httpdRequestReady() tells
+** whether the next request can be read without waiting.
+*/
+int
+httpdKeepAlive(request * r)
+{
+    if (!r->request.keepAlive || !r->response.headersSent)
+        return (HTTP_FALSE);
+    if (++r->requestCount >= HTTP_KEEPALIVE_MAX)
+        return (HTTP_FALSE);
+    _httpd_freeVariables(r->variables);
+    r->variables = NULL;
+    bzero(&r->request, sizeof(r->request));
+    bzero(&r->response, sizeof(r->response));
+    return (HTTP_TRUE);
+}
+
 void
 httpdEndRequest(request * r)
 {
@@ -676,7 +807,7 @@ char *data;
 void
 httpdSendHeaders(request * r)
 {
-    _httpd_sendHeaders(r, 0, 0);
+    _httpd_sendHeaders(r, HTTP_LENGTH_UNKNOWN, 0);
 }
 
 void
@@ -763,6 +894,41 @@ httpdOutput(request * r, const char *msg)
     _httpd_net_write(r->clientSock, buf, strlen(buf));
 }
 
+/** Send the response headers, if not sent yet, and body segments in a
+ * single writev() call. When this call sends the headers, the segments
+ * are the whole body and its length is announced.
+ */
+void
+httpdOutputV(request * r, const struct iovec *iov, int iovcnt)
+{
+    struct iovec local[HTTP_OUTPUT_IOV], *vec = local;
+    char headers[HTTP_HEADERS_BUF_LEN];
+    int i, count = 0, length = 0;
+
+    if (iovcnt + 1 > HTTP_OUTPUT_IOV) {
+        vec = malloc((iovcnt + 1) * sizeof(struct iovec));
+        if (vec == NULL)
+            return;
+    }
+
+    if (r->response.headersSent == 0) {
+        r->response.headersSent = 1;
+        for (i = 0; i < iovcnt; i++)
+            length += iov[i].iov_len;
+        vec[count].iov_base = headers;
+        vec[count++].iov_len = _httpd_formatHeaders(r, headers, sizeof(headers), length, 0);
+    }
+    for (i = 0; i < iovcnt; i++) {
+        r->response.responseLength += iov[i].iov_len;
+        vec[count++] = iov[i];
+    }
+    if (_httpd_net_writev(r->clientSock, vec, count) < 0)
+        r->request.keepAlive = 0;
+
+    if (vec != local)
+        free(vec);
+}
+
 #ifdef HAVE_STDARG_H
 void
 httpdPrintf(request * r, const char *fmt, ...)
@@ -815,7 +981,18 @@ httpdProcessRequest(httpd * server, request * r)
     else
         *(cp + 1) = 0;
 
-    _httpd_send404(server, r);
+    /*
+     ** Only files are served from the content tree.  Everything else,
+     ** the wifidog pages included, goes to the 404 handler.
+     */
+    dir = _httpd_findContentDir(server, dirName, HTTP_FALSE);
+    entry = dir ? _httpd_findContentEntry(r, dir, entryName) : NULL;
+    if (entry && entry->type == HTTP_FILE)
+        _httpd_sendFile(server, r, entry->path);
+    else if (entry && entry->type == HTTP_WILDCARD)
+        _httpd_sendDirectoryEntry(server, r, entry, entryName);
+    else
+        _httpd_send404(server, r);
     _httpd_writeAccessLog(server, r);
 }
 
@@ -877,33 +1054,7 @@ httpdSetErrorFunction(httpd * server, int error, void (*function) ())
 void
 httpdSendFile(httpd * server, request * r, const char *path)
 {
-    char *suffix;
-    struct stat sbuf;
-
-    suffix = strrchr(path, '.');
-    if (suffix != NULL) {
-        if (strcasecmp(suffix, ".gif") == 0)
-            strcpy(r->response.contentType, "image/gif");
-        if (strcasecmp(suffix, ".jpg") == 0)
-            strcpy(r->response.contentType, "image/jpeg");
-        if (strcasecmp(suffix, ".xbm") == 0)
-            strcpy(r->response.contentType, "image/xbm");
-        if (strcasecmp(suffix, ".png") == 0)
-            strcpy(r->response.contentType, "image/png");
-        if (strcasecmp(suffix, ".css") == 0)
-            strcpy(r->response.contentType, "text/css");
-    }
-    if (stat(path, &sbuf) < 0) {
-        _httpd_send404(server, r);
-        return;
-    }
-    if (_httpd_checkLastModified(r, sbuf.st_mtime) == 0) {
-        _httpd_send304(server, r);
-    } else {
-        _httpd_sendHeaders(r, sbuf.st_size, sbuf.st_mtime);
-
-        _httpd_catFile(r, path);
-    }
+    _httpd_sendFile(server, r, (char *)path);
 }
 
 void
@@ -0,0 +1,195 @@
+/*
+** $Id$
+**
+** Cache of small static files.  The splash page assets are fetched by
+** every new client, so they are kept in memory and sent together with
+** the response headers in a single writev().  Entries are checked
+** against the file's modification time and size on every request and
+** are reference counted, so a file can be replaced while it is being
+** sent.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#endif
+
+#include "config.h"
+#include "httpd.h"
+#include "httpd_priv.h"
+
+static httpCacheEntry *cacheBuckets[HTTP_CACHE_BUCKETS];
+static long cacheSize = 0;
+
+#if defined(_WIN32)
+#define	CACHE_LOCK()
+#define	CACHE_UNLOCK()
+#else
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define	CACHE_LOCK()	pthread_mutex_lock(&cacheMutex)
+#define	CACHE_UNLOCK()	pthread_mutex_unlock(&cacheMutex)
+#endif
+
+static unsigned int
+_httpd_cacheHash(const char *path)
+{
+    unsigned int hash = 5381;
+
+    while (*path)
+        hash = hash * 33 + (unsigned char)*path++;
+    return (hash % HTTP_CACHE_BUCKETS);
+}
+
+static void
+_httpd_cacheFree(httpCacheEntry * entry)
+{
+    free(entry->path);
+    free(entry->data);
+    free(entry);
+}
+
+/*
+** Take an entry out of the cache.  It is freed straight away unless a
+** request is still sending it.  Called with the cache locked.
+*/
+static void
+_httpd_cacheRemove(httpCacheEntry ** prev)
+{
+    httpCacheEntry *entry = *prev;
+
+    *prev = entry->next;
+    cacheSize -= entry->size;
+    entry->stale = 1;
+    if (entry->refs == 0)
+        _httpd_cacheFree(entry);
+}
+
+static char *
+_httpd_cacheRead(const char *path, off_t size)
+{
+    char *data;
+    off_t offset;
+    int fd, len;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return (NULL);
+    data = malloc(size + 1);
+    if (data == NULL) {
+        close(fd);
+        return (NULL);
+    }
+    offset = 0;
+    while (offset < size) {
+        len = read(fd, data + offset, size - offset);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+        offset += len;
+    }
+    close(fd);
+    if (offset < size) {
+        /* Truncated while we read it */
+        free(data);
+        return (NULL);
+    }
+    return (data);
+}
+
+/*
+** Return the cached contents of a file, loading it if it is small enough
+** and there is room left.  The entry must be handed back with
+** _httpd_cacheRelease().  NULL means the file should be sent from disk.
+*/
+httpCacheEntry *
+_httpd_cacheGet(const char *path, struct stat *sbuf)
+{
+    httpCacheEntry *entry, *newEntry, **prev;
+    unsigned int bucket;
+    char *data;
+    int full;
+
+    if (sbuf->st_size > HTTP_CACHE_MAX_FILE)
+        return (NULL);
+
+    bucket = _httpd_cacheHash(path);
+    CACHE_LOCK();
+    for (prev = &cacheBuckets[bucket]; (entry = *prev) != NULL; prev = &entry->next) {
+        if (strcmp(entry->path, path) != 0)
+            continue;
+        if (entry->modTime == sbuf->st_mtime && entry->size == sbuf->st_size) {
+            entry->refs++;
+            CACHE_UNLOCK();
+            return (entry);
+        }
+        /* Changed on disk */
+        _httpd_cacheRemove(prev);
+        break;
+    }
+    full = (cacheSize + sbuf->st_size > HTTP_CACHE_MAX_SIZE);
+    CACHE_UNLOCK();
+    if (full)
+        return (NULL);
+
+    /* Read the file without holding up the other threads */
+    data = _httpd_cacheRead(path, sbuf->st_size);
+    if (data == NULL)
+        return (NULL);
+    newEntry = malloc(sizeof(httpCacheEntry));
+    if (newEntry == NULL) {
+        free(data);
+        return (NULL);
+    }
+    bzero(newEntry, sizeof(httpCacheEntry));
+    newEntry->path = strdup(path);
+    newEntry->data = data;
+    newEntry->size = sbuf->st_size;
+    newEntry->modTime = sbuf->st_mtime;
+    newEntry->refs = 1;
+
+    CACHE_LOCK();
+    for (prev = &cacheBuckets[bucket]; (entry = *prev) != NULL; prev = &entry->next) {
+        if (strcmp(entry->path, path) != 0)
+            continue;
+        if (entry->modTime == newEntry->modTime && entry->size == newEntry->size) {
+            /* Another thread loaded it meanwhile */
+            entry->refs++;
+            CACHE_UNLOCK();
+            _httpd_cacheFree(newEntry);
+            return (entry);
+        }
+        _httpd_cacheRemove(prev);
+        break;
+    }
+    if (newEntry->path == NULL || cacheSize + newEntry->size > HTTP_CACHE_MAX_SIZE) {
+        /* Send it this once, then let it go */
+        newEntry->stale = 1;
+    } else {
+        newEntry->next = cacheBuckets[bucket];
+        cacheBuckets[bucket] = newEntry;
+        cacheSize += newEntry->size;
+    }
+    CACHE_UNLOCK();
+    return (newEntry);
+}
+
+void
+_httpd_cacheRelease(httpCacheEntry * entry)
+{
+    CACHE_LOCK();
+    if (--entry->refs == 0 && entry->stale)
+        _httpd_cacheFree(entry);
+    CACHE_UNLOCK();
+}
@@ -44,6 +44,7 @@
 #ifndef u_int
 #include <sys/types.h>
 #endif
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -61,6 +62,12 @@ extern "C" {
 #define	HTTP_IP_ADDR_LEN	17
 #define	HTTP_TIME_STRING_LEN	40
 #define	HTTP_READ_BUF_LEN	4096
+#define	HTTP_HEADERS_BUF_LEN	(HTTP_MAX_URL * 2 + HTTP_MAX_HEADERS + 128)
+#define	HTTP_ETAG_LEN		40
+#define	HTTP_KEEPALIVE_MAX	100     /* Requests served on one connection */
+#define	HTTP_READ_TIMEOUT	10      /* Seconds to read all of a request */
+#define	HTTP_CACHE_MAX_FILE	(32 * 1024)     /* Larger files are always sent with sendfile() */
+#define	HTTP_CACHE_MAX_SIZE	(512 * 1024)    /* Memory used by cached files */
 #define	HTTP_ANY_ADDR		NULL
 
 #define	HTTP_GET		1
@@ -82,6 +89,7 @@ extern "C" {
 #define httpdRequestPath(s)		s->request.path
 #define httpdRequestContentType(s)	s->request.contentType
 #define httpdRequestContentLength(s)	s->request.contentLength
+#define httpdRequestPending(s)		(s->readBufRemain > 0)
 
 #define HTTP_ACL_PERMIT		1
 #define HTTP_ACL_DENY		2
@@ -93,10 +101,10 @@ extern "C" {
 */
 
     typedef struct {
-        int method, contentLength, authLength;
+        int method, contentLength, authLength, keepAlive;
         char path[HTTP_MAX_URL], query[HTTP_MAX_URL], host[HTTP_MAX_URL],       /* acv@acv.ca/wifidog: Added decoding
                                                                                    of host: header if present. */
-         ifModified[HTTP_MAX_URL];
+         ifModified[HTTP_MAX_URL], ifNoneMatch[HTTP_ETAG_LEN];
         char authUser[HTTP_MAX_AUTH];
         char authPassword[HTTP_MAX_AUTH];
     } httpReq;
@@ -143,7 +151,8 @@ extern "C" {
     } httpd;
 
     typedef struct {
-        int clientSock, readBufRemain;
+        int clientSock, readBufRemain, requestCount;
+        time_t readDeadline;
         httpReq request;
         httpRes response;
         httpVar *variables;
@@ -162,7 +171,11 @@ extern "C" {
     int httpdAddVariable __ANSI_PROTO((request *, const char *, const char *));
     int httpdSetVariableValue __ANSI_PROTO((request *, const char *, const char *));
     request *httpdGetConnection __ANSI_PROTO((httpd *, struct timeval *));
+    request *httpdAcceptConnection __ANSI_PROTO((httpd *));
     int httpdReadRequest __ANSI_PROTO((httpd *, request *));
+    int httpdReadHeaders __ANSI_PROTO((request *));
+    int httpdRequestReady __ANSI_PROTO((request *));
+    int httpdKeepAlive __ANSI_PROTO((request *));
     int httpdCheckAcl __ANSI_PROTO((httpd *, request *, httpAcl *));
     int httpdAuthenticate __ANSI_PROTO((request *, const char *));
     void httpdForceAuthenticate __ANSI_PROTO((request *, const char *));
@@ -180,6 +193,7 @@ extern "C" {
     void httpdFreeVariables __ANSI_PROTO((request *));
     void httpdDumpVariables __ANSI_PROTO((request *));
     void httpdOutput __ANSI_PROTO((request *, const char *));
+    void httpdOutputV __ANSI_PROTO((request *, const struct iovec *, int));
     void httpdPrintf __ANSI_PROTO((request *, const char *, ...));
     void httpdProcessRequest __ANSI_PROTO((httpd *, request *));
     void httpdSendHeaders __ANSI_PROTO((request *));
@@ -31,6 +31,10 @@
 
 #define LIB_HTTPD_H_PRIV 1
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
 #if !defined(__ANSI_PROTO)
 #if defined(_WIN32) || defined(__STDC__) || defined(__cplusplus)
 #define __ANSI_PROTO(x)       x
@@ -44,13 +48,26 @@ extern "C" {
 #endif
 
 #define	LEVEL_NOTICE	"notice"
+#define	HTTP_OUTPUT_IOV	32      /* Segments httpdOutputV() sends without allocating */
 #define LEVEL_ERROR	"error"
+#define	HTTP_LENGTH_UNKNOWN	-1      /* Body sent until the connection closes */
+#define	HTTP_CACHE_BUCKETS	64
+
+    typedef struct _httpd_cache_entry {
+        char *path, *data;
+        off_t size;
+        time_t modTime;
+        int refs, stale;
+        struct _httpd_cache_entry *next;
+    } httpCacheEntry;
 
     char *_httpd_unescape __ANSI_PROTO((char *));
     char *_httpd_escape __ANSI_PROTO((const char *));
     char _httpd_from_hex __ANSI_PROTO((char));
 
-    void _httpd_catFile __ANSI_PROTO((request *, const char *));
+    void _httpd_catFile __ANSI_PROTO((request *, const char *, off_t));
+    void _httpd_cacheRelease __ANSI_PROTO((httpCacheEntry *));
+    void _httpd_formatETag __ANSI_PROTO((char *, struct stat *));
     void _httpd_send403 __ANSI_PROTO((httpd *, request *));
     void _httpd_send404 __ANSI_PROTO((httpd *, request *));
     void _httpd_send304 __ANSI_PROTO((httpd *, request *));
@@ -66,14 +83,17 @@ extern "C" {
     void _httpd_writeAccessLog __ANSI_PROTO((httpd *, request *));
     void _httpd_writeErrorLog __ANSI_PROTO((httpd *, request *, char *, char *));
 
-    int _httpd_net_read __ANSI_PROTO((int, char *, int));
+    int _httpd_net_read __ANSI_PROTO((int, char *, int, int));
     int _httpd_net_write __ANSI_PROTO((int, char *, int));
+    int _httpd_net_writev __ANSI_PROTO((int, struct iovec *, int));
+    int _httpd_formatHeaders __ANSI_PROTO((request *, char *, int, int, int));
     int _httpd_readBuf __ANSI_PROTO((request *, char *, int));
     int _httpd_readChar __ANSI_PROTO((request *, char *));
     int _httpd_readLine __ANSI_PROTO((request *, char *, int));
     int _httpd_checkLastModified __ANSI_PROTO((request *, int));
     int _httpd_sendDirectoryEntry __ANSI_PROTO((httpd *, request * r, httpContent *, char *));
 
+    httpCacheEntry *_httpd_cacheGet __ANSI_PROTO((const char *, struct stat *));
     httpContent *_httpd_findContentEntry __ANSI_PROTO((request *, httpDir *, char *));
     httpDir *_httpd_findContentDir __ANSI_PROTO((httpd *, char *, int));
 
@@ -30,18 +30,25 @@
 #else
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/file.h>
+#include <sys/uio.h>
 #endif
 
 #include "config.h"
 #include "httpd.h"
 #include "httpd_priv.h"
 
+#if defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
+
 int
-_httpd_net_read(sock, buf, len)
+_httpd_net_read(sock, buf, len, timeoutSec)
 int sock;
 char *buf;
 int len;
+int timeoutSec;
 {
 #if defined(_WIN32)
     return (recv(sock, buf, len, 0));
@@ -55,7 +62,7 @@ int len;
 
     FD_ZERO(&readfds);
     FD_SET(sock, &readfds);
-    timeout.tv_sec = 10;
+    timeout.tv_sec = timeoutSec;
     timeout.tv_usec = 0;
     nfds = sock + 1;
 
@@ -81,12 +88,62 @@ int len;
 #endif
 }
 
+int
+_httpd_net_writev(sock, iov, iovcnt)
+int sock;
+struct iovec *iov;
+int iovcnt;
+{
+#if defined(_WIN32)
+    int i, total = 0;
+
+    for (i = 0; i < iovcnt; i++)
+        total += send(sock, iov[i].iov_base, iov[i].iov_len, 0);
+    return (total);
+#else
+    ssize_t written;
+    int total = 0;
+
+    /* Write everything, resuming after partial writes */
+    while (iovcnt > 0) {
+        written = writev(sock, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return (-1);
+        }
+        total += written;
+        while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return (total);
+#endif
+}
+
 int
 _httpd_readChar(request * r, char *cp)
 {
+    int timeout = HTTP_READ_TIMEOUT;
+
     if (r->readBufRemain == 0) {
+        /*
+         ** A client sending its request a byte at a time must not hold
+         ** the connection past the deadline of the whole request
+         */
+        if (r->readDeadline) {
+            timeout = r->readDeadline - time(NULL);
+            if (timeout <= 0)
+                return (0);
+        }
         bzero(r->readBuf, HTTP_READ_BUF_LEN + 1);
-        r->readBufRemain = _httpd_net_read(r->clientSock, r->readBuf, HTTP_READ_BUF_LEN);
+        r->readBufRemain = _httpd_net_read(r->clientSock, r->readBuf, HTTP_READ_BUF_LEN, timeout);
         if (r->readBufRemain < 1)
             return (0);
         r->readBuf[r->readBufRemain] = 0;
@@ -382,41 +439,55 @@ _httpd_formatTimeString(char *ptr, int clock)
     strftime(ptr, HTTP_TIME_STRING_LEN, "%a, %d %b %Y %T GMT", timePtr);
 }
 
+/*
+** A connection is only kept open when the client asked for it and the
+** body length is known.  Otherwise the end of the body is marked by
+** closing the connection, as before.
+*/
+int
+_httpd_formatHeaders(request * r, char *buf, int len, int contentLength, int modTime)
+{
+    char timeBuf[HTTP_TIME_STRING_LEN];
+    int count;
+
+    if (contentLength < 0)
+        r->request.keepAlive = 0;
+
+    _httpd_formatTimeString(timeBuf, 0);
+    count = snprintf(buf, len, "HTTP/1.1 %s%sDate: %s\nConnection: %s\nContent-Type: %s\n",
+                     r->response.response, r->response.headers, timeBuf,
+                     r->request.keepAlive ? "keep-alive" : "close", r->response.contentType);
+    if (count >= len - 1)
+        count = len - 2;
+
+    if (contentLength >= 0) {
+        count += snprintf(buf + count, len - count, "Content-Length: %d\n", contentLength);
+        if (count >= len - 1)
+            count = len - 2;
+    }
+    if (modTime > 0) {
+        _httpd_formatTimeString(timeBuf, modTime);
+        count += snprintf(buf + count, len - count, "Last-Modified: %s\n", timeBuf);
+        if (count >= len - 1)
+            count = len - 2;
+    }
+    buf[count++] = '\n';
+    buf[count] = 0;
+    return (count);
+}
+
 void
 _httpd_sendHeaders(request * r, int contentLength, int modTime)
 {
-    char tmpBuf[80], timeBuf[HTTP_TIME_STRING_LEN];
+    char buf[HTTP_HEADERS_BUF_LEN];
+    int len;
 
     if (r->response.headersSent)
         return;
 
     r->response.headersSent = 1;
-    _httpd_net_write(r->clientSock, "HTTP/1.0 ", 9);
-    _httpd_net_write(r->clientSock, r->response.response, strlen(r->response.response));
-    _httpd_net_write(r->clientSock, r->response.headers, strlen(r->response.headers));
-
-    _httpd_formatTimeString(timeBuf, 0);
-    _httpd_net_write(r->clientSock, "Date: ", 6);
-    _httpd_net_write(r->clientSock, timeBuf, strlen(timeBuf));
-    _httpd_net_write(r->clientSock, "\n", 1);
-
-    _httpd_net_write(r->clientSock, "Connection: close\n", 18);
-    _httpd_net_write(r->clientSock, "Content-Type: ", 14);
-    _httpd_net_write(r->clientSock, r->response.contentType, strlen(r->response.contentType));
-    _httpd_net_write(r->clientSock, "\n", 1);
-
-    if (contentLength > 0) {
-        _httpd_net_write(r->clientSock, "Content-Length: ", 16);
-        snprintf(tmpBuf, sizeof(tmpBuf), "%d", contentLength);
-        _httpd_net_write(r->clientSock, tmpBuf, strlen(tmpBuf));
-        _httpd_net_write(r->clientSock, "\n", 1);
-
-        _httpd_formatTimeString(timeBuf, modTime);
-        _httpd_net_write(r->clientSock, "Last-Modified: ", 15);
-        _httpd_net_write(r->clientSock, timeBuf, strlen(timeBuf));
-        _httpd_net_write(r->clientSock, "\n", 1);
-    }
-    _httpd_net_write(r->clientSock, "\n", 1);
+    len = _httpd_formatHeaders(r, buf, sizeof(buf), contentLength, modTime);
+    _httpd_net_write(r->clientSock, buf, len);
 }
 
 httpDir *
@@ -425,13 +496,13 @@ httpd *server;
 char *dir;
 int createFlag;
 {
-    char buffer[HTTP_MAX_URL], *curDir;
+    char buffer[HTTP_MAX_URL], *curDir, *last;
     httpDir *curItem, *curChild;
 
     strncpy(buffer, dir, HTTP_MAX_URL);
     buffer[HTTP_MAX_URL - 1] = 0;
     curItem = server->content;
-    curDir = strtok(buffer, "/");
+    curDir = strtok_r(buffer, "/", &last);
     while (curDir) {
         curChild = curItem->children;
         while (curChild) {
@@ -451,7 +522,7 @@ int createFlag;
             }
         }
         curItem = curChild;
-        curDir = strtok(NULL, "/");
+        curDir = strtok_r(NULL, "/", &last);
     }
     return (curItem);
 }
@@ -494,7 +565,7 @@ _httpd_send403(httpd * server, request * r)
         (server->errorFunction403) (server, r, 403);
     } else {
         httpdSetResponse(r, "403 Permission Denied\n");
-        _httpd_sendHeaders(r, 0, 0);
+        _httpd_sendHeaders(r, HTTP_LENGTH_UNKNOWN, 0);
         _httpd_sendText(r, "<HTML><HEAD><TITLE>403 Permission Denied</TITLE></HEAD>\n");
         _httpd_sendText(r, "<BODY><H1>Access to the request URL was denied!</H1>\n");
 
@@ -519,28 +590,56 @@ _httpd_send404(httpd * server, request * r)
          * Send stock 404
          */
         httpdSetResponse(r, "404 Not Found\n");
-        _httpd_sendHeaders(r, 0, 0);
+        _httpd_sendHeaders(r, HTTP_LENGTH_UNKNOWN, 0);
         _httpd_sendText(r, "<HTML><HEAD><TITLE>404 Not Found</TITLE></HEAD>\n");
         _httpd_sendText(r, "<BODY><H1>The request URL was not found! -- Author by fengcc </H1>\n");
         _httpd_sendText(r, "</BODY></HTML>\n");
     }
 }
 
+/*
+** Send the body of a file whose headers have been sent.  The file is
+** handed to the kernel with sendfile() where available.  If fewer than
+** the announced bytes could be sent, the connection is not reused.
+*/
 void
-_httpd_catFile(request * r, const char *path)
+_httpd_catFile(request * r, const char *path, off_t size)
 {
-    int fd, len;
+    int fd;
+    off_t offset;
+#if defined(HAVE_SYS_SENDFILE_H)
+    ssize_t sent;
+#else
+    int len;
     char buf[HTTP_MAX_LEN];
+#endif
 
     fd = open(path, O_RDONLY);
-    if (fd < 0)
+    if (fd < 0) {
+        r->request.keepAlive = 0;
         return;
+    }
+    offset = 0;
+#if defined(HAVE_SYS_SENDFILE_H)
+    while (offset < size) {
+        sent = sendfile(r->clientSock, fd, &offset, size - offset);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            break;
+    }
+#else
     len = read(fd, buf, HTTP_MAX_LEN);
-    while (len > 0) {
-        r->response.responseLength += len;
-        _httpd_net_write(r->clientSock, buf, len);
+    while (len > 0 && offset < size) {
+        if (_httpd_net_write(r->clientSock, buf, len) != len)
+            break;
+        offset += len;
         len = read(fd, buf, HTTP_MAX_LEN);
     }
+#endif
+    r->response.responseLength += offset;
+    if (offset != size)
+        r->request.keepAlive = 0;
     close(fd);
 }
 
@@ -549,16 +648,26 @@ _httpd_sendStatic(httpd * server, request * r, char *data)
 {
     if (_httpd_checkLastModified(r, server->startTime) == 0) {
         _httpd_send304(server, r);
+        return;
     }
-    _httpd_sendHeaders(r, server->startTime, strlen(data));
+    _httpd_sendHeaders(r, HTTP_LENGTH_UNKNOWN, server->startTime);
     httpdOutput(r, data);
 }
 
+void
+_httpd_formatETag(char *buf, struct stat *sbuf)
+{
+    snprintf(buf, HTTP_ETAG_LEN, "\"%lx-%lx\"", (unsigned long)sbuf->st_mtime, (unsigned long)sbuf->st_size);
+}
+
 void
 _httpd_sendFile(httpd * server, request * r, char *path)
 {
-    char *suffix;
+    char *suffix, etag[HTTP_ETAG_LEN], buf[HTTP_HEADERS_BUF_LEN];
     struct stat sbuf;
+    struct iovec iov[2];
+    httpCacheEntry *entry;
+    int notModified;
 
     suffix = strrchr(path, '.');
     if (suffix != NULL) {
@@ -570,19 +679,50 @@ _httpd_sendFile(httpd * server, request * r, char *path)
             strcpy(r->response.contentType, "image/xbm");
         if (strcasecmp(suffix, ".png") == 0)
             strcpy(r->response.contentType, "image/png");
+        if (strcasecmp(suffix, ".ico") == 0)
+            strcpy(r->response.contentType, "image/x-icon");
+        if (strcasecmp(suffix, ".svg") == 0)
+            strcpy(r->response.contentType, "image/svg+xml");
         if (strcasecmp(suffix, ".css") == 0)
             strcpy(r->response.contentType, "text/css");
+        if (strcasecmp(suffix, ".js") == 0)
+            strcpy(r->response.contentType, "application/javascript");
     }
-    if (stat(path, &sbuf) < 0) {
+    if (stat(path, &sbuf) < 0 || !S_ISREG(sbuf.st_mode)) {
         _httpd_send404(server, r);
         return;
     }
-    if (_httpd_checkLastModified(r, sbuf.st_mtime) == 0) {
+
+    /*
+     ** If-None-Match wins over If-Modified-Since when both are sent
+     */
+    _httpd_formatETag(etag, &sbuf);
+    if (*r->request.ifNoneMatch)
+        notModified = (strstr(r->request.ifNoneMatch, etag) != NULL || strcmp(r->request.ifNoneMatch, "*") == 0);
+    else
+        notModified = (_httpd_checkLastModified(r, sbuf.st_mtime) == 0);
+    snprintf(buf, sizeof(buf), "ETag: %s", etag);
+    httpdAddHeader(r, buf);
+    if (notModified) {
         _httpd_send304(server, r);
-    } else {
+        return;
+    }
+
+    entry = _httpd_cacheGet(path, &sbuf);
+    if (entry == NULL) {
         _httpd_sendHeaders(r, sbuf.st_size, sbuf.st_mtime);
-        _httpd_catFile(r, path);
+        _httpd_catFile(r, path, sbuf.st_size);
+        return;
     }
+    r->response.headersSent = 1;
+    iov[0].iov_base = buf;
+    iov[0].iov_len = _httpd_formatHeaders(r, buf, sizeof(buf), entry->size, entry->modTime);
+    iov[1].iov_base = entry->data;
+    iov[1].iov_len = entry->size;
+    r->response.responseLength += entry->size;
+    if (_httpd_net_writev(r->clientSock, iov, 2) < 0)
+        r->request.keepAlive = 0;
+    _httpd_cacheRelease(entry);
 }
 
 int
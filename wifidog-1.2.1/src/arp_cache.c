@@ -0,0 +1,419 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+
+/** @file arp_cache.c
+    @brief IP to MAC address cache kept in sync with the kernel neighbour table
+
+    The cache is filled from an rtnetlink dump of the neighbour table and
+    updated from RTM_NEWNEIGH/RTM_DELNEIGH events, so looking up a client
+    costs a hash probe instead of parsing the ARP table file. The file is
+    still read, at most once per ArpReloadInterval seconds, when a lookup
+    misses, when netlink is not available, or when a custom ARP table file
+    was given on the command line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+#include "common.h"
+#include "safe.h"
+#include "debug.h"
+#include "conf.h"
+#include "arp_cache.h"
+
+/** Initial number of slots of the table */
+#define ARP_CACHE_MIN_SIZE 64
+
+/** @internal
+ * One neighbour */
+typedef struct {
+    in_addr_t ip;               /**< IP address, 0 if the slot is free */
+    char mac[ARP_MAC_LEN];      /**< MAC address, formatted as in the ARP table file */
+} t_arp_entry;
+
+/** @internal
+ * Open-addressing table of neighbours, with linear probing */
+typedef struct {
+    t_arp_entry *slots;
+    unsigned int size;          /**< Number of slots, a power of two */
+    unsigned int used;
+} t_arp_table;
+
+static t_arp_table arp_table;
+static pthread_rwlock_t arp_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** @internal
+ * Serializes reloads from the ARP table file */
+static pthread_mutex_t arp_reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static time_t arp_last_reload = 0;
+
+/** Set while the netlink thread keeps the table up to date */
+static volatile int arp_netlink_active = 0;
+
+/** @internal
+ * Home slot of an address */
+static unsigned int
+arp_table_slot(const t_arp_table * table, in_addr_t ip)
+{
+    return (ntohl(ip) * 2654435761u) & (table->size - 1);
+}
+
+/** @internal
+ * Find the slot of an address, -1 if absent */
+static int
+arp_table_find(const t_arp_table * table, in_addr_t ip)
+{
+    unsigned int i;
+
+    if (table->size == 0)
+        return -1;
+    for (i = arp_table_slot(table, ip); table->slots[i].ip != 0; i = (i + 1) & (table->size - 1))
+        if (table->slots[i].ip == ip)
+            return i;
+
+    return -1;
+}
+
+/** @internal
+ * Add or update a neighbour */
+static void
+arp_table_set(t_arp_table * table, in_addr_t ip, const char *mac)
+{
+    t_arp_entry *old_slots = table->slots;
+    unsigned int old_size = table->size, i;
+
+    /* Keep the table at most half full so probes stay short */
+    if ((table->used + 1) * 2 > table->size) {
+        table->size = old_size ? old_size * 2 : ARP_CACHE_MIN_SIZE;
+        table->slots = safe_malloc(table->size * sizeof(t_arp_entry));
+        memset(table->slots, 0, table->size * sizeof(t_arp_entry));
+        table->used = 0;
+        for (i = 0; i < old_size; i++)
+            if (old_slots[i].ip != 0)
+                arp_table_set(table, old_slots[i].ip, old_slots[i].mac);
+        free(old_slots);
+    }
+
+    for (i = arp_table_slot(table, ip); table->slots[i].ip != 0; i = (i + 1) & (table->size - 1))
+        if (table->slots[i].ip == ip)
+            break;
+    if (table->slots[i].ip == 0) {
+        table->slots[i].ip = ip;
+        table->used++;
+    }
+    strncpy(table->slots[i].mac, mac, ARP_MAC_LEN - 1);
+    table->slots[i].mac[ARP_MAC_LEN - 1] = '\0';
+}
+
+/** @internal
+ * Remove a neighbour, shifting back the entries that probed past it */
+static void
+arp_table_remove(t_arp_table * table, in_addr_t ip)
+{
+    unsigned int mask = table->size - 1, hole, i, home;
+    int found = arp_table_find(table, ip);
+
+    if (found < 0)
+        return;
+
+    hole = found;
+    table->slots[hole].ip = 0;
+    table->used--;
+    for (i = (hole + 1) & mask; table->slots[i].ip != 0; i = (i + 1) & mask) {
+        home = arp_table_slot(table, table->slots[i].ip);
+        /* Move the entry into the hole unless its home lies between the two */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->slots[hole] = table->slots[i];
+            table->slots[i].ip = 0;
+            hole = i;
+        }
+    }
+}
+
+/** @internal
+ * Replace the table with the contents of the ARP table file */
+static void
+arp_cache_reload(void)
+{
+    s_config *config = config_get_config();
+    t_arp_table table, old;
+    struct in_addr addr;
+    char ip[16];
+    char mac[ARP_MAC_LEN];
+    FILE *proc;
+
+    if (!(proc = fopen(config->arp_table_path, "r"))) {
+        debug(LOG_ERR, "Could not open %s: %s", config->arp_table_path, strerror(errno));
+        return;
+    }
+
+    memset(&table, 0, sizeof(table));
+
+    /* Skip first line */
+    while (!feof(proc) && fgetc(proc) != '\n') ;
+
+    while (!feof(proc) && (fscanf(proc, " %15[0-9.] %*s %*s %17[A-Fa-f0-9:] %*s %*s", ip, mac) == 2)) {
+        if (inet_aton(ip, &addr) && addr.s_addr != 0)
+            arp_table_set(&table, addr.s_addr, mac);
+    }
+
+    fclose(proc);
+
+    pthread_rwlock_wrlock(&arp_lock);
+    old = arp_table;
+    arp_table = table;
+    pthread_rwlock_unlock(&arp_lock);
+    free(old.slots);
+
+    debug(LOG_DEBUG, "Loaded %u neighbours from %s", table.used, config->arp_table_path);
+}
+
+/** @internal
+ * Reload the ARP table file unless it was read less than ArpReloadInterval seconds ago.
+ * @param force Reload even if netlink keeps the table up to date
+ * @return 1 if the table was reloaded
+ */
+static int
+arp_cache_reload_if_due(int force)
+{
+    s_config *config = config_get_config();
+    time_t now = time(NULL);
+    int reloaded = 0;
+
+    pthread_mutex_lock(&arp_reload_mutex);
+    if ((force || !arp_netlink_active) && now - arp_last_reload >= config->arpreloadinterval) {
+        arp_last_reload = now;
+        arp_cache_reload();
+        reloaded = 1;
+    }
+    pthread_mutex_unlock(&arp_reload_mutex);
+
+    return reloaded;
+}
+
+/** @internal
+ * Copy the MAC address of an address out of the table */
+static int
+arp_cache_find(in_addr_t ip, char *mac)
+{
+    int i;
+
+    pthread_rwlock_rdlock(&arp_lock);
+    i = arp_table_find(&arp_table, ip);
+    if (i >= 0)
+        memcpy(mac, arp_table.slots[i].mac, ARP_MAC_LEN);
+    pthread_rwlock_unlock(&arp_lock);
+
+    return i >= 0 ? 0 : -1;
+}
+
+/** Find the MAC address bound to an IP address.
+ * @param ip IP address, in dotted quad notation
+ * @param mac Returns the MAC address; must hold ARP_MAC_LEN characters
+ * @return 0 on success, -1 if the address is not in the neighbour table
+ */
+int
+arp_cache_lookup(const char *ip, char *mac)
+{
+    struct in_addr addr;
+
+    if (!inet_aton(ip, &addr) || addr.s_addr == 0)
+        return -1;
+
+    /* Without netlink the table is a snapshot of the file: refresh it first */
+    arp_cache_reload_if_due(0);
+
+    if (arp_cache_find(addr.s_addr, mac) == 0)
+        return 0;
+
+    /* The neighbour may have appeared after the last update */
+    if (arp_cache_reload_if_due(1) && arp_cache_find(addr.s_addr, mac) == 0)
+        return 0;
+
+    return -1;
+}
+
+/** @internal
+ * Ask the kernel for its whole IPv4 neighbour table */
+static int
+arp_netlink_dump(int fd)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct ndmsg ndm;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+    req.nh.nlmsg_type = RTM_GETNEIGH;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = time(NULL);
+    req.ndm.ndm_family = AF_INET;
+
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0) {
+        debug(LOG_ERR, "Could not request the neighbour table: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/** @internal
+ * Apply one neighbour message to the table */
+static void
+arp_netlink_update(struct nlmsghdr *nh)
+{
+    struct ndmsg *ndm = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    int len = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+    const unsigned char *lladdr = NULL;
+    in_addr_t ip = 0;
+    char mac[ARP_MAC_LEN];
+
+    if (len < 0 || ndm->ndm_family != AF_INET)
+        return;
+
+    for (rta = (struct rtattr *)((char *)ndm + NLMSG_ALIGN(sizeof(*ndm))); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == NDA_DST && RTA_PAYLOAD(rta) == sizeof(ip))
+            memcpy(&ip, RTA_DATA(rta), sizeof(ip));
+        else if (rta->rta_type == NDA_LLADDR && RTA_PAYLOAD(rta) == 6)
+            lladdr = RTA_DATA(rta);
+    }
+    if (ip == 0)
+        return;
+
+    pthread_rwlock_wrlock(&arp_lock);
+    if (nh->nlmsg_type == RTM_DELNEIGH || lladdr == NULL || (ndm->ndm_state & (NUD_INCOMPLETE | NUD_FAILED))) {
+        arp_table_remove(&arp_table, ip);
+    } else {
+        snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 lladdr[0], lladdr[1], lladdr[2], lladdr[3], lladdr[4], lladdr[5]);
+        arp_table_set(&arp_table, ip, mac);
+    }
+    pthread_rwlock_unlock(&arp_lock);
+}
+
+/** @internal
+ * Follow neighbour table changes until the netlink socket fails */
+static void *
+thread_arp_netlink(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[16384];
+    struct nlmsghdr *nh;
+    int len;
+
+    free(arg);
+
+    while (1) {
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS) {
+                /* Events were lost: start over from a full dump */
+                debug(LOG_WARNING, "Neighbour events lost, reloading the neighbour table");
+                pthread_rwlock_wrlock(&arp_lock);
+                free(arp_table.slots);
+                memset(&arp_table, 0, sizeof(arp_table));
+                pthread_rwlock_unlock(&arp_lock);
+                if (arp_netlink_dump(fd) == 0)
+                    continue;
+            } else {
+                debug(LOG_ERR, "Could not read neighbour events: %s", strerror(errno));
+            }
+            break;
+        }
+
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == RTM_NEWNEIGH || nh->nlmsg_type == RTM_DELNEIGH)
+                arp_netlink_update(nh);
+        }
+    }
+
+    debug(LOG_WARNING, "No longer following the neighbour table, reading %s instead",
+          config_get_config()->arp_table_path);
+    arp_netlink_active = 0;
+    close(fd);
+
+    return NULL;
+}
+
+/** Fill the cache and keep it in sync with the kernel neighbour table.
+ *
+ * If netlink cannot be used, or a custom ARP table file was given, the
+ * cache is a snapshot of that file reloaded every ArpReloadInterval seconds.
+ * @return 0 if neighbour events are followed, -1 otherwise
+ */
+int
+arp_cache_init(void)
+{
+    s_config *config = config_get_config();
+    struct sockaddr_nl addr;
+    int fd, rcvbuf = 256 * 1024, *arg;
+    pthread_t tid;
+
+    if (strcmp(config->arp_table_path, DEFAULT_ARPTABLE) != 0) {
+        debug(LOG_INFO, "Using custom ARP table %s, not following neighbour events", config->arp_table_path);
+        return -1;
+    }
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) {
+        debug(LOG_ERR, "Could not open a netlink socket: %s", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_NEIGH;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || arp_netlink_dump(fd) < 0) {
+        debug(LOG_ERR, "Could not follow neighbour events: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    arg = safe_malloc(sizeof(int));
+    *arg = fd;
+    arp_netlink_active = 1;
+    if (pthread_create(&tid, NULL, thread_arp_netlink, arg) != 0) {
+        debug(LOG_ERR, "Failed to create the neighbour thread: %s", strerror(errno));
+        arp_netlink_active = 0;
+        free(arg);
+        close(fd);
+        return -1;
+    }
+    pthread_detach(tid);
+
+    return 0;
+}
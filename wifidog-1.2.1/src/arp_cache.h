@@ -0,0 +1,38 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+
+/** @file arp_cache.h
+    @brief IP to MAC address cache kept in sync with the kernel neighbour table
+*/
+
+#ifndef _ARP_CACHE_H_
+#define _ARP_CACHE_H_
+
+/** @brief Size of a MAC address string, including the terminating NUL */
+#define ARP_MAC_LEN 18
+
+/** @brief Start following the kernel neighbour table */
+int arp_cache_init(void);
+
+/** @brief Find the MAC address of an IP address without allocating */
+int arp_cache_lookup(const char *ip, char *mac);
+
+#endif                          /* _ARP_CACHE_H_ */
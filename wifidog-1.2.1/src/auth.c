@@ -50,38 +50,6 @@
 #include "util.h"
 #include "wd_util.h"
 
-/** Launches a thread that periodically checks if any of the connections has timed out
-@param arg Must contain a pointer to a string containing the IP adress of the client to check to check
-@todo Also pass MAC adress? 
-@todo This thread loops infinitely, need a watchdog to verify that it is still running?
-*/
-void
-thread_client_timeout_check(const void *arg)
-{
-    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
-    pthread_mutex_t cond_mutex = PTHREAD_MUTEX_INITIALIZER;
-    struct timespec timeout;
-
-    while (1) {
-        /* Sleep for config.checkinterval seconds... */
-        timeout.tv_sec = time(NULL) + config_get_config()->checkinterval;
-        timeout.tv_nsec = 0;
-
-        /* Mutex must be locked for pthread_cond_timedwait... */
-        pthread_mutex_lock(&cond_mutex);
-
-        /* Thread safe "sleep" */
-        pthread_cond_timedwait(&cond, &cond_mutex, &timeout);
-
-        /* No longer needs to be locked */
-        pthread_mutex_unlock(&cond_mutex);
-
-        debug(LOG_DEBUG, "Running fw_counter()");
-
-        fw_sync_with_authserver();
-    }
-}
-
 /**
  * @brief Logout a client and report to auth server.
  *
@@ -174,8 +142,7 @@ authenticate_client(request * r)
 
     if (strcmp(token, client->token) != 0) {
         /* If token changed, save it. */
-        free(client->token);
-        client->token = token;
+        client_list_set_token(client, token);
     } else {
         free(token);
     }
@@ -59,7 +59,4 @@ void logout_client(t_client *);
 /** @brief Authenticate a single client against the central server */
 void authenticate_client(request *);
 
-/** @brief Periodically check if connections expired */
-void thread_client_timeout_check(const void *arg);
-
 #endif
@@ -49,10 +49,70 @@
 #include "debug.h"
 #include "centralserver.h"
 #include "firewall.h"
+#include "pstring.h"
+#include "dns_cache.h"
 #include "../config.h"
 
 #include "simple_http.h"
 
+/** @internal
+ * Format a GET request for the auth script.
+@param request_type Use the REQUEST_TYPE_* defines in centralserver.h
+@param keepalive Ask the server to keep the connection open afterwards
+@return The request, caller frees
+*/
+static char *
+auth_server_format_request(const char *request_type, const char *ip, const char *mac, const char *token,
+                           unsigned long long int incoming, unsigned long long int outgoing,
+                           unsigned long long int incoming_delta, unsigned long long int outgoing_delta, int keepalive)
+{
+    s_config *config = config_get_config();
+    t_auth_serv *auth_server = get_auth_server();
+    pstr_t *request = pstr_new();
+    char *safe_token;
+
+        /**
+	 * TODO: XXX change the PHP so we can harmonize stage as request_type
+	 * everywhere.
+	 */
+    safe_token = httpdUrlEncode(token);
+    pstr_append_sprintf(request, "GET %s%sstage=%s&ip=%s&mac=%s&token=%s&incoming=%llu&outgoing=%llu",
+                        auth_server->authserv_path,
+                        auth_server->authserv_auth_script_path_fragment,
+                        request_type, ip, mac, safe_token, incoming, outgoing);
+    if (config->deltatraffic)
+        pstr_append_sprintf(request, "&incomingdelta=%llu&outgoingdelta=%llu", incoming_delta, outgoing_delta);
+    pstr_append_sprintf(request, "&gw_id=%s HTTP/1.0\r\n"
+                        "User-Agent: WiFiDog %s\r\n"
+                        "Host: %s\r\n"
+                        "%s"
+                        "\r\n",
+                        config->gw_id, VERSION, auth_server->authserv_hostname,
+                        keepalive ? "Connection: keep-alive\r\n" : "");
+    free(safe_token);
+
+    return pstr_to_string(request);
+}
+
+/** @internal
+ * Extract the authentication code from an auth server response */
+static t_authcode
+auth_server_parse_response(const char *res)
+{
+    const char *tmp;
+    int authcode;
+
+    if ((tmp = strstr(res, "Auth: "))) {
+        if (sscanf(tmp, "Auth: %d", &authcode) == 1) {
+            debug(LOG_INFO, "Auth server returned authentication code %d", authcode);
+            return (t_authcode) authcode;
+        } else {
+            debug(LOG_WARNING, "Auth server did not return expected authentication code");
+        }
+    }
+    return (AUTH_ERROR);
+}
+
 /** Initiates a transaction with the auth server, either to authenticate or to
  * update the traffic counters at the server
 @param authresponse Returns the information given by the central server 
@@ -67,83 +127,248 @@ t_authcode
 auth_server_request(t_authresponse * authresponse, const char *request_type, const char *ip, const char *mac,
                     const char *token, unsigned long long int incoming, unsigned long long int outgoing, unsigned long long int incoming_delta, unsigned long long int outgoing_delta)
 {
-    s_config *config = config_get_config();
     int sockfd;
-    char buf[MAX_BUF];
-    char *tmp;
-    char *safe_token;
-    t_auth_serv *auth_server = NULL;
-    auth_server = get_auth_server();
+    char *req;
 
     /* Blanket default is error. */
     authresponse->authcode = AUTH_ERROR;
 
     sockfd = connect_auth_server();
 
-        /**
-	 * TODO: XXX change the PHP so we can harmonize stage as request_type
-	 * everywhere.
-	 */
-    memset(buf, 0, sizeof(buf));
-    safe_token = httpdUrlEncode(token);
-    if(config -> deltatraffic) {
-           snprintf(buf, (sizeof(buf) - 1),
-             "GET %s%sstage=%s&ip=%s&mac=%s&token=%s&incoming=%llu&outgoing=%llu&incomingdelta=%llu&outgoingdelta=%llu&gw_id=%s HTTP/1.0\r\n"
-             "User-Agent: WiFiDog %s\r\n"
-             "Host: %s\r\n"
-             "\r\n",
-             auth_server->authserv_path,
-             auth_server->authserv_auth_script_path_fragment,
-             request_type,
-             ip, mac, safe_token, 
-             incoming, 
-             outgoing, 
-             incoming_delta, 
-             outgoing_delta,
-             config->gw_id, VERSION, auth_server->authserv_hostname);
-    } else {
-            snprintf(buf, (sizeof(buf) - 1),
-             "GET %s%sstage=%s&ip=%s&mac=%s&token=%s&incoming=%llu&outgoing=%llu&gw_id=%s HTTP/1.0\r\n"
-             "User-Agent: WiFiDog %s\r\n"
-             "Host: %s\r\n"
-             "\r\n",
-             auth_server->authserv_path,
-             auth_server->authserv_auth_script_path_fragment,
-             request_type,
-             ip,
-             mac, safe_token, incoming, outgoing, config->gw_id, VERSION, auth_server->authserv_hostname);
-        }
-    free(safe_token);
+    req = auth_server_format_request(request_type, ip, mac, token, incoming, outgoing, incoming_delta,
+                                     outgoing_delta, 0);
 
     char *res;
 #ifdef USE_CYASSL
+    t_auth_serv *auth_server = get_auth_server();
     if (auth_server->authserv_use_ssl) {
-        res = https_get(sockfd, buf, auth_server->authserv_hostname);
+        res = https_get(sockfd, req, auth_server->authserv_hostname);
     } else {
-        res = http_get(sockfd, buf);
+        res = http_get(sockfd, req);
     }
 #endif
 #ifndef USE_CYASSL
-    res = http_get(sockfd, buf);
+    res = http_get(sockfd, req);
 #endif
+    free(req);
     if (NULL == res) {
         debug(LOG_ERR, "There was a problem talking to the auth server!");
         return (AUTH_ERROR);
     }
 
-    if ((tmp = strstr(res, "Auth: "))) {
-        if (sscanf(tmp, "Auth: %d", (int *)&authresponse->authcode) == 1) {
-            debug(LOG_INFO, "Auth server returned authentication code %d", authresponse->authcode);
-            free(res);
-            return (authresponse->authcode);
-        } else {
-            debug(LOG_WARNING, "Auth server did not return expected authentication code");
-            free(res);
-            return (AUTH_ERROR);
+    authresponse->authcode = auth_server_parse_response(res);
+    free(res);
+    return (authresponse->authcode);
+}
+
+/** @internal
+ * Report the counters of many clients in a single POST.
+ *
+ * The body has one line per client with the same fields as a counters
+ * request. The server answers with one "Auth: <code> <ip>" line per
+ * client it processed, preferably in the order they were sent.
+@param clients The clients to report
+@param authcodes Returns the code of each client the server answered for
+@param pending Indexes of the clients to report; on return, those the server did not answer for
+@param count Number of entries in pending
+@return Number of entries left in pending, -1 if no auth server could be reached
+*/
+static int
+auth_server_counters_bulk(t_client ** clients, t_authcode * authcodes, int *pending, int count)
+{
+    s_config *config = config_get_config();
+    t_auth_serv *auth_server = get_auth_server();
+    pstr_t *body = pstr_new(), *request = pstr_new();
+    char *req, *res, *line, *end, *safe_token, *answered;
+    int sockfd, i, j, cursor, authcode, left;
+    t_client *client;
+
+    for (i = 0; i < count; i++) {
+        client = clients[pending[i]];
+        safe_token = httpdUrlEncode(client->token);
+        pstr_append_sprintf(body, "ip=%s&mac=%s&token=%s&incoming=%llu&outgoing=%llu",
+                            client->ip, client->mac, safe_token, client->counters.incoming, client->counters.outgoing);
+        if (config->deltatraffic)
+            pstr_append_sprintf(body, "&incomingdelta=%llu&outgoingdelta=%llu",
+                                client->counters.incoming_delta, client->counters.outgoing_delta);
+        pstr_cat(body, "\n");
+        free(safe_token);
+    }
+
+    pstr_append_sprintf(request, "POST %s%sstage=%s&gw_id=%s HTTP/1.0\r\n"
+                        "User-Agent: WiFiDog %s\r\n"
+                        "Host: %s\r\n"
+                        "Content-Type: text/plain\r\n"
+                        "Content-Length: %lu\r\n"
+                        "\r\n",
+                        auth_server->authserv_path,
+                        auth_server->authserv_auth_script_path_fragment,
+                        REQUEST_TYPE_COUNTERS, config->gw_id, VERSION, auth_server->authserv_hostname,
+                        (unsigned long)body->len);
+    req = pstr_to_string(body);
+    pstr_cat(request, req);
+    free(req);
+    req = pstr_to_string(request);
+
+    sockfd = connect_auth_server();
+    if (sockfd == -1) {
+        free(req);
+        return -1;
+    }
+#ifdef USE_CYASSL
+    if (auth_server->authserv_use_ssl) {
+        res = https_get(sockfd, req, auth_server->authserv_hostname);
+    } else {
+        res = http_get(sockfd, req);
+    }
+#endif
+#ifndef USE_CYASSL
+    res = http_get(sockfd, req);
+#endif
+    free(req);
+    if (NULL == res) {
+        debug(LOG_ERR, "There was a problem talking to the auth server!");
+        return count;
+    }
+
+    answered = safe_malloc(count);
+    memset(answered, 0, count);
+    cursor = 0;
+    line = strstr(res, "\r\n\r\n");
+    for (line = line ? line + 4 : res; *line; line = end) {
+        end = line + strcspn(line, "\r\n");
+        if (*end)
+            *end++ = '\0';
+        if (strncmp(line, "Auth: ", 6) != 0)
+            continue;
+        authcode = (int)strtol(line + 6, &line, 10);
+        line += strspn(line, " ");
+        if (*line == '\0')
+            continue;
+
+        /* Responses normally come back in order, only search when they do not */
+        if (cursor >= count || strcmp(clients[pending[cursor]]->ip, line) != 0) {
+            for (cursor = 0; cursor < count; cursor++)
+                if (strcmp(clients[pending[cursor]]->ip, line) == 0)
+                    break;
+            if (cursor == count) {
+                debug(LOG_WARNING, "Auth server answered for unknown client [%s]", line);
+                continue;
+            }
         }
+        authcodes[pending[cursor]] = (t_authcode) authcode;
+        answered[cursor++] = 1;
     }
     free(res);
-    return (AUTH_ERROR);
+
+    for (i = j = 0; i < count; i++)
+        if (!answered[i])
+            pending[j++] = pending[i];
+    left = j;
+    free(answered);
+
+    debug(LOG_INFO, "Auth server answered for %d of %d clients in bulk", count - left, count);
+    if (left == count)
+        debug(LOG_WARNING, "Auth server did not understand the bulk counters request, reporting clients one by one");
+
+    return left;
+}
+
+/** @internal
+ * Report the counters of many clients with one request per client, sent
+ * concurrently over a few keep-alive connections.
+@param clients The clients to report
+@param authcodes Returns the code of each client
+@param pending Indexes of the clients to report
+@param count Number of entries in pending
+*/
+static void
+auth_server_counters_parallel(t_client ** clients, t_authcode * authcodes, const int *pending, int count)
+{
+    s_config *config = config_get_config();
+    t_authresponse authresponse;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    t_http_job *jobs;
+    t_client *client;
+    int sockfd, i;
+
+#ifdef USE_CYASSL
+    if (get_auth_server()->authserv_use_ssl) {
+        /* Connections are not shared with CyaSSL, report clients one by one */
+        for (i = 0; i < count; i++) {
+            client = clients[pending[i]];
+            authcodes[pending[i]] = auth_server_request(&authresponse, REQUEST_TYPE_COUNTERS, client->ip,
+                                                        client->mac, client->token, client->counters.incoming,
+                                                        client->counters.outgoing, client->counters.incoming_delta,
+                                                        client->counters.outgoing_delta);
+        }
+        return;
+    }
+#endif
+
+    /* The first connection also resolves the server and fails over if needed */
+    sockfd = connect_auth_server();
+    if (sockfd == -1)
+        return;
+    if (getpeername(sockfd, (struct sockaddr *)&addr, &addrlen) == -1) {
+        debug(LOG_ERR, "getpeername() failed: %s", strerror(errno));
+        close(sockfd);
+        return;
+    }
+
+    jobs = safe_malloc(count * sizeof(t_http_job));
+    for (i = 0; i < count; i++) {
+        client = clients[pending[i]];
+        jobs[i].request = auth_server_format_request(REQUEST_TYPE_COUNTERS, client->ip, client->mac, client->token,
+                                                     client->counters.incoming, client->counters.outgoing,
+                                                     client->counters.incoming_delta,
+                                                     client->counters.outgoing_delta, 1);
+    }
+
+    if (http_get_parallel(&addr, sockfd, jobs, count, config->syncconnections) < count)
+        debug(LOG_ERR, "There was a problem talking to the auth server!");
+
+    for (i = 0; i < count; i++) {
+        if (jobs[i].response) {
+            authresponse.authcode = auth_server_parse_response(jobs[i].response);
+            authcodes[pending[i]] = authresponse.authcode;
+            free(jobs[i].response);
+        }
+        free(jobs[i].request);
+    }
+    free(jobs);
+}
+
+/** Report the traffic counters of many clients to the auth server.
+ *
+ * With BulkCounters enabled all clients go in a single request first;
+ * clients the server did not answer for, and all clients otherwise, are
+ * reported with concurrent per-client requests. Either way a sync pass
+ * takes a few round trips rather than one per client.
+@param clients The clients to report
+@param authcodes Returns the code the server returned for each client, AUTH_ERROR if none
+@param count Number of clients
+*/
+void
+auth_server_counters_request(t_client ** clients, t_authcode * authcodes, int count)
+{
+    s_config *config = config_get_config();
+    int *pending;
+    int i, left = count;
+
+    pending = safe_malloc((count > 0 ? count : 1) * sizeof(int));
+    for (i = 0; i < count; i++) {
+        authcodes[i] = AUTH_ERROR;
+        pending[i] = i;
+    }
+
+    if (config->bulkcounters && count > 0)
+        left = auth_server_counters_bulk(clients, authcodes, pending, count);
+    if (left > 0)
+        auth_server_counters_parallel(clients, authcodes, pending, left);
+
+    free(pending);
 }
 
 /* Tries really hard to connect to an auth server. Returns a file descriptor, -1 on error
@@ -177,7 +402,9 @@ _connect_auth_server(int level)
     s_config *config = config_get_config();
     t_auth_serv *auth_server = NULL;
     t_popular_server *popular_server = NULL;
-    struct in_addr *h_addr;
+    struct in_addr *h_addr, popular_addr;
+    const char **popular_names;
+    int num_popular, popular;
     int num_servers = 0;
     char *hostname = NULL;
     char *ip;
@@ -222,17 +449,25 @@ _connect_auth_server(int level)
          */
         debug(LOG_DEBUG, "Level %d: Resolving auth server [%s] failed", level, hostname);
 
-        for (popular_server = config->popular_servers; popular_server; popular_server = popular_server->next) {
-            debug(LOG_DEBUG, "Level %d: Resolving popular server [%s]", level, popular_server->hostname);
-            h_addr = wd_gethostbyname(popular_server->hostname);
-            if (h_addr) {
-                debug(LOG_DEBUG, "Level %d: Resolving popular server [%s] succeeded = [%s]", level, popular_server->hostname,
-                      inet_ntoa(*h_addr));
-                break;
-            } else {
-                debug(LOG_DEBUG, "Level %d: Resolving popular server [%s] failed", level, popular_server->hostname);
-            }
+        /* The popular servers are resolved in parallel, and only once per DNSCacheTTL */
+        num_popular = 0;
+        for (popular_server = config->popular_servers; popular_server; popular_server = popular_server->next)
+            num_popular++;
+        popular_names = safe_malloc((num_popular > 0 ? num_popular : 1) * sizeof(char *));
+        num_popular = 0;
+        for (popular_server = config->popular_servers; popular_server; popular_server = popular_server->next)
+            popular_names[num_popular++] = popular_server->hostname;
+        debug(LOG_DEBUG, "Level %d: Resolving %d popular servers", level, num_popular);
+        popular = dns_cache_lookup_any(popular_names, num_popular, &popular_addr);
+        if (popular >= 0) {
+            debug(LOG_DEBUG, "Level %d: Resolving popular server [%s] succeeded = [%s]", level, popular_names[popular],
+                  inet_ntoa(popular_addr));
+            h_addr = safe_malloc(sizeof(*h_addr));
+            *h_addr = popular_addr;
+        } else {
+            debug(LOG_DEBUG, "Level %d: Resolving all popular servers failed", level);
         }
+        free(popular_names);
 
         /* 
          * If we got any h_addr buffer for one of the popular servers, in other
@@ -343,3 +578,59 @@ _connect_auth_server(int level)
         }
     }
 }
+
+/** @internal
+ * Called by the DNS cache when a host name changed address: update the
+ * address of the auth servers and the firewall rules that let clients
+ * reach them.
+ */
+static void
+auth_server_dns_changed(void)
+{
+    s_config *config = config_get_config();
+    t_auth_serv *auth_server;
+    struct in_addr addr;
+    char *ip;
+    int changed = 0;
+
+    LOCK_CONFIG();
+    for (auth_server = config->auth_servers; auth_server; auth_server = auth_server->next) {
+        /* Only servers already in use have firewall rules */
+        if (!auth_server->last_ip || dns_cache_lookup(auth_server->authserv_hostname, &addr) != 0)
+            continue;
+        ip = inet_ntoa(addr);
+        if (strcmp(auth_server->last_ip, ip) != 0) {
+            debug(LOG_INFO, "Auth server [%s] moved from [%s] to [%s]", auth_server->authserv_hostname,
+                  auth_server->last_ip, ip);
+            free(auth_server->last_ip);
+            auth_server->last_ip = safe_strdup(ip);
+            changed = 1;
+        }
+    }
+    if (changed) {
+        fw_clear_authservers();
+        fw_set_authservers();
+    }
+    UNLOCK_CONFIG();
+}
+
+/** Resolve the auth and popular servers in the background and keep their
+ * addresses up to date, so that connecting to an auth server does not wait
+ * for DNS.
+ */
+void
+auth_server_dns_init(void)
+{
+    s_config *config = config_get_config();
+    t_auth_serv *auth_server;
+    t_popular_server *popular_server;
+
+    LOCK_CONFIG();
+    for (auth_server = config->auth_servers; auth_server; auth_server = auth_server->next)
+        dns_cache_prefetch(auth_server->authserv_hostname);
+    for (popular_server = config->popular_servers; popular_server; popular_server = popular_server->next)
+        dns_cache_prefetch(popular_server->hostname);
+    UNLOCK_CONFIG();
+
+    dns_cache_start(auth_server_dns_changed);
+}
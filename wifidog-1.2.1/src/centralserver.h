@@ -53,6 +53,12 @@ t_authcode auth_server_request(t_authresponse * authresponse,
                                const char *mac,
                                const char *token, unsigned long long int incoming, unsigned long long int outgoing, unsigned long long int incoming_delta, unsigned long long int outgoing_delta);
 
+/** @brief Report the traffic counters of many clients at once */
+void auth_server_counters_request(t_client ** clients, t_authcode * authcodes, int count);
+
+/** @brief Keep the auth and popular servers' addresses resolved in the background */
+void auth_server_dns_init(void);
+
 /** @brief Tries really hard to connect to an auth server.  Returns a connected file descriptor or -1 on error */
 int connect_auth_server(void);
 
@@ -36,6 +36,8 @@
 #include <sys/types.h>
 
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "safe.h"
 #include "debug.h"
@@ -47,6 +49,37 @@
  */
 static t_client *firstclient = NULL;
 
+/** @internal
+ * Holds a pointer to the last element of the list
+ */
+static t_client *lastclient = NULL;
+
+/** @internal
+ * Number of clients in the list
+ */
+static unsigned int client_count = 0;
+
+/** Number of buckets of each index when the first client is added */
+#define CLIENT_INDEX_MIN_SIZE 64
+
+/** @internal
+ * Hash buckets of each index, chained through t_client::hnext. All indexes
+ * have client_index_size buckets, a power of two that is grown so that
+ * there is at most one client per bucket on average.
+ */
+static t_client **client_index[CLIENT_INDEX_MAX];
+static unsigned int client_index_size = 0;
+
+/** Number of one second slots of the idle index */
+#define CLIENT_IDLE_WHEEL_SIZE 1024
+
+/** @internal
+ * Idle deadlines of the clients, through t_client::idle_timer. A deadline
+ * is only a hint: when it comes up, the client's counters tell whether it
+ * really was idle, and if not it is pushed back.
+ */
+static t_timer_wheel client_idle_wheel;
+
 /** @internal
  * Client ID
  */
@@ -60,6 +93,110 @@ static pthread_mutex_t client_id_mutex = PTHREAD_MUTEX_INITIALIZER;
 /** Global mutex to protect access to the client list */
 pthread_mutex_t client_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/** @internal
+ * Hash a key of one of the indexes into a bucket (FNV-1a)
+ */
+static unsigned int
+client_index_hash(t_client_index index, const char *key, unsigned long long id)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    if (index == CLIENT_INDEX_ID) {
+        for (i = 0; i < 8; i++) {
+            h ^= (unsigned char)(id >> (i * 8));
+            h *= 16777619u;
+        }
+    } else {
+        for (; *key; key++) {
+            h ^= (unsigned char)*key;
+            h *= 16777619u;
+        }
+    }
+
+    return h & (client_index_size - 1);
+}
+
+/** @internal
+ * Get the string key of a client for one of the indexes
+ */
+static const char *
+client_index_key(const t_client * client, t_client_index index)
+{
+    switch (index) {
+    case CLIENT_INDEX_IP:
+        return client->ip;
+    case CLIENT_INDEX_MAC:
+        return client->mac;
+    case CLIENT_INDEX_TOKEN:
+        return client->token;
+    default:
+        return "";
+    }
+}
+
+/** @internal
+ * Add a client at the head of its bucket in one index
+ */
+static void
+client_index_link(t_client * client, t_client_index index)
+{
+    const char *key = client_index_key(client, index);
+    unsigned int bucket;
+
+    /* Clients inherited from a parent may lack a field */
+    if (key == NULL)
+        return;
+
+    bucket = client_index_hash(index, key, client->id);
+    client->hnext[index] = client_index[index][bucket];
+    client_index[index][bucket] = client;
+}
+
+/** @internal
+ * Remove a client from its bucket in one index
+ */
+static void
+client_index_unlink(t_client * client, t_client_index index)
+{
+    const char *key = client_index_key(client, index);
+    t_client **ptr;
+
+    if (key == NULL)
+        return;
+
+    ptr = &client_index[index][client_index_hash(index, key, client->id)];
+    while (*ptr != NULL && *ptr != client)
+        ptr = &(*ptr)->hnext[index];
+    if (*ptr != NULL)
+        *ptr = client->hnext[index];
+    client->hnext[index] = NULL;
+}
+
+/** @internal
+ * Double the number of buckets and rehash every client. The list is walked
+ * from the tail so that within a bucket the most recently added client still
+ * comes first, as it does in the list.
+ */
+static void
+client_index_grow(void)
+{
+    t_client *client;
+    int index;
+
+    client_index_size = client_index_size ? client_index_size * 2 : CLIENT_INDEX_MIN_SIZE;
+    for (index = 0; index < CLIENT_INDEX_MAX; index++) {
+        free(client_index[index]);
+        client_index[index] = safe_malloc(client_index_size * sizeof(t_client *));
+    }
+
+    for (client = lastclient; client != NULL; client = client->prev)
+        for (index = 0; index < CLIENT_INDEX_MAX; index++)
+            client_index_link(client, index);
+
+    debug(LOG_DEBUG, "Client list indexes grown to %u buckets", client_index_size);
+}
+
 /** Get a new client struct, not added to the list yet
  * @return Pointer to newly created client object not on the list yet.
  */
@@ -86,6 +223,27 @@ void
 client_list_init(void)
 {
     firstclient = NULL;
+    lastclient = NULL;
+    client_count = 0;
+}
+
+/** Get the number of clients in the list. Lock should be held when calling this!
+ * @return Number of clients
+ */
+unsigned int
+client_list_count(void)
+{
+    return client_count;
+}
+
+/** @internal
+ * When the client will have been idle for too long if its counters do not move */
+static time_t
+client_idle_deadline(const t_client * client)
+{
+    const s_config *config = config_get_config();
+
+    return client->counters.last_updated + config->checkinterval * config->clienttimeout;
 }
 
 /** Insert client at head of list. Lock should be held when calling this!
@@ -94,14 +252,31 @@ client_list_init(void)
 void
 client_list_insert_client(t_client * client)
 {
-    t_client *prev_head;
+    int index;
 
     pthread_mutex_lock(&client_id_mutex);
     client->id = client_id++;
     pthread_mutex_unlock(&client_id_mutex);
-    prev_head = firstclient;
-    client->next = prev_head;
+
+    client->prev = NULL;
+    client->next = firstclient;
+    if (firstclient != NULL)
+        firstclient->prev = client;
+    else
+        lastclient = client;
     firstclient = client;
+    client_count++;
+
+    if (client_count > client_index_size)
+        client_index_grow();
+    else
+        for (index = 0; index < CLIENT_INDEX_MAX; index++)
+            client_index_link(client, index);
+
+    if (client_idle_wheel.slots == NULL)
+        timer_wheel_init(&client_idle_wheel, CLIENT_IDLE_WHEEL_SIZE, time(NULL));
+    client->idle_timer.pprev = NULL;
+    timer_wheel_add(&client_idle_wheel, &client->idle_timer, client_idle_deadline(client));
 }
 
 /** Based on the parameters it receives, this function creates a new entry
@@ -124,7 +299,8 @@ client_list_add(const char *ip, const char *mac, const char *token)
     curclient->token = safe_strdup(token);
     curclient->counters.incoming_delta = curclient->counters.outgoing_delta = 
             curclient->counters.incoming = curclient->counters.incoming_history = curclient->counters.outgoing =
-        curclient->counters.outgoing_history = 0;
+        curclient->counters.outgoing_history = curclient->counters.incoming_packets =
+        curclient->counters.outgoing_packets = 0;
     curclient->counters.last_updated = time(NULL);
 
     client_list_insert_client(curclient);
@@ -195,6 +371,8 @@ client_dup(const t_client * src)
     new->counters.outgoing = src->counters.outgoing;
     new->counters.outgoing_history = src->counters.outgoing_history;
     new->counters.outgoing_delta = src->counters.outgoing_delta;
+    new->counters.incoming_packets = src->counters.incoming_packets;
+    new->counters.outgoing_packets = src->counters.outgoing_packets;
     new->counters.last_updated = src->counters.last_updated;
     new->next = NULL;
 
@@ -209,14 +387,39 @@ client_dup(const t_client * src)
 t_client *
 client_list_find_by_client(t_client * client)
 {
-    t_client *c = firstclient;
+    t_client *c;
 
+    if (client_index_size == 0)
+        return NULL;
+
+    c = client_index[CLIENT_INDEX_ID][client_index_hash(CLIENT_INDEX_ID, NULL, client->id)];
     while (NULL != c) {
         if (c->id == client->id) {
             return c;
         }
-        c = c->next;
+        c = c->hnext[CLIENT_INDEX_ID];
+    }
+    return NULL;
+}
+
+/** @internal
+ * Find the first client whose ip, mac or token equals key
+ */
+static t_client *
+client_list_find_by_key(t_client_index index, const char *key)
+{
+    t_client *ptr;
+
+    if (client_index_size == 0)
+        return NULL;
+
+    ptr = client_index[index][client_index_hash(index, key, 0)];
+    while (NULL != ptr) {
+        if (0 == strcmp(client_index_key(ptr, index), key))
+            return ptr;
+        ptr = ptr->hnext[index];
     }
+
     return NULL;
 }
 
@@ -231,11 +434,14 @@ client_list_find(const char *ip, const char *mac)
 {
     t_client *ptr;
 
-    ptr = firstclient;
+    if (client_index_size == 0)
+        return NULL;
+
+    ptr = client_index[CLIENT_INDEX_IP][client_index_hash(CLIENT_INDEX_IP, ip, 0)];
     while (NULL != ptr) {
-        if (0 == strcmp(ptr->ip, ip) && 0 == strcmp(ptr->mac, mac))
+        if (0 == strcmp(ptr->ip, ip) && ptr->mac != NULL && 0 == strcmp(ptr->mac, mac))
             return ptr;
-        ptr = ptr->next;
+        ptr = ptr->hnext[CLIENT_INDEX_IP];
     }
 
     return NULL;
@@ -250,16 +456,7 @@ client_list_find(const char *ip, const char *mac)
 t_client *
 client_list_find_by_ip(const char *ip)
 {
-    t_client *ptr;
-
-    ptr = firstclient;
-    while (NULL != ptr) {
-        if (0 == strcmp(ptr->ip, ip))
-            return ptr;
-        ptr = ptr->next;
-    }
-
-    return NULL;
+    return client_list_find_by_key(CLIENT_INDEX_IP, ip);
 }
 
 /**
@@ -271,16 +468,7 @@ client_list_find_by_ip(const char *ip)
 t_client *
 client_list_find_by_mac(const char *mac)
 {
-    t_client *ptr;
-
-    ptr = firstclient;
-    while (NULL != ptr) {
-        if (0 == strcmp(ptr->mac, mac))
-            return ptr;
-        ptr = ptr->next;
-    }
-
-    return NULL;
+    return client_list_find_by_key(CLIENT_INDEX_MAC, mac);
 }
 
 /** Finds a client by its token
@@ -290,16 +478,7 @@ client_list_find_by_mac(const char *mac)
 t_client *
 client_list_find_by_token(const char *token)
 {
-    t_client *ptr;
-
-    ptr = firstclient;
-    while (NULL != ptr) {
-        if (0 == strcmp(ptr->token, token))
-            return ptr;
-        ptr = ptr->next;
-    }
-
-    return NULL;
+    return client_list_find_by_key(CLIENT_INDEX_TOKEN, token);
 }
 
 /** Destroy the client list. Including all free...
@@ -362,24 +541,70 @@ client_list_delete(t_client * client)
 void
 client_list_remove(t_client * client)
 {
-    t_client *ptr;
-
-    ptr = firstclient;
+    int index;
 
-    if (ptr == NULL) {
+    if (firstclient == NULL) {
         debug(LOG_ERR, "Node list empty!");
-    } else if (ptr == client) {
-        firstclient = ptr->next;
-    } else {
-        /* Loop forward until we reach our point in the list. */
-        while (ptr->next != NULL && ptr->next != client) {
-            ptr = ptr->next;
-        }
-        /* If we reach the end before finding out element, complain. */
-        if (ptr->next == NULL) {
-            debug(LOG_ERR, "Node to delete could not be found.");
-        } else {
-            ptr->next = client->next;
-        }
+        return;
     }
+    if (client->prev == NULL && firstclient != client) {
+        debug(LOG_ERR, "Node to delete could not be found.");
+        return;
+    }
+
+    for (index = 0; index < CLIENT_INDEX_MAX; index++)
+        client_index_unlink(client, index);
+    timer_wheel_del(&client_idle_wheel, &client->idle_timer);
+
+    if (client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        firstclient = client->next;
+    if (client->next != NULL)
+        client->next->prev = client->prev;
+    else
+        lastclient = client->prev;
+    client->next = client->prev = NULL;
+    client_count--;
+}
+
+/** Find a client that has been idle for ClientTimeout check intervals.
+ * Only the clients whose deadline has come up are looked at, so this costs
+ * O(1) per client found and clients that were active in the meantime are
+ * rescheduled on the way. The client is left out of the idle index, the
+ * caller is expected to remove it. Lock should be held when calling this!
+ * @param now Current time
+ * @return An idle client, or NULL if there are none left
+ */
+t_client *
+client_list_find_idle(time_t now)
+{
+    t_timer *timer;
+    t_client *client;
+
+    if (client_idle_wheel.slots == NULL)
+        return NULL;
+
+    while ((timer = timer_wheel_expired(&client_idle_wheel, now)) != NULL) {
+        client = (t_client *) ((char *)timer - offsetof(t_client, idle_timer));
+        if (client_idle_deadline(client) <= now)
+            return client;
+        timer_wheel_add(&client_idle_wheel, &client->idle_timer, client_idle_deadline(client));
+    }
+
+    return NULL;
+}
+
+/** Replace the token of a client in the list, keeping the token index up
+ * to date. Lock should be held when calling this!
+ * @param client Client in the list
+ * @param token New token, owned by the client afterwards
+ */
+void
+client_list_set_token(t_client * client, char *token)
+{
+    client_index_unlink(client, CLIENT_INDEX_TOKEN);
+    free(client->token);
+    client->token = token;
+    client_index_link(client, CLIENT_INDEX_TOKEN);
 }
@@ -28,6 +28,8 @@
 #ifndef _CLIENT_LIST_H_
 #define _CLIENT_LIST_H_
 
+#include "timer_wheel.h"
+
 /** Global mutex to protect access to the client list */
 extern pthread_mutex_t client_list_mutex;
 
@@ -41,14 +43,30 @@ typedef struct _t_counters {
     /* Delta traffic stats by t123yh */
     unsigned long long incoming_delta;                    /**< @brief Incoming data after last report*/
     unsigned long long outgoing_delta;                    /**< @brief Outgoing data after last report*/
+    unsigned long long incoming_packets;        /**< @brief Incoming packets, counted with NFLOG accounting only */
+    unsigned long long outgoing_packets;        /**< @brief Outgoing packets, counted with NFLOG accounting only */
     time_t last_updated;        /**< @brief Last update of the counters */
 } t_counters;
 
+/** Hash indexes kept over the client list */
+typedef enum _t_client_index {
+    CLIENT_INDEX_IP,            /**< @brief Index on t_client::ip */
+    CLIENT_INDEX_MAC,           /**< @brief Index on t_client::mac */
+    CLIENT_INDEX_TOKEN,         /**< @brief Index on t_client::token */
+    CLIENT_INDEX_ID,            /**< @brief Index on t_client::id */
+    CLIENT_INDEX_MAX
+} t_client_index;
+
 /** Client node for the connected client linked list.
  */
 typedef struct _t_client {
     struct _t_client *next;             /**< @brief Pointer to the next client */
-    unsigned long long id;           /**< @brief Unique ID per client */
+    struct _t_client *prev;             /**< @brief Pointer to the previous client */
+    struct _t_client *hnext[CLIENT_INDEX_MAX];  /**< @brief Next client in the same
+					     bucket of each index */
+    unsigned long long id;           /**< @brief Unique ID per client. IDs are never
+					     reused, so a copy made with client_dup() can be
+					     revalidated with client_list_find_by_client() */
     char *ip;                           /**< @brief Client Ip address */
     char *mac;                          /**< @brief Client Mac address */
     char *token;                        /**< @brief Client token */
@@ -59,6 +77,8 @@ typedef struct _t_client {
 					     _http_* function is called */
     t_counters counters;                /**< @brief Counters for input/output of
 					     the client. */
+    t_timer idle_timer;                 /**< @brief Due when the client may have
+					     been idle for too long */
 } t_client;
 
 /** @brief Get a new client struct, not added to the list yet */
@@ -101,6 +121,15 @@ t_client *client_list_find_by_mac(const char *);        /* needed by wdctl_threa
 /** @brief Finds a client by its token */
 t_client *client_list_find_by_token(const char *);
 
+/** @brief Replaces the token of a client in the list */
+void client_list_set_token(t_client *, char *);
+
+/** @brief Number of clients in the list */
+unsigned int client_list_count(void);
+
+/** @brief Takes out of the idle index a client that has been idle for too long */
+t_client *client_list_find_idle(time_t);
+
 /** @brief Deletes a client from the connections list and frees its memory*/
 void client_list_delete(t_client *);
 
@@ -0,0 +1,174 @@
+/* vim: set et sw=4 ts=4 sts=4 : */
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+/** @file client_list_bench.c
+  @brief Measures client list lookup and update cost.
+
+  Not built by default; run "make client_list_bench" in src/ and then
+  ./client_list_bench [clients...] (default: 100 1000 10000).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "safe.h"
+#include "debug.h"
+#include "client_list.h"
+
+/** Number of lookups timed per client count */
+#define BENCH_LOOKUPS 200000
+
+/** @internal
+ * Current time in nanoseconds */
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** @internal
+ * Build the IP, MAC and token of the i-th test client */
+static void
+bench_client_keys(int i, char *ip, char *mac, char *token)
+{
+    sprintf(ip, "10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+    sprintf(mac, "02:00:00:%02x:%02x:%02x", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+    sprintf(token, "%08x%08x", i * 2654435761u, i);
+}
+
+/** @internal
+ * Time one kind of lookup over random clients */
+static void
+bench_lookup(const char *name, int clients, t_client * (*find) (const char *), int key)
+{
+    char ip[16], mac[18], token[17];
+    const char *keys[3] = { ip, mac, token };
+    double start, elapsed = 0;
+    int i, misses = 0;
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        bench_client_keys(rand() % clients, ip, mac, token);
+        start = bench_now();
+        if (find(keys[key]) == NULL)
+            misses++;
+        elapsed += bench_now() - start;
+    }
+
+    printf("%8d  %-22s %10.1f ns/op%s\n", clients, name, elapsed / BENCH_LOOKUPS, misses ? "  (MISSES!)" : "");
+}
+
+/** @internal
+ * Linear scan, as the list was searched before it was indexed */
+static t_client *
+bench_scan_by_ip(const char *ip)
+{
+    t_client *ptr;
+
+    for (ptr = client_get_first_client(); ptr != NULL; ptr = ptr->next)
+        if (strcmp(ptr->ip, ip) == 0)
+            return ptr;
+
+    return NULL;
+}
+
+static t_client *
+bench_find_by_id(const char *ip)
+{
+    t_client *client = client_list_find_by_ip(ip);
+
+    return client ? client_list_find_by_client(client) : NULL;
+}
+
+static void
+bench_run(int clients)
+{
+    char ip[16], mac[18], token[17];
+    t_client *client;
+    double start;
+    int i;
+
+    client_list_init();
+
+    start = bench_now();
+    for (i = 0; i < clients; i++) {
+        bench_client_keys(i, ip, mac, token);
+        client_list_add(ip, mac, token);
+    }
+    printf("%8d  %-22s %10.1f ns/op\n", clients, "add", (bench_now() - start) / clients);
+
+    bench_lookup("find_by_ip", clients, client_list_find_by_ip, 0);
+    bench_lookup("find_by_mac", clients, client_list_find_by_mac, 1);
+    bench_lookup("find_by_token", clients, client_list_find_by_token, 2);
+    bench_lookup("find_by_ip+by_client", clients, bench_find_by_id, 0);
+    bench_lookup("linear scan by ip", clients, bench_scan_by_ip, 0);
+
+    /* Token refresh, as done on every successful authentication */
+    start = bench_now();
+    for (i = 0; i < clients; i++) {
+        bench_client_keys(i, ip, mac, token);
+        client = client_list_find_by_ip(ip);
+        token[0] = token[0] == 'x' ? 'y' : 'x';
+        client_list_set_token(client, safe_strdup(token));
+    }
+    printf("%8d  %-22s %10.1f ns/op\n", clients, "set_token", (bench_now() - start) / clients);
+
+    /* Clients leaving and coming back */
+    start = bench_now();
+    for (i = 0; i < clients; i++) {
+        bench_client_keys(i, ip, mac, token);
+        client_list_delete(client_list_find_by_ip(ip));
+        client_list_add(ip, mac, token);
+    }
+    printf("%8d  %-22s %10.1f ns/op\n", clients, "delete+add", (bench_now() - start) / clients);
+
+    while ((client = client_get_first_client()) != NULL)
+        client_list_delete(client);
+}
+
+int
+main(int argc, char **argv)
+{
+    int i;
+
+    debugconf.debuglevel = LOG_ERR;
+    debugconf.log_stderr = 1;
+    srand(1);
+
+    if (argc < 2) {
+        bench_run(100);
+        bench_run(1000);
+        bench_run(10000);
+    } else {
+        for (i = 1; i < argc; i++)
+            bench_run(atoi(argv[i]));
+    }
+
+    return 0;
+}
@@ -74,6 +74,14 @@ typedef enum {
     oGatewayAddress,
     oGatewayPort,
     oDeltaTraffic,
+    oBulkCounters,
+    oSyncConnections,
+    oDNSCacheTTL,
+    oDNSCacheNegativeTTL,
+    oAllowedHostTTL,
+    oNFLogGroup,
+    oPeriodicChecks,
+    oArpReloadInterval,
     oAuthServer,
     oAuthServHostname,
     oAuthServSSLAvailable,
@@ -87,6 +95,10 @@ typedef enum {
     oAuthServAuthScriptPathFragment,
     oHTTPDMaxConn,
     oHTTPDName,
+    oHTTPDThreads,
+    oHTTPDQueueLength,
+    oHTTPDIdleTimeout,
+    oHTTPDStaticDir,
     oHTTPDRealm,
     oHTTPDUsername,
     oHTTPDPassword,
@@ -114,6 +126,14 @@ static const struct {
 } keywords[] = {
     {
     "deltatraffic", oDeltaTraffic}, {
+    "bulkcounters", oBulkCounters}, {
+    "syncconnections", oSyncConnections}, {
+    "dnscachettl", oDNSCacheTTL}, {
+    "dnscachenegativettl", oDNSCacheNegativeTTL}, {
+    "allowedhostttl", oAllowedHostTTL}, {
+    "nfloggroup", oNFLogGroup}, {
+    "periodicchecks", oPeriodicChecks}, {
+    "arpreloadinterval", oArpReloadInterval}, {
     "daemon", oDaemon}, {
     "debuglevel", oDebugLevel}, {
     "externalinterface", oExternalInterface}, {
@@ -124,6 +144,10 @@ static const struct {
     "authserver", oAuthServer}, {
     "httpdmaxconn", oHTTPDMaxConn}, {
     "httpdname", oHTTPDName}, {
+    "httpdthreads", oHTTPDThreads}, {
+    "httpdqueuelength", oHTTPDQueueLength}, {
+    "httpdidletimeout", oHTTPDIdleTimeout}, {
+    "httpdstaticdir", oHTTPDStaticDir}, {
     "httpdrealm", oHTTPDRealm}, {
     "httpdusername", oHTTPDUsername}, {
     "httpdpassword", oHTTPDPassword}, {
@@ -182,6 +206,10 @@ config_init(void)
     config.configfile = safe_strdup(DEFAULT_CONFIGFILE);
     config.htmlmsgfile = safe_strdup(DEFAULT_HTMLMSGFILE);
     config.httpdmaxconn = DEFAULT_HTTPDMAXCONN;
+    config.httpdthreads = DEFAULT_HTTPDTHREADS;
+    config.httpdqueuelength = DEFAULT_HTTPDQUEUELENGTH;
+    config.httpdidletimeout = DEFAULT_HTTPDIDLETIMEOUT;
+    config.httpdstaticdir = NULL;
     config.external_interface = NULL;
     config.gw_id = DEFAULT_GATEWAYID;
     config.gw_interface = NULL;
@@ -205,8 +233,16 @@ config_init(void)
     config.ssl_certs = safe_strdup(DEFAULT_AUTHSERVSSLCERTPATH);
     config.ssl_verify = DEFAULT_AUTHSERVSSLPEERVER;
     config.deltatraffic = DEFAULT_DELTATRAFFIC;
+    config.bulkcounters = DEFAULT_BULKCOUNTERS;
+    config.syncconnections = DEFAULT_SYNCCONNECTIONS;
+    config.dnscachettl = DEFAULT_DNSCACHETTL;
+    config.dnscachenegativettl = DEFAULT_DNSCACHENEGATIVETTL;
+    config.allowedhostttl = DEFAULT_ALLOWEDHOSTTTL;
+    config.nfloggroup = DEFAULT_NFLOGGROUP;
+    config.periodicchecks = DEFAULT_PERIODICCHECKS;
     config.ssl_cipher_list = NULL;
     config.arp_table_path = safe_strdup(DEFAULT_ARPTABLE);
+    config.arpreloadinterval = DEFAULT_ARPRELOADINTERVAL;
     config.ssl_use_sni = DEFAULT_AUTHSERVSSLSNI;
 
     debugconf.log_stderr = 1;
@@ -701,6 +737,30 @@ config_read(const char *filename)
                 case oDeltaTraffic:
                     config.deltatraffic = parse_boolean_value(p1);
                     break;
+                case oBulkCounters:
+                    config.bulkcounters = parse_boolean_value(p1);
+                    break;
+                case oSyncConnections:
+                    sscanf(p1, "%d", &config.syncconnections);
+                    break;
+                case oDNSCacheTTL:
+                    sscanf(p1, "%d", &config.dnscachettl);
+                    break;
+                case oDNSCacheNegativeTTL:
+                    sscanf(p1, "%d", &config.dnscachenegativettl);
+                    break;
+                case oAllowedHostTTL:
+                    sscanf(p1, "%d", &config.allowedhostttl);
+                    break;
+                case oNFLogGroup:
+                    sscanf(p1, "%d", &config.nfloggroup);
+                    break;
+                case oPeriodicChecks:
+                    config.periodicchecks = parse_boolean_value(p1);
+                    break;
+                case oArpReloadInterval:
+                    sscanf(p1, "%d", &config.arpreloadinterval);
+                    break;
                 case oDaemon:
                     if (config.daemon == -1 && ((value = parse_boolean_value(p1)) != -1)) {
                         config.daemon = value;
@@ -744,6 +804,18 @@ config_read(const char *filename)
                 case oHTTPDMaxConn:
                     sscanf(p1, "%d", &config.httpdmaxconn);
                     break;
+                case oHTTPDThreads:
+                    sscanf(p1, "%d", &config.httpdthreads);
+                    break;
+                case oHTTPDQueueLength:
+                    sscanf(p1, "%d", &config.httpdqueuelength);
+                    break;
+                case oHTTPDIdleTimeout:
+                    sscanf(p1, "%d", &config.httpdidletimeout);
+                    break;
+                case oHTTPDStaticDir:
+                    config.httpdstaticdir = safe_strdup(p1);
+                    break;
                 case oHTTPDRealm:
                     config.httpdrealm = safe_strdup(p1);
                     break;
@@ -42,6 +42,9 @@
 #define DEFAULT_DAEMON 1
 #define DEFAULT_DEBUGLEVEL LOG_INFO
 #define DEFAULT_HTTPDMAXCONN 10
+#define DEFAULT_HTTPDTHREADS 4
+#define DEFAULT_HTTPDQUEUELENGTH 64
+#define DEFAULT_HTTPDIDLETIMEOUT 10
 #define DEFAULT_GATEWAYID NULL
 #define DEFAULT_GATEWAYPORT 2060
 #define DEFAULT_HTTPDNAME "WiFiDog"
@@ -66,7 +69,15 @@
 /** Note that DEFAULT_AUTHSERVSSLNOPEERVER must be 0 or 1, even if the config file syntax is yes or no */
 #define DEFAULT_AUTHSERVSSLPEERVER 1    /* 0 means: Enable peer verification */
 #define DEFAULT_DELTATRAFFIC 0    /* 0 means: Enable peer verification */
+#define DEFAULT_BULKCOUNTERS 0
+#define DEFAULT_SYNCCONNECTIONS 4
+#define DEFAULT_DNSCACHETTL 300
+#define DEFAULT_DNSCACHENEGATIVETTL 30
+#define DEFAULT_ALLOWEDHOSTTTL 600
+#define DEFAULT_NFLOGGROUP 0
+#define DEFAULT_PERIODICCHECKS 0
 #define DEFAULT_ARPTABLE "/proc/net/arp"
+#define DEFAULT_ARPRELOADINTERVAL 5
 #define DEFAULT_AUTHSERVSSLSNI 0  /* 0 means: Disable SNI */
 /*@}*/
 
@@ -162,6 +173,14 @@ typedef struct {
     char *wdctl_sock;           /**< @brief wdctl path to socket */
     char *internal_sock;                /**< @brief internal path to socket */
     int deltatraffic;                   /**< @brief reset each user's traffic (Outgoing and Incoming) value after each Auth operation. */
+    int bulkcounters;                   /**< @brief report all clients' counters in a single request */
+    int syncconnections;                /**< @brief concurrent connections used to report counters */
+    int dnscachettl;                    /**< @brief seconds a resolved host name is cached */
+    int dnscachenegativettl;            /**< @brief seconds a failed resolution is cached */
+    int allowedhostttl;                 /**< @brief seconds a host allowed by the 404 handler stays allowed */
+    int nfloggroup;                     /**< @brief NFLOG group used to count client traffic, 0 to read
+                                             the firewall counters instead */
+    int periodicchecks;                 /**< @brief send heartbeats and sync counters every checkinterval */
     int daemon;                 /**< @brief if daemon > 0, use daemon mode */
     char *pidfile;            /**< @brief pid file path of wifidog */
     char *external_interface;   /**< @brief External network interface name for
@@ -178,6 +197,13 @@ typedef struct {
 				     replying to a request */
     int httpdmaxconn;           /**< @brief Used by libhttpd, not sure what it
 				     does */
+    int httpdthreads;           /**< @brief Number of web server worker threads */
+    int httpdqueuelength;       /**< @brief Requests that may wait for a free
+				     worker before new ones are rejected */
+    int httpdidletimeout;       /**< @brief Seconds a client may stay connected
+				     without sending a request */
+    char *httpdstaticdir;       /**< @brief Directory served under
+				     /wifidog/static/, NULL for none */
     char *httpdrealm;           /**< @brief HTTP Authentication realm */
     char *httpdusername;        /**< @brief Username for HTTP authentication */
     char *httpdpassword;        /**< @brief Password for HTTP authentication */
@@ -195,6 +221,8 @@ typedef struct {
     auth server for server name indication, the TLS extension */
     t_firewall_ruleset *rulesets;       /**< @brief firewall rules */
     t_trusted_mac *trustedmaclist; /**< @brief list of trusted macs */
+    int arpreloadinterval;      /**< @brief Minimum seconds between two reads
+				     of the ARP table file */
     char *arp_table_path; /**< @brief Path to custom ARP table, formatted
         like /proc/net/arp */
     t_popular_server *popular_servers; /**< @brief list of popular servers */
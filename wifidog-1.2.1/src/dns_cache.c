@@ -0,0 +1,456 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+
+/** @file dns_cache.c
+    @brief Cached host name resolution, refreshed in the background
+
+    Entries live for DNSCacheTTL seconds, or DNSCacheNegativeTTL seconds when
+    the name did not resolve. Expired entries keep being served while a
+    background thread resolves them again, so only the very first lookup of
+    a name waits for DNS. When a refresh fails for a reason other than the
+    name not existing, the previous address keeps being served for up to
+    another DNSCacheTTL.
+
+    The cache holds at most DNS_CACHE_MAX_ENTRIES names; beyond that the least
+    recently looked up name is evicted. At most DNS_CACHE_MAX_THREADS names
+    are resolved at the same time.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "safe.h"
+#include "debug.h"
+#include "conf.h"
+#include "dns_cache.h"
+
+/** Longest the refresh thread sleeps when no entry expires sooner */
+#define DNS_CACHE_MAX_SLEEP 60
+
+/** Most names kept in the cache */
+#define DNS_CACHE_MAX_ENTRIES 128
+
+/** Most resolutions run in parallel */
+#define DNS_CACHE_MAX_THREADS 4
+
+/** @internal
+ * One cached host name */
+typedef struct _t_dns_entry {
+    char *name;                 /**< Host name, never changes */
+    struct in_addr addr;        /**< Address, valid if resolved */
+    int resolved;               /**< The address can be served */
+    int pending;                /**< A resolution is in progress */
+    int refs;                   /**< Lookups using the entry, which must not be evicted */
+    time_t expires;             /**< When to resolve again, 0 if never resolved */
+    time_t stale_until;         /**< Serve the address until then if refreshing fails */
+    time_t last_used;           /**< Last lookup, for eviction */
+    struct _t_dns_entry *next;
+} t_dns_entry;
+
+/** @internal
+ * Names being resolved by a set of worker threads */
+typedef struct {
+    t_dns_entry **entries;
+    int count;
+    int next;                   /**< Next entry to resolve, protected by dns_mutex */
+} t_dns_batch;
+
+static t_dns_entry *dns_cache = NULL;
+static int dns_cache_size = 0;
+static int dns_cache_changed = 0;
+
+/** @internal
+ * Protects the entries; dns_refresh_cond wakes the refresh thread and
+ * dns_done_cond wakes lookups waiting for a first resolution. */
+static pthread_mutex_t dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_refresh_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t dns_done_cond = PTHREAD_COND_INITIALIZER;
+
+static void (*dns_changed_cb) (void) = NULL;
+
+/** @internal
+ * Resolve a name with the system resolver, without holding any lock.
+ * @return 0 on success, otherwise the getaddrinfo() error */
+static int
+dns_resolve(const char *name, struct in_addr *addr)
+{
+    struct addrinfo hints, *res = NULL;
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    rc = getaddrinfo(name, NULL, &hints, &res);
+    if (rc != 0 || res == NULL) {
+        debug(LOG_DEBUG, "Resolving [%s] failed: %s", name, gai_strerror(rc));
+        return rc != 0 ? rc : EAI_NONAME;
+    }
+    *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+/** @internal
+ * Whether a resolution error means that the name does not exist, rather than
+ * that DNS could not be asked */
+static int
+dns_error_is_final(int rc)
+{
+#ifdef EAI_NODATA
+    if (rc == EAI_NODATA)
+        return 1;
+#endif
+    return rc == EAI_NONAME;
+}
+
+/** @internal
+ * Drop the least recently used entry that no lookup or resolution uses.
+ * Must be called with dns_mutex held. */
+static void
+dns_cache_evict(void)
+{
+    t_dns_entry **pos, **lru = NULL, *entry;
+
+    for (pos = &dns_cache; *pos; pos = &(*pos)->next) {
+        if ((*pos)->refs > 0 || (*pos)->pending)
+            continue;
+        if (lru == NULL || (*pos)->last_used < (*lru)->last_used)
+            lru = pos;
+    }
+    if (lru == NULL)
+        return;
+
+    entry = *lru;
+    *lru = entry->next;
+    dns_cache_size--;
+    debug(LOG_DEBUG, "Evicting [%s] from the DNS cache", entry->name);
+    free(entry->name);
+    free(entry);
+}
+
+/** @internal
+ * Find the entry of a name, adding an unresolved one if needed.
+ * Must be called with dns_mutex held. */
+static t_dns_entry *
+dns_cache_get(const char *name)
+{
+    t_dns_entry *entry;
+
+    for (entry = dns_cache; entry; entry = entry->next) {
+        if (strcasecmp(entry->name, name) == 0) {
+            entry->last_used = time(NULL);
+            return entry;
+        }
+    }
+
+    if (dns_cache_size >= DNS_CACHE_MAX_ENTRIES)
+        dns_cache_evict();
+
+    entry = safe_malloc(sizeof(t_dns_entry));
+    memset(entry, 0, sizeof(t_dns_entry));
+    entry->name = safe_strdup(name);
+    entry->last_used = time(NULL);
+    entry->next = dns_cache;
+    dns_cache = entry;
+    dns_cache_size++;
+
+    return entry;
+}
+
+/** @internal
+ * Store the result of a resolution.
+ * Must be called with dns_mutex held. */
+static void
+dns_cache_store(t_dns_entry * entry, int rc, struct in_addr addr)
+{
+    s_config *config = config_get_config();
+    time_t now = time(NULL);
+    int ttl = config->dnscachettl > 0 ? config->dnscachettl : 1;
+
+    if (rc == 0) {
+        if (entry->resolved && entry->addr.s_addr != addr.s_addr) {
+            debug(LOG_INFO, "Host [%s] changed address to %s", entry->name, inet_ntoa(addr));
+            dns_cache_changed = 1;
+        } else if (!entry->resolved && entry->expires != 0) {
+            dns_cache_changed = 1;
+        }
+        entry->addr = addr;
+        entry->resolved = 1;
+        entry->expires = now + ttl;
+        entry->stale_until = entry->expires + ttl;
+    } else {
+        if (entry->resolved && !dns_error_is_final(rc) && now < entry->stale_until) {
+            debug(LOG_INFO, "Could not refresh [%s], still using %s", entry->name, inet_ntoa(entry->addr));
+        } else {
+            if (entry->resolved)
+                dns_cache_changed = 1;
+            entry->resolved = 0;
+        }
+        entry->expires = now + (config->dnscachenegativettl > 0 ? config->dnscachenegativettl : 1);
+    }
+    entry->pending = 0;
+    pthread_cond_broadcast(&dns_done_cond);
+}
+
+/** @internal
+ * Resolve the entries of a batch until none is left; the entries must be
+ * marked pending */
+static void *
+dns_resolve_thread(void *arg)
+{
+    t_dns_batch *batch = arg;
+    t_dns_entry *entry;
+    struct in_addr addr;
+    int rc;
+
+    pthread_mutex_lock(&dns_mutex);
+    while (batch->next < batch->count) {
+        entry = batch->entries[batch->next++];
+        pthread_mutex_unlock(&dns_mutex);
+
+        rc = dns_resolve(entry->name, &addr);
+
+        pthread_mutex_lock(&dns_mutex);
+        dns_cache_store(entry, rc, addr);
+    }
+    pthread_mutex_unlock(&dns_mutex);
+
+    return NULL;
+}
+
+/** @internal
+ * Resolve several pending entries in parallel, with at most
+ * DNS_CACHE_MAX_THREADS threads, and wait for all of them */
+static void
+dns_resolve_entries(t_dns_entry ** entries, int count)
+{
+    pthread_t tids[DNS_CACHE_MAX_THREADS - 1];
+    t_dns_batch batch;
+    int i, started = 0;
+
+    batch.entries = entries;
+    batch.count = count;
+    batch.next = 0;
+
+    /* The calling thread is one of the workers */
+    for (i = 1; i < count && i < DNS_CACHE_MAX_THREADS; i++) {
+        if (pthread_create(&tids[started], NULL, dns_resolve_thread, &batch) != 0)
+            break;
+        started++;
+    }
+    dns_resolve_thread(&batch);
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+}
+
+/** Resolve a host name to an IPv4 address.
+ *
+ * Only the first lookup of a name waits for DNS; afterwards the cached
+ * result is returned, even if it has expired and is being refreshed.
+ * @param name Host name
+ * @param addr Returns the address
+ * @return 0 on success, -1 if the name does not resolve
+ */
+int
+dns_cache_lookup(const char *name, struct in_addr *addr)
+{
+    t_dns_entry *entry;
+    struct in_addr resolved;
+    int rc;
+
+    pthread_mutex_lock(&dns_mutex);
+    entry = dns_cache_get(name);
+    entry->refs++;
+    if (entry->expires == 0 && !entry->pending) {
+        entry->pending = 1;
+        pthread_mutex_unlock(&dns_mutex);
+        rc = dns_resolve(name, &resolved);
+        pthread_mutex_lock(&dns_mutex);
+        dns_cache_store(entry, rc, resolved);
+    }
+    while (entry->expires == 0)
+        pthread_cond_wait(&dns_done_cond, &dns_mutex);
+
+    if (entry->expires <= time(NULL) && !entry->pending)
+        pthread_cond_signal(&dns_refresh_cond);
+
+    *addr = entry->addr;
+    rc = entry->resolved ? 0 : -1;
+    entry->refs--;
+    pthread_mutex_unlock(&dns_mutex);
+
+    return rc;
+}
+
+/** Find the first of several host names that resolves.
+ *
+ * Names that were never resolved are resolved in parallel, so checking
+ * whether DNS works at all takes one lookup time rather than one per name.
+ * @param names Host names, in order of preference
+ * @param count Number of names
+ * @param addr Returns the address of the name found
+ * @return Index of the name found, -1 if none resolves
+ */
+int
+dns_cache_lookup_any(const char **names, int count, struct in_addr *addr)
+{
+    t_dns_entry **entries, **unresolved;
+    int i, n = 0, found = -1;
+
+    if (count <= 0)
+        return -1;
+
+    entries = safe_malloc(count * sizeof(t_dns_entry *));
+    unresolved = safe_malloc(count * sizeof(t_dns_entry *));
+
+    pthread_mutex_lock(&dns_mutex);
+    for (i = 0; i < count; i++) {
+        entries[i] = dns_cache_get(names[i]);
+        entries[i]->refs++;
+        if (entries[i]->expires == 0 && !entries[i]->pending) {
+            entries[i]->pending = 1;
+            unresolved[n++] = entries[i];
+        }
+    }
+    pthread_mutex_unlock(&dns_mutex);
+
+    if (n > 0)
+        dns_resolve_entries(unresolved, n);
+
+    pthread_mutex_lock(&dns_mutex);
+    for (i = 0; i < count; i++)
+        while (entries[i]->expires == 0)
+            pthread_cond_wait(&dns_done_cond, &dns_mutex);
+    for (i = 0; i < count && found == -1; i++) {
+        if (entries[i]->resolved) {
+            *addr = entries[i]->addr;
+            found = i;
+        }
+    }
+    for (i = 0; i < count; i++)
+        entries[i]->refs--;
+    pthread_mutex_unlock(&dns_mutex);
+
+    free(unresolved);
+    free(entries);
+
+    return found;
+}
+
+/** Add a host name to the cache without waiting for it to resolve.
+ * @param name Host name
+ */
+void
+dns_cache_prefetch(const char *name)
+{
+    pthread_mutex_lock(&dns_mutex);
+    dns_cache_get(name);
+    pthread_cond_signal(&dns_refresh_cond);
+    pthread_mutex_unlock(&dns_mutex);
+}
+
+/** @internal
+ * Resolve expired entries again, several at a time */
+static void *
+thread_dns_refresh(void *arg)
+{
+    t_dns_entry *entry, **due = NULL;
+    struct timespec timeout;
+    time_t now, next;
+    int count, size = 0;
+
+    pthread_mutex_lock(&dns_mutex);
+    while (1) {
+        now = time(NULL);
+        next = now + DNS_CACHE_MAX_SLEEP;
+        count = 0;
+        for (entry = dns_cache; entry; entry = entry->next) {
+            if (entry->pending)
+                continue;
+            if (entry->expires <= now) {
+                if (count == size) {
+                    size = size ? size * 2 : 8;
+                    due = safe_realloc(due, size * sizeof(t_dns_entry *));
+                }
+                entry->pending = 1;
+                due[count++] = entry;
+            } else if (entry->expires < next) {
+                next = entry->expires;
+            }
+        }
+
+        if (count > 0) {
+            debug(LOG_DEBUG, "Refreshing %d cached host names", count);
+            pthread_mutex_unlock(&dns_mutex);
+            dns_resolve_entries(due, count);
+            pthread_mutex_lock(&dns_mutex);
+        }
+
+        if (dns_cache_changed) {
+            dns_cache_changed = 0;
+            if (dns_changed_cb) {
+                pthread_mutex_unlock(&dns_mutex);
+                dns_changed_cb();
+                pthread_mutex_lock(&dns_mutex);
+            }
+        }
+
+        if (count == 0) {
+            timeout.tv_sec = next;
+            timeout.tv_nsec = 0;
+            pthread_cond_timedwait(&dns_refresh_cond, &dns_mutex, &timeout);
+        }
+    }
+
+    return NULL;
+}
+
+/** Start the thread that resolves expired and prefetched names again.
+ * @param changed Called from that thread after a name changed address or
+ *        started resolving again
+ * @return 0 on success, -1 on failure
+ */
+int
+dns_cache_start(void (*changed) (void))
+{
+    pthread_t tid;
+
+    dns_changed_cb = changed;
+    if (pthread_create(&tid, NULL, thread_dns_refresh, NULL) != 0) {
+        debug(LOG_ERR, "Failed to create the DNS refresh thread: %s", strerror(errno));
+        return -1;
+    }
+    pthread_detach(tid);
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+
+/** @file dns_cache.h
+    @brief Cached host name resolution, refreshed in the background
+*/
+
+#ifndef _DNS_CACHE_H_
+#define _DNS_CACHE_H_
+
+#include <netinet/in.h>
+
+/** @brief Resolve a host name, from the cache when possible */
+int dns_cache_lookup(const char *name, struct in_addr *addr);
+
+/** @brief Find the first of several host names that resolves, resolving them in parallel */
+int dns_cache_lookup_any(const char **names, int count, struct in_addr *addr);
+
+/** @brief Add a host name to the cache so that it is resolved in the background */
+void dns_cache_prefetch(const char *name);
+
+/** @brief Start the thread that refreshes expired entries */
+int dns_cache_start(void (*changed) (void));
+
+#endif                          /* _DNS_CACHE_H_ */
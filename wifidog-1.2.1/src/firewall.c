@@ -53,12 +53,43 @@
 #include "conf.h"
 #include "firewall.h"
 #include "fw_iptables.h"
+#include "arp_cache.h"
+#include "fw_nflog.h"
 #include "auth.h"
 #include "centralserver.h"
 #include "client_list.h"
 #include "commandline.h"
 
 static int _fw_deny_raw(const char *, const char *, const int);
+static unsigned int fw_hash_ip(in_addr_t);
+
+/** Number of slots of the set of hosts allowed by fw_allow_host(); at most
+ * half of them are used. Must be a power of two. */
+#define FW_ALLOWED_HOSTS_SIZE 1024
+
+/** Seconds between two sweeps for expired allowed hosts */
+#define FW_ALLOWED_HOSTS_SWEEP 60
+
+/** Most addresses of one host name that fw_allow_host() allows */
+#define FW_ALLOW_HOST_MAX_ADDRS 16
+
+/** @internal
+ * An address allowed through the global chain by fw_allow_host() */
+typedef struct {
+    in_addr_t ip;               /**< Network byte order, 0 for an empty slot */
+    time_t expires;
+} t_fw_allowed_host;
+
+/** @internal
+ * Open addressing set of the addresses fw_allow_host() added a rule for, so
+ * that each one is added once and removed when its time is up. */
+static struct {
+    t_fw_allowed_host slots[FW_ALLOWED_HOSTS_SIZE];
+    int used;
+    time_t next_sweep;
+} fw_allowed_hosts;
+
+static pthread_mutex_t fw_allowed_hosts_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * Allow a client access through the firewall by adding a rule in the firewall to MARK the user's packets with the proper
@@ -77,8 +108,10 @@ fw_allow(t_client * client, int new_fw_connection_state)
     debug(LOG_DEBUG, "Allowing %s %s with fw_connection_state %d", client->ip, client->mac, new_fw_connection_state);
     client->fw_connection_state = new_fw_connection_state;
 
+    iptables_fw_batch_begin();
+
     /* Grant first */
-    result = iptables_fw_access(FW_ACCESS_ALLOW, client->ip, client->mac, new_fw_connection_state);
+    iptables_fw_access(FW_ACCESS_ALLOW, client->ip, client->mac, new_fw_connection_state);
 
     /* Deny after if needed. */
     if (old_state != FW_MARK_NONE) {
@@ -86,20 +119,225 @@ fw_allow(t_client * client, int new_fw_connection_state)
         _fw_deny_raw(client->ip, client->mac, old_state);
     }
 
+    result = iptables_fw_batch_commit();
+
     return result;
 }
 
+/** @internal
+ * Find the slot of an allowed address, or the empty slot where it belongs.
+ * Called with fw_allowed_hosts_mutex held. */
+static unsigned int
+fw_allowed_hosts_slot(in_addr_t ip)
+{
+    unsigned int i = fw_hash_ip(ip) & (FW_ALLOWED_HOSTS_SIZE - 1);
+
+    while (fw_allowed_hosts.slots[i].ip != 0 && fw_allowed_hosts.slots[i].ip != ip)
+        i = (i + 1) & (FW_ALLOWED_HOSTS_SIZE - 1);
+
+    return i;
+}
+
+/** @internal
+ * Empty a slot, moving back the entries that probed past it so that they
+ * can still be found. Called with fw_allowed_hosts_mutex held. */
+static void
+fw_allowed_hosts_remove(unsigned int i)
+{
+    t_fw_allowed_host *slots = fw_allowed_hosts.slots;
+    unsigned int j = i, k;
+
+    slots[i].ip = 0;
+    fw_allowed_hosts.used--;
+    while (1) {
+        j = (j + 1) & (FW_ALLOWED_HOSTS_SIZE - 1);
+        if (slots[j].ip == 0)
+            break;
+        k = fw_hash_ip(slots[j].ip) & (FW_ALLOWED_HOSTS_SIZE - 1);
+        /* Leave the entry if its home slot lies cyclically in (i, j] */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        slots[i] = slots[j];
+        slots[j].ip = 0;
+        i = j;
+    }
+}
+
+/** @internal
+ * Take the expired addresses out of the set.
+ * Called with fw_allowed_hosts_mutex held.
+ * @param now Current time
+ * @param expired Filled with the removed addresses, FW_ALLOWED_HOSTS_SIZE / 2 entries at most
+ * @return The number of removed addresses
+ */
+static int
+fw_allowed_hosts_expire(time_t now, in_addr_t * expired)
+{
+    s_config *config = config_get_config();
+    unsigned int i;
+    int count = 0;
+
+    for (i = 0; i < FW_ALLOWED_HOSTS_SIZE; i++) {
+        /* Removing may move a later entry into this slot, so check it again */
+        while (fw_allowed_hosts.slots[i].ip != 0 && fw_allowed_hosts.slots[i].expires <= now) {
+            expired[count++] = fw_allowed_hosts.slots[i].ip;
+            fw_allowed_hosts_remove(i);
+        }
+    }
+    fw_allowed_hosts.next_sweep = now + (config->allowedhostttl > 0 && config->allowedhostttl < FW_ALLOWED_HOSTS_SWEEP ?
+                                         config->allowedhostttl : FW_ALLOWED_HOSTS_SWEEP);
+
+    return count;
+}
+
+/** @internal
+ * Remove the rules of expired addresses, in one firewall batch */
+static void
+fw_allowed_hosts_deny(const in_addr_t * expired, int count)
+{
+    struct in_addr addr;
+    char ip[INET_ADDRSTRLEN];
+    int i;
+
+    if (count == 0)
+        return;
+
+    debug(LOG_DEBUG, "Removing %d expired allowed hosts", count);
+    iptables_fw_batch_begin();
+    for (i = 0; i < count; i++) {
+        addr.s_addr = expired[i];
+        inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+        iptables_fw_access_host(FW_ACCESS_DENY, ip);
+    }
+    iptables_fw_batch_commit();
+}
+
+/** @internal
+ * Resolve a host name to all its IPv4 addresses. The name comes from a
+ * client, so it is not kept in the DNS cache.
+ * @return The number of distinct addresses, 0 if the name does not resolve
+ */
+static int
+fw_resolve_host(const char *host, struct in_addr *addrs, int max)
+{
+    struct addrinfo hints, *res = NULL, *ai;
+    struct in_addr addr;
+    int count = 0, i, rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    rc = getaddrinfo(host, NULL, &hints, &res);
+    if (rc != 0) {
+        debug(LOG_DEBUG, "Resolving [%s] failed: %s", host, gai_strerror(rc));
+        return 0;
+    }
+    for (ai = res; ai && count < max; ai = ai->ai_next) {
+        addr = ((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+        for (i = 0; i < count; i++)
+            if (addrs[i].s_addr == addr.s_addr)
+                break;
+        if (i == count)
+            addrs[count++] = addr;
+    }
+    freeaddrinfo(res);
+
+    return count;
+}
+
+/** @internal
+ * Allow one address of a host for AllowedHostTTL seconds, unless it is
+ * already allowed.
+ * @return Return code of the command, 0 if the address was already allowed
+ */
+static int
+fw_allow_host_addr(const char *host, struct in_addr addr)
+{
+    s_config *config = config_get_config();
+    in_addr_t expired[FW_ALLOWED_HOSTS_SIZE / 2];
+    char ip[INET_ADDRSTRLEN];
+    time_t now = time(NULL);
+    unsigned int i;
+    int count = 0, rc;
+
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+
+    pthread_mutex_lock(&fw_allowed_hosts_mutex);
+    if (now >= fw_allowed_hosts.next_sweep)
+        count = fw_allowed_hosts_expire(now, expired);
+
+    i = fw_allowed_hosts_slot(addr.s_addr);
+    if (fw_allowed_hosts.slots[i].ip != 0) {
+        pthread_mutex_unlock(&fw_allowed_hosts_mutex);
+        debug(LOG_DEBUG, "%s (%s) is already allowed", host, ip);
+        fw_allowed_hosts_deny(expired, count);
+        return 0;
+    }
+
+    /* When full, make room with the entries that expired since the last sweep */
+    if ((fw_allowed_hosts.used + 1) * 2 > FW_ALLOWED_HOSTS_SIZE && count == 0) {
+        count = fw_allowed_hosts_expire(now, expired);
+        i = fw_allowed_hosts_slot(addr.s_addr);
+    }
+    if ((fw_allowed_hosts.used + 1) * 2 > FW_ALLOWED_HOSTS_SIZE) {
+        pthread_mutex_unlock(&fw_allowed_hosts_mutex);
+        debug(LOG_WARNING, "Too many allowed hosts, not allowing %s (%s)", host, ip);
+        fw_allowed_hosts_deny(expired, count);
+        return -1;
+    }
+
+    /* Claim the slot before adding the rule, so that concurrent requests
+     * for the same address do not add it twice */
+    fw_allowed_hosts.slots[i].ip = addr.s_addr;
+    fw_allowed_hosts.slots[i].expires = now + (config->allowedhostttl > 0 ? config->allowedhostttl : 1);
+    fw_allowed_hosts.used++;
+    pthread_mutex_unlock(&fw_allowed_hosts_mutex);
+
+    fw_allowed_hosts_deny(expired, count);
+
+    debug(LOG_DEBUG, "Allowing %s (%s)", host, ip);
+    rc = iptables_fw_access_host(FW_ACCESS_ALLOW, ip);
+    if (rc != 0) {
+        pthread_mutex_lock(&fw_allowed_hosts_mutex);
+        i = fw_allowed_hosts_slot(addr.s_addr);
+        if (fw_allowed_hosts.slots[i].ip != 0)
+            fw_allowed_hosts_remove(i);
+        pthread_mutex_unlock(&fw_allowed_hosts_mutex);
+    }
+
+    return rc;
+}
+
 /**
- * Allow a host through the firewall by adding a rule in the firewall
+ * Allow a host through the firewall by adding a rule in the firewall.
+ * The host is resolved and each of its addresses is allowed for
+ * AllowedHostTTL seconds; asking again for a host whose addresses are
+ * already allowed does not touch the firewall.
  * @param host IP address, domain or hostname to allow
- * @return Return code of the command
+ * @return Return code of the command, -1 if an address could not be allowed
  */
 int
 fw_allow_host(const char *host)
 {
-    debug(LOG_DEBUG, "Allowing %s", host);
+    struct in_addr addrs[FW_ALLOW_HOST_MAX_ADDRS];
+    int count, i, rc = 0;
+
+    if (inet_aton(host, &addrs[0])) {
+        count = 1;
+    } else {
+        count = fw_resolve_host(host, addrs, FW_ALLOW_HOST_MAX_ADDRS);
+        if (count == 0) {
+            debug(LOG_WARNING, "Could not resolve %s, not allowing it", host);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        if (fw_allow_host_addr(host, addrs[i]) != 0)
+            rc = -1;
 
-    return iptables_fw_access_host(FW_ACCESS_ALLOW, host);
+    return rc;
 }
 
 /**
@@ -153,38 +391,19 @@ fw_set_authup(void)
 /* XXX DCY */
 /**
  * Get an IP's MAC address from the ARP cache.
- * Go through all the entries in config->arp_table_path until we find the
- * requested IP address and return the MAC address bound to it.
- * @todo Make this function portable (using shell scripts?)
+ * Callers that can provide a buffer should use arp_cache_lookup() instead,
+ * which does not allocate.
+ * @return The MAC address, which the caller frees, or NULL if unknown
  */
 char *
 arp_get(const char *req_ip)
 {
-    FILE *proc;
-    char ip[16];
-    char mac[18];
-    char *reply;
-    s_config *config = config_get_config();
+    char mac[ARP_MAC_LEN];
 
-    if (!(proc = fopen(config->arp_table_path, "r"))) {
+    if (arp_cache_lookup(req_ip, mac) != 0)
         return NULL;
-    }
 
-    /* Skip first line */
-    while (!feof(proc) && fgetc(proc) != '\n') ;
-
-    /* Find ip, copy mac in reply */
-    reply = NULL;
-    while (!feof(proc) && (fscanf(proc, " %15[0-9.] %*s %*s %17[A-Fa-f0-9:] %*s %*s", ip, mac) == 2)) {
-        if (strcmp(ip, req_ip) == 0) {
-            reply = safe_strdup(mac);
-            break;
-        }
-    }
-
-    fclose(proc);
-
-    return reply;
+    return safe_strdup(mac);
 }
 
 /** Initialize the firewall rules
@@ -206,6 +425,7 @@ fw_init(void)
     if (restart_orig_pid) {
         debug(LOG_INFO, "Restoring firewall rules for clients inherited from parent");
         LOCK_CLIENT_LIST();
+        iptables_fw_batch_begin();
         client = client_get_first_client();
         while (client) {
             new_fw_state = client->fw_connection_state;
@@ -213,6 +433,7 @@ fw_init(void)
             fw_allow(client, new_fw_state);
             client = client->next;
         }
+        iptables_fw_batch_commit();
         UNLOCK_CLIENT_LIST();
     }
 
@@ -246,24 +467,234 @@ fw_destroy(void)
 {
     close_icmp_socket();
     debug(LOG_INFO, "Removing Firewall rules");
+
+    /* The rules of allowed hosts go away with the global chain */
+    pthread_mutex_lock(&fw_allowed_hosts_mutex);
+    memset(&fw_allowed_hosts, 0, sizeof(fw_allowed_hosts));
+    pthread_mutex_unlock(&fw_allowed_hosts_mutex);
+
     return iptables_fw_destroy();
 }
 
+/** Initial number of slots of a counter set */
+#define FW_COUNTERS_MIN_SIZE 64
+
+/** @internal
+ * Mix the bits of an IPv4 address for the hash tables of this file */
+static unsigned int
+fw_hash_ip(in_addr_t ip)
+{
+    uint32_t h = (uint32_t) ip;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/** @internal
+ * Hash an IPv4 address into a slot of a counter set */
+static unsigned int
+fw_counters_hash(const t_fw_counters * counters, in_addr_t ip)
+{
+    return fw_hash_ip(ip) & (counters->size - 1);
+}
+
+/** @internal
+ * Find the slot of an IP address, or the empty slot where it belongs */
+static t_fw_counter *
+fw_counters_slot(const t_fw_counters * counters, in_addr_t ip)
+{
+    unsigned int i = fw_counters_hash(counters, ip);
+
+    while (counters->slots[i].ip != 0 && counters->slots[i].ip != ip)
+        i = (i + 1) & (counters->size - 1);
+
+    return &counters->slots[i];
+}
+
+/** Initialize an empty counter set
+ * @param counters The set to initialize
+ */
+void
+fw_counters_init(t_fw_counters * counters)
+{
+    counters->size = FW_COUNTERS_MIN_SIZE;
+    counters->used = 0;
+    counters->slots = safe_malloc(counters->size * sizeof(t_fw_counter));
+}
+
+/** Remove all entries from a counter set
+ * @param counters The set to empty
+ */
+void
+fw_counters_reset(t_fw_counters * counters)
+{
+    memset(counters->slots, 0, counters->size * sizeof(t_fw_counter));
+    counters->used = 0;
+}
+
+/** Free the memory used by a counter set
+ * @param counters The set to free
+ */
+void
+fw_counters_free(t_fw_counters * counters)
+{
+    free(counters->slots);
+    counters->slots = NULL;
+    counters->size = counters->used = 0;
+}
+
+/** Record a byte counter read from the firewall. If an address shows up in
+ * several rules, the largest counter wins.
+ * @param counters The set to add to
+ * @param ip Client IP address, network byte order
+ * @param direction FW_COUNTER_OUTGOING or FW_COUNTER_INCOMING
+ * @param bytes Byte counter of the rule
+ */
+void
+fw_counters_add(t_fw_counters * counters, in_addr_t ip, int direction, unsigned long long bytes)
+{
+    t_fw_counter *old, *counter;
+    unsigned int i, size;
+
+    if (ip == 0)
+        return;
+
+    /* Keep the table at most half full */
+    if ((counters->used + 1) * 2 > counters->size) {
+        old = counters->slots;
+        size = counters->size;
+        counters->size *= 2;
+        counters->slots = safe_malloc(counters->size * sizeof(t_fw_counter));
+        for (i = 0; i < size; i++)
+            if (old[i].ip != 0)
+                *fw_counters_slot(counters, old[i].ip) = old[i];
+        free(old);
+    }
+
+    counter = fw_counters_slot(counters, ip);
+    if (counter->ip == 0) {
+        counter->ip = ip;
+        counters->used++;
+    }
+    if (direction == FW_COUNTER_OUTGOING) {
+        if (!(counter->flags & FW_COUNTER_OUTGOING) || counter->outgoing < bytes)
+            counter->outgoing = bytes;
+    } else {
+        if (!(counter->flags & FW_COUNTER_INCOMING) || counter->incoming < bytes)
+            counter->incoming = bytes;
+    }
+    counter->flags |= direction;
+}
+
+/** Update the traffic counters of the client list from the counters read
+ * from the firewall, in a single pass with the client list locked. Rules
+ * left in the firewall for IP addresses without a client are removed.
+ * @param counters Counters read from the firewall
+ */
+void
+fw_counters_merge(t_fw_counters * counters)
+{
+    t_client *p1;
+    t_fw_counter *counter;
+    struct in_addr addr;
+    unsigned int i;
+    char ip[INET_ADDRSTRLEN];
+
+    LOCK_CLIENT_LIST();
+    for (p1 = client_get_first_client(); p1; p1 = p1->next) {
+        if (!inet_aton(p1->ip, &addr))
+            continue;
+        counter = fw_counters_slot(counters, addr.s_addr);
+        if (counter->ip == 0)
+            continue;
+        counter->flags |= FW_COUNTER_CLIENT;
+
+        if ((counter->flags & FW_COUNTER_OUTGOING) &&
+            (p1->counters.outgoing - p1->counters.outgoing_history) < counter->outgoing) {
+            p1->counters.outgoing_delta = p1->counters.outgoing_history + counter->outgoing - p1->counters.outgoing;
+            p1->counters.outgoing = p1->counters.outgoing_history + counter->outgoing;
+            p1->counters.last_updated = time(NULL);
+            debug(LOG_DEBUG, "%s - Outgoing traffic %llu bytes, updated counter.outgoing to %llu bytes.  Updated last_updated to %d",
+                  p1->ip, counter->outgoing, p1->counters.outgoing, p1->counters.last_updated);
+        }
+        if ((counter->flags & FW_COUNTER_INCOMING) &&
+            (p1->counters.incoming - p1->counters.incoming_history) < counter->incoming) {
+            p1->counters.incoming_delta = p1->counters.incoming_history + counter->incoming - p1->counters.incoming;
+            p1->counters.incoming = p1->counters.incoming_history + counter->incoming;
+            debug(LOG_DEBUG, "%s - Incoming traffic %llu bytes, Updated counter.incoming to %llu bytes", p1->ip,
+                  counter->incoming, p1->counters.incoming);
+        }
+    }
+    UNLOCK_CLIENT_LIST();
+
+    for (i = 0; i < counters->size; i++) {
+        counter = &counters->slots[i];
+        if (counter->ip == 0 || (counter->flags & FW_COUNTER_CLIENT))
+            continue;
+        addr.s_addr = counter->ip;
+        inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+        debug(LOG_ERR,
+              "fw_counters_merge(): Could not find %s in client list, this should not happen unless if the gateway crashed",
+              ip);
+        debug(LOG_ERR, "Preventively deleting firewall rules for %s", ip);
+        iptables_fw_destroy_mention("mangle", CHAIN_OUTGOING, ip);
+        iptables_fw_destroy_mention("mangle", CHAIN_INCOMING, ip);
+    }
+}
+
+/** Log out the clients whose counters have not moved for ClientTimeout
+ * check intervals. The idle index of the client list only hands out the
+ * clients whose deadline has come up, so this does not go through the
+ * whole list.
+ */
+void
+fw_expire_idle_clients(void)
+{
+    s_config *config = config_get_config();
+    t_client *client;
+    time_t current_time = time(NULL);
+
+    iptables_fw_batch_begin();
+    LOCK_CLIENT_LIST();
+    while ((client = client_list_find_idle(current_time)) != NULL) {
+        debug(LOG_INFO, "%s - Inactive for more than %ld seconds (last updated %ld), removing client and denying in firewall",
+              client->ip, config->checkinterval * config->clienttimeout, client->counters.last_updated);
+        logout_client(client);
+    }
+    UNLOCK_CLIENT_LIST();
+    iptables_fw_batch_commit();
+}
+
 /**Probably a misnomer, this function actually refreshes the entire client list's traffic counter, re-authenticates every client with the central server and update's the central servers traffic counters and notifies it if a client has logged-out.
  * @todo Make this function smaller and use sub-fonctions
  */
 void
 fw_sync_with_authserver(void)
 {
-    t_authresponse authresponse;
-    t_client *p1, *p2, *worklist, *tmp;
+    t_client *p1, *worklist, *tmp;
+    t_client **clients;
+    t_authcode *authcodes;
+    int i, count;
     s_config *config = config_get_config();
 
-    if (-1 == iptables_fw_counters_update()) {
-        debug(LOG_ERR, "Could not get counters from firewall!");
-        return;
+    /* With NFLOG accounting the counters are already current, and idle
+     * clients are timed out as they go */
+    if (!fw_nflog_running()) {
+        if (-1 == iptables_fw_counters_update()) {
+            debug(LOG_ERR, "Could not get counters from firewall!");
+            return;
+        }
+        fw_expire_idle_clients();
     }
 
+    /* Firewall changes for denied clients are applied together */
+    iptables_fw_batch_begin();
+
     LOCK_CLIENT_LIST();
 
     /* XXX Ideally, from a thread safety PoV, this function should build a list of client pointers,
@@ -272,115 +703,114 @@ fw_sync_with_authserver(void)
      * a SIGSEGV.
      */
     client_list_dup(&worklist);
+
+    /* NFLOG deltas add up from one report to the next */
+    if (fw_nflog_running())
+        for (p1 = client_get_first_client(); p1 != NULL; p1 = p1->next)
+            p1->counters.incoming_delta = p1->counters.outgoing_delta = 0;
     UNLOCK_CLIENT_LIST();
 
-    for (p1 = p2 = worklist; NULL != p1; p1 = p2) {
-        p2 = p1->next;
+    for (count = 0, p1 = worklist; NULL != p1; p1 = p1->next)
+        count++;
+    clients = safe_malloc((count > 0 ? count : 1) * sizeof(t_client *));
+    authcodes = safe_malloc((count > 0 ? count : 1) * sizeof(t_authcode));
+
+    for (i = 0, p1 = worklist; NULL != p1; p1 = p1->next, i++) {
+        clients[i] = p1;
+        authcodes[i] = AUTH_ERROR;
 
         /* Ping the client, if he responds it'll keep activity on the link.
          * However, if the firewall blocks it, it will not help.  The suggested
          * way to deal witht his is to keep the DHCP lease time extremely
          * short:  Shorter than config->checkinterval * config->clienttimeout */
         icmp_ping(p1->ip);
-        /* Update the counters on the remote server only if we have an auth server */
-        if (config->auth_servers != NULL) {
-            auth_server_request(&authresponse, REQUEST_TYPE_COUNTERS, p1->ip, p1->mac, p1->token, p1->counters.incoming,
-                                p1->counters.outgoing, p1->counters.incoming_delta, p1->counters.outgoing_delta);
-        }
+    }
 
-        time_t current_time = time(NULL);
-        debug(LOG_INFO,
-              "Checking client %s for timeout:  Last updated %ld (%ld seconds ago), timeout delay %ld seconds, current time %ld, ",
-              p1->ip, p1->counters.last_updated, current_time - p1->counters.last_updated,
-              config->checkinterval * config->clienttimeout, current_time);
-        if (p1->counters.last_updated + (config->checkinterval * config->clienttimeout) <= current_time) {
-            /* Timing out user */
-            debug(LOG_INFO, "%s - Inactive for more than %ld seconds, removing client and denying in firewall",
-                  p1->ip, config->checkinterval * config->clienttimeout);
-            LOCK_CLIENT_LIST();
-            tmp = client_list_find_by_client(p1);
-            if (NULL != tmp) {
-                logout_client(tmp);
-            } else {
-                debug(LOG_NOTICE, "Client was already removed. Not logging out.");
-            }
+    /* Update the counters on the remote server only if we have an auth server.
+     * All clients are reported at once so that a pass takes a few round trips
+     * to the server rather than one per client. */
+    if (config->auth_servers != NULL && count > 0)
+        auth_server_counters_request(clients, authcodes, count);
+
+    for (i = 0; i < count; i++) {
+        /*
+         * This handles any change in
+         * the status this allows us
+         * to change the status of a
+         * user while he's connected
+         *
+         * Only run if we have an auth server
+         * configured!
+         */
+        LOCK_CLIENT_LIST();
+        tmp = client_list_find_by_client(clients[i]);
+        if (NULL == tmp) {
             UNLOCK_CLIENT_LIST();
-        } else {
-            /*
-             * This handles any change in
-             * the status this allows us
-             * to change the status of a
-             * user while he's connected
-             *
-             * Only run if we have an auth server
-             * configured!
-             */
-            LOCK_CLIENT_LIST();
-            tmp = client_list_find_by_client(p1);
-            if (NULL == tmp) {
-                UNLOCK_CLIENT_LIST();
-                debug(LOG_NOTICE, "Client was already removed. Skipping auth processing");
-                continue;       /* Next client please */
-            }
-
-            if (config->auth_servers != NULL) {
-                switch (authresponse.authcode) {
-                case AUTH_DENIED:
-                    debug(LOG_NOTICE, "%s - Denied. Removing client and firewall rules", tmp->ip);
-                    fw_deny(tmp);
-                    client_list_delete(tmp);
-                    break;
+            debug(LOG_NOTICE, "Client was already removed. Skipping auth processing");
+            continue;           /* Next client please */
+        }
 
-                case AUTH_VALIDATION_FAILED:
-                    debug(LOG_NOTICE, "%s - Validation timeout, now denied. Removing client and firewall rules",
+        if (config->auth_servers != NULL) {
+            switch (authcodes[i]) {
+            case AUTH_DENIED:
+                debug(LOG_NOTICE, "%s - Denied. Removing client and firewall rules", tmp->ip);
+                fw_deny(tmp);
+                client_list_delete(tmp);
+                break;
+
+            case AUTH_VALIDATION_FAILED:
+                debug(LOG_NOTICE, "%s - Validation timeout, now denied. Removing client and firewall rules",
+                      tmp->ip);
+                fw_deny(tmp);
+                client_list_delete(tmp);
+                break;
+
+            case AUTH_ALLOWED:
+                if (tmp->fw_connection_state != FW_MARK_KNOWN) {
+                    debug(LOG_INFO, "%s - Access has changed to allowed, refreshing firewall and clearing counters",
                           tmp->ip);
-                    fw_deny(tmp);
-                    client_list_delete(tmp);
-                    break;
-
-                case AUTH_ALLOWED:
-                    if (tmp->fw_connection_state != FW_MARK_KNOWN) {
-                        debug(LOG_INFO, "%s - Access has changed to allowed, refreshing firewall and clearing counters",
+                    //WHY did we deny, then allow!?!? benoitg 2007-06-21
+                    //fw_deny(tmp->ip, tmp->mac, tmp->fw_connection_state); /* XXX this was possibly to avoid dupes. */
+
+                    if (tmp->fw_connection_state != FW_MARK_PROBATION) {
+                        tmp->counters.incoming_delta =
+                         tmp->counters.outgoing_delta =
+                         tmp->counters.incoming =
+                         tmp->counters.outgoing = 0;
+                    } else {
+                        //We don't want to clear counters if the user was in validation, it probably already transmitted data..
+                        debug(LOG_INFO,
+                              "%s - Skipped clearing counters after all, the user was previously in validation",
                               tmp->ip);
-                        //WHY did we deny, then allow!?!? benoitg 2007-06-21
-                        //fw_deny(tmp->ip, tmp->mac, tmp->fw_connection_state); /* XXX this was possibly to avoid dupes. */
-
-                        if (tmp->fw_connection_state != FW_MARK_PROBATION) {
-                            tmp->counters.incoming_delta =
-                             tmp->counters.outgoing_delta =
-                             tmp->counters.incoming =
-                             tmp->counters.outgoing = 0;
-                        } else {
-                            //We don't want to clear counters if the user was in validation, it probably already transmitted data..
-                            debug(LOG_INFO,
-                                  "%s - Skipped clearing counters after all, the user was previously in validation",
-                                  tmp->ip);
-                        }
-                        fw_allow(tmp, FW_MARK_KNOWN);
                     }
-                    break;
-
-                case AUTH_VALIDATION:
-                    /*
-                     * Do nothing, user
-                     * is in validation
-                     * period
-                     */
-                    debug(LOG_INFO, "%s - User in validation period", tmp->ip);
-                    break;
-
-                case AUTH_ERROR:
-                    debug(LOG_WARNING, "Error communicating with auth server - leaving %s as-is for now", tmp->ip);
-                    break;
-
-                default:
-                    debug(LOG_ERR, "I do not know about authentication code %d", authresponse.authcode);
-                    break;
+                    fw_allow(tmp, FW_MARK_KNOWN);
                 }
+                break;
+
+            case AUTH_VALIDATION:
+                /*
+                 * Do nothing, user
+                 * is in validation
+                 * period
+                 */
+                debug(LOG_INFO, "%s - User in validation period", tmp->ip);
+                break;
+
+            case AUTH_ERROR:
+                debug(LOG_WARNING, "Error communicating with auth server - leaving %s as-is for now", tmp->ip);
+                break;
+
+            default:
+                debug(LOG_ERR, "I do not know about authentication code %d", authcodes[i]);
+                break;
             }
-            UNLOCK_CLIENT_LIST();
         }
+        UNLOCK_CLIENT_LIST();
     }
 
+    iptables_fw_batch_commit();
+
+    free(authcodes);
+    free(clients);
     client_list_destroy(worklist);
 }
@@ -28,6 +28,8 @@
 #ifndef _FIREWALL_H_
 #define _FIREWALL_H_
 
+#include <netinet/in.h>
+
 #include "client_list.h"
 
 /** Used by fw_iptables.c */
@@ -40,6 +42,41 @@ typedef enum _t_fw_marks {
     FW_MARK_LOCKED = 254 /**< @brief The client has been locked out */
 } t_fw_marks;
 
+/** Flags of a t_fw_counter */
+#define FW_COUNTER_OUTGOING 0x01 /**< @brief outgoing holds a value read from the firewall */
+#define FW_COUNTER_INCOMING 0x02 /**< @brief incoming holds a value read from the firewall */
+#define FW_COUNTER_CLIENT   0x04 /**< @brief A client with this IP was found in the client list */
+
+/** Byte counters read from the firewall for one IP address */
+typedef struct _t_fw_counter {
+    in_addr_t ip;               /**< @brief Client IP, network byte order. 0 marks an empty slot */
+    int flags;                  /**< @brief FW_COUNTER_* */
+    unsigned long long outgoing;        /**< @brief Bytes sent by the client */
+    unsigned long long incoming;        /**< @brief Bytes received by the client */
+} t_fw_counter;
+
+/** Set of firewall counters indexed by IP address */
+typedef struct _t_fw_counters {
+    t_fw_counter *slots;        /**< @brief Open addressing hash table */
+    unsigned int size;          /**< @brief Number of slots, a power of two */
+    unsigned int used;          /**< @brief Number of slots in use */
+} t_fw_counters;
+
+/** @brief Initialize an empty counter set */
+void fw_counters_init(t_fw_counters *);
+
+/** @brief Remove all entries from a counter set */
+void fw_counters_reset(t_fw_counters *);
+
+/** @brief Free the memory used by a counter set */
+void fw_counters_free(t_fw_counters *);
+
+/** @brief Record a byte counter read from the firewall */
+void fw_counters_add(t_fw_counters *, in_addr_t, int, unsigned long long);
+
+/** @brief Update the client list from a counter set */
+void fw_counters_merge(t_fw_counters *);
+
 /** @brief Initialize the firewall */
 int fw_init(void);
 
@@ -70,6 +107,9 @@ int fw_set_authup(void);
 /** @brief Refreshes the entire client list */
 void fw_sync_with_authserver(void);
 
+/** @brief Logs out the clients that have been idle for too long */
+void fw_expire_idle_clients(void);
+
 /** @brief Get an IP's MAC address from the ARP cache.*/
 char *arp_get(const char *);
 
@@ -38,6 +38,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
 
 #include "common.h"
 
@@ -48,6 +50,8 @@
 #include "debug.h"
 #include "util.h"
 #include "client_list.h"
+#include "pstring.h"
+#include "fw_nflog.h"
 
 static int iptables_do_command(const char *format, ...);
 static char *iptables_compile(const char *, const char *, const t_firewall_rule *);
@@ -57,6 +61,23 @@ static void iptables_load_ruleset(const char *, const char *, const char *);
 Used to supress the error output of the firewall during destruction */
 static int fw_quiet = 0;
 
+/** Number of queued commands after which a batch is applied early */
+#define FW_BATCH_MAX 64
+
+/** @internal
+ * Commands queued since iptables_fw_batch_begin(), in "-t table ..." form
+ * with the gateway id already substituted. Each thread has its own batch,
+ * so batching never makes one thread wait for another (callers may hold
+ * the client list lock). */
+static __thread struct {
+    int depth;                  /* nesting of begin/commit, queueing while > 0 */
+    char **commands;
+    int count;
+    int size;
+} fw_batch;
+
+static int iptables_fw_batch_apply(void);
+
 /** @internal
  * @brief Insert $ID$ with the gateway's id in a string.
  *
@@ -100,11 +121,23 @@ iptables_do_command(const char *format, ...)
     safe_vasprintf(&fmt_cmd, format, vlist);
     va_end(vlist);
 
+    iptables_insert_gateway_id(&fmt_cmd);
+
+    if (fw_batch.depth > 0) {
+        debug(LOG_DEBUG, "Queueing command: iptables %s", fmt_cmd);
+        if (fw_batch.count == fw_batch.size) {
+            fw_batch.size = fw_batch.size ? fw_batch.size * 2 : FW_BATCH_MAX;
+            fw_batch.commands = safe_realloc(fw_batch.commands, fw_batch.size * sizeof(char *));
+        }
+        fw_batch.commands[fw_batch.count++] = fmt_cmd;
+        if (fw_batch.count >= FW_BATCH_MAX)
+            return iptables_fw_batch_apply();
+        return 0;
+    }
+
     safe_asprintf(&cmd, "iptables %s", fmt_cmd);
     free(fmt_cmd);
 
-    iptables_insert_gateway_id(&cmd);
-
     debug(LOG_DEBUG, "Executing command: %s", cmd);
 
     rc = execute(cmd, fw_quiet);
@@ -122,6 +155,124 @@ iptables_do_command(const char *format, ...)
     return rc;
 }
 
+/** @internal
+ * Split a queued "-t table ..." command into its table and the rest.
+ * @return The rule part of the command
+ */
+static const char *
+iptables_fw_batch_table(const char *command, char *table, size_t len)
+{
+    const char *p;
+    size_t n;
+
+    if (strncmp(command, "-t ", 3) != 0 || (p = strchr(command + 3, ' ')) == NULL) {
+        /* Same default as iptables itself */
+        snprintf(table, len, "filter");
+        return command;
+    }
+    n = p - (command + 3);
+    if (n >= len)
+        n = len - 1;
+    memcpy(table, command + 3, n);
+    table[n] = '\0';
+
+    return p + 1;
+}
+
+/** @internal
+ * Apply the queued commands with one iptables-restore --noflush per table.
+ * iptables-restore applies a table atomically, so if it fails (usually a -D
+ * for a rule that is already gone) the commands of that table are replayed
+ * one by one, as they would have been without batching.
+ * @return 0 on success, the last failing return code otherwise
+ */
+static int
+iptables_fw_batch_apply(void)
+{
+    char table[32], other[32], *cmd, *input;
+    const char *rule;
+    pstr_t *script;
+    int i, j, rc, result = 0;
+    int *done;
+
+    if (fw_batch.count == 0)
+        return 0;
+
+    done = safe_malloc(fw_batch.count * sizeof(int));
+    for (i = 0; i < fw_batch.count; i++) {
+        if (done[i])
+            continue;
+
+        /* Gather every command for this table, in order */
+        iptables_fw_batch_table(fw_batch.commands[i], table, sizeof(table));
+        script = pstr_new();
+        pstr_append_sprintf(script, "*%s\n", table);
+        for (j = i; j < fw_batch.count; j++) {
+            rule = iptables_fw_batch_table(fw_batch.commands[j], other, sizeof(other));
+            if (!done[j] && strcmp(table, other) == 0) {
+                pstr_append_sprintf(script, "%s\n", rule);
+                done[j] = 1;
+            }
+        }
+        pstr_cat(script, "COMMIT\n");
+        input = pstr_to_string(script);
+
+        debug(LOG_DEBUG, "Applying batch with iptables-restore: %s", input);
+        rc = execute_input("iptables-restore --noflush", input, fw_quiet);
+        free(input);
+        if (rc == 0)
+            continue;
+
+        debug(fw_quiet ? LOG_DEBUG : LOG_WARNING, "iptables-restore failed(%d) for table %s, applying rules one by one",
+              rc, table);
+        for (j = i; j < fw_batch.count; j++) {
+            iptables_fw_batch_table(fw_batch.commands[j], other, sizeof(other));
+            if (strcmp(table, other) != 0)
+                continue;
+            safe_asprintf(&cmd, "iptables %s", fw_batch.commands[j]);
+            rc = execute(cmd, fw_quiet);
+            if (rc != 0) {
+                result = rc;
+                if (fw_quiet == 0)
+                    debug(LOG_ERR, "iptables command failed(%d): %s", rc, cmd);
+                else if (fw_quiet == 1)
+                    debug(LOG_DEBUG, "iptables command failed(%d): %s", rc, cmd);
+            }
+            free(cmd);
+        }
+    }
+    free(done);
+
+    for (i = 0; i < fw_batch.count; i++)
+        free(fw_batch.commands[i]);
+    fw_batch.count = 0;
+
+    return result;
+}
+
+/** Start collecting firewall changes into a batch. Until the matching
+ * iptables_fw_batch_commit(), commands issued by this thread are queued and
+ * then applied with a single iptables-restore per table, instead of one
+ * fork of iptables per rule. Batches nest.
+ */
+void
+iptables_fw_batch_begin(void)
+{
+    fw_batch.depth++;
+}
+
+/** Apply the changes collected since iptables_fw_batch_begin()
+ * @return 0 on success, the return code of a failed command otherwise
+ */
+int
+iptables_fw_batch_commit(void)
+{
+    if (fw_batch.depth == 0 || --fw_batch.depth > 0)
+        return 0;
+
+    return iptables_fw_batch_apply();
+}
+
 /**
  * @internal
  * Compiles a struct definition of a firewall rule into a valid iptables
@@ -230,12 +381,14 @@ iptables_fw_set_authservers(void)
 
     config = config_get_config();
 
+    iptables_fw_batch_begin();
     for (auth_server = config->auth_servers; auth_server != NULL; auth_server = auth_server->next) {
         if (auth_server->last_ip && strcmp(auth_server->last_ip, "0.0.0.0") != 0) {
             iptables_do_command("-t filter -A " CHAIN_AUTHSERVERS " -d %s -j ACCEPT", auth_server->last_ip);
             iptables_do_command("-t nat -A " CHAIN_AUTHSERVERS " -d %s -j ACCEPT", auth_server->last_ip);
         }
     }
+    iptables_fw_batch_commit();
 
 }
 
@@ -266,6 +419,9 @@ iptables_fw_init(void)
         debug(LOG_ERR, "FATAL: no external interface");
         return 0;
     }
+    /* All of the rules below go in with one iptables-restore per table */
+    iptables_fw_batch_begin();
+
     /*
      *
      * Everything in the MANGLE table
@@ -286,6 +442,14 @@ iptables_fw_init(void)
         iptables_do_command("-t mangle -I PREROUTING 1 -i %s -j " CHAIN_AUTH_IS_DOWN, config->gw_interface);    //this rule must be last in the chain
     iptables_do_command("-t mangle -I POSTROUTING 1 -o %s -j " CHAIN_INCOMING, config->gw_interface);
 
+    /* Copy client traffic to NFLOG ahead of the per-client rules */
+    if (config->nfloggroup > 0) {
+        iptables_do_command("-t mangle -A " CHAIN_OUTGOING " -j NFLOG --nflog-group %d --nflog-prefix "
+                            FW_NFLOG_PREFIX_OUTGOING, config->nfloggroup);
+        iptables_do_command("-t mangle -A " CHAIN_INCOMING " -j NFLOG --nflog-group %d --nflog-prefix "
+                            FW_NFLOG_PREFIX_INCOMING, config->nfloggroup);
+    }
+
     for (p = config->trustedmaclist; p != NULL; p = p->next)
         iptables_do_command("-t mangle -A " CHAIN_TRUSTED " -m mac --mac-source %s -j MARK --set-mark %d", p->mac,
                             FW_MARK_KNOWN);
@@ -397,6 +561,8 @@ iptables_fw_init(void)
     iptables_load_ruleset("filter", FWRULESET_UNKNOWN_USERS, CHAIN_UNKNOWN);
     iptables_do_command("-t filter -A " CHAIN_UNKNOWN " -j REJECT --reject-with icmp-port-unreachable");
 
+    iptables_fw_batch_commit();
+
     UNLOCK_CONFIG();
 
     free(ext_interface);
@@ -558,6 +724,7 @@ iptables_fw_access(fw_access_t type, const char *ip, const char *mac, int tag)
 
     fw_quiet = 0;
 
+    iptables_fw_batch_begin();
     switch (type) {
     case FW_ACCESS_ALLOW:
         iptables_do_command("-t mangle -A " CHAIN_OUTGOING " -s %s -m mac --mac-source %s -j MARK --set-mark %d", ip,
@@ -574,6 +741,8 @@ iptables_fw_access(fw_access_t type, const char *ip, const char *mac, int tag)
         rc = -1;
         break;
     }
+    if (iptables_fw_batch_commit() != 0)
+        rc = -1;
 
     return rc;
 }
@@ -585,6 +754,7 @@ iptables_fw_access_host(fw_access_t type, const char *host)
 
     fw_quiet = 0;
 
+    iptables_fw_batch_begin();
     switch (type) {
     case FW_ACCESS_ALLOW:
         iptables_do_command("-t nat -A " CHAIN_GLOBAL " -d %s -j ACCEPT", host);
@@ -598,6 +768,8 @@ iptables_fw_access_host(fw_access_t type, const char *host)
         rc = -1;
         break;
     }
+    if (iptables_fw_batch_commit() != 0)
+        rc = -1;
 
     return rc;
 }
@@ -624,18 +796,113 @@ iptables_fw_auth_reachable(void)
         return 1;
 }
 
-/** Update the counters of all the clients in the client list */
-int
-iptables_fw_counters_update(void)
+/** @internal
+ * Read the byte counter of every client rule in the mangle table straight
+ * from the kernel, in the same binary form libiptc uses.
+ * @param counters Set to add the counters to
+ * @return 0 on success, -1 if the table could not be read or has no WiFiDog
+ * chains (e.g. when the rules live in nftables)
+ */
+static int
+iptables_fw_counters_read_kernel(t_fw_counters * counters)
+{
+    struct ipt_getinfo info;
+    struct ipt_get_entries *entries = NULL;
+    struct ipt_entry *e;
+    struct xt_entry_target *t;
+    socklen_t len;
+    unsigned int offset;
+    const char *chain = NULL;
+    char *outgoing, *incoming;
+    int sock, tries, found = 0;
+
+    sock = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+    if (sock < 0) {
+        debug(LOG_DEBUG, "Could not open raw socket for iptables counters: %s", strerror(errno));
+        return -1;
+    }
+
+    /* The table may change between the two calls, in which case the kernel
+     * answers EAGAIN and we start over */
+    for (tries = 0; tries < 3; tries++) {
+        memset(&info, 0, sizeof(info));
+        strncpy(info.name, "mangle", sizeof(info.name) - 1);
+        len = sizeof(info);
+        if (getsockopt(sock, IPPROTO_IP, IPT_SO_GET_INFO, &info, &len) < 0)
+            break;
+
+        len = sizeof(*entries) + info.size;
+        entries = safe_malloc(len);
+        strncpy(entries->name, "mangle", sizeof(entries->name) - 1);
+        entries->size = info.size;
+        if (getsockopt(sock, IPPROTO_IP, IPT_SO_GET_ENTRIES, entries, &len) == 0)
+            break;
+
+        free(entries);
+        entries = NULL;
+        if (errno != EAGAIN)
+            break;
+    }
+    if (!entries) {
+        debug(LOG_DEBUG, "Could not read the mangle table from the kernel: %s", strerror(errno));
+        close(sock);
+        return -1;
+    }
+    close(sock);
+
+    outgoing = safe_strdup(CHAIN_OUTGOING);
+    iptables_insert_gateway_id(&outgoing);
+    incoming = safe_strdup(CHAIN_INCOMING);
+    iptables_insert_gateway_id(&incoming);
+
+    for (offset = 0; offset + sizeof(*e) <= entries->size; offset += e->next_offset) {
+        e = (struct ipt_entry *)((char *)entries->entrytable + offset);
+        if (e->next_offset < sizeof(*e))
+            break;
+        t = (struct xt_entry_target *)((char *)e + e->target_offset);
+
+        /* User defined chains start with an ERROR target carrying the chain name */
+        if (strcmp(t->u.user.name, XT_ERROR_TARGET) == 0) {
+            chain = (const char *)t->data;
+            if (strcmp(chain, outgoing) == 0 || strcmp(chain, incoming) == 0)
+                found = 1;
+            continue;
+        }
+        if (!chain)
+            continue;
+
+        if (strcmp(chain, outgoing) == 0 && e->ip.smsk.s_addr == INADDR_BROADCAST)
+            fw_counters_add(counters, e->ip.src.s_addr, FW_COUNTER_OUTGOING, e->counters.bcnt);
+        else if (strcmp(chain, incoming) == 0 && e->ip.dmsk.s_addr == INADDR_BROADCAST)
+            fw_counters_add(counters, e->ip.dst.s_addr, FW_COUNTER_INCOMING, e->counters.bcnt);
+    }
+
+    free(outgoing);
+    free(incoming);
+    free(entries);
+
+    return found ? 0 : -1;
+}
+
+/** @internal
+ * Read the byte counters of one client chain by parsing the output of
+ * iptables -L. Used when the kernel table cannot be read directly.
+ * @param counters Set to add the counters to
+ * @param direction FW_COUNTER_OUTGOING or FW_COUNTER_INCOMING
+ * @return 0 on success, -1 if iptables could not be run
+ */
+static int
+iptables_fw_counters_read_text(t_fw_counters * counters, int direction)
 {
     FILE *output;
     char *script, ip[16], rc;
     unsigned long long int counter;
-    t_client *p1;
     struct in_addr tempaddr;
 
-    /* Look for outgoing traffic */
-    safe_asprintf(&script, "%s %s", "iptables", "-v -n -x -t mangle -L " CHAIN_OUTGOING);
+    if (direction == FW_COUNTER_OUTGOING)
+        safe_asprintf(&script, "%s %s", "iptables", "-v -n -x -t mangle -L " CHAIN_OUTGOING);
+    else
+        safe_asprintf(&script, "%s %s", "iptables", "-v -n -x -t mangle -L " CHAIN_INCOMING);
     iptables_insert_gateway_id(&script);
     output = popen(script, "r");
     free(script);
@@ -648,80 +915,42 @@ iptables_fw_counters_update(void)
     while (('\n' != fgetc(output)) && !feof(output)) ;
     while (('\n' != fgetc(output)) && !feof(output)) ;
     while (output && !(feof(output))) {
-        rc = fscanf(output, "%*s %llu %*s %*s %*s %*s %*s %15[0-9.] %*s %*s %*s %*s %*s %*s", &counter, ip);
-        //rc = fscanf(output, "%*s %llu %*s %*s %*s %*s %*s %15[0-9.] %*s %*s %*s %*s %*s 0x%*u", &counter, ip);
+        if (direction == FW_COUNTER_OUTGOING)
+            rc = fscanf(output, "%*s %llu %*s %*s %*s %*s %*s %15[0-9.] %*s %*s %*s %*s %*s %*s", &counter, ip);
+        else
+            rc = fscanf(output, "%*s %llu %*s %*s %*s %*s %*s %*s %15[0-9.]", &counter, ip);
         if (2 == rc && EOF != rc) {
             /* Sanity */
             if (!inet_aton(ip, &tempaddr)) {
                 debug(LOG_WARNING, "I was supposed to read an IP address but instead got [%s] - ignoring it", ip);
                 continue;
             }
-            debug(LOG_DEBUG, "Read outgoing traffic for %s: Bytes=%llu", ip, counter);
-            LOCK_CLIENT_LIST();
-            if ((p1 = client_list_find_by_ip(ip))) {
-                if ((p1->counters.outgoing - p1->counters.outgoing_history) < counter) {
-                    p1->counters.outgoing_delta = p1->counters.outgoing_history + counter - p1->counters.outgoing;
-                    p1->counters.outgoing = p1->counters.outgoing_history + counter;
-                    p1->counters.last_updated = time(NULL);
-                    debug(LOG_DEBUG, "%s - Outgoing traffic %llu bytes, updated counter.outgoing to %llu bytes.  Updated last_updated to %d", ip,
-                          counter, p1->counters.outgoing, p1->counters.last_updated);
-                }
-            } else {
-                debug(LOG_ERR,
-                      "iptables_fw_counters_update(): Could not find %s in client list, this should not happen unless if the gateway crashed",
-                      ip);
-                debug(LOG_ERR, "Preventively deleting firewall rules for %s in table %s", ip, CHAIN_OUTGOING);
-                iptables_fw_destroy_mention("mangle", CHAIN_OUTGOING, ip);
-                debug(LOG_ERR, "Preventively deleting firewall rules for %s in table %s", ip, CHAIN_INCOMING);
-                iptables_fw_destroy_mention("mangle", CHAIN_INCOMING, ip);
-            }
-            UNLOCK_CLIENT_LIST();
+            fw_counters_add(counters, tempaddr.s_addr, direction, counter);
         }
     }
     pclose(output);
 
-    /* Look for incoming traffic */
-    safe_asprintf(&script, "%s %s", "iptables", "-v -n -x -t mangle -L " CHAIN_INCOMING);
-    iptables_insert_gateway_id(&script);
-    output = popen(script, "r");
-    free(script);
-    if (!output) {
-        debug(LOG_ERR, "popen(): %s", strerror(errno));
-        return -1;
-    }
+    return 0;
+}
 
-    /* skip the first two lines */
-    while (('\n' != fgetc(output)) && !feof(output)) ;
-    while (('\n' != fgetc(output)) && !feof(output)) ;
-    while (output && !(feof(output))) {
-        rc = fscanf(output, "%*s %llu %*s %*s %*s %*s %*s %*s %15[0-9.]", &counter, ip);
-        if (2 == rc && EOF != rc) {
-            /* Sanity */
-            if (!inet_aton(ip, &tempaddr)) {
-                debug(LOG_WARNING, "I was supposed to read an IP address but instead got [%s] - ignoring it", ip);
-                continue;
-            }
-            debug(LOG_DEBUG, "Read incoming traffic for %s: Bytes=%llu", ip, counter);
-            LOCK_CLIENT_LIST();
-            if ((p1 = client_list_find_by_ip(ip))) {
-                if ((p1->counters.incoming - p1->counters.incoming_history) < counter) {
-                    p1->counters.incoming_delta = p1->counters.incoming_history + counter - p1->counters.incoming;
-                    p1->counters.incoming = p1->counters.incoming_history + counter;
-                    debug(LOG_DEBUG, "%s - Incoming traffic %llu bytes, Updated counter.incoming to %llu bytes", ip, counter, p1->counters.incoming);
-                }
-            } else {
-                debug(LOG_ERR,
-                      "iptables_fw_counters_update(): Could not find %s in client list, this should not happen unless if the gateway crashed",
-                      ip);
-                debug(LOG_ERR, "Preventively deleting firewall rules for %s in table %s", ip, CHAIN_OUTGOING);
-                iptables_fw_destroy_mention("mangle", CHAIN_OUTGOING, ip);
-                debug(LOG_ERR, "Preventively deleting firewall rules for %s in table %s", ip, CHAIN_INCOMING);
-                iptables_fw_destroy_mention("mangle", CHAIN_INCOMING, ip);
-            }
-            UNLOCK_CLIENT_LIST();
+/** Update the counters of all the clients in the client list */
+int
+iptables_fw_counters_update(void)
+{
+    t_fw_counters counters;
+
+    fw_counters_init(&counters);
+    if (iptables_fw_counters_read_kernel(&counters) != 0) {
+        fw_counters_reset(&counters);
+        if (iptables_fw_counters_read_text(&counters, FW_COUNTER_OUTGOING) != 0 ||
+            iptables_fw_counters_read_text(&counters, FW_COUNTER_INCOMING) != 0) {
+            fw_counters_free(&counters);
+            return -1;
         }
     }
-    pclose(output);
+
+    fw_counters_merge(&counters);
+    fw_counters_free(&counters);
 
     return 1;
 }
@@ -52,6 +52,12 @@ typedef enum fw_access_t_ {
     FW_ACCESS_DENY
 } fw_access_t;
 
+/** @brief Start collecting firewall changes into a batch */
+void iptables_fw_batch_begin(void);
+
+/** @brief Apply the changes collected since iptables_fw_batch_begin() */
+int iptables_fw_batch_commit(void);
+
 /** @brief Initialize the firewall */
 int iptables_fw_init(void);
 
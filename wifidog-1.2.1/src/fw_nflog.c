@@ -0,0 +1,295 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+/** @file fw_nflog.c
+    @brief Client traffic accounting from NFLOG events
+
+    When NFLogGroup is set, the firewall copies the IP header of every
+    packet going through the outgoing and incoming chains to that NFLOG
+    group. The kernel hands them over in batches, and each batch updates
+    the byte and packet counters and the last activity time of the clients
+    with the client list locked once. The counters are then always current,
+    so the firewall counters no longer need to be read every CheckInterval
+    and idle clients are timed out as soon as their deadline passes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_log.h>
+
+#include "safe.h"
+#include "debug.h"
+#include "conf.h"
+#include "client_list.h"
+#include "fw_nflog.h"
+
+/** Bytes of each packet copied to us: the IPv4 header without options */
+#define FW_NFLOG_COPY_RANGE 20
+
+/** Packets the kernel queues before sending them in one batch */
+#define FW_NFLOG_QTHRESH 256
+
+/** Longest time the kernel holds a batch, in 1/100 s */
+#define FW_NFLOG_TIMEOUT 50
+
+/** Size of the kernel buffer for one batch */
+#define FW_NFLOG_NLBUFSIZ 65536
+
+/** @internal
+ * Set while the NFLOG thread is counting traffic */
+static volatile int fw_nflog_active = 0;
+
+/** @internal
+ * Send one configuration attribute for an NFLOG group and wait for the
+ * kernel to acknowledge it.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+static int
+fw_nflog_config(int fd, int family, int group, int type, const void *data, int len)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct nfgenmsg nfg;
+        char attr[NLA_HDRLEN + 8];
+    } req;
+    static unsigned int seq = 0;
+    struct nlattr *nla = (struct nlattr *)req.attr;
+    struct nlmsghdr *nh;
+    struct nlmsgerr *err;
+    char buf[8192];
+    int n;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_type = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_CONFIG;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.nh.nlmsg_seq = ++seq;
+    req.nfg.nfgen_family = family;
+    req.nfg.version = NFNETLINK_V0;
+    req.nfg.res_id = htons(group);
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy(req.attr + NLA_HDRLEN, data, len);
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.nfg)) + NLA_ALIGN(nla->nla_len);
+
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+        return -1;
+
+    /* Packets may already be coming in once the group is bound: skip them */
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n)) {
+            if (nh->nlmsg_type != NLMSG_ERROR || nh->nlmsg_seq != seq)
+                continue;
+            err = NLMSG_DATA(nh);
+            if (err->error == 0)
+                return 0;
+            errno = -err->error;
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+/** @internal
+ * Account one logged packet. Called with the client list locked. */
+static void
+fw_nflog_packet(struct nlmsghdr *nh, time_t now)
+{
+    struct nfgenmsg *nfg = NLMSG_DATA(nh);
+    struct nlattr *nla = (struct nlattr *)((char *)nfg + NLMSG_ALIGN(sizeof(*nfg)));
+    int len = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*nfg));
+    const struct iphdr *iph = NULL;
+    const char *prefix = NULL;
+    struct in_addr addr;
+    t_client *client;
+    char ip[INET_ADDRSTRLEN];
+    unsigned int bytes;
+    int outgoing;
+
+    while (len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+        switch (nla->nla_type & NLA_TYPE_MASK) {
+        case NFULA_PAYLOAD:
+            if (nla->nla_len - NLA_HDRLEN >= (int)sizeof(struct iphdr))
+                iph = (const struct iphdr *)((char *)nla + NLA_HDRLEN);
+            break;
+        case NFULA_PREFIX:
+            prefix = (const char *)nla + NLA_HDRLEN;
+            break;
+        }
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+    if (iph == NULL || prefix == NULL || iph->version != 4)
+        return;
+
+    outgoing = strcmp(prefix, FW_NFLOG_PREFIX_OUTGOING) == 0;
+    addr.s_addr = outgoing ? iph->saddr : iph->daddr;
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    if ((client = client_list_find_by_ip(ip)) == NULL)
+        return;
+
+    bytes = ntohs(iph->tot_len);
+    if (outgoing) {
+        client->counters.outgoing += bytes;
+        client->counters.outgoing_delta += bytes;
+        client->counters.outgoing_packets++;
+        /* As with the firewall counters, only traffic from the client
+         * counts as activity */
+        client->counters.last_updated = now;
+    } else {
+        client->counters.incoming += bytes;
+        client->counters.incoming_delta += bytes;
+        client->counters.incoming_packets++;
+    }
+}
+
+/** @internal
+ * Count logged packets until the netlink socket fails */
+static void *
+thread_fw_nflog(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[FW_NFLOG_NLBUFSIZ];
+    struct nlmsghdr *nh;
+    time_t now;
+    int len;
+
+    free(arg);
+
+    while (1) {
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS) {
+                debug(LOG_WARNING, "Traffic accounting events lost, counters will be low");
+                continue;
+            }
+            debug(LOG_ERR, "Could not read traffic accounting events: %s", strerror(errno));
+            break;
+        }
+
+        now = time(NULL);
+        LOCK_CLIENT_LIST();
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == ((NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET))
+                fw_nflog_packet(nh, now);
+        }
+        UNLOCK_CLIENT_LIST();
+    }
+
+    debug(LOG_WARNING, "No longer counting traffic from NFLOG, reading the firewall counters instead");
+    fw_nflog_active = 0;
+    close(fd);
+
+    return NULL;
+}
+
+/** Start counting client traffic from the NFLOG group given by NFLogGroup.
+ * The firewall rules that feed the group are set up by iptables_fw_init().
+ * @return 0 if traffic is counted from NFLOG, -1 if the firewall counters
+ *         have to be read instead
+ */
+int
+fw_nflog_init(void)
+{
+    s_config *config = config_get_config();
+    struct sockaddr_nl addr;
+    struct nfulnl_msg_config_cmd cmd;
+    struct nfulnl_msg_config_mode mode;
+    u_int32_t value;
+    int fd, rcvbuf = 1024 * 1024, *arg;
+    pthread_t tid;
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER)) < 0) {
+        debug(LOG_ERR, "Could not open a netfilter netlink socket: %s", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        debug(LOG_ERR, "Could not bind the netfilter netlink socket: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /* Older kernels need the IPv4 log handler bound to nfnetlink_log */
+    cmd.command = NFULNL_CFG_CMD_PF_UNBIND;
+    fw_nflog_config(fd, AF_INET, 0, NFULA_CFG_CMD, &cmd, sizeof(cmd));
+    cmd.command = NFULNL_CFG_CMD_PF_BIND;
+    fw_nflog_config(fd, AF_INET, 0, NFULA_CFG_CMD, &cmd, sizeof(cmd));
+
+    cmd.command = NFULNL_CFG_CMD_BIND;
+    mode.copy_range = htonl(FW_NFLOG_COPY_RANGE);
+    mode.copy_mode = NFULNL_COPY_PACKET;
+    mode._pad = 0;
+    if (fw_nflog_config(fd, AF_UNSPEC, config->nfloggroup, NFULA_CFG_CMD, &cmd, sizeof(cmd)) < 0 ||
+        fw_nflog_config(fd, AF_UNSPEC, config->nfloggroup, NFULA_CFG_MODE, &mode, sizeof(mode)) < 0) {
+        debug(LOG_ERR, "Could not bind NFLOG group %d: %s", config->nfloggroup, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    value = htonl(FW_NFLOG_QTHRESH);
+    fw_nflog_config(fd, AF_UNSPEC, config->nfloggroup, NFULA_CFG_QTHRESH, &value, sizeof(value));
+    value = htonl(FW_NFLOG_TIMEOUT);
+    fw_nflog_config(fd, AF_UNSPEC, config->nfloggroup, NFULA_CFG_TIMEOUT, &value, sizeof(value));
+    value = htonl(FW_NFLOG_NLBUFSIZ);
+    fw_nflog_config(fd, AF_UNSPEC, config->nfloggroup, NFULA_CFG_NLBUFSIZ, &value, sizeof(value));
+
+    arg = safe_malloc(sizeof(int));
+    *arg = fd;
+    fw_nflog_active = 1;
+    if (pthread_create(&tid, NULL, thread_fw_nflog, arg) != 0) {
+        debug(LOG_ERR, "Failed to create the traffic accounting thread: %s", strerror(errno));
+        fw_nflog_active = 0;
+        free(arg);
+        close(fd);
+        return -1;
+    }
+    pthread_detach(tid);
+
+    debug(LOG_INFO, "Counting client traffic from NFLOG group %d", config->nfloggroup);
+    return 0;
+}
+
+/** Whether client counters are kept up to date from NFLOG events, so that
+ * the firewall counters do not need to be read.
+ * @return 1 if the NFLOG thread is running, 0 otherwise
+ */
+int
+fw_nflog_running(void)
+{
+    return fw_nflog_active;
+}
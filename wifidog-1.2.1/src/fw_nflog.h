@@ -0,0 +1,40 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+/** @file fw_nflog.h
+    @brief Client traffic accounting from NFLOG events
+*/
+
+#ifndef _FW_NFLOG_H_
+#define _FW_NFLOG_H_
+
+/** @brief NFLOG prefix of packets sent by clients */
+#define FW_NFLOG_PREFIX_OUTGOING "wifidog-out"
+
+/** @brief NFLOG prefix of packets sent to clients */
+#define FW_NFLOG_PREFIX_INCOMING "wifidog-in"
+
+/** @brief Start counting client traffic from the NFLOG group */
+int fw_nflog_init(void);
+
+/** @brief Whether client counters are kept up to date from NFLOG events */
+int fw_nflog_running(void);
+
+#endif                          /* _FW_NFLOG_H_ */
@@ -44,6 +44,10 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
+/* for the web server event loop */
+#include <fcntl.h>
+#include <sys/epoll.h>
+
 #include "common.h"
 #include "httpd.h"
 #include "safe.h"
@@ -53,25 +57,46 @@
 #include "firewall.h"
 #include "commandline.h"
 #include "auth.h"
+#include "centralserver.h"
 #include "http.h"
 #include "client_list.h"
 #include "wdctl_thread.h"
 #include "ping_thread.h"
 #include "httpd_thread.h"
 #include "util.h"
-
-/** XXX Ugly hack 
- * We need to remember the thread IDs of threads that simulate wait with pthread_cond_timedwait
- * so we can explicitly kill them in the termination handler
- */
-static pthread_t tid_fw_counter = 0;
-static pthread_t tid_ping = 0;
+#include "arp_cache.h"
+#include "html_template.h"
+#include "scheduler.h"
+#include "fw_nflog.h"
 
 time_t started_time = 0;
 
 /* The internal web server */
 httpd * webserver = NULL;
 
+/** Maximum number of web server events handled per epoll_wait() */
+#define HTTPD_MAX_EVENTS 64
+
+/** @internal
+ * A web server connection waiting for its next request, either just
+ * accepted or kept open after a response. The request headers are read
+ * here as they arrive, so that a worker only gets complete requests. Kept
+ * in the order they started waiting so that connections that do not send a
+ * complete request in time can be expired from the head of the list. */
+typedef struct _httpd_conn_t {
+    request *r;
+    time_t idle_since;
+    struct _httpd_conn_t *prev;
+    struct _httpd_conn_t *next;
+} t_httpd_conn;
+
+static t_httpd_conn *httpd_conn_head = NULL;
+static t_httpd_conn *httpd_conn_tail = NULL;
+
+/** @internal
+ * epoll tag of the pipe workers hand kept-alive connections back through */
+static int httpd_idle_event;
+
 /* Appends -x, the current PID, and NULL to restartargv
  * see parse_commandline in commandline.c for details
  *
@@ -259,7 +284,6 @@ void
 termination_handler(int s)
 {
     static pthread_mutex_t sigterm_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_t self = pthread_self();
 
     debug(LOG_INFO, "Handler for termination caught signal %d", s);
 
@@ -274,24 +298,19 @@ termination_handler(int s)
     debug(LOG_INFO, "Flushing firewall rules...");
     fw_destroy();
 
-    /* XXX Hack
-     * Aparently pthread_cond_timedwait under openwrt prevents signals (and therefore
-     * termination handler) from happening so we need to explicitly kill the threads 
-     * that use that
-     */
-    if (tid_fw_counter && self != tid_fw_counter) {
-        debug(LOG_INFO, "Explicitly killing the fw_counter thread");
-        pthread_kill(tid_fw_counter, SIGKILL);
-    }
-    if (tid_ping && self != tid_ping) {
-        debug(LOG_INFO, "Explicitly killing the ping thread");
-        pthread_kill(tid_ping, SIGKILL);
-    }
-
     debug(LOG_NOTICE, "Exiting...");
     exit(s == 0 ? 1 : 0);
 }
 
+/** @internal
+ * Handles SIGHUP by rereading the HTML message file on next use
+ */
+static void
+sighup_handler(int s)
+{
+    html_template_reload();
+}
+
 /** @internal 
  * Registers all the signal handlers
  */
@@ -322,6 +341,13 @@ init_signals(void)
         exit(1);
     }
 
+    /* Trap SIGHUP */
+    sa.sa_handler = sighup_handler;
+    if (sigaction(SIGHUP, &sa, NULL) == -1) {
+        debug(LOG_ERR, "sigaction(): %s", strerror(errno));
+        exit(1);
+    }
+
     sa.sa_handler = termination_handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = SA_RESTART;
@@ -345,17 +371,109 @@ init_signals(void)
     }
 }
 
+/** @internal
+ * Removes a connection from the idle list and frees the list entry
+ * (not the request) */
+static void
+httpd_conn_unlink(t_httpd_conn * conn)
+{
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        httpd_conn_head = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    else
+        httpd_conn_tail = conn->prev;
+    free(conn);
+}
+
+/** @internal
+ * Waits for a connection to send its next request */
+static void
+httpd_watch_connection(int epfd, request * r)
+{
+    struct epoll_event ev;
+    t_httpd_conn *conn;
+
+    conn = safe_malloc(sizeof(t_httpd_conn));
+    conn->r = r;
+    conn->idle_since = time(NULL);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, r->clientSock, &ev) < 0) {
+        debug(LOG_ERR, "Could not watch connection from %s: %s", r->clientAddr, strerror(errno));
+        httpdEndRequest(r);
+        free(conn);
+        return;
+    }
+
+    conn->prev = httpd_conn_tail;
+    if (httpd_conn_tail)
+        httpd_conn_tail->next = conn;
+    else
+        httpd_conn_head = conn;
+    httpd_conn_tail = conn;
+}
+
+/** @internal
+ * Accepts every pending connection on the web server socket and waits for
+ * each of them to send its request */
+static void
+httpd_accept_connections(int epfd)
+{
+    request *r;
+
+    while (1) {
+        r = httpdAcceptConnection(webserver);
+        if (r == NULL) {
+            /* 2 means the client failed an ACL; look for the next one */
+            if (webserver->lastError == 2)
+                continue;
+            if (webserver->lastError < 0)
+                debug(LOG_WARNING, "Failed to accept web server connection (%d): %s", webserver->lastError,
+                      strerror(errno));
+            return;
+        }
+
+        debug(LOG_INFO, "Received connection from %s", r->clientAddr);
+        httpd_watch_connection(epfd, r);
+    }
+}
+
+/** @internal
+ * Closes connections that have not sent a complete request within the idle
+ * timeout */
+static void
+httpd_expire_connections(int epfd, int timeout)
+{
+    time_t now = time(NULL);
+    t_httpd_conn *conn;
+    request *r;
+
+    while ((conn = httpd_conn_head) != NULL && now - conn->idle_since >= timeout) {
+        r = conn->r;
+        debug(LOG_DEBUG, "Closing idle connection from %s", r->clientAddr);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, r->clientSock, NULL);
+        httpd_conn_unlink(conn);
+        httpdEndRequest(r);
+    }
+}
+
 /**@internal
  * Main execution loop 
  */
 static void
 main_loop(void)
 {
-    int result;
-    pthread_t tid;
     s_config *config = config_get_config();
+    struct epoll_event ev, events[HTTPD_MAX_EVENTS];
+    t_httpd_conn *conn;
     request *r;
-    void **params;
+    pthread_t tid;
+    int epfd, n, i, rc;
 
     /* Set the time when wifidog started */
     if (!started_time) {
@@ -407,6 +525,9 @@ main_loop(void)
     httpdAddCContent(webserver, "/wifidog", "auth", 0, NULL, http_callback_auth);
     httpdAddCContent(webserver, "/wifidog", "disconnect", 0, NULL, http_callback_disconnect);
 
+    if (config->httpdstaticdir)
+        httpdAddWildcardContent(webserver, "/wifidog/static", NULL, config->httpdstaticdir);
+
     httpdSetErrorFunction(webserver, 404, http_callback_404);
 
     /* Reset the firewall (if WiFiDog crashed) */
@@ -417,49 +538,99 @@ main_loop(void)
         exit(1);
     }
 
+    /* Resolve the auth servers before the first client needs them */
+    auth_server_dns_init();
+
+    /* Look up client MAC addresses without reading the ARP table each time */
+    arp_cache_init();
+
+    /* Count client traffic as it goes rather than polling the firewall */
+    if (config->nfloggroup > 0)
+        fw_nflog_init();
+
+    if (fcntl(webserver->serverSock, F_SETFL, fcntl(webserver->serverSock, F_GETFL) | O_NONBLOCK) < 0 ||
+        (epfd = epoll_create(HTTPD_MAX_EVENTS)) < 0) {
+        debug(LOG_ERR, "Could not set up the web server event loop: %s", strerror(errno));
+        exit(1);
+    }
+    register_fd_cleanup_on_fork(epfd);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, webserver->serverSock, &ev) < 0) {
+        debug(LOG_ERR, "Could not watch the web server socket: %s", strerror(errno));
+        exit(1);
+    }
+
+    if (httpd_pool_init(webserver, config->httpdthreads, config->httpdqueuelength) != 0) {
+        debug(LOG_ERR, "FATAL: Failed to create any httpd worker thread - exiting");
+        termination_handler(0);
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &httpd_idle_event;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, httpd_pool_idle_fd(), &ev) < 0) {
+        debug(LOG_ERR, "Could not watch the httpd keep-alive pipe: %s", strerror(errno));
+        exit(1);
+    }
+
+    /* Start the heartbeat, counter sync and client timeouts */
+    if (config->periodicchecks) {
+        if (pthread_create(&tid, NULL, (void *)thread_scheduler, NULL) != 0) {
+            debug(LOG_ERR, "FATAL: Failed to create a new thread (scheduler) - exiting");
+            termination_handler(0);
+        }
+        pthread_detach(tid);
+    } else {
+        debug(LOG_INFO, "PeriodicChecks is off: no heartbeat, counter sync or client timeouts");
+    }
+
     debug(LOG_NOTICE, "Waiting for connections");
     while (1) {
-        r = httpdGetConnection(webserver, NULL);
-
-        /* We can't convert this to a switch because there might be
-         * values that are not -1, 0 or 1. */
-        if (webserver->lastError == -1) {
-            /* Interrupted system call */
-            if (NULL != r) {
-                httpdEndRequest(r);
-            }
-        } else if (webserver->lastError < -1) {
+        n = epoll_wait(epfd, events, HTTPD_MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
             /*
              * FIXME
              * An error occurred - should we abort?
              * reboot the device ?
              */
-            debug(LOG_ERR, "FATAL: httpdGetConnection returned unexpected value %d, exiting.", webserver->lastError);
+            debug(LOG_ERR, "FATAL: epoll_wait failed: %s, exiting.", strerror(errno));
             termination_handler(0);
-        } else if (r != NULL) {
-            /*
-             * We got a connection
-             *
-             * We should create another thread
-             */
-            debug(LOG_INFO, "Received connection from %s, spawning worker thread", r->clientAddr);
-            /* The void**'s are a simulation of the normal C
-             * function calling sequence. */
-            params = safe_malloc(2 * sizeof(void *));
-            *params = webserver;
-            *(params + 1) = r;
-
-            result = pthread_create(&tid, NULL, (void *)thread_httpd, (void *)params);
-            if (result != 0) {
-                debug(LOG_ERR, "FATAL: Failed to create a new thread (httpd) - exiting");
-                termination_handler(0);
+        }
+
+        for (i = 0; i < n; i++) {
+            conn = events[i].data.ptr;
+            if (conn == NULL) {
+                httpd_accept_connections(epfd);
+                continue;
+            }
+            if (events[i].data.ptr == &httpd_idle_event) {
+                while ((r = httpd_pool_idle_next()) != NULL)
+                    httpd_watch_connection(epfd, r);
+                continue;
+            }
+
+            /* The client has sent something (or gone away): buffer it until
+             * the request headers are complete, then let a worker parse them */
+            r = conn->r;
+            rc = (events[i].events & EPOLLIN) ? httpdReadHeaders(r) : -1;
+            if (rc == 0)
+                continue;
+            epoll_ctl(epfd, EPOLL_CTL_DEL, r->clientSock, NULL);
+            httpd_conn_unlink(conn);
+            if (rc > 0) {
+                debug(LOG_DEBUG, "Request ready from %s, queueing for a worker thread", r->clientAddr);
+                httpd_pool_submit(r);
+            } else {
+                httpdEndRequest(r);
             }
-            pthread_detach(tid);
-        } else {
-            /* webserver->lastError should be 2 */
-            /* XXX We failed an ACL.... No handling because
-             * we don't set any... */
         }
+
+        httpd_expire_connections(epfd, config->httpdidletimeout);
     }
 
     /* never reached */
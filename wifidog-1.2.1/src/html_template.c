@@ -0,0 +1,291 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+
+/** @file html_template.c
+    @brief Cached, precompiled HTML message template
+
+    The template file is read once and split into a list of segments: runs
+    of static text and references to the $variables in t_html_var. Sending
+    a page is then a single writev() of those segments, with the variables
+    filled in. The file is read again after SIGHUP, or when its modification
+    time, size or inode changes (checked at most once per second).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "httpd.h"
+
+#include "safe.h"
+#include "debug.h"
+#include "html_template.h"
+
+/** Segments rendered without allocating */
+#define HTML_TEMPLATE_IOV 32
+
+/** @internal
+ * Names of the variables, indexed by t_html_var */
+static const char *html_var_names[HTML_VAR_MAX] = { "title", "message", "nodeID" };
+
+/** @internal
+ * Static text, or a variable if var is not -1 */
+typedef struct {
+    const char *text;
+    size_t len;
+    int var;
+} t_html_segment;
+
+/** @internal
+ * A loaded template; freed when replaced and no longer being sent */
+typedef struct {
+    char *path;
+    char *text;                 /**< File contents, the segments point into it */
+    t_html_segment *segments;
+    int count;
+    time_t mtime;
+    off_t size;
+    ino_t ino;
+    int refcount;               /**< One for the cache, one per page being sent */
+} t_html_template;
+
+static t_html_template *html_template = NULL;
+static pthread_mutex_t html_template_mutex = PTHREAD_MUTEX_INITIALIZER;
+static time_t html_template_checked = 0;
+static volatile sig_atomic_t html_template_stale = 0;
+
+/** @internal
+ * Append a segment, merging static text with the previous segment */
+static void
+html_template_add(t_html_template * tpl, int *size, const char *text, size_t len, int var)
+{
+    t_html_segment *last = tpl->count ? &tpl->segments[tpl->count - 1] : NULL;
+
+    if (var == -1 && len == 0)
+        return;
+    if (var == -1 && last && last->var == -1 && last->text + last->len == text) {
+        last->len += len;
+        return;
+    }
+    if (tpl->count == *size) {
+        *size = *size ? *size * 2 : 16;
+        tpl->segments = safe_realloc(tpl->segments, *size * sizeof(t_html_segment));
+    }
+    tpl->segments[tpl->count].text = text;
+    tpl->segments[tpl->count].len = len;
+    tpl->segments[tpl->count].var = var;
+    tpl->count++;
+}
+
+/** @internal
+ * Split the template text into static and variable segments.
+ * Unknown $names are kept as text, as httpdOutput() did. */
+static void
+html_template_compile(t_html_template * tpl)
+{
+    const char *p, *start, *name;
+    size_t name_len;
+    int size = 0, var;
+
+    for (start = p = tpl->text; *p; p++) {
+        if (*p != '$')
+            continue;
+        for (name = p + 1, name_len = 0; isalnum((unsigned char)name[name_len]) || name[name_len] == '_'; name_len++) ;
+        for (var = 0; var < HTML_VAR_MAX; var++)
+            if (strlen(html_var_names[var]) == name_len && strncmp(name, html_var_names[var], name_len) == 0)
+                break;
+        if (var == HTML_VAR_MAX)
+            continue;
+
+        html_template_add(tpl, &size, start, p - start, -1);
+        html_template_add(tpl, &size, NULL, 0, var);
+        p += name_len;
+        start = p + 1;
+    }
+    html_template_add(tpl, &size, start, p - start, -1);
+}
+
+/** @internal
+ * Free a template once nobody uses it; called with html_template_mutex held */
+static void
+html_template_unref(t_html_template * tpl)
+{
+    if (--tpl->refcount > 0)
+        return;
+    free(tpl->segments);
+    free(tpl->text);
+    free(tpl->path);
+    free(tpl);
+}
+
+/** @internal
+ * Read and compile a template file */
+static t_html_template *
+html_template_load(const char *path)
+{
+    t_html_template *tpl;
+    struct stat stat_info;
+    ssize_t numbytes;
+    size_t done = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        debug(LOG_CRIT, "Failed to open HTML message file %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    if (fstat(fd, &stat_info) == -1) {
+        debug(LOG_CRIT, "Failed to stat HTML message file: %s", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    tpl = safe_malloc(sizeof(t_html_template));
+    memset(tpl, 0, sizeof(t_html_template));
+    tpl->text = safe_malloc((size_t) stat_info.st_size + 1);
+    while (done < (size_t) stat_info.st_size) {
+        numbytes = read(fd, tpl->text + done, (size_t) stat_info.st_size - done);
+        if (numbytes == -1 && errno == EINTR)
+            continue;
+        if (numbytes == -1) {
+            debug(LOG_CRIT, "Failed to read HTML message file: %s", strerror(errno));
+            free(tpl->text);
+            free(tpl);
+            close(fd);
+            return NULL;
+        }
+        if (numbytes == 0)
+            break;
+        done += numbytes;
+    }
+    close(fd);
+    tpl->text[done] = '\0';
+
+    tpl->path = safe_strdup(path);
+    tpl->mtime = stat_info.st_mtime;
+    tpl->size = stat_info.st_size;
+    tpl->ino = stat_info.st_ino;
+    tpl->refcount = 1;
+    html_template_compile(tpl);
+
+    debug(LOG_INFO, "Loaded HTML message file %s (%d segments)", path, tpl->count);
+    return tpl;
+}
+
+/** @internal
+ * Take a reference to the current template, loading it if needed */
+static t_html_template *
+html_template_get(const char *path)
+{
+    t_html_template *tpl, *loaded;
+    struct stat stat_info;
+    time_t now = time(NULL);
+    int reload;
+
+    pthread_mutex_lock(&html_template_mutex);
+    tpl = html_template;
+    reload = tpl == NULL || html_template_stale || strcmp(tpl->path, path) != 0;
+    if (!reload && now != html_template_checked) {
+        html_template_checked = now;
+        reload = stat(path, &stat_info) == 0 && (stat_info.st_mtime != tpl->mtime ||
+                                                 stat_info.st_size != tpl->size || stat_info.st_ino != tpl->ino);
+    }
+    if (reload) {
+        html_template_stale = 0;
+        html_template_checked = now;
+        /* Keep serving the old template if the new one cannot be read */
+        if ((loaded = html_template_load(path)) != NULL) {
+            if (tpl)
+                html_template_unref(tpl);
+            html_template = tpl = loaded;
+        }
+    }
+    if (tpl)
+        tpl->refcount++;
+    pthread_mutex_unlock(&html_template_mutex);
+
+    return tpl;
+}
+
+/** Send a page built from a template file.
+ * @param r The request
+ * @param path Template file
+ * @param values Value of each t_html_var; NULL values are left empty
+ * @return 0 on success, -1 if the template could not be loaded
+ */
+int
+html_template_send(request * r, const char *path, const char *const *values)
+{
+    struct iovec local[HTML_TEMPLATE_IOV], *iov = local;
+    t_html_template *tpl;
+    t_html_segment *seg;
+    const char *value;
+    int i;
+
+    if ((tpl = html_template_get(path)) == NULL)
+        return -1;
+
+    if (tpl->count > HTML_TEMPLATE_IOV)
+        iov = safe_malloc(tpl->count * sizeof(struct iovec));
+
+    for (i = 0; i < tpl->count; i++) {
+        seg = &tpl->segments[i];
+        if (seg->var == -1) {
+            iov[i].iov_base = (void *)seg->text;
+            iov[i].iov_len = seg->len;
+        } else {
+            value = values[seg->var] ? values[seg->var] : "";
+            iov[i].iov_base = (void *)value;
+            iov[i].iov_len = strlen(value);
+        }
+    }
+    httpdOutputV(r, iov, tpl->count);
+
+    if (iov != local)
+        free(iov);
+
+    pthread_mutex_lock(&html_template_mutex);
+    html_template_unref(tpl);
+    pthread_mutex_unlock(&html_template_mutex);
+
+    return 0;
+}
+
+/** Make the next page read the template file again. Only sets a flag, so
+ * it can be called from a signal handler.
+ */
+void
+html_template_reload(void)
+{
+    html_template_stale = 1;
+}
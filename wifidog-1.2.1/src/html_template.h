@@ -0,0 +1,45 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+
+/** @file html_template.h
+    @brief Cached, precompiled HTML message template
+*/
+
+#ifndef _HTML_TEMPLATE_H_
+#define _HTML_TEMPLATE_H_
+
+#include "httpd.h"
+
+/** @brief Variables that can appear in the template as $name */
+typedef enum {
+    HTML_VAR_TITLE,             /**< @brief $title */
+    HTML_VAR_MESSAGE,           /**< @brief $message */
+    HTML_VAR_NODEID,            /**< @brief $nodeID */
+    HTML_VAR_MAX
+} t_html_var;
+
+/** @brief Render a template file to the client */
+int html_template_send(request * r, const char *path, const char *const *values);
+
+/** @brief Reload the template on next use; safe to call from a signal handler */
+void html_template_reload(void);
+
+#endif                          /* _HTML_TEMPLATE_H_ */
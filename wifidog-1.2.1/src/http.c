@@ -54,6 +54,8 @@
 #include "centralserver.h"
 #include "util.h"
 #include "wd_util.h"
+#include "arp_cache.h"
+#include "html_template.h"
 
 #include "../config.h"
 
@@ -62,10 +64,14 @@
 void
 http_callback_404(httpd * webserver, request * r, int error_code)
 {
-    char tmp_url[MAX_BUF], *url, *mac;
+    char tmp_url[MAX_BUF], *url, mac[ARP_MAC_LEN];
     s_config *config = config_get_config();
     t_auth_serv *auth_server = get_auth_server();
 
+    /* The request was captured on its way to another host; if that host is
+     * allowed below, the client must reach it on a new connection */
+    r->request.keepAlive = 0;
+
     memset(tmp_url, 0, sizeof(tmp_url));
     /* 
      * XXX Note the code below assumes that the client's request is a plain
@@ -77,19 +83,18 @@ http_callback_404(httpd * webserver, request * r, int error_code)
     url = httpdUrlEncode(tmp_url);
 
     /* Re-direct them to auth server */
-    char *urlFragment;
+    char urlFragment[MAX_BUF];
 
-    if (!(mac = arp_get(r->clientAddr))) {
+    if (arp_cache_lookup(r->clientAddr, mac) != 0) {
         /* We could not get their MAC address */
         debug(LOG_INFO, "Failed to retrieve MAC address for ip %s, so not putting in the login request",
                 r->clientAddr);
-        safe_asprintf(&urlFragment, "%smac=%s",
+        snprintf(urlFragment, sizeof(urlFragment), "%smac=%s",
                 auth_server->authserv_login_script_path_fragment, "Can't get mac addr");
     } else {
         debug(LOG_INFO, "Got client MAC address for ip %s: %s", r->clientAddr, mac);
-        safe_asprintf(&urlFragment, "%smac=%s",
+        snprintf(urlFragment, sizeof(urlFragment), "%smac=%s",
                 auth_server->authserv_login_script_path_fragment, mac);
-        free(mac);
     }
 
     // if host is not in whitelist, maybe not in conf or domain'IP changed, it will go to here.
@@ -116,7 +121,6 @@ http_callback_404(httpd * webserver, request * r, int error_code)
                 fw_allow_host(r->request.host);
                 http_send_redirect(r, tmp_url, "allow subdomain");
                 free(url);
-                free(urlFragment);
                 return;
             }
         } else {
@@ -125,14 +129,12 @@ http_callback_404(httpd * webserver, request * r, int error_code)
             fw_allow_host(r->request.host);
             http_send_redirect(r, tmp_url, "allow domain");
             free(url);
-            free(urlFragment);
             return;
         }
     }
 
     debug(LOG_INFO, "Captured %s requesting [%s] and re-directing them to login page", r->clientAddr, url);
     http_send_redirect_to_auth(r, urlFragment, "Redirect to login page");
-    free(urlFragment);
     free(url);
 }
 
@@ -180,6 +182,7 @@ http_send_redirect_to_auth(request * r, const char *urlFragment, const char *tex
     char *protocol = NULL;
     int port = 80;
     t_auth_serv *auth_server = get_auth_server();
+    char url[MAX_BUF];
 
     if (auth_server->authserv_use_ssl) {
         protocol = "https";
@@ -189,11 +192,9 @@ http_send_redirect_to_auth(request * r, const char *urlFragment, const char *tex
         port = auth_server->authserv_http_port;
     }
 
-    char *url = NULL;
-    safe_asprintf(&url, "%s://%s:%d%s%s",
-                  protocol, auth_server->authserv_hostname, port, auth_server->authserv_path, urlFragment);
+    snprintf(url, sizeof(url), "%s://%s:%d%s%s",
+             protocol, auth_server->authserv_hostname, port, auth_server->authserv_path, urlFragment);
     http_send_redirect(r, url, text);
-    free(url);
 }
 
 /** @brief Sends a redirect to the web browser 
@@ -203,20 +204,20 @@ http_send_redirect_to_auth(request * r, const char *urlFragment, const char *tex
 void
 http_send_redirect(request * r, const char *url, const char *text)
 {
-    char *message = NULL;
-    char *header = NULL;
-    char *response = NULL;
+    /* Built on the stack: redirects are the most frequent response */
+    char message[MAX_BUF + 64];
+    char header[HTTP_MAX_HEADERS];
+    char response[HTTP_MAX_URL];
     /* Re-direct them to auth server */
     debug(LOG_DEBUG, "Redirecting client browser to %s", url);
-    safe_asprintf(&header, "Location: %s", url);
-    safe_asprintf(&response, "302 %s\n", text ? text : "Redirecting");
+    /* The browser could otherwise send the redirected request back here */
+    r->request.keepAlive = 0;
+    snprintf(header, sizeof(header), "Location: %s", url);
+    snprintf(response, sizeof(response), "302 %s\n", text ? text : "Redirecting");
     httpdSetResponse(r, response);
     httpdAddHeader(r, header);
-    free(response);
-    free(header);
-    safe_asprintf(&message, "Please <a href='%s'>click here</a>.", url);
+    snprintf(message, sizeof(message), "Please <a href='%s'>click here</a>.", url);
     send_http_page(r, text ? text : "Redirection to message", message);
-    free(message);
 }
 
 void
@@ -224,12 +225,12 @@ http_callback_auth(httpd * webserver, request * r)
 {
     t_client *client;
     httpVar *token;
-    char *mac;
+    char mac[ARP_MAC_LEN];
     httpVar *logout = httpdGetVariableByName(r, "logout");
 
     if ((token = httpdGetVariableByName(r, "token"))) {
         /* They supplied variable "token" */
-        if (!(mac = arp_get(r->clientAddr))) {
+        if (arp_cache_lookup(r->clientAddr, mac) != 0) {
             /* We could not get their MAC address */
             debug(LOG_ERR, "Failed to retrieve MAC address for ip %s", r->clientAddr);
             send_http_page(r, "WiFiDog Error", "Failed to retrieve your MAC address");
@@ -250,7 +251,6 @@ http_callback_auth(httpd * webserver, request * r)
             if (!logout) { /* applies for case 1 and 3 from above if */
                 authenticate_client(r);
             }
-            free(mac);
         }
     } else {
         /* They did not supply variable "token" */
@@ -304,37 +304,10 @@ void
 send_http_page(request * r, const char *title, const char *message)
 {
     s_config *config = config_get_config();
-    char *buffer;
-    struct stat stat_info;
-    int fd;
-    ssize_t written;
-
-    fd = open(config->htmlmsgfile, O_RDONLY);
-    if (fd == -1) {
-        debug(LOG_CRIT, "Failed to open HTML message file %s: %s", config->htmlmsgfile, strerror(errno));
-        return;
-    }
+    const char *values[HTML_VAR_MAX];
 
-    if (fstat(fd, &stat_info) == -1) {
-        debug(LOG_CRIT, "Failed to stat HTML message file: %s", strerror(errno));
-        close(fd);
-        return;
-    }
-    // Cast from long to unsigned int
-    buffer = (char *)safe_malloc((size_t) stat_info.st_size + 1);
-    written = read(fd, buffer, (size_t) stat_info.st_size);
-    if (written == -1) {
-        debug(LOG_CRIT, "Failed to read HTML message file: %s", strerror(errno));
-        free(buffer);
-        close(fd);
-        return;
-    }
-    close(fd);
-
-    buffer[written] = 0;
-    httpdAddVariable(r, "title", title);
-    httpdAddVariable(r, "message", message);
-    httpdAddVariable(r, "nodeID", config->gw_id);
-    httpdOutput(r, buffer);
-    free(buffer);
+    values[HTML_VAR_TITLE] = title;
+    values[HTML_VAR_MESSAGE] = message;
+    values[HTML_VAR_NODEID] = config->gw_id;
+    html_template_send(r, config->htmlmsgfile, values);
 }
@@ -35,41 +35,269 @@
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netfilter_ipv4.h>
 
 #include "httpd.h"
 
 #include "../config.h"
 #include "common.h"
 #include "debug.h"
+#include "safe.h"
+#include "pstring.h"
 #include "httpd_thread.h"
 
-/** Main request handling thread.
-@param args Two item array of void-cast pointers to the httpd and request struct
+/** Sent to clients that arrive while every worker is busy and the queue is full */
+#define HTTPD_BUSY_RESPONSE "HTTP/1.0 503 Service Unavailable\r\n" \
+    "Retry-After: 1\r\n" \
+    "Content-Length: 0\r\n" \
+    "Connection: close\r\n\r\n"
+
+/** @internal
+ * Protects the request queue below and wakes up idle workers */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+/** @internal
+ * Bounded ring of requests waiting for a worker. */
+static struct {
+    httpd *webserver;
+    request **queue;
+    int queue_len;
+    int head;
+    int count;
+    int threads;
+    int busy;
+    unsigned long served;
+    unsigned long rejected;
+    unsigned long kept;
+} pool;
+
+/** @internal
+ * Connections kept open after a response travel back to the event loop
+ * through this pipe, one request pointer per write, so that no worker
+ * waits for a client's next request. */
+static int idle_pipe[2] = { -1, -1 };
+
+static void *thread_httpd_worker(void *);
+
+/** @internal
+ * Hand a kept-alive connection back to the event loop.
+ * @return 0 on success, -1 if the connection must be closed instead */
+static int
+httpd_pool_keep(request * r)
+{
+    if (write(idle_pipe[1], &r, sizeof(r)) != sizeof(r))
+        return -1;
+
+    pthread_mutex_lock(&pool_mutex);
+    pool.kept++;
+    pthread_mutex_unlock(&pool_mutex);
+    return 0;
+}
+
+/** @internal
+ * Whether the firewall redirected the connection to the gateway rather than
+ * the client addressing the gateway. Such a connection must not be kept
+ * open: conntrack keeps sending its requests to the gateway even after the
+ * 404 handler has let the client through to the host it asked for. */
+static int
+httpd_is_redirected(const request * r)
+{
+    struct sockaddr_in local, orig;
+    socklen_t len;
+
+    len = sizeof(orig);
+    if (getsockopt(r->clientSock, SOL_IP, SO_ORIGINAL_DST, &orig, &len) != 0)
+        return 0;
+    len = sizeof(local);
+    if (getsockname(r->clientSock, (struct sockaddr *)&local, &len) != 0)
+        return 1;
+
+    return orig.sin_addr.s_addr != local.sin_addr.s_addr || orig.sin_port != local.sin_port;
+}
+
+/** Handle the web requests waiting on a connection. Requests the client
+has already sent in full are served in turn; when the connection is kept
+open and no complete request is left to read, it goes back to the event
+loop.
+@param webserver The web server
+@param r The request, freed or handed back before returning
 */
 void
-thread_httpd(void *args)
+thread_httpd(httpd * webserver, request * r)
 {
-	void	**params;
-	httpd	*webserver;
-	request	*r;
-	
-	params = (void **)args;
-	webserver = *params;
-	r = *(params + 1);
-	free(params); /* XXX We must release this ourselves. */
-	
-	if (httpdReadRequest(webserver, r) == 0) {
+	while (1) {
+		if (httpdReadRequest(webserver, r) != 0) {
+			debug(LOG_DEBUG, "No valid request received from %s", r->clientAddr);
+			break;
+		}
 		/*
-		 * We read the request fine
+		 * We read the request fine. Only connections made to the
+		 * gateway itself are kept open, so a redirected one never
+		 * gets past its first request.
 		 */
+		if (r->requestCount == 0 && r->request.keepAlive && httpd_is_redirected(r))
+			r->request.keepAlive = 0;
 		debug(LOG_DEBUG, "Processing request from %s", r->clientAddr);
 		debug(LOG_DEBUG, "Calling httpdProcessRequest() for %s", r->clientAddr);
 		httpdProcessRequest(webserver, r);
 		debug(LOG_DEBUG, "Returned from httpdProcessRequest() for %s", r->clientAddr);
-	}
-	else {
-		debug(LOG_DEBUG, "No valid request received from %s", r->clientAddr);
+
+		if (!httpdKeepAlive(r))
+			break;
+		if (!httpdRequestReady(r)) {
+			/* Another worker may own it as soon as it is handed back */
+			debug(LOG_DEBUG, "Keeping connection with %s open", r->clientAddr);
+			if (httpd_pool_keep(r) != 0)
+				break;
+			return;
+		}
+		debug(LOG_DEBUG, "Reading pipelined request from %s", r->clientAddr);
 	}
 	debug(LOG_DEBUG, "Closing connection with %s", r->clientAddr);
 	httpdEndRequest(r);
 }
+
+/** @internal
+ * Worker thread: takes requests off the queue until the process exits */
+static void *
+thread_httpd_worker(void *arg)
+{
+    request *r;
+
+    while (1) {
+        pthread_mutex_lock(&pool_mutex);
+        while (pool.count == 0)
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        r = pool.queue[pool.head];
+        pool.head = (pool.head + 1) % pool.queue_len;
+        pool.count--;
+        pool.busy++;
+        pthread_mutex_unlock(&pool_mutex);
+
+        thread_httpd(pool.webserver, r);
+
+        pthread_mutex_lock(&pool_mutex);
+        pool.busy--;
+        pool.served++;
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    return NULL;
+}
+
+/** Start the fixed set of web server worker threads.
+@param webserver The web server the requests belong to
+@param threads Number of worker threads
+@param queue_len Number of ready requests that may wait for a free worker
+@return 0 on success, -1 if no worker could be started
+*/
+int
+httpd_pool_init(httpd * webserver, int threads, int queue_len)
+{
+    pthread_t tid;
+    int i;
+
+    if (threads < 1)
+        threads = 1;
+    if (queue_len < 1)
+        queue_len = 1;
+
+    pool.webserver = webserver;
+    pool.queue = safe_malloc(queue_len * sizeof(request *));
+    pool.queue_len = queue_len;
+
+    /* A full pipe closes the connection rather than blocking a worker */
+    if (pipe(idle_pipe) != 0 ||
+        fcntl(idle_pipe[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(idle_pipe[1], F_SETFL, O_NONBLOCK) < 0) {
+        debug(LOG_ERR, "Could not create the httpd keep-alive pipe: %s", strerror(errno));
+        return -1;
+    }
+    register_fd_cleanup_on_fork(idle_pipe[0]);
+    register_fd_cleanup_on_fork(idle_pipe[1]);
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tid, NULL, thread_httpd_worker, NULL) != 0) {
+            debug(LOG_ERR, "Failed to create httpd worker thread %d: %s", i, strerror(errno));
+            break;
+        }
+        pthread_detach(tid);
+    }
+    pool.threads = i;
+
+    debug(LOG_INFO, "Started %d httpd worker threads with a queue of %d requests", i, queue_len);
+    return i > 0 ? 0 : -1;
+}
+
+/** Hand a request whose first bytes have arrived to a worker thread.
+ *
+ * If the queue is full the client is told to retry with a 503 and the
+ * connection is closed, so a burst of clients cannot grow the number of
+ * threads or the memory used by waiting requests without bound.
+@param r The request, owned by the pool (or freed) afterwards
+@return 0 if the request was queued, -1 if it was rejected
+*/
+int
+httpd_pool_submit(request * r)
+{
+    pthread_mutex_lock(&pool_mutex);
+    if (pool.count >= pool.queue_len) {
+        pool.rejected++;
+        pthread_mutex_unlock(&pool_mutex);
+        debug(LOG_WARNING, "All httpd workers busy, rejecting request from %s", r->clientAddr);
+        send(r->clientSock, HTTPD_BUSY_RESPONSE, strlen(HTTPD_BUSY_RESPONSE), MSG_DONTWAIT | MSG_NOSIGNAL);
+        httpdEndRequest(r);
+        return -1;
+    }
+    pool.queue[(pool.head + pool.count) % pool.queue_len] = r;
+    pool.count++;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    return 0;
+}
+
+/** Descriptor that becomes readable when workers hand connections back.
+@return The read end of the keep-alive pipe
+*/
+int
+httpd_pool_idle_fd(void)
+{
+    return idle_pipe[0];
+}
+
+/** Take back a connection a worker has kept open.
+@return The connection, waiting for its next request, or NULL if none is left
+*/
+request *
+httpd_pool_idle_next(void)
+{
+    request *r;
+
+    if (read(idle_pipe[0], &r, sizeof(r)) != sizeof(r))
+        return NULL;
+    return r;
+}
+
+/** Append the worker pool state to a status report */
+void
+httpd_pool_status(pstr_t * pstr)
+{
+    int busy, count;
+    unsigned long served, rejected, kept;
+
+    pthread_mutex_lock(&pool_mutex);
+    busy = pool.busy;
+    count = pool.count;
+    served = pool.served;
+    rejected = pool.rejected;
+    kept = pool.kept;
+    pthread_mutex_unlock(&pool_mutex);
+
+    pstr_append_sprintf(pstr, "HTTP workers: %d busy of %d, %d of %d queued\n",
+                        busy, pool.threads, count, pool.queue_len);
+    pstr_append_sprintf(pstr, "HTTP requests: %lu served, %lu rejected, %lu kept alive\n", served, rejected, kept);
+}
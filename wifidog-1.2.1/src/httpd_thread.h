@@ -27,7 +27,25 @@
 #ifndef _HTTPD_THREAD_H_
 #define _HTTPD_THREAD_H_
 
-/** @brief Handle a web request */
-void thread_httpd(void *args);
+#include "httpd.h"
+#include "pstring.h"
+
+/** @brief Handle the web requests waiting on a connection */
+void thread_httpd(httpd *, request *);
+
+/** @brief Start the web server worker threads */
+int httpd_pool_init(httpd *, int, int);
+
+/** @brief Queue a request for the worker threads, or reject it if they are saturated */
+int httpd_pool_submit(request *);
+
+/** @brief Descriptor that becomes readable when a kept-alive connection is handed back */
+int httpd_pool_idle_fd(void);
+
+/** @brief Take back a kept-alive connection, NULL if there is none */
+request *httpd_pool_idle_next(void);
+
+/** @brief Append the worker pool state to a status report */
+void httpd_pool_status(pstr_t *);
 
 #endif
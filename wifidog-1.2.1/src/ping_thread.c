@@ -38,6 +38,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/sysinfo.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <syslog.h>
@@ -56,47 +57,14 @@
 #include "gateway.h"
 #include "simple_http.h"
 
-static void ping(void);
-
-/** Launches a thread that periodically checks in with the wifidog auth server to perform heartbeat function.
-@param arg NULL
-@todo This thread loops infinitely, need a watchdog to verify that it is still running?
-*/
-void
-thread_ping(void *arg)
-{
-    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
-    pthread_mutex_t cond_mutex = PTHREAD_MUTEX_INITIALIZER;
-    struct timespec timeout;
-
-    while (1) {
-        /* Make sure we check the servers at the very begining */
-        debug(LOG_DEBUG, "Running ping()");
-        ping();
-
-        /* Sleep for config.checkinterval seconds... */
-        timeout.tv_sec = time(NULL) + config_get_config()->checkinterval;
-        timeout.tv_nsec = 0;
-
-        /* Mutex must be locked for pthread_cond_timedwait... */
-        pthread_mutex_lock(&cond_mutex);
-
-        /* Thread safe "sleep" */
-        pthread_cond_timedwait(&cond, &cond_mutex, &timeout);
-
-        /* No longer needs to be locked */
-        pthread_mutex_unlock(&cond_mutex);
-    }
-}
-
-/** @internal
- * This function does the actual request.
+/** Check in with the auth server once, to perform the heartbeat function.
+ * Run every CheckInterval seconds by the scheduler thread.
  */
-static void
-ping(void)
+void
+ping_auth_server(void)
 {
     char request[MAX_BUF];
-    FILE *fh;
+    struct sysinfo info;
     int sockfd;
     unsigned long int sys_uptime = 0;
     unsigned int sys_memfree = 0;
@@ -105,7 +73,7 @@ ping(void)
     auth_server = get_auth_server();
     static int authdown = 0;
 
-    debug(LOG_DEBUG, "Entering ping()");
+    debug(LOG_DEBUG, "Entering ping_auth_server()");
     memset(request, 0, sizeof(request));
 
     /*
@@ -126,31 +94,15 @@ ping(void)
     }
 
     /*
-     * Populate uptime, memfree and load
+     * Populate uptime, memfree (in kB) and load, with one system call
+     * rather than parsing three files under /proc
      */
-    if ((fh = fopen("/proc/uptime", "r"))) {
-        if (fscanf(fh, "%lu", &sys_uptime) != 1)
-            debug(LOG_CRIT, "Failed to read uptime");
-
-        fclose(fh);
-    }
-    if ((fh = fopen("/proc/meminfo", "r"))) {
-        while (!feof(fh)) {
-            if (fscanf(fh, "MemFree: %u", &sys_memfree) == 0) {
-                /* Not on this line */
-                while (!feof(fh) && fgetc(fh) != '\n') ;
-            } else {
-                /* Found it */
-                break;
-            }
-        }
-        fclose(fh);
-    }
-    if ((fh = fopen("/proc/loadavg", "r"))) {
-        if (fscanf(fh, "%f", &sys_load) != 1)
-            debug(LOG_CRIT, "Failed to read loadavg");
-
-        fclose(fh);
+    if (sysinfo(&info) == 0) {
+        sys_uptime = info.uptime;
+        sys_memfree = (unsigned int)((unsigned long long)info.freeram * info.mem_unit / 1024);
+        sys_load = (float)info.loads[0] / (1 << SI_LOAD_SHIFT);
+    } else {
+        debug(LOG_CRIT, "Failed to read system information: %s", strerror(errno));
     }
 
     /*
@@ -21,7 +21,7 @@
 
 /* $Id$ */
 /** @file ping_thread.h
-    @brief WiFiDog heartbeat thread
+    @brief WiFiDog heartbeat
     @author Copyright (C) 2004 Alexandre Carmel-Veilleux <acv@miniguru.ca>
 */
 
@@ -30,7 +30,7 @@
 
 #define MINIMUM_STARTED_TIME 1041379200 /* 2003-01-01 */
 
-/** @brief Periodically checks on the auth server to see if it's alive. */
-void thread_ping(void *arg);
+/** @brief Checks in with the auth server once */
+void ping_auth_server(void);
 
 #endif
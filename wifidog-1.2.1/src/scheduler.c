@@ -0,0 +1,135 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+/** @file scheduler.c
+    @brief Runs the periodic work of the gateway from a single thread
+
+    Each task has a timer in a small timer wheel; the thread sleeps until
+    the earliest one is due, runs what is due and schedules it again.
+    Client idle timeouts are not a full scan of the client list: each client
+    has its own deadline in the idle index of the client list, which the
+    counter sync walks through, or, when NFLOG keeps the counters current,
+    which is checked every second.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "debug.h"
+#include "conf.h"
+#include "firewall.h"
+#include "fw_nflog.h"
+#include "ping_thread.h"
+#include "timer_wheel.h"
+#include "scheduler.h"
+
+/** Number of one second slots of the task wheel */
+#define SCHEDULER_WHEEL_SIZE 64
+
+/** @internal
+ * A periodic task */
+typedef struct {
+    t_timer timer;              /**< Must come first, timers are cast back to tasks */
+    const char *name;
+    void (*run) (void);
+    int (*interval) (void);     /**< Seconds until the next run */
+} t_scheduler_task;
+
+/** @internal
+ * Interval of the tasks that run every CheckInterval seconds */
+static int
+scheduler_check_interval(void)
+{
+    return config_get_config()->checkinterval;
+}
+
+/** @internal
+ * Without NFLOG accounting the counter sync times out idle clients, right
+ * after reading the counters: between two reads they are out of date. */
+static int
+scheduler_idle_interval(void)
+{
+    return fw_nflog_running() ? 1 : config_get_config()->checkinterval;
+}
+
+/** @internal
+ * Time out idle clients as soon as their deadline passes, if the counters
+ * are kept current */
+static void
+scheduler_expire_idle(void)
+{
+    if (fw_nflog_running())
+        fw_expire_idle_clients();
+}
+
+/** @internal
+ * Everything the scheduler runs */
+static t_scheduler_task scheduler_tasks[] = {
+    {{NULL, NULL, 0}, "heartbeat", ping_auth_server, scheduler_check_interval},
+    {{NULL, NULL, 0}, "counter sync", fw_sync_with_authserver, scheduler_check_interval},
+    {{NULL, NULL, 0}, "idle clients", scheduler_expire_idle, scheduler_idle_interval},
+};
+
+/** Launches the thread that runs the periodic tasks. The heartbeat runs
+ * right away so that the auth server state is known early; the other
+ * tasks run after one interval.
+@param arg NULL
+*/
+void
+thread_scheduler(void *arg)
+{
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    pthread_mutex_t cond_mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct timespec timeout;
+    t_timer_wheel wheel;
+    t_scheduler_task *task;
+    t_timer *timer;
+    time_t now = time(NULL), next;
+    unsigned int i;
+
+    timer_wheel_init(&wheel, SCHEDULER_WHEEL_SIZE, now);
+    for (i = 0; i < sizeof(scheduler_tasks) / sizeof(scheduler_tasks[0]); i++)
+        timer_wheel_add(&wheel, &scheduler_tasks[i].timer, i == 0 ? now : now + scheduler_tasks[i].interval());
+
+    while (1) {
+        while ((timer = timer_wheel_expired(&wheel, time(NULL))) != NULL) {
+            task = (t_scheduler_task *) timer;
+            debug(LOG_DEBUG, "Running %s", task->name);
+            task->run();
+            /* Keep the period even if the task ran late or for long */
+            next = timer->expires + task->interval();
+            now = time(NULL);
+            timer_wheel_add(&wheel, timer, next > now ? next : now + task->interval());
+        }
+
+        /* Thread safe "sleep" until the next task is due */
+        timeout.tv_sec = timer_wheel_next(&wheel);
+        timeout.tv_nsec = 0;
+        pthread_mutex_lock(&cond_mutex);
+        pthread_cond_timedwait(&cond, &cond_mutex, &timeout);
+        pthread_mutex_unlock(&cond_mutex);
+    }
+}
@@ -21,6 +21,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -34,7 +37,9 @@
 #include "../config.h"
 #include "common.h"
 #include "debug.h"
+#include "safe.h"
 #include "pstring.h"
+#include "simple_http.h"
 
 #ifdef USE_CYASSL
 #include <cyassl/ssl.h>
@@ -133,6 +138,345 @@ http_get(const int sockfd, const char *req)
     return NULL;
 }
 
+/** Seconds a request may go without any progress, as for http_get() */
+#define HTTP_PARALLEL_TIMEOUT 30
+
+/** @internal
+ * One keep-alive connection used by http_get_parallel() */
+typedef struct {
+    int fd;                     /**< Socket, -1 if not connected */
+    int connecting;             /**< Non-blocking connect() still in progress */
+    int reused;                 /**< A previous request completed on this socket */
+    int job;                    /**< Job in flight, -1 if idle */
+    int retried;                /**< The job was already resent once */
+    size_t sent;                /**< Bytes of the request sent so far */
+    pstr_t *response;           /**< Response read so far */
+    time_t last_activity;       /**< Last time the job made progress */
+} t_http_conn;
+
+/** @internal
+ * Find a header in a response header block.
+ * @return Pointer to the header value, or NULL if the header is absent
+ */
+static const char *
+http_header_value(const char *headers, const char *end, const char *name)
+{
+    size_t name_len = strlen(name);
+    const char *line, *value;
+
+    for (line = strstr(headers, "\r\n"); line && line < end; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            for (value = line + name_len + 1; *value == ' ' || *value == '\t'; value++) ;
+            return value;
+        }
+    }
+
+    return NULL;
+}
+
+/** @internal
+ * Check whether the response read so far is complete.
+ * @param response Response read so far
+ * @param keepalive Set to 1 if the server keeps the connection open afterwards
+ * @return 1 if the whole response has been read, 0 if it ends when the server
+ *         closes the connection or more is expected
+ */
+static int
+http_response_complete(const pstr_t * response, int *keepalive)
+{
+    const char *end, *value;
+    unsigned long length;
+    int http11;
+
+    *keepalive = 0;
+    end = strstr(response->buf, "\r\n\r\n");
+    if (end == NULL)
+        return 0;
+    end += 2;
+
+    /* Without a length the body ends when the connection does */
+    value = http_header_value(response->buf, end, "Content-Length");
+    if (value == NULL || sscanf(value, "%lu", &length) != 1)
+        return 0;
+    if (response->len - (end + 2 - response->buf) < length)
+        return 0;
+
+    http11 = strncmp(response->buf, "HTTP/1.1", 8) == 0;
+    value = http_header_value(response->buf, end, "Connection");
+    if (value == NULL)
+        *keepalive = http11;
+    else
+        *keepalive = strncasecmp(value, "keep-alive", 10) == 0 || (http11 && strncasecmp(value, "close", 5) != 0);
+
+    return 1;
+}
+
+/** @internal
+ * Close a connection so that the next job opens a new one */
+static void
+http_conn_close(t_http_conn * conn)
+{
+    if (conn->fd >= 0)
+        close(conn->fd);
+    conn->fd = -1;
+    conn->connecting = 0;
+    conn->reused = 0;
+}
+
+/** @internal
+ * Start a non-blocking connect() for a connection */
+static int
+http_conn_open(t_http_conn * conn, const struct sockaddr_in *addr)
+{
+    conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->fd == -1) {
+        debug(LOG_ERR, "Failed to create a new SOCK_STREAM socket: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+
+    if (connect(conn->fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1) {
+        if (errno != EINPROGRESS) {
+            debug(LOG_ERR, "Failed to connect to %s:%d: %s", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port),
+                  strerror(errno));
+            http_conn_close(conn);
+            return -1;
+        }
+        conn->connecting = 1;
+    }
+
+    return 0;
+}
+
+/** @internal
+ * Finish the job in flight on a connection.
+ * @param ok 1 to hand the response over, 0 to report the job as failed
+ */
+static void
+http_conn_finish(t_http_conn * conn, t_http_job * jobs, int ok)
+{
+    char *response = pstr_to_string(conn->response);
+
+    conn->response = NULL;
+    if (ok) {
+        jobs[conn->job].response = response;
+    } else {
+        free(response);
+        http_conn_close(conn);
+    }
+    conn->job = -1;
+}
+
+/** @internal
+ * Handle a connection that failed while a job was in flight.
+ *
+ * Servers may drop an idle keep-alive connection at any time, so a job
+ * that failed on a reused connection is sent once more on a new one.
+ * @return 1 if the job is finished (failed), 0 if it was resent
+ */
+static int
+http_conn_failed(t_http_conn * conn, t_http_job * jobs, const struct sockaddr_in *addr, const char *why)
+{
+    if (conn->reused && !conn->retried) {
+        debug(LOG_DEBUG, "Keep-alive connection lost (%s), resending request", why);
+        http_conn_close(conn);
+        conn->retried = 1;
+        conn->sent = 0;
+        free(pstr_to_string(conn->response));
+        conn->response = pstr_new();
+        if (http_conn_open(conn, addr) == 0)
+            return 0;
+    } else {
+        debug(LOG_ERR, "Request to %s:%d failed: %s", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), why);
+    }
+    http_conn_finish(conn, jobs, 0);
+    return 1;
+}
+
+/** @internal
+ * Read from a connection.
+ * @return 1 if the job in flight is finished, 0 if more is expected
+ */
+static int
+http_conn_read(t_http_conn * conn, t_http_job * jobs, const struct sockaddr_in *addr)
+{
+    char readbuf[MAX_BUF];
+    ssize_t numbytes;
+    int keepalive;
+
+    numbytes = read(conn->fd, readbuf, sizeof(readbuf) - 1);
+    if (numbytes < 0 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+
+    if (numbytes > 0) {
+        readbuf[numbytes] = '\0';
+        pstr_cat(conn->response, readbuf);
+        if (!http_response_complete(conn->response, &keepalive))
+            return 0;
+        if (!keepalive)
+            http_conn_close(conn);
+        else
+            conn->reused = 1;
+        http_conn_finish(conn, jobs, 1);
+        return 1;
+    }
+
+    if (numbytes == 0 && conn->response->len > 0) {
+        /* The server closed the connection to end the response */
+        http_conn_close(conn);
+        http_conn_finish(conn, jobs, 1);
+        return 1;
+    }
+
+    return http_conn_failed(conn, jobs, addr, numbytes < 0 ? strerror(errno) : "connection closed without a response");
+}
+
+/**
+ * Perform many HTTP requests to one server over a bounded number of
+ * concurrent keep-alive connections.
+ *
+ * Each connection carries one request at a time and is reused for the
+ * next one when the server allows it, so the whole batch takes about
+ * count / max_conns round trips instead of count round trips plus a
+ * connection setup for every request.
+ * @param addr Address of the server
+ * @param sockfd A socket already connected to addr, or -1; owned by this function
+ * @param jobs Requests to send; on return each response, NULL on error
+ * @param count Number of jobs
+ * @param max_conns Maximum number of concurrent connections
+ * @return Number of jobs that got a response
+ */
+int
+http_get_parallel(const struct sockaddr_in *addr, int sockfd, t_http_job * jobs, int count, int max_conns)
+{
+    t_http_conn *conns;
+    struct pollfd *pfds;
+    int *pfd_conn;
+    int i, nfds, next = 0, done = 0, ok = 0;
+    time_t now;
+    size_t reqlen;
+
+    if (max_conns < 1)
+        max_conns = 1;
+    if (max_conns > count)
+        max_conns = count > 0 ? count : 1;
+
+    conns = safe_malloc(max_conns * sizeof(t_http_conn));
+    pfds = safe_malloc(max_conns * sizeof(struct pollfd));
+    pfd_conn = safe_malloc(max_conns * sizeof(int));
+    for (i = 0; i < max_conns; i++) {
+        conns[i].fd = -1;
+        conns[i].job = -1;
+    }
+    for (i = 0; i < count; i++)
+        jobs[i].response = NULL;
+
+    if (sockfd >= 0) {
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+        conns[0].fd = sockfd;
+    }
+
+    while (done < count) {
+        now = time(NULL);
+
+        /* Give idle connections the next jobs */
+        for (i = 0; i < max_conns && next < count; i++) {
+            if (conns[i].job != -1)
+                continue;
+            conns[i].job = next++;
+            conns[i].retried = 0;
+            conns[i].sent = 0;
+            conns[i].response = pstr_new();
+            conns[i].last_activity = now;
+            if (conns[i].fd == -1 && http_conn_open(&conns[i], addr) == -1) {
+                http_conn_finish(&conns[i], jobs, 0);
+                done++;
+                i--;
+            }
+        }
+
+        nfds = 0;
+        for (i = 0; i < max_conns; i++) {
+            if (conns[i].job == -1)
+                continue;
+            pfds[nfds].fd = conns[i].fd;
+            reqlen = strlen(jobs[conns[i].job].request);
+            pfds[nfds].events = conns[i].connecting || conns[i].sent < reqlen ? POLLOUT : POLLIN;
+            pfds[nfds].revents = 0;
+            pfd_conn[nfds++] = i;
+        }
+        if (nfds == 0)
+            break;
+
+        if (poll(pfds, nfds, 1000) < 0 && errno != EINTR) {
+            debug(LOG_ERR, "poll() failed: %s", strerror(errno));
+            break;
+        }
+
+        now = time(NULL);
+        for (i = 0; i < nfds; i++) {
+            t_http_conn *conn = &conns[pfd_conn[i]];
+            const char *req = jobs[conn->job].request;
+            int err = 0;
+            socklen_t errlen = sizeof(err);
+            ssize_t numbytes;
+
+            if (pfds[i].revents == 0) {
+                if (now - conn->last_activity > HTTP_PARALLEL_TIMEOUT) {
+                    debug(LOG_ERR, "Timed out waiting for server");
+                    http_conn_finish(conn, jobs, 0);
+                    done++;
+                }
+                continue;
+            }
+            conn->last_activity = now;
+
+            if (conn->connecting) {
+                getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+                if (err != 0) {
+                    debug(LOG_ERR, "Failed to connect to %s:%d: %s", inet_ntoa(addr->sin_addr),
+                          ntohs(addr->sin_port), strerror(err));
+                    http_conn_finish(conn, jobs, 0);
+                    done++;
+                    continue;
+                }
+                conn->connecting = 0;
+            }
+
+            reqlen = strlen(req);
+            if (conn->sent < reqlen) {
+                numbytes = send(conn->fd, req + conn->sent, reqlen - conn->sent, MSG_NOSIGNAL);
+                if (numbytes > 0) {
+                    conn->sent += numbytes;
+                } else if (numbytes < 0 && errno != EAGAIN && errno != EINTR) {
+                    if (http_conn_failed(conn, jobs, addr, strerror(errno)))
+                        done++;
+                }
+                continue;
+            }
+
+            if (http_conn_read(conn, jobs, addr))
+                done++;
+        }
+    }
+
+    for (i = 0; i < max_conns; i++) {
+        if (conns[i].job != -1)
+            http_conn_finish(&conns[i], jobs, 0);
+        http_conn_close(&conns[i]);
+    }
+    for (i = 0; i < count; i++)
+        if (jobs[i].response)
+            ok++;
+
+    free(pfd_conn);
+    free(pfds);
+    free(conns);
+
+    return ok;
+}
+
 #ifdef USE_CYASSL
 
 static CYASSL_CTX *cyassl_ctx = NULL;
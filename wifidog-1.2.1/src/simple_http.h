@@ -22,8 +22,19 @@
 #ifndef _SIMPLE_HTTP_H_
 #define _SIMPLE_HTTP_H_
 
+#include <netinet/in.h>
+
+/** @brief One request of a batch performed by http_get_parallel() */
+typedef struct {
+    char *request;              /**< @brief Fully formatted request, asking for keep-alive */
+    char *response;             /**< @brief Response, or NULL on error; caller frees */
+} t_http_job;
+
 char *http_get(const int, const char *);
 
+/** @brief Performs many requests to one server over a few concurrent keep-alive connections */
+int http_get_parallel(const struct sockaddr_in *, int, t_http_job *, int, int);
+
 #ifdef USE_CYASSL
 char *https_get(const int, const char *, const char *);
 #endif                          /* defined(USE_CYASSL) */
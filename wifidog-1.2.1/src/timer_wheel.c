@@ -0,0 +1,149 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+/** @file timer_wheel.c
+    @brief Hashed timer wheel with one second resolution
+
+    Each timer sits in the slot of its expiry second, modulo the size of the
+    wheel, so scheduling and cancelling are O(1) and expiring K timers costs
+    O(K) plus one slot per elapsed second. Timers more than one turn of the
+    wheel away are looked at, and left alone, once per turn.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "safe.h"
+#include "timer_wheel.h"
+
+/**
+ * Set up an empty wheel
+ * @param wheel The wheel
+ * @param size Number of slots; timers due within that many seconds are
+ *        never looked at before they expire
+ * @param now Current time
+ */
+void
+timer_wheel_init(t_timer_wheel * wheel, unsigned int size, time_t now)
+{
+    wheel->slots = safe_malloc(size * sizeof(t_timer *));
+    wheel->size = size;
+    wheel->count = 0;
+    wheel->current = now;
+}
+
+/**
+ * Schedule a timer, or move it if it is already scheduled. A time in the
+ * past makes it due right away.
+ * @param wheel The wheel
+ * @param timer The timer
+ * @param expires When the timer is due
+ */
+void
+timer_wheel_add(t_timer_wheel * wheel, t_timer * timer, time_t expires)
+{
+    t_timer **slot;
+
+    timer_wheel_del(wheel, timer);
+
+    timer->expires = expires;
+    slot = &wheel->slots[(expires > wheel->current ? expires : wheel->current) % wheel->size];
+    timer->next = *slot;
+    if (timer->next != NULL)
+        timer->next->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+    wheel->count++;
+}
+
+/**
+ * Cancel a timer. Does nothing if it is not scheduled.
+ * @param wheel The wheel
+ * @param timer The timer
+ */
+void
+timer_wheel_del(t_timer_wheel * wheel, t_timer * timer)
+{
+    if (timer->pprev == NULL)
+        return;
+
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    wheel->count--;
+}
+
+/**
+ * Take out one timer that is due. Call it until it returns NULL to expire
+ * everything that is due; the wheel can be changed between calls.
+ * @param wheel The wheel
+ * @param now Current time
+ * @return A timer no longer scheduled, or NULL if none is due
+ */
+t_timer *
+timer_wheel_expired(t_timer_wheel * wheel, time_t now)
+{
+    t_timer *timer;
+
+    /* The clock went back: carry on from there, nothing is lost since
+     * timers are found by their slot */
+    if (now < wheel->current)
+        wheel->current = now;
+    /* Seconds more than one turn ago all share the slots of the last turn */
+    if (now - wheel->current >= (time_t) wheel->size)
+        wheel->current = now - wheel->size + 1;
+
+    while (wheel->count > 0) {
+        for (timer = wheel->slots[wheel->current % wheel->size]; timer != NULL; timer = timer->next) {
+            if (timer->expires <= now) {
+                timer_wheel_del(wheel, timer);
+                return timer;
+            }
+        }
+        if (wheel->current == now)
+            break;
+        wheel->current++;
+    }
+
+    return NULL;
+}
+
+/**
+ * Find when the next timer is due. This looks at every timer, so it is
+ * meant for wheels holding a handful of them.
+ * @param wheel The wheel
+ * @return The earliest expiry time, or 0 if no timer is scheduled
+ */
+time_t
+timer_wheel_next(const t_timer_wheel * wheel)
+{
+    t_timer *timer;
+    time_t next = 0;
+    unsigned int i;
+
+    for (i = 0; i < wheel->size; i++)
+        for (timer = wheel->slots[i]; timer != NULL; timer = timer->next)
+            if (next == 0 || timer->expires < next)
+                next = timer->expires;
+
+    return next;
+}
@@ -0,0 +1,61 @@
+/********************************************************************\
+ * This program is free software; you can redistribute it and/or    *
+ * modify it under the terms of the GNU General Public License as   *
+ * published by the Free Software Foundation; either version 2 of   *
+ * the License, or (at your option) any later version.              *
+ *                                                                  *
+ * This program is distributed in the hope that it will be useful,  *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of   *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the    *
+ * GNU General Public License for more details.                     *
+ *                                                                  *
+ * You should have received a copy of the GNU General Public License*
+ * along with this program; if not, contact:                        *
+ *                                                                  *
+ * Free Software Foundation           Voice:  +1-617-542-5942       *
+ * 59 Temple Place - Suite 330        Fax:    +1-617-542-2652       *
+ * Boston, MA  02111-1307,  USA       gnu@gnu.org                   *
+ *                                                                  *
+\********************************************************************/
+
+/** @file timer_wheel.h
+    @brief Hashed timer wheel with one second resolution
+*/
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <time.h>
+
+/** @brief A timer, embedded in the structure it belongs to */
+typedef struct _t_timer {
+    struct _t_timer *next;      /**< @brief Next timer in the same slot */
+    struct _t_timer **pprev;    /**< @brief Link pointing to this timer, NULL when not scheduled */
+    time_t expires;             /**< @brief When the timer is due */
+} t_timer;
+
+/** @brief Timers hashed by their expiry second. Not locked: the owner of
+ * the wheel provides the locking. */
+typedef struct _t_timer_wheel {
+    t_timer **slots;            /**< @brief One list of timers per second, modulo size */
+    unsigned int size;          /**< @brief Number of slots */
+    unsigned int count;         /**< @brief Number of scheduled timers */
+    time_t current;             /**< @brief Second being expired, earlier ones are done */
+} t_timer_wheel;
+
+/** @brief Set up an empty wheel */
+void timer_wheel_init(t_timer_wheel *, unsigned int, time_t);
+
+/** @brief Schedule or reschedule a timer */
+void timer_wheel_add(t_timer_wheel *, t_timer *, time_t);
+
+/** @brief Cancel a timer if it is scheduled */
+void timer_wheel_del(t_timer_wheel *, t_timer *);
+
+/** @brief Take out one timer that is due */
+t_timer *timer_wheel_expired(t_timer_wheel *, time_t);
+
+/** @brief Earliest expiry time of the scheduled timers */
+time_t timer_wheel_next(const t_timer_wheel *);
+
+#endif                          /* _TIMER_WHEEL_H_ */
@@ -57,21 +57,10 @@
 #include "util.h"
 #include "debug.h"
 #include "pstring.h"
+#include "dns_cache.h"
 
 #include "../config.h"
 
-#define LOCK_GHBN() do { \
-	debug(LOG_DEBUG, "Locking wd_gethostbyname()"); \
-	pthread_mutex_lock(&ghbn_mutex); \
-	debug(LOG_DEBUG, "wd_gethostbyname() locked"); \
-} while (0)
-
-#define UNLOCK_GHBN() do { \
-	debug(LOG_DEBUG, "Unlocking wd_gethostbyname()"); \
-	pthread_mutex_unlock(&ghbn_mutex); \
-	debug(LOG_DEBUG, "wd_gethostbyname() unlocked"); \
-} while (0)
-
 #include "../config.h"
 #ifdef __ANDROID__
 #define WD_SHELL_PATH "/system/bin/sh"
@@ -82,9 +71,6 @@
 /** @brief FD for icmp raw socket */
 static int icmp_fd;
 
-/** @brief Mutex to protect gethostbyname since not reentrant */
-static pthread_mutex_t ghbn_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 static unsigned short rand16(void);
 
 /** Fork a child and execute a shell command, the parent
@@ -94,8 +80,25 @@ static unsigned short rand16(void);
  */
 int
 execute(const char *cmd_line, int quiet)
+{
+    return execute_input(cmd_line, NULL, quiet);
+}
+
+/** Fork a child and execute a shell command with the given text on its
+ * standard input, the parent process waits for the child to return and
+ * returns the child's exit() value.
+ * @param cmd_line Shell command
+ * @param input Text to write to the command, or NULL to leave stdin alone
+ * @param quiet Hide the error output of the command
+ * @return Return code of the command
+ */
+int
+execute_input(const char *cmd_line, const char *input, int quiet)
 {
     int pid, status, rc;
+    int fds[2] = { -1, -1 };
+    size_t len;
+    ssize_t written;
 
     const char *new_argv[4];
     new_argv[0] = WD_SHELL_PATH;
@@ -103,8 +106,18 @@ execute(const char *cmd_line, int quiet)
     new_argv[2] = cmd_line;
     new_argv[3] = NULL;
 
+    if (input && pipe(fds) == -1) {
+        debug(LOG_ERR, "pipe(): %s", strerror(errno));
+        return 1;
+    }
+
     pid = safe_fork();
     if (pid == 0) {             /* for the child process:         */
+        if (input) {
+            dup2(fds[0], 0);
+            close(fds[0]);
+            close(fds[1]);
+        }
         /* We don't want to see any errors if quiet flag is on */
         if (quiet)
             close(2);
@@ -117,6 +130,23 @@ execute(const char *cmd_line, int quiet)
     }
 
     /* for the parent:      */
+    if (input) {
+        close(fds[0]);
+        len = strlen(input);
+        while (len > 0) {
+            written = write(fds[1], input, len);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                debug(LOG_ERR, "Could not write to PID %d: %s", pid, strerror(errno));
+                break;
+            }
+            input += written;
+            len -= written;
+        }
+        close(fds[1]);
+    }
+
     debug(LOG_DEBUG, "Waiting for PID %d to exit", pid);
     rc = waitpid(pid, &status, 0);
     debug(LOG_DEBUG, "Process PID %d exited", rc);
@@ -135,32 +165,22 @@ execute(const char *cmd_line, int quiet)
     }
 }
 
+/** Resolve a host name through the DNS cache.
+ * @return The address, which the caller frees, or NULL if it does not resolve
+ */
 struct in_addr *
 wd_gethostbyname(const char *name)
 {
-    struct hostent *he = NULL;
     struct in_addr *addr = NULL;
-    struct in_addr *in_addr_temp = NULL;
 
     /* XXX Calling function is reponsible for free() */
 
     addr = safe_malloc(sizeof(*addr));
-
-    LOCK_GHBN();
-
-    he = gethostbyname(name);
-
-    if (he == NULL) {
+    if (dns_cache_lookup(name, addr) != 0) {
         free(addr);
-        UNLOCK_GHBN();
         return NULL;
     }
 
-    in_addr_temp = (struct in_addr *)he->h_addr_list[0];
-    addr->s_addr = in_addr_temp->s_addr;
-
-    UNLOCK_GHBN();
-
     return addr;
 }
 
@@ -37,6 +37,9 @@
 /** @brief Execute a shell command */
 int execute(const char *, int);
 
+/** @brief Execute a shell command, feeding it text on stdin */
+int execute_input(const char *, const char *, int);
+
 /** @brief Thread safe gethostbyname */
 struct in_addr *wd_gethostbyname(const char *);
 
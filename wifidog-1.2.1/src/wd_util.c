@@ -44,6 +44,7 @@
 #include "wd_util.h"
 #include "debug.h"
 #include "pstring.h"
+#include "httpd_thread.h"
 
 #include "../config.h"
 
@@ -191,7 +192,9 @@ get_status_text()
 
     pstr_append_sprintf(pstr, "Internet Connectivity: %s\n", (is_online()? "yes" : "no"));
     pstr_append_sprintf(pstr, "Auth server reachable: %s\n", (is_auth_online()? "yes" : "no"));
-    pstr_append_sprintf(pstr, "Clients served this session: %lu\n\n", served_this_session);
+    pstr_append_sprintf(pstr, "Clients served this session: %lu\n", served_this_session);
+    httpd_pool_status(pstr);
+    pstr_cat(pstr, "\n");
 
     LOCK_CLIENT_LIST();
 